@@ -0,0 +1,250 @@
+#include "bench.h"
+#include <QElapsedTimer>
+#include <QByteArray>
+#include "qvkupload.h"
+#include "qvkcmdbuf.h"
+#include "qvkculling.h"
+#include "qvkbvh.h"
+
+// deterministic sizes, so runs are comparable
+static uint32_t nextRandom(uint32_t& state) {
+    state = state * 1664525u + 1013904223u;
+    return state >> 8;
+}
+
+void benchmarkAllocator(QSharedPointer<QVkDevice> device) {
+    DEBUG_ENTRY;
+    // stay well below maxMemoryAllocationCount for the raw path
+    const int count = qMin<int>(2000, device->limits().maxMemoryAllocationCount / 2);
+    const int rounds = 10;
+
+    // memory type usable for typical buffers
+    VkBufferCreateInfo buf_ci = {};
+    buf_ci.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    buf_ci.size = 4096;
+    buf_ci.usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT |
+                   VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+    VkBuffer buffer = nullptr;
+    VkResult U_ASSERT_ONLY err = vkCreateBuffer(*device, &buf_ci, nullptr, &buffer);
+    Q_ASSERT(!err);
+    VkMemoryRequirements probe = {};
+    vkGetBufferMemoryRequirements(*device, buffer, &probe);
+    vkDestroyBuffer(*device, buffer, nullptr);
+    int memoryType = device->memoryType(probe.memoryTypeBits, QVkMemoryUsage::GpuOnly);
+    Q_ASSERT(memoryType >= 0);
+
+    QVector<VkMemoryRequirements> requests(count);
+    uint32_t state = 1;
+    for (auto& r: requests) {
+        r.size = 256 + nextRandom(state) % (64 * 1024);
+        r.alignment = probe.alignment;
+        r.memoryTypeBits = 1u << memoryType;
+    }
+
+    QElapsedTimer timer;
+
+    QVector<VkDeviceMemory> raw(count);
+    timer.start();
+    for (int round = 0; round < rounds; round++) {
+        for (int i = 0; i < count; i++) {
+            VkMemoryAllocateInfo allocinfo = {};
+            allocinfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+            allocinfo.allocationSize = requests[i].size;
+            allocinfo.memoryTypeIndex = memoryType;
+            err = vkAllocateMemory(*device, &allocinfo, nullptr, &raw[i]);
+            Q_ASSERT(!err);
+        }
+        for (int i = 0; i < count; i++)
+            vkFreeMemory(*device, raw[i], nullptr);
+    }
+    qint64 rawNs = timer.nsecsElapsed();
+
+    QVkMemoryAllocator& allocator = device->allocator();
+    QVector<QVkAllocation> pooled(count);
+    timer.restart();
+    for (int round = 0; round < rounds; round++) {
+        for (int i = 0; i < count; i++)
+            pooled[i] = allocator.allocate(requests[i], memoryType);
+        for (int i = 0; i < count; i++)
+            allocator.free(pooled[i]);
+    }
+    qint64 pooledNs = timer.nsecsElapsed();
+
+    double total = double(count) * rounds;
+    qDebug() << "allocation benchmark:" << count << "allocations x" << rounds << "rounds";
+    qDebug() << "  vkAllocateMemory:  " << total / (rawNs / 1.0e6) << "alloc+free/ms";
+    qDebug() << "  QVkMemoryAllocator:" << total / (pooledNs / 1.0e6) << "alloc+free/ms";
+
+    // leave every other allocation alive to look at fragmentation
+    for (int i = 0; i < count; i++)
+        pooled[i] = allocator.allocate(requests[i], memoryType);
+    for (int i = 0; i < count; i += 2)
+        allocator.free(pooled[i]);
+    qDebug() << "  half freed:" << allocator.stats();
+    for (int i = 1; i < count; i += 2)
+        allocator.free(pooled[i]);
+    qDebug() << "  all freed: " << allocator.stats();
+}
+
+void benchmarkUploads(QSharedPointer<QVkDevice> device, VkQueue queue, uint32_t queueFamilyIndex) {
+    DEBUG_ENTRY;
+    const int count = 4000;
+
+    QVector<VkDeviceSize> sizes(count);
+    QVector<VkDeviceSize> offsets(count);
+    VkDeviceSize total = 0;
+    uint32_t state = 1;
+    for (int i = 0; i < count; i++) {
+        sizes[i] = 64 + nextRandom(state) % 4096;
+        offsets[i] = total;
+        total += (sizes[i] + 15) / 16 * 16;
+    }
+    QByteArray data(int(total), 'x');
+    QVkDeviceBuffer dst(device, total, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT);
+
+    QElapsedTimer timer;
+    VkResult U_ASSERT_ONLY err;
+
+    // one staging buffer, command buffer, submit and wait per upload
+    VkCommandPool pool = nullptr;
+    VkCommandPoolCreateInfo cmd_pool_info = {};
+    cmd_pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    cmd_pool_info.queueFamilyIndex = queueFamilyIndex;
+    cmd_pool_info.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+    err = vkCreateCommandPool(*device, &cmd_pool_info, nullptr, &pool);
+    Q_ASSERT(!err);
+    QVkCommandBuffer cmd(device, pool);
+
+    timer.start();
+    for (int i = 0; i < count; i++) {
+        QVkStagingBuffer staging(device, sizes[i]);
+        memcpy(staging.memory().map(), data.constData() + offsets[i], sizes[i]);
+        staging.memory().flush();
+        cmd.record(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT)
+            .copyBuffer(staging.buffer(), dst.buffer(), sizes[i], 0, offsets[i]);
+        VkCommandBuffer cb = cmd;
+        VkSubmitInfo submit_info = {};
+        submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        submit_info.commandBufferCount = 1;
+        submit_info.pCommandBuffers = &cb;
+        err = vkQueueSubmit(queue, 1, &submit_info, nullptr);
+        Q_ASSERT(!err);
+        err = vkQueueWaitIdle(queue);
+        Q_ASSERT(!err);
+    }
+    qint64 naiveNs = timer.nsecsElapsed();
+
+    QVkUploadManager uploads(device, queue, queueFamilyIndex);
+    timer.restart();
+    for (int i = 0; i < count; i++)
+        uploads.uploadBuffer(dst.buffer(), offsets[i], data.constData() + offsets[i], sizes[i]);
+    uploads.wait(uploads.submit());
+    qint64 batchedNs = timer.nsecsElapsed();
+
+    qDebug() << "upload benchmark:" << count << "uploads," << total << "bytes";
+    qDebug() << "  submit per upload:" << naiveNs / 1.0e6 << "ms";
+    qDebug() << "  QVkUploadManager: " << batchedNs / 1.0e6 << "ms, staging" << uploads.stagingSize() << "bytes";
+
+    vkDestroyCommandPool(*device, pool, nullptr);
+}
+
+void benchmarkCulling(const QMatrix4x4& viewProjection) {
+    DEBUG_ENTRY;
+    const QVkFrustum frustum = QVkFrustum::fromMatrix(viewProjection);
+    const uint32_t counts[] = { 10000, 100000, 1000000 };
+    const QVkCpuCuller::Kernel kernels[] = { QVkCpuCuller::Scalar, QVkCpuCuller::Sse, QVkCpuCuller::Avx };
+    const char* names[] = { "scalar:", "SSE:   ", "AVX:   " };
+    const int rounds = 10;
+
+    qDebug() << "culling benchmark, best kernel" << names[QVkCpuCuller::bestKernel()];
+    for (uint32_t count : counts) {
+        // half spheres, half boxes, scattered through a cube around the
+        // origin so that part of them is visible
+        QVkCpuCuller culler;
+        culler.reserve(count);
+        // the same objects for the BVH, spheres by their bounds
+        QVector<QVkAabb> boxes(count);
+        uint32_t state = 1;
+        for (uint32_t i = 0; i < count; i++) {
+            QVector3D center((nextRandom(state) % 2001) / 10.0f - 100.0f,
+                             (nextRandom(state) % 2001) / 10.0f - 100.0f,
+                             (nextRandom(state) % 2001) / 10.0f - 100.0f);
+            float size = 0.5f + (nextRandom(state) % 100) / 50.0f;
+            if (i & 1)
+                culler.addSphere(QVector4D(center, size));
+            else
+                culler.addBox(center - QVector3D(size, size, size), center + QVector3D(size, size, size));
+            boxes[i] = QVkAabb(center - QVector3D(size, size, size), center + QVector3D(size, size, size));
+        }
+
+        qDebug() << " " << count << "objects";
+        QVector<uint32_t> reference;
+        culler.cull(frustum, &reference, QVkCpuCuller::Scalar);
+        for (int k = 0; k < 3; k++) {
+            // AVX needs support by the CPU
+            if (kernels[k] > QVkCpuCuller::bestKernel())
+                continue;
+            QVector<uint32_t> visible;
+            qint64 bestNs = -1;
+            for (int round = 0; round < rounds; round++) {
+                QElapsedTimer timer;
+                timer.start();
+                culler.cull(frustum, &visible, kernels[k]);
+                qint64 ns = timer.nsecsElapsed();
+                if (bestNs < 0 || ns < bestNs)
+                    bestNs = ns;
+            }
+            if (visible != reference)
+                qFatal("%s visible objects differ from the scalar kernel", names[k]);
+            qDebug() << "   " << names[k] << count / (qMax<qint64>(bestNs, 1) / 1.0e6) << "objects/ms,"
+                     << visible.size() << "visible";
+        }
+
+        QElapsedTimer timer;
+        timer.start();
+        QVkBvh bvh;
+        bvh.build(boxes);
+        qint64 buildNs = timer.nsecsElapsed();
+        timer.restart();
+        bvh.refit(boxes);
+        qint64 refitNs = timer.nsecsElapsed();
+        qDebug() << "    BVH: build" << buildNs / 1.0e6 << "ms, refit" << refitNs / 1.0e6 << "ms,"
+                 << bvh.nodes().size() << "nodes, depth" << bvh.depth();
+
+        QVector<uint32_t> visible;
+        qint64 bestNs = -1;
+        for (int round = 0; round < rounds; round++) {
+            timer.restart();
+            bvh.cullFrustum(frustum, &visible);
+            qint64 ns = timer.nsecsElapsed();
+            if (bestNs < 0 || ns < bestNs)
+                bestNs = ns;
+        }
+        qDebug() << "    BVH:   " << count / (qMax<qint64>(bestNs, 1) / 1.0e6) << "objects/ms,"
+                 << visible.size() << "visible boxes";
+
+        // picking rays through a 500x500 window, against a linear scan
+        const int rays = 1000;
+        QVector<QVkRay> picks(rays);
+        for (QVkRay& ray : picks)
+            ray = QVkRay::fromWindow(viewProjection, QPointF(nextRandom(state) % 500, nextRandom(state) % 500),
+                                     QSize(500, 500));
+        timer.restart();
+        int hits = 0;
+        for (const QVkRay& ray : picks)
+            hits += bvh.raycast(ray) >= 0;
+        qint64 bvhNs = timer.nsecsElapsed();
+        timer.restart();
+        int linearHits = 0;
+        for (const QVkRay& ray : picks) {
+            float closest = FLT_MAX;
+            for (const QVkAabb& box : boxes)
+                closest = qMin(closest, box.intersect(ray));
+            linearHits += closest != FLT_MAX;
+        }
+        qint64 linearNs = timer.nsecsElapsed();
+        Q_ASSERT(hits == linearHits);
+        qDebug() << "    rays: BVH" << rays / (qMax<qint64>(bvhNs, 1) / 1.0e6) << "rays/ms, linear"
+                 << rays / (qMax<qint64>(linearNs, 1) / 1.0e6) << "rays/ms," << hits << "hits";
+    }
+}
@@ -0,0 +1,22 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <QMatrix4x4>
+#include "qvkdevice.h"
+
+/*
+ * Micro benchmarks, run from the cube demo's command line.
+ * Results are printed with qDebug().
+ */
+
+// vkAllocateMemory per resource vs. sub-allocation by QVkMemoryAllocator
+void benchmarkAllocator(QSharedPointer<QVkDevice> device);
+
+// staging buffer, submit and wait per upload vs. batching by QVkUploadManager
+void benchmarkUploads(QSharedPointer<QVkDevice> device, VkQueue queue, uint32_t queueFamilyIndex);
+
+// QVkCpuCuller kernels and QVkBvh queries on 10k, 100k and 1M spheres
+// and boxes
+void benchmarkCulling(const QMatrix4x4& viewProjection);
+
+#endif // BENCH_H
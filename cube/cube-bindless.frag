@@ -0,0 +1,14 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_ARB_shading_language_420pack : enable
+#extension GL_EXT_nonuniform_qualifier : require
+// all textures of the view, in a set of their own, see
+// QVulkanView::bindlessTextureSet()
+layout (set = 1, binding = 0) uniform sampler2D textures[];
+layout (location = 0) in vec4 texcoord;
+layout (location = 1) flat in uint texIndex;
+layout (location = 0) out vec4 uFragColor;
+void main() {
+   // neighbouring cubes may be in the same subgroup
+   uFragColor = texture(textures[nonuniformEXT(texIndex)], texcoord.xy);
+}
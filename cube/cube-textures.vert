@@ -0,0 +1,32 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_ARB_shading_language_420pack : enable
+// cube.vert for more than one texture, each instance picks one with
+// its texture index.
+// the grid of an atlas, 1 x 1 for arrays of textures
+layout (constant_id = 0) const uint ATLAS_COLUMNS = 1;
+layout (constant_id = 1) const uint ATLAS_ROWS = 1;
+layout(std140, binding = 0) uniform buf {
+        mat4 viewProjection;
+        mat4 model;
+} ubuf;
+layout (location = 0) in vec3 pos;
+layout (location = 1) in vec2 uv;
+// per instance
+layout (location = 2) in mat4 instanceModel;
+layout (location = 6) in uint instanceTexture;
+layout (location = 0) out vec4 texcoord;
+layout (location = 1) flat out uint texIndex;
+void main()
+{
+   uint index = instanceTexture;
+   texIndex = index;
+   // the cell of the texture in the atlas
+   uint cell = index % (ATLAS_COLUMNS * ATLAS_ROWS);
+   vec2 origin = vec2(cell % ATLAS_COLUMNS, cell / ATLAS_COLUMNS);
+   texcoord = vec4((origin + uv) / vec2(ATLAS_COLUMNS, ATLAS_ROWS), 0.0, 0.0);
+   gl_Position = ubuf.viewProjection * instanceModel * ubuf.model * vec4(pos, 1.0);
+   // GL->VK conventions
+   gl_Position.y = -gl_Position.y;
+   gl_Position.z = (gl_Position.z + gl_Position.w) / 2.0;
+}
@@ -1,40 +1,145 @@
 #include "cube.h"
 #include <QTimer>
 #include <QApplication>
+#include <QCommandLineParser>
+#include <QMouseEvent>
 #include "cubemesh.h"
+#include "bench.h"
 
-MeshData makeCube() {
+// Every triangle of the cube split into subdivisions^2 triangles, pushed
+// out onto the unit sphere if round.
+MeshData makeCube(int subdivisions = 1, bool round = false) {
     DEBUG_ENTRY;
     MeshData mesh;
-    int numverts = 6*6;
+    const int n = qMax(1, subdivisions);
+    int numverts = 6*6*n*n;
     mesh.pos.reserve(numverts);
     mesh.uv.reserve(numverts);
 
-    for(int i=0; i < numverts; i++) {
-        mesh.pos<<QVector3D(
-                g_vertex_buffer_data[i*3+0],
-                g_vertex_buffer_data[i*3+1],
-                g_vertex_buffer_data[i*3+2]);
+    for (int t = 0; t < 12; t++) {
+        QVector3D p[3];
+        QVector2D uv[3];
+        for (int k = 0; k < 3; k++) {
+            int i = t*3 + k;
+            p[k] = QVector3D(
+                    g_vertex_buffer_data[i*3+0],
+                    g_vertex_buffer_data[i*3+1],
+                    g_vertex_buffer_data[i*3+2]);
+            uv[k] = QVector2D(
+                    g_uv_buffer_data[i*2+0],
+                    g_uv_buffer_data[i*2+1]);
+        }
+        // integer weights of the corners, so that points on an edge come
+        // out bitwise equal in both triangles sharing it and weld
+        auto vertex = [&](int a, int b, int c) {
+            QVector3D pos = (p[0] * a + p[1] * b + p[2] * c) / n;
+            if (round)
+                pos.normalize();
+            mesh.pos<<pos;
+            mesh.uv<<(uv[0] * a + uv[1] * b + uv[2] * c) / n;
+        };
+        for (int b = 0; b < n; b++) {
+            for (int c = 0; c < n - b; c++) {
+                int a = n - b - c;
+                vertex(a, b, c);
+                vertex(a - 1, b + 1, c);
+                vertex(a - 1, b, c + 1);
+                if (a > 1) {
+                    vertex(a - 1, b + 1, c);
+                    vertex(a - 2, b + 1, c + 1);
+                    vertex(a - 1, b, c + 1);
+                }
+            }
+        }
+    }
 
-        mesh.uv<<QVector2D(
-                g_uv_buffer_data[i*2+0],
-                g_uv_buffer_data[i*2+1]);
+    return mesh;
+}
+
+static QVkMesh<CubeVertex> makeCubeMesh(bool lod) {
+    DEBUG_ENTRY;
+    // enough triangles to simplify
+    MeshData cube = lod ? makeCube(16, true) : makeCube();
+    QVector<CubeVertex> triangles(cube.pos.size());
+    for (int i = 0; i < cube.pos.size(); i++) {
+        triangles[i].position = cube.pos[i];
+        triangles[i].uv = cube.uv[i];
     }
 
+    QVkMesh<CubeVertex> mesh = QVkMesh<CubeVertex>::fromTriangles(triangles);
+    qDebug()<<"cube mesh:"<<triangles.size()<<"vertices welded to"<<mesh.vertices.size()
+            <<"cache miss ratio"<<vertexCacheMissRatio(mesh.indices, mesh.vertices.size());
     return mesh;
 }
 
-CubeDemo::CubeDemo()
-    : m_uniformBuffer(device())
-//    , m_vertexBuffer(device())
+// appends the LODs to the indices of mesh
+static QVector<QVkLod> makeLods(QVkMesh<CubeVertex>& mesh, bool lod) {
+    DEBUG_ENTRY;
+    if (!lod)
+        return { { 0, (uint32_t)mesh.indices.size(), 0.0f } };
+
+    QVector<QVkLod> lods = buildLodChain(mesh);
+    for (int i = 0; i < lods.size(); i++)
+        qDebug()<<"lod"<<i<<":"<<lods[i].indexCount / 3<<"triangles, error"<<lods[i].error;
+    return lods;
+}
+
+CubeDemo::CubeDemo(bool quantize, uint32_t instances, bool gpuCulling, bool lod, bool cpuCulling)
+    : m_mesh(makeCubeMesh(lod && !gpuCulling))
+    , m_lods(makeLods(m_mesh, lod && !gpuCulling))
+    , m_indexBuffer(device(), m_mesh.indices.size(), m_mesh.indexType())
+    , m_instanceBuffer(device(), qMax(1u, instances))
 {
     DEBUG_ENTRY;
+    // the culler only draws m_lods[0], so neither the tessellated mesh
+    // nor its chain were built
+    if (lod && gpuCulling)
+        qWarning()<<"--lod is ignored with --gpu-culling";
     QVector3D eye(0.0f, 3.0f, 5.0f);
     QVector3D origin(0, 0, 0);
     QVector3D up(0.0f, 1.0f, 0.0);
-    m_cube = makeCube();
 
-    m_projection_matrix.perspective(45.0f, 1.0f, 0.1f, 100.0f);
+    // submitted ahead of the first frame
+    if (quantize)
+        uploadPackedVertices();
+    else
+        uploadVertices(m_mesh.vertices);
+    m_indexBuffer.upload(uploads(), m_mesh.indices);
+    if (gpuCulling) {
+        m_culler.reset(new QVkGpuCuller(device(), createShaderModule("cull-comp.spv"),
+                                        m_instanceBuffer.count(), sizeof(CubeInstance)));
+        m_culler->setDraw(m_lods[0].indexCount);
+    }
+    float gridSize = uploadInstances();
+    if ((lod || cpuCulling) && !gpuCulling) {
+        VkDeviceSize perFrame = frameRing().aligned(sizeof(CubeUniforms))
+                + frameRing().aligned(m_instances.size() * sizeof(CubeInstance))
+                + m_lods.size() * sizeof(VkDrawIndexedIndirectCommand);
+        if (perFrame > frameRing().regionSize()) {
+            qWarning()<<"--lod and --cpu-culling need"<<perFrame
+                      <<"bytes per frame, more than the frame ring has, drawing all cubes at full detail";
+        } else {
+            m_cpuCulling = cpuCulling;
+            if (lod && !device()->features().drawIndirectFirstInstance)
+                qWarning()<<"--lod needs drawIndirectFirstInstance, drawing full detail";
+            else
+                m_lodEnabled = lod;
+        }
+    }
+    m_lodSelector = QVkLodSelector(m_lods);
+    m_instanceLods.fill(-1, m_instances.size());
+
+    // the instance attributes follow the vertex attributes
+    uint32_t instanceLocation = m_meshAttributes.size();
+    setVertexInput({ m_meshBinding, m_instanceBuffer.bindingDescription(1) },
+                   m_meshAttributes + m_instanceBuffer.attributeDescriptions(1, instanceLocation));
+
+    // step back until the whole grid is in view, a single cube is 3 units
+    // on the grid
+    float distance = qMax(1.0f, gridSize / 3.0f);
+    eye *= distance;
+    m_eye = eye;
+    m_projection_matrix.perspective(45.0f, 1.0f, 0.1f, 100.0f * distance);
     m_view_matrix.lookAt(eye, origin, up);
     m_model_matrix = QMatrix();
     m_fpsTimer.start();
@@ -45,58 +150,184 @@ CubeDemo::CubeDemo()
         m_current_buffer = i;
         buildDrawCommand(m_buffers[i].cmd);
     }
-
-    // FIXME: make cube mesh a proper vertex buffer
-    // not this stupid uniform hack
-    auto* data = m_uniformBuffer.map();
-    for (int i = 0; i < m_cube.pos.size(); i++) {
-        data->position[i] = QVector4D(m_cube.pos[i], 1.0f);
-        data->attr[i] = QVector4D(m_cube.uv[i], 0.0f, 0.0f);
-    }
-    m_uniformBuffer.unmap();
 }
 
 CubeDemo::~CubeDemo()
 {
     DEBUG_ENTRY;
+    // the mesh buffers go away before QVulkanView waits for the device
+    vkDeviceWaitIdle(*device());
+}
+
+template <typename VT> void CubeDemo::uploadVertices(const QVector<VT>& vertices) {
+    DEBUG_ENTRY;
+    QVkVertexBuffer<VT>* buffer = new QVkVertexBuffer<VT>(device(), vertices.size());
+    buffer->upload(uploads(), vertices);
+    m_meshBinding = buffer->bindingDescription(0);
+    m_meshAttributes = buffer->attributeDescriptions(0);
+    m_vertexBuffer.reset(buffer);
+}
+
+float CubeDemo::uploadInstances() {
+    DEBUG_ENTRY;
+    const uint32_t count = m_instanceBuffer.count();
+    // cubes per side of the smallest grid holding all of them
+    uint32_t side = 1;
+    while (side * side * side < count)
+        side++;
+    const float spacing = 3.0f;
+    const float center = (side - 1) * spacing / 2.0f;
+
+    // the cubes spin around their centers, a sphere around the mesh
+    // bounds them at any angle
+    float radius = 0.0f;
+    for (const CubeVertex& v : m_mesh.vertices)
+        radius = qMax(radius, v.position.length());
+    m_meshRadius = radius;
+
+    QVector<CubeInstance>& instances = m_instances;
+    instances.resize(count);
+    QVector<QVector4D> spheres(count);
+    m_instancePositions.resize(count);
+    m_cpuCuller.clear();
+    m_cpuCuller.reserve(count);
+    for (uint32_t i = 0; i < count; i++) {
+        QVector3D position((i % side) * spacing - center,
+                           (i / side % side) * spacing - center,
+                           (i / (side * side)) * spacing - center);
+        QMatrix4x4 model;
+        model.translate(position);
+        instances[i].model = model;
+        // the cubes take turns, see cube-textures.vert
+        instances[i].texture = textureCount() > 1 ? i % (uint32_t)textureCount() : 0;
+        spheres[i] = QVector4D(position, radius);
+        m_cpuCuller.addSphere(spheres[i]);
+        m_instancePositions[i] = position;
+    }
+    m_bvh.build(instanceBounds());
+    m_instanceBuffer.upload(uploads(), instances);
+    if (m_culler)
+        m_culler->upload(uploads(), spheres, instances);
+    return side * spacing;
+}
+
+void CubeDemo::uploadPackedVertices() {
+    DEBUG_ENTRY;
+    QVector<QVector3D> positions(m_mesh.vertices.size());
+    for (int i = 0; i < m_mesh.vertices.size(); i++)
+        positions[i] = m_mesh.vertices[i].position;
+    QVkPositionQuantizer quantizer(positions);
+
+    QVector<CubePackedVertex> packed(m_mesh.vertices.size());
+    QVkQuantizationReport report;
+    for (int i = 0; i < m_mesh.vertices.size(); i++) {
+        const CubeVertex& v = m_mesh.vertices[i];
+        packed[i].position = quantizer.encodeSnorm(v.position);
+        packed[i].uv = encodeUv(v.uv);
+        report.addPosition(v.position, quantizer.decode(packed[i].position), quantizer.size());
+        report.addUv(v.uv, decodeUv(packed[i].uv));
+    }
+    qDebug()<<"vertex size"<<sizeof(CubeVertex)<<"->"<<sizeof(CubePackedVertex)<<report;
+
+    m_dequantization = quantizer.dequantization();
+    uploadVertices(packed);
 }
 
 void CubeDemo::prepareDescriptorSet()
 {
     DEBUG_ENTRY;
+    // a set per swapchain image, see QVulkanView::m_desc_sets
+    m_desc_sets.resize(m_buffers.count());
+    const QVector<VkDescriptorSetLayout> layouts(m_desc_sets.size(), m_desc_layout);
     VkDescriptorSetAllocateInfo alloc_info = {};
     alloc_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
     alloc_info.pNext = nullptr;
     alloc_info.descriptorPool = m_desc_pool;
-    alloc_info.descriptorSetCount = 1;
-    alloc_info.pSetLayouts = &m_desc_layout;
+    alloc_info.descriptorSetCount = m_desc_sets.size();
+    alloc_info.pSetLayouts = layouts.constData();
 
     VkResult U_ASSERT_ONLY err;
-    err = vkAllocateDescriptorSets(*device(), &alloc_info, &m_desc_set);
+    err = vkAllocateDescriptorSets(*device(), &alloc_info, m_desc_sets.data());
     Q_ASSERT(!err);
 
-    VkDescriptorImageInfo tex_descs[DEMO_TEXTURE_COUNT] = {};
-    for (uint32_t i = 0; i < DEMO_TEXTURE_COUNT; i++) {
-        tex_descs[i].sampler = m_textures[i].sampler;
-        tex_descs[i].imageView = m_textures[i].view;
-        tex_descs[i].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+    // the uniforms of each frame come from the frame ring, selected by
+    // the dynamic offset, see buildDrawCommand()
+    VkDescriptorBufferInfo uniformInfo = frameRing().descriptorInfo(sizeof(CubeUniforms));
+
+    for (int image = 0; image < m_desc_sets.size(); image++) {
+        VkWriteDescriptorSet write = {};
+        write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        write.dstSet = m_desc_sets[image];
+        write.descriptorCount = 1;
+        write.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+        write.pBufferInfo = &uniformInfo;
+
+        vkUpdateDescriptorSets(*device(), 1, &write, 0, nullptr);
+        updateTextureDescriptors(image);
     }
 
-    VkWriteDescriptorSet writes[2]={{},{}};
-    writes[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-    writes[0].dstSet = m_desc_set;
-    writes[0].descriptorCount = 1;
-    writes[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-    writes[0].pBufferInfo = m_uniformBuffer.descriptorInfo();
+    // the frame ring is new after a resize
+    if (m_culler)
+        m_culler->setFrustumBuffer(frameRing().descriptorInfo(sizeof(QVkFrustum)));
+}
+
+void CubeDemo::updateTextureDescriptors(uint32_t image)
+{
+    DEBUG_ENTRY;
+    // bindless textures are in a set of their own, see buildDrawCommand()
+    if (textureMode() == BindlessTextures)
+        return;
+    VkDescriptorImageInfo tex_desc = textureDescriptor();
+
+    VkWriteDescriptorSet write = {};
+    write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write.dstSet = m_desc_sets[image];
+    write.dstBinding = 1;
+    write.descriptorCount = 1;
+    write.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    write.pImageInfo = &tex_desc;
+
+    vkUpdateDescriptorSets(*device(), 1, &write, 0, nullptr);
+}
+
+QVector<QVkAabb> CubeDemo::instanceBounds() const {
+    // all cubes spin alike, so their boxes differ by the translation only
+    QVkAabb mesh;
+    for (const CubeVertex& v : m_mesh.vertices)
+        mesh.grow(m_model_matrix * v.position);
+
+    QVector<QVkAabb> bounds(m_instancePositions.size());
+    for (int i = 0; i < bounds.size(); i++)
+        bounds[i] = QVkAabb(mesh.min + m_instancePositions[i], mesh.max + m_instancePositions[i]);
+    return bounds;
+}
+
+void CubeDemo::mousePressEvent(QMouseEvent* event) {
+    DEBUG_ENTRY;
+    // the cubes turned since the last click, the tree still fits them
+    m_bvh.refit(instanceBounds());
+    QVkRay ray = QVkRay::fromWindow(viewProjection(), event->localPos(), size());
+    float distance = 0.0f;
+    int cube = m_bvh.raycast(ray, &distance);
+    if (cube >= 0)
+        qDebug() << "picked cube" << cube << "at" << m_instancePositions[cube] << "distance" << distance;
+    else
+        qDebug() << "picked nothing";
+}
+
+uint32_t CubeDemo::frustumOffset() {
+    return (uint32_t)(frameRing().regionOffset(m_current_buffer)
+                      + frameRing().aligned(sizeof(CubeUniforms)));
+}
 
-    writes[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-    writes[1].dstSet = m_desc_set;
-    writes[1].dstBinding = 1;
-    writes[1].descriptorCount = DEMO_TEXTURE_COUNT;
-    writes[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-    writes[1].pImageInfo = tex_descs;
+uint32_t CubeDemo::frameInstancesOffset() {
+    return (uint32_t)(frameRing().regionOffset(m_current_buffer)
+                      + frameRing().aligned(sizeof(CubeUniforms)));
+}
 
-    vkUpdateDescriptorSets(*device(), 2, writes, 0, nullptr);
+uint32_t CubeDemo::frameDrawsOffset() {
+    return (uint32_t)(frameInstancesOffset()
+                      + frameRing().aligned(m_instances.size() * sizeof(CubeInstance)));
 }
 
 void CubeDemo::buildDrawCommand(VkCommandBuffer cmd_buf)
@@ -108,32 +339,53 @@ void CubeDemo::buildDrawCommand(VkCommandBuffer cmd_buf)
     i+=20;
     QColor clear = QColor(40,40,i);
 
+    // The command buffers are prerecorded per swapchain image, so each one
+    // reads the frame ring region of its image. The uniforms are the first
+    // allocation prepareFrame() makes there, see updateUniforms().
+    uint32_t uniformOffset = (uint32_t)frameRing().regionOffset(m_current_buffer);
+
+    // the visible cubes are drawn from the culler's instances, the cubes
+    // culled on the CPU or sorted by LOD from the frame ring
+    VkBuffer instances = m_instanceBuffer.buffer();
+    VkDeviceSize instancesOffset = 0;
+    if (m_culler) {
+        m_culler->record(br, frustumOffset());
+        instances = m_culler->visibleInstances();
+    } else if (frameInstances()) {
+        instances = frameRing().buffer();
+        instancesOffset = frameInstancesOffset();
+    }
+
     br.beginRenderPass(m_render_pass,
                        m_framebuffers[m_current_buffer],
                        QVkRect(0, 0, width(), height()),
                        clear)
         .bindPipeline(m_pipeline)
-        .bindDescriptorSet(m_pipeline_layout, &m_desc_set)
+        .bindDescriptorSet(m_pipeline_layout, &m_desc_sets[m_current_buffer], 1, &uniformOffset)
         .viewport(QVkViewport((float)width(), (float)height()))
         .scissor(QRect(0, 0, qMax(0, width()), qMax(0, height())))
-        .draw(m_cube.pos.size())
-        .endRenderPass();
-
-    VkImageMemoryBarrier prePresentBarrier = {};
-    prePresentBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-    prePresentBarrier.pNext = nullptr;
-    prePresentBarrier.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-    prePresentBarrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
-    prePresentBarrier.oldLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-    prePresentBarrier.newLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
-    prePresentBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-    prePresentBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-    prePresentBarrier.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
-    prePresentBarrier.image = m_buffers[m_current_buffer].image;
-
-    br.pipelineBarrier(VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
-                       VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
-                       0, &prePresentBarrier);
+        .bindVertexBuffers(0, { m_vertexBuffer->buffer(), instances }, { 0, instancesOffset })
+        .bindIndexBuffer(m_indexBuffer.buffer(), m_indexBuffer.indexType());
+    // all textures, the instances pick theirs
+    if (textureMode() == BindlessTextures)
+        br.bindDescriptorSets(m_pipeline_layout, 1, { bindlessTextureSet(m_current_buffer) }, {});
+    if (m_culler) {
+        br.drawIndexedIndirect(m_culler->indirectBuffer());
+    } else if (frameInstances()) {
+        // one draw per LOD, updateFrameInstances() fills in the instance
+        // counts
+        uint32_t lodCount = m_lods.size();
+        if (device()->features().multiDrawIndirect) {
+            br.drawIndexedIndirect(frameRing().buffer(), frameDrawsOffset(), lodCount);
+        } else {
+            for (uint32_t lod = 0; lod < lodCount; lod++)
+                br.drawIndexedIndirect(frameRing().buffer(),
+                                       frameDrawsOffset() + lod * sizeof(VkDrawIndexedIndirectCommand));
+        }
+    } else {
+        br.drawIndexed(m_lods[0].indexCount, 0, 0, m_instanceBuffer.count());
+    }
+    br.endRenderPass();
 }
 
 void CubeDemo::redraw() {
@@ -141,33 +393,121 @@ void CubeDemo::redraw() {
     static uint32_t f = 0;
     f++;
     if(f == 100) {
-        qDebug()<<(float)f / (float)m_fpsTimer.elapsed() * 1000.0f;
+        qDebug()<<"fps:"<<(float)f / (float)m_fpsTimer.elapsed() * 1000.0f
+                <<"frames in flight:"<<framesInFlight();
+        if (frameInstances())
+            qDebug()<<"triangles:"<<m_drawnTriangles<<"of"
+                    <<m_instances.size() * m_lods[0].indexCount / 3<<"at full detail";
+        if (textureStreamer())
+            qDebug()<<"streamed texture levels:"<<textureStreamer()->size() / 1024<<"of"
+                    <<textureStreamer()->budget() / 1024<<"KB";
         f=0;
         m_fpsTimer.restart();
     }
 
-    // Wait for work to finish before updating MVP.
-    vkDeviceWaitIdle(*device());
-    updateUniforms();
     draw();
 }
 
+void CubeDemo::prepareFrame() {
+    DEBUG_ENTRY;
+    updateUniforms();
+    if (textureStreamer())
+        requestTextureSizes();
+}
+
 void CubeDemo::updateUniforms() {
 
     DEBUG_ENTRY;
-    QMatrix4x4 MVP, VP;
+    QMatrix4x4 model, VP;
     int matrixSize = 16 * sizeof(float);
 
-    VP = m_projection_matrix * m_view_matrix;
+    VP = viewProjection();
 
     // Rotate 22.5 degrees around the Y axis
     m_model_matrix.rotate(0.1f, QVector3D(0.0f, 1.0f, 0.0f));
 
-    MVP = VP * m_model_matrix;
+    // every cube spins around its own center
+    model = m_model_matrix * m_dequantization;
+
+    QVkFrameAllocation uniforms;
+    CubeUniforms* data = frameRing().allocate<CubeUniforms>(&uniforms);
+    memcpy(data->viewProjection, (const void *)VP.constData(), matrixSize);
+    memcpy(data->model, (const void *)model.constData(), matrixSize);
+    Q_ASSERT(uniforms.offset == frameRing().regionOffset(m_current_buffer));
 
-    auto* data = m_uniformBuffer.map();
-    memcpy(&data->mvp, (const void *)MVP.data(), matrixSize);
-    m_uniformBuffer.unmap();
+    if (m_culler) {
+        QVkFrameAllocation frustum;
+        *frameRing().allocate<QVkFrustum>(&frustum) = QVkFrustum::fromMatrix(VP);
+        Q_ASSERT(frustum.offset == frustumOffset());
+    } else if (frameInstances()) {
+        updateFrameInstances();
+    }
+}
+
+void CubeDemo::updateFrameInstances() {
+    DEBUG_ENTRY;
+    const float pixelsPerUnit = QVkLodSelector::pixelsPerUnit(45.0f, height());
+    const int lodCount = m_lods.size();
+
+    // the cubes in the frustum, or all of them
+    if (m_cpuCulling) {
+        m_cpuCuller.cull(QVkFrustum::fromMatrix(viewProjection()), &m_visible);
+    } else if (m_visible.size() != m_instances.size()) {
+        m_visible.resize(m_instances.size());
+        for (int i = 0; i < m_visible.size(); i++)
+            m_visible[i] = i;
+    }
+
+    // the LOD of every cube, from the distance of its bounding sphere
+    QVector<uint32_t> first(lodCount + 1, 0);
+    for (uint32_t i : m_visible) {
+        int lod = 0;
+        if (m_lodEnabled) {
+            float distance = (m_instancePositions[i] - m_eye).length() - m_meshRadius;
+            lod = m_lodSelector.select(distance, pixelsPerUnit, m_instanceLods[i]);
+        }
+        m_instanceLods[i] = lod;
+        first[lod + 1]++;
+    }
+    for (int lod = 0; lod < lodCount; lod++)
+        first[lod + 1] += first[lod];
+
+    // the cubes grouped by LOD, each group drawn from its first instance;
+    // room for all of them, so the draws stay at frameDrawsOffset()
+    QVkFrameAllocation instances = frameRing().allocate(m_instances.size() * sizeof(CubeInstance));
+    Q_ASSERT(instances.offset == frameInstancesOffset());
+    CubeInstance* data = instances.data<CubeInstance>();
+    QVector<uint32_t> next = first;
+    for (uint32_t i : m_visible)
+        data[next[m_instanceLods[i]]++] = m_instances[i];
+
+    QVkFrameAllocation draws = frameRing().allocate(lodCount * sizeof(VkDrawIndexedIndirectCommand));
+    Q_ASSERT(draws.offset == frameDrawsOffset());
+    VkDrawIndexedIndirectCommand* commands = draws.data<VkDrawIndexedIndirectCommand>();
+    m_drawnTriangles = 0;
+    for (int lod = 0; lod < lodCount; lod++) {
+        commands[lod] = {};
+        commands[lod].indexCount = m_lods[lod].indexCount;
+        commands[lod].instanceCount = first[lod + 1] - first[lod];
+        commands[lod].firstIndex = m_lods[lod].firstIndex;
+        // without drawIndirectFirstInstance only LOD 0 is drawn, from 0
+        commands[lod].firstInstance = commands[lod].instanceCount ? first[lod] : 0;
+        m_drawnTriangles += commands[lod].instanceCount * m_lods[lod].indexCount / 3;
+    }
+}
+
+void CubeDemo::requestTextureSizes() {
+    DEBUG_ENTRY;
+    const float pixelsPerUnit = QVkLodSelector::pixelsPerUnit(45.0f, height());
+    const QVkFrustum frustum = QVkFrustum::fromMatrix(viewProjection());
+    for (int i = 0; i < m_instancePositions.size(); i++) {
+        if (!frustum.intersectsSphere(QVector4D(m_instancePositions[i], m_meshRadius)))
+            continue;
+        // every face of the cube, 2 units wide, shows the whole texture;
+        // the closest point of the cube is at least at the near plane
+        float distance = qMax(0.1f, (m_instancePositions[i] - m_eye).length() - m_meshRadius);
+        requestTextureSize(m_instances[i].texture, 2.0f * pixelsPerUnit / distance);
+    }
 }
 
 int main(int argc, char **argv) {
@@ -175,11 +515,90 @@ int main(int argc, char **argv) {
     setvbuf(stdout, nullptr, _IONBF, 0);
 
     QGuiApplication app(argc, argv);
-    CubeDemo demo;
+
+    QCommandLineParser parser;
+    parser.addHelpOption();
+    QCommandLineOption framesInFlightOption("frames-in-flight",
+            "Number of frames the CPU may record ahead of the GPU.",
+            "count", QString::number(DEFAULT_FRAMES_IN_FLIGHT));
+    QCommandLineOption unthrottledOption("unthrottled",
+            "Redraw as fast as possible instead of every 16ms, to measure frames/second.");
+    QCommandLineOption benchAllocatorOption("benchmark-allocator",
+            "Compare vkAllocateMemory with the sub-allocator and exit.");
+    parser.addOption(framesInFlightOption);
+    parser.addOption(unthrottledOption);
+    QCommandLineOption benchUploadsOption("benchmark-uploads",
+            "Compare one submit per upload with batched uploads and exit.");
+    QCommandLineOption quantizeOption("quantize",
+            "Upload 16 bit normalized vertices instead of floats and print the error.");
+    QCommandLineOption instancesOption("instances",
+            "Number of cubes, drawn with a single instanced draw call.",
+            "count", "1");
+    QCommandLineOption benchCullingOption("benchmark-culling",
+            "Measure the CPU frustum culling kernels and exit.");
+    QCommandLineOption gpuCullingOption("gpu-culling",
+            "Cull the cubes against the view frustum in a compute shader and draw the rest indirectly.");
+    QCommandLineOption cpuCullingOption("cpu-culling",
+            "Cull the cubes against the view frustum on the CPU every frame and draw the rest indirectly.");
+    parser.addOption(benchAllocatorOption);
+    parser.addOption(benchUploadsOption);
+    parser.addOption(benchCullingOption);
+    parser.addOption(quantizeOption);
+    parser.addOption(instancesOption);
+    QCommandLineOption lodOption("lod",
+            "Draw rounded cubes, simplified per cube to what is visible at its distance.");
+    QCommandLineOption textureOption("texture",
+            "Image to texture the cube with; KTX2 and DDS files are uploaded block compressed, with their mip levels. "
+            "Given more than once, the cubes take turns.",
+            "file");
+    QCommandLineOption atlasOption("atlas",
+            "Put more than one texture into an atlas, even if the device supports bindless textures.");
+    parser.addOption(gpuCullingOption);
+    parser.addOption(cpuCullingOption);
+    parser.addOption(lodOption);
+    QCommandLineOption textureBudgetOption("texture-budget",
+            "Device memory in MB the texture cache keeps textures resident in.",
+            "MB", QString::number(DEFAULT_TEXTURE_CACHE_BUDGET / (1024 * 1024)));
+    QCommandLineOption streamingBudgetOption("streaming-budget",
+            "Device memory in MB the mip levels of large textures are streamed into, as their size on screen "
+            "requires; 0 uploads textures whole.",
+            "MB", QString::number(DEFAULT_TEXTURE_STREAMING_BUDGET / (1024 * 1024)));
+    parser.addOption(textureOption);
+    parser.addOption(textureBudgetOption);
+    parser.addOption(streamingBudgetOption);
+    parser.addOption(atlasOption);
+    parser.process(app);
+
+    if (parser.isSet(cpuCullingOption) && parser.isSet(gpuCullingOption))
+        qWarning()<<"--cpu-culling and --gpu-culling exclude each other, culling on the GPU";
+    if (parser.isSet(textureOption))
+        QVulkanView::setTextureFiles(parser.values(textureOption));
+    QVulkanView::setTextureAtlasForced(parser.isSet(atlasOption));
+    QVulkanView::setTextureStreamingBudget(
+            (VkDeviceSize)qMax(0, parser.value(streamingBudgetOption).toInt()) * 1024 * 1024);
+    CubeDemo demo(parser.isSet(quantizeOption),
+                  qMax(1, parser.value(instancesOption).toInt()),
+                  parser.isSet(gpuCullingOption),
+                  parser.isSet(lodOption),
+                  parser.isSet(cpuCullingOption));
+    if (parser.isSet(benchAllocatorOption)) {
+        benchmarkAllocator(demo.device());
+        return 0;
+    }
+    if (parser.isSet(benchCullingOption)) {
+        benchmarkCulling(demo.viewProjection());
+        return 0;
+    }
+    if (parser.isSet(benchUploadsOption)) {
+        benchmarkUploads(demo.device(), demo.queue(), demo.queueFamilyIndex());
+        return 0;
+    }
+    demo.setFramesInFlight(qMax(1, parser.value(framesInFlightOption).toInt()));
+    demo.device()->textureCache().setBudget((VkDeviceSize)qMax(0, parser.value(textureBudgetOption).toInt()) * 1024 * 1024);
     demo.resize(500,500);
     demo.show();
     QTimer t;
-    t.setInterval(16);
+    t.setInterval(parser.isSet(unthrottledOption) ? 0 : 16);
     QObject::connect(&t, &QTimer::timeout, &demo, &CubeDemo::redraw );
     t.start();
     app.exec();
@@ -3,30 +3,135 @@
 
 #include "qvulkanview.h"
 #include "qvulkanbuffer.h"
+#include "qvkvertexbuffer.h"
+#include "qvkquantize.h"
+#include "qvkculling.h"
+#include "qvkbvh.h"
+#include "qvklod.h"
 
 struct CubeUniforms {
     CubeUniforms() {
         memset(this, 0, sizeof(*this));
     }
 
-    float mvp[4][4];
-    QVector4D position[12 * 3];
-    QVector4D attr[12 * 3];
+    // projection * view, the model matrices are applied per instance
+    float viewProjection[4][4];
+    float model[4][4];
 };
 
+// matches the inputs of cube.vert
+struct CubeVertex {
+    QVector3D position;
+    QVector2D uv;
+};
+
+QVK_DECLARE_VERTEX_LAYOUT(CubeVertex,
+    QVK_VERTEX_ATTRIBUTE(CubeVertex, position),
+    QVK_VERTEX_ATTRIBUTE(CubeVertex, uv))
+
+// CubeVertex in 12 instead of 20 bytes, see QVkPositionQuantizer
+struct CubePackedVertex {
+    QVkSnorm16x4 position;
+    QVkUnorm16x2 uv;
+};
+
+QVK_DECLARE_VERTEX_LAYOUT(CubePackedVertex,
+    QVK_VERTEX_ATTRIBUTE(CubePackedVertex, position),
+    QVK_VERTEX_ATTRIBUTE(CubePackedVertex, uv))
+
+// placement of one cube, applied before the common model matrix
+struct CubeInstance {
+    QVkMatrix4 model;
+    // index of the texture of the cube, see cube-textures.vert
+    uint32_t texture        {0};
+    // QVkGpuCuller copies instances 16 bytes at a time
+    uint32_t padding[3]     {};
+};
+
+QVK_DECLARE_VERTEX_LAYOUT(CubeInstance,
+    QVK_VERTEX_ATTRIBUTE(CubeInstance, model),
+    QVK_VERTEX_ATTRIBUTE(CubeInstance, texture))
+
 class CubeDemo: public QVulkanView {
 public:
-    CubeDemo();
+    // quantize: upload CubePackedVertex instead of CubeVertex
+    // instances: cubes to draw, on a grid, with a single draw call
+    // gpuCulling: draw only the cubes a compute pass finds in the frustum
+    // lod: draw rounded, finely tessellated cubes with a LOD chain, each
+    //      instance at the LOD its distance allows
+    // cpuCulling: draw only the cubes QVkCpuCuller finds in the frustum
+    explicit CubeDemo(bool quantize = false, uint32_t instances = 1, bool gpuCulling = false,
+                      bool lod = false, bool cpuCulling = false);
     ~CubeDemo();
     void init();
     virtual void prepareDescriptorSet() override;
     virtual void buildDrawCommand(VkCommandBuffer cmd_buf) override;
+    virtual void updateTextureDescriptors(uint32_t image) override;
+    virtual void prepareFrame() override;
+    // picks the cube under the cursor
+    void mousePressEvent(QMouseEvent* event) override;
+
+    // the frustum the cubes are culled against
+    QMatrix4x4 viewProjection() const {
+        return m_projection_matrix * m_view_matrix;
+    }
 public slots:
     void redraw();
 
 private:
-    QVkUniformBuffer<CubeUniforms> m_uniformBuffer;
-    MeshData m_cube;
+    // welded and optimized, see QVkMesh::fromTriangles()
+    QVkMesh<CubeVertex> m_mesh;
+    // index ranges of the LODs in m_mesh.indices, just the mesh without
+    // --lod
+    QVector<QVkLod> m_lods;
+    QScopedPointer<QVkDeviceBuffer> m_vertexBuffer;
+    QVkIndexBuffer m_indexBuffer;
+    QVkInstanceBuffer<CubeInstance> m_instanceBuffer;
+    // replaces m_instanceBuffer with the visible instances, if enabled
+    QScopedPointer<QVkGpuCuller> m_culler;
+    // centers of the instances and the hierarchy over their boxes
+    QVector<QVector3D> m_instancePositions;
+    QVkBvh m_bvh;
+    // With LODs or CPU culling, the instances to draw are written to the
+    // frame ring every frame, grouped by LOD.
+    bool m_lodEnabled   {false};
+    bool m_cpuCulling   {false};
+    QVkLodSelector m_lodSelector;
+    // the LOD of every instance in the last frame
+    QVector<int> m_instanceLods;
+    // bounding spheres of the instances, and the ones in the frustum
+    QVkCpuCuller m_cpuCuller;
+    QVector<uint32_t> m_visible;
+    QVector<CubeInstance> m_instances;
+    float m_meshRadius  {0.0f};
+    uint32_t m_drawnTriangles   {0};
+    QVector3D m_eye     {};
+    // turns quantized positions back into model space
+    QMatrix4x4 m_dequantization     {};
+
+    // binding 0 per vertex, binding 1 per instance
+    VkVertexInputBindingDescription m_meshBinding     {};
+    QVector<VkVertexInputAttributeDescription> m_meshAttributes {};
+
+    template <typename VT> void uploadVertices(const QVector<VT>& vertices);
+    void uploadPackedVertices();
+    // grid of the instances around the origin, returns its size
+    float uploadInstances();
+    // world space boxes of the spinning cubes
+    QVector<QVkAabb> instanceBounds() const;
+    // the QVkFrustum follows the CubeUniforms in the frame ring
+    uint32_t frustumOffset();
+    // with LODs or CPU culling the instances follow the CubeUniforms
+    // instead, then one VkDrawIndexedIndirectCommand per LOD
+    bool frameInstances() const {
+        return m_lodEnabled || m_cpuCulling;
+    }
+    uint32_t frameInstancesOffset();
+    uint32_t frameDrawsOffset();
+    void updateFrameInstances();
+    // the on-screen size of the textures of the cubes in the frustum, for
+    // the texture streamer
+    void requestTextureSizes();
 
     void updateUniforms();
     float m_spin_angle  {0.1f};
@@ -38,14 +143,6 @@ private:
     QMatrix4x4 m_projection_matrix  {};
     QMatrix4x4 m_view_matrix        {};
     QMatrix4x4 m_model_matrix       {};
-
-
-    struct CubeVertexType {
-        QVector4D position;
-        QVector4D attr;
-    };
-//    QVkVertexBuffer<CubeVertexType> m_vertexBuffer;
-
 };
 
 
@@ -40,7 +40,23 @@ SOURCES += \
     qvkimage.cpp \
     qvkinstance.cpp \
     qvkdevice.cpp \
-    qvkphysicaldevice.cpp
+    qvkphysicaldevice.cpp \
+    qvkallocator.cpp \
+    qvkupload.cpp \
+    qvkdeletionqueue.cpp \
+    qvkmesh.cpp \
+    qvkquantize.cpp \
+    qvkculling.cpp \
+    qvkbvh.cpp \
+    qvklod.cpp \
+    qvkmipmap.cpp \
+    qvktexturefile.cpp \
+    qvktextureloader.cpp \
+    qvktexturecache.cpp \
+    qvktextureatlas.cpp \
+    qvktexturestreamer.cpp \
+    qvkimageformat.cpp \
+    bench.cpp
 
 HEADERS += \
     cube.h \
@@ -51,5 +67,46 @@ HEADERS += \
     qvkimage.h \
     qvkinstance.h \
     qvkdevice.h \
-    qvkphysicaldevice.h
+    qvkphysicaldevice.h \
+    qvkallocator.h \
+    qvkupload.h \
+    qvkdeletionqueue.h \
+    qvkvertexbuffer.h \
+    qvkmesh.h \
+    qvkquantize.h \
+    qvkculling.h \
+    qvkbvh.h \
+    qvklod.h \
+    qvkmipmap.h \
+    qvktexturefile.h \
+    qvktextureloader.h \
+    qvktexturecache.h \
+    qvktextureatlas.h \
+    qvktexturestreamer.h \
+    qvkimageformat.h \
+    bench.h
 
+# The SPIR-V the demo loads is always built from the GLSL next to it, with
+#   glslangValidator -V <shader> -o <base>-<stage>.spv
+# and written to this directory, which the demo has to be run from.
+SHADERS_VERT = cube.vert cube-textures.vert
+SHADERS_FRAG = cube.frag cube-bindless.frag
+SHADERS_COMP = cull.comp mip.comp
+OTHER_FILES += $$SHADERS_VERT $$SHADERS_FRAG $$SHADERS_COMP
+
+GLSLANG = $$system(which glslangValidator)
+isEmpty(GLSLANG): error("glslangValidator not found, it is needed to compile the shaders")
+
+vert.input = SHADERS_VERT
+vert.output = $$PWD/${QMAKE_FILE_BASE}-vert.spv
+vert.commands = $$GLSLANG -V ${QMAKE_FILE_NAME} -o ${QMAKE_FILE_OUT}
+vert.CONFIG += no_link target_predeps
+frag.input = SHADERS_FRAG
+frag.output = $$PWD/${QMAKE_FILE_BASE}-frag.spv
+frag.commands = $$GLSLANG -V ${QMAKE_FILE_NAME} -o ${QMAKE_FILE_OUT}
+frag.CONFIG += no_link target_predeps
+comp.input = SHADERS_COMP
+comp.output = $$PWD/${QMAKE_FILE_BASE}-comp.spv
+comp.commands = $$GLSLANG -V ${QMAKE_FILE_NAME} -o ${QMAKE_FILE_OUT}
+comp.CONFIG += no_link target_predeps
+QMAKE_EXTRA_COMPILERS += vert frag comp
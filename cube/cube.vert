@@ -0,0 +1,21 @@
+#version 400
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_ARB_shading_language_420pack : enable
+layout(std140, binding = 0) uniform buf {
+        mat4 viewProjection;
+        mat4 model;
+} ubuf;
+layout (location = 0) in vec3 pos;
+layout (location = 1) in vec2 uv;
+// per instance
+layout (location = 2) in mat4 instanceModel;
+// location 6, the texture index, is only read by cube-textures.vert
+layout (location = 0) out vec4 texcoord;
+void main()
+{
+   texcoord = vec4(uv, 0.0, 0.0);
+   gl_Position = ubuf.viewProjection * instanceModel * ubuf.model * vec4(pos, 1.0);
+   // GL->VK conventions
+   gl_Position.y = -gl_Position.y;
+   gl_Position.z = (gl_Position.z + gl_Position.w) / 2.0;
+}
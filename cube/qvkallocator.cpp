@@ -0,0 +1,364 @@
+#include "qvkallocator.h"
+#include "qvkdevice.h"
+
+// Requests are rounded up to powers of two, keep the smallest ones from
+// wasting more than they use.
+static const VkDeviceSize MIN_RANGE_SIZE = 256;
+static const VkDeviceSize MAX_BLOCK_SIZE = 64 * 1024 * 1024;
+static const VkDeviceSize MIN_BLOCK_SIZE = 1024 * 1024;
+
+static VkDeviceSize nextPowerOfTwo(VkDeviceSize v) {
+    VkDeviceSize p = 1;
+    while (p < v)
+        p <<= 1;
+    return p;
+}
+
+QVkMemoryRequest::QVkMemoryRequest(QVkMemoryUsage usage)
+    : required(0)
+    , preferred(0)
+    , forbidden(0)
+{
+    switch (usage) {
+    case QVkMemoryUsage::GpuOnly:
+        // host visible device local memory is scarce, scoring keeps
+        // GpuOnly out of it unless nothing else is left
+        preferred = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+        break;
+    case QVkMemoryUsage::Upload:
+        // write combined system memory, cached memory is slower to write
+        required = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+        preferred = VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+        break;
+    case QVkMemoryUsage::Readback:
+        // uncached reads are painfully slow
+        required = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+        preferred = VK_MEMORY_PROPERTY_HOST_CACHED_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+        break;
+    case QVkMemoryUsage::Dynamic:
+        // device local and host visible (BAR) if there is any left
+        required = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+        preferred = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+        break;
+    }
+}
+
+QDebug operator<<(QDebug dbg, const QVkAllocatorStats& stats) {
+    QDebugStateSaver saver(dbg);
+    dbg.nospace() << "QVkAllocatorStats(blocks " << stats.blocks
+                  << ", dedicated " << stats.dedicatedAllocations
+                  << ", allocations " << stats.allocations
+                  << ", reserved " << stats.reservedBytes
+                  << ", used " << stats.usedBytes
+                  << ", free " << stats.freeBytes
+                  << ", largest free " << stats.largestFreeRange
+                  << ", fragmentation " << stats.fragmentation() << ")";
+    return dbg;
+}
+
+QVkMemoryBlock::QVkMemoryBlock(VkDeviceMemory memory, void* mapped, VkDeviceSize size, VkDeviceSize minSize)
+    : m_memory(memory)
+    , m_mapped(mapped)
+    , m_size(size)
+    , m_minSize(minSize)
+    , m_freeBytes(size)
+{
+    int orders = 1;
+    while ((m_minSize << (orders - 1)) < m_size)
+        orders++;
+    m_free.resize(orders);
+    m_free[orders - 1].insert(0);
+}
+
+bool QVkMemoryBlock::allocate(VkDeviceSize size, VkDeviceSize* offset, uint32_t* order) {
+    int wanted = 0;
+    while ((m_minSize << wanted) < size)
+        wanted++;
+    if (wanted >= m_free.count())
+        return false;
+
+    int found = wanted;
+    while (found < m_free.count() && m_free[found].isEmpty())
+        found++;
+    if (found == m_free.count())
+        return false;
+
+    auto it = m_free[found].begin();
+    VkDeviceSize start = *it;
+    m_free[found].erase(it);
+
+    // split, keeping the lower half and freeing the upper buddy
+    while (found > wanted) {
+        found--;
+        m_free[found].insert(start + (m_minSize << found));
+    }
+
+    m_freeBytes -= m_minSize << wanted;
+    *offset = start;
+    *order = wanted;
+    return true;
+}
+
+void QVkMemoryBlock::free(VkDeviceSize offset, uint32_t order) {
+    m_freeBytes += m_minSize << order;
+
+    // merge with the buddy for as long as it is free as well
+    int o = order;
+    while (o < m_free.count() - 1) {
+        VkDeviceSize buddy = offset ^ (m_minSize << o);
+        if (!m_free[o].remove(buddy))
+            break;
+        offset = qMin(offset, buddy);
+        o++;
+    }
+    m_free[o].insert(offset);
+}
+
+VkDeviceSize QVkMemoryBlock::largestFreeRange() const {
+    for (int o = m_free.count() - 1; o >= 0; o--) {
+        if (!m_free[o].isEmpty())
+            return m_minSize << o;
+    }
+    return 0;
+}
+
+QVkMemoryAllocator::QVkMemoryAllocator(QVkDevice& device,
+                                       const VkPhysicalDeviceMemoryProperties& memoryProperties)
+    : m_device(device)
+    , m_memoryProperties(memoryProperties)
+{
+    DEBUG_ENTRY;
+    m_nonCoherentAtomSize = qMax<VkDeviceSize>(1, m_device.limits().nonCoherentAtomSize);
+}
+
+QVkMemoryAllocator::~QVkMemoryAllocator() {
+    DEBUG_ENTRY;
+    if (m_allocationCount)
+        qWarning() << "destroying allocator with" << m_allocationCount << "live allocations";
+
+    for (uint32_t type = 0; type < VK_MAX_MEMORY_TYPES; type++) {
+        for (auto& pool: m_blocks[type]) {
+            for (QVkMemoryBlock* block: pool) {
+                freeMemory(block->memory(), block->mapped(), type, block->size());
+                delete block;
+            }
+            pool.clear();
+        }
+    }
+}
+
+VkDeviceSize QVkMemoryAllocator::blockSize(uint32_t memoryType) const {
+    // Small heaps (e.g. the 256MB host visible device local one) should
+    // not be taken up by a few mostly empty blocks.
+    uint32_t heap = m_memoryProperties.memoryTypes[memoryType].heapIndex;
+    VkDeviceSize heapSize = m_memoryProperties.memoryHeaps[heap].size;
+    VkDeviceSize size = MAX_BLOCK_SIZE;
+    while (size > MIN_BLOCK_SIZE && size > heapSize / 8)
+        size >>= 1;
+    return size;
+}
+
+VkDeviceMemory QVkMemoryAllocator::allocateMemory(VkDeviceSize size, uint32_t memoryType, void** mapped) {
+    DEBUG_ENTRY;
+    VkMemoryAllocateInfo allocinfo = {};
+    allocinfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    allocinfo.allocationSize = size;
+    allocinfo.memoryTypeIndex = memoryType;
+
+    VkDeviceMemory memory = nullptr;
+    VkResult err = vkAllocateMemory(m_device, &allocinfo, nullptr, &memory);
+    if (err) {
+        qWarning() << "vkAllocateMemory of" << size << "bytes failed:" << err;
+        return nullptr;
+    }
+    m_device.memoryAllocated(memoryType, size);
+
+    *mapped = nullptr;
+    if (m_memoryProperties.memoryTypes[memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+        err = vkMapMemory(m_device, memory, 0, VK_WHOLE_SIZE, 0, mapped);
+        Q_ASSERT(!err);
+    }
+    return memory;
+}
+
+void QVkMemoryAllocator::freeMemory(VkDeviceMemory memory, void* mapped,
+                                    uint32_t memoryType, VkDeviceSize size) {
+    DEBUG_ENTRY;
+    if (mapped)
+        vkUnmapMemory(m_device, memory);
+    vkFreeMemory(m_device, memory, nullptr);
+    m_device.memoryFreed(memoryType, size);
+}
+
+QVkAllocation QVkMemoryAllocator::allocate(const VkMemoryRequirements& requirements,
+                                           uint32_t memoryType,
+                                           QVkAllocation::Kind kind) {
+    Q_ASSERT(memoryType < m_memoryProperties.memoryTypeCount);
+    Q_ASSERT(requirements.memoryTypeBits & (1u << memoryType));
+    QMutexLocker locker(&m_lock);
+
+    QVkAllocation a;
+    a.size = requirements.size;
+    a.memoryType = memoryType;
+    a.kind = kind;
+
+    // Buddy ranges are aligned to their size, so rounding the size up to
+    // the alignment takes care of it.
+    VkDeviceSize rangeSize = nextPowerOfTwo(qMax(qMax(requirements.size, requirements.alignment), MIN_RANGE_SIZE));
+    VkDeviceSize newBlockSize = blockSize(memoryType);
+
+    if (rangeSize > newBlockSize / 2) {
+        void* mapped = nullptr;
+        a.memory = allocateMemory(requirements.size, memoryType, &mapped);
+        if (a.memory == nullptr)
+            return QVkAllocation();
+        a.offset = 0;
+        a.mapped = mapped;
+        a.memorySize = requirements.size;
+        m_dedicatedCount++;
+        m_dedicatedBytes += requirements.size;
+    } else {
+        QVector<QVkMemoryBlock*>& pool = m_blocks[memoryType][kind];
+        VkDeviceSize offset = 0;
+        uint32_t order = 0;
+        QVkMemoryBlock* block = nullptr;
+        for (QVkMemoryBlock* candidate: pool) {
+            if (candidate->allocate(rangeSize, &offset, &order)) {
+                block = candidate;
+                break;
+            }
+        }
+        if (!block) {
+            void* mapped = nullptr;
+            VkDeviceMemory memory = allocateMemory(newBlockSize, memoryType, &mapped);
+            if (memory == nullptr)
+                return QVkAllocation();
+            block = new QVkMemoryBlock(memory, mapped, newBlockSize, MIN_RANGE_SIZE);
+            pool << block;
+            bool U_ASSERT_ONLY ok = block->allocate(rangeSize, &offset, &order);
+            Q_ASSERT(ok);
+        }
+        a.block = block;
+        a.memory = block->memory();
+        a.memorySize = block->size();
+        a.offset = offset;
+        a.order = order;
+        if (block->mapped())
+            a.mapped = static_cast<char*>(block->mapped()) + offset;
+    }
+
+    m_allocationCount++;
+    m_usedBytes += a.size;
+    return a;
+}
+
+QVkAllocation QVkMemoryAllocator::allocateBest(const VkMemoryRequirements& requirements,
+                                               const QVkMemoryRequest& request,
+                                               QVkAllocation::Kind kind) {
+    uint32_t typeBits = requirements.memoryTypeBits;
+    while (typeBits) {
+        int index = m_device.memoryType(typeBits, request, requirements.size);
+        if (index < 0)
+            break;
+        QVkAllocation a = allocate(requirements, index, kind);
+        if (!a.isNull())
+            return a;
+        // heap full (or over budget for the driver), try the next best
+        typeBits &= ~(1u << index);
+    }
+    return QVkAllocation();
+}
+
+QVkAllocation QVkMemoryAllocator::allocateForBuffer(VkBuffer buffer,
+                                                    const QVkMemoryRequest& request) {
+    VkMemoryRequirements reqs = {};
+    vkGetBufferMemoryRequirements(m_device, buffer, &reqs);
+
+    QVkAllocation a = allocateBest(reqs, request, QVkAllocation::Linear);
+    Q_ASSERT(!a.isNull());
+    VkResult U_ASSERT_ONLY err = vkBindBufferMemory(m_device, buffer, a.memory, a.offset);
+    Q_ASSERT(!err);
+    return a;
+}
+
+QVkAllocation QVkMemoryAllocator::allocateForImage(VkImage image,
+                                                   VkImageTiling tiling,
+                                                   const QVkMemoryRequest& request) {
+    VkMemoryRequirements reqs = {};
+    vkGetImageMemoryRequirements(m_device, image, &reqs);
+
+    QVkAllocation a = allocateBest(reqs, request, tiling == VK_IMAGE_TILING_OPTIMAL
+                                   ? QVkAllocation::Optimal : QVkAllocation::Linear);
+    Q_ASSERT(!a.isNull());
+    VkResult U_ASSERT_ONLY err = vkBindImageMemory(m_device, image, a.memory, a.offset);
+    Q_ASSERT(!err);
+    return a;
+}
+
+void QVkMemoryAllocator::free(QVkAllocation& a) {
+    if (a.isNull())
+        return;
+    QMutexLocker locker(&m_lock);
+
+    if (a.block) {
+        QVector<QVkMemoryBlock*>& pool = m_blocks[a.memoryType][a.kind];
+        a.block->free(a.offset, a.order);
+        // keep one empty block around, so allocating and freeing the same
+        // size in a loop does not hit vkAllocateMemory every time
+        if (a.block->isEmpty() && pool.count() > 1) {
+            pool.removeOne(a.block);
+            freeMemory(a.block->memory(), a.block->mapped(), a.memoryType, a.block->size());
+            delete a.block;
+        }
+    } else {
+        freeMemory(a.memory, a.mapped, a.memoryType, a.memorySize);
+        m_dedicatedCount--;
+        m_dedicatedBytes -= a.size;
+    }
+
+    m_allocationCount--;
+    m_usedBytes -= a.size;
+    a = QVkAllocation();
+}
+
+void QVkMemoryAllocator::flush(const QVkAllocation& a, VkDeviceSize offset, VkDeviceSize size) {
+    if (m_memoryProperties.memoryTypes[a.memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)
+        return;
+    if (size == VK_WHOLE_SIZE)
+        size = a.size - offset;
+    Q_ASSERT(offset + size <= a.size);
+
+    // The range has to be aligned to nonCoherentAtomSize relative to the
+    // start of the VkDeviceMemory, or reach its end.
+    VkDeviceSize atom = m_nonCoherentAtomSize;
+    VkDeviceSize begin = (a.offset + offset) / atom * atom;
+    VkDeviceSize end = qMin(a.memorySize, (a.offset + offset + size + atom - 1) / atom * atom);
+
+    VkMappedMemoryRange range = {};
+    range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+    range.memory = a.memory;
+    range.offset = begin;
+    range.size = end - begin;
+    VkResult U_ASSERT_ONLY err = vkFlushMappedMemoryRanges(m_device, 1, &range);
+    Q_ASSERT(!err);
+}
+
+QVkAllocatorStats QVkMemoryAllocator::stats() {
+    QMutexLocker locker(&m_lock);
+    QVkAllocatorStats s;
+    for (auto& pools: m_blocks) {
+        for (auto& pool: pools) {
+            for (QVkMemoryBlock* block: pool) {
+                s.blocks++;
+                s.reservedBytes += block->size();
+                s.freeBytes += block->freeBytes();
+                s.largestFreeRange = qMax(s.largestFreeRange, block->largestFreeRange());
+            }
+        }
+    }
+    s.dedicatedAllocations = m_dedicatedCount;
+    s.reservedBytes += m_dedicatedBytes;
+    s.allocations = m_allocationCount;
+    s.usedBytes = m_usedBytes;
+    return s;
+}
@@ -0,0 +1,184 @@
+#ifndef QVKALLOCATOR_H
+#define QVKALLOCATOR_H
+
+#include <vulkan/vulkan.h>
+#include <QVector>
+#include <QSet>
+#include <QMutex>
+#include "qvkutil.h"
+
+class QVkDevice;
+class QVkMemoryBlock;
+
+/*
+ * What memory is going to be used for. Picks the flags of a
+ * QVkMemoryRequest, see QVkDevice::memoryType().
+ */
+enum class QVkMemoryUsage {
+    // only accessed by the device: render targets, textures, static meshes
+    GpuOnly,
+    // written once by the host and copied by the device: staging buffers
+    Upload,
+    // written by the device and read back by the host
+    Readback,
+    // rewritten by the host every frame and read by the device in place:
+    // uniforms, dynamic vertices
+    Dynamic
+};
+
+struct QVkMemoryRequest {
+    QVkMemoryRequest(VkMemoryPropertyFlags requiredFlags = 0,
+                     VkMemoryPropertyFlags preferredFlags = 0,
+                     VkMemoryPropertyFlags forbiddenFlags = 0)
+        : required(requiredFlags)
+        , preferred(preferredFlags)
+        , forbidden(forbiddenFlags)
+    { }
+    QVkMemoryRequest(QVkMemoryUsage usage);
+
+    // types without all of these are never picked
+    VkMemoryPropertyFlags required;
+    // the more of these a type has the better
+    VkMemoryPropertyFlags preferred;
+    // types with any of these are never picked
+    VkMemoryPropertyFlags forbidden;
+};
+
+/*
+ * A range of device memory handed out by QVkMemoryAllocator. Small
+ * allocations share a VkDeviceMemory with others, so memory has to be
+ * bound at offset. Host visible memory is mapped for its whole lifetime,
+ * mapped then points at offset.
+ */
+struct QVkAllocation {
+    // Buffers and linear images must not share a
+    // bufferImageGranularity page with optimal images.
+    enum Kind {
+        Linear,
+        Optimal
+    };
+
+    VkDeviceMemory memory   {nullptr};
+    VkDeviceSize offset     {0};
+    VkDeviceSize size       {0};
+    uint32_t memoryType     {0};
+    void* mapped            {nullptr};
+
+    bool isNull() const { return memory == nullptr; }
+
+private:
+    friend class QVkMemoryAllocator;
+    QVkMemoryBlock* block   {nullptr};
+    VkDeviceSize memorySize {0};
+    uint32_t order          {0};
+    Kind kind               {Linear};
+};
+
+struct QVkAllocatorStats {
+    uint32_t blocks                 {0};
+    uint32_t dedicatedAllocations   {0};
+    uint32_t allocations            {0};
+    // bytes of VkDeviceMemory held, blocks and dedicated allocations
+    VkDeviceSize reservedBytes      {0};
+    // bytes requested by the allocations
+    VkDeviceSize usedBytes          {0};
+    // bytes unused in the blocks
+    VkDeviceSize freeBytes          {0};
+    VkDeviceSize largestFreeRange   {0};
+
+    // 0 when all free memory is one contiguous range, towards 1 the more
+    // it is split into small pieces
+    float fragmentation() const {
+        return freeBytes ? 1.0f - (float)largestFreeRange / (float)freeBytes : 0.0f;
+    }
+};
+
+QDebug operator<<(QDebug dbg, const QVkAllocatorStats& stats);
+
+/*
+ * Sub-allocates device memory out of large blocks, one set of blocks per
+ * memory type and QVkAllocation::Kind. Within a block ranges are managed
+ * by a buddy allocator, so offsets are naturally aligned to the (power of
+ * two) size of the range. Requests larger than half a block get their own
+ * VkDeviceMemory.
+ */
+class QVkMemoryAllocator {
+public:
+    QVkMemoryAllocator(QVkDevice& device,
+                       const VkPhysicalDeviceMemoryProperties& memoryProperties);
+    ~QVkMemoryAllocator();
+    Q_DISABLE_COPY(QVkMemoryAllocator)
+
+    QVkAllocation allocate(const VkMemoryRequirements& requirements,
+                           uint32_t memoryType,
+                           QVkAllocation::Kind kind = QVkAllocation::Linear);
+
+    // picks the best memory type for request, allocates and binds. Falls
+    // back to the next best type when a heap is out of memory.
+    QVkAllocation allocateForBuffer(VkBuffer buffer,
+                                    const QVkMemoryRequest& request);
+    QVkAllocation allocateForImage(VkImage image,
+                                   VkImageTiling tiling,
+                                   const QVkMemoryRequest& request);
+
+    void free(QVkAllocation& allocation);
+
+    // make host writes visible to the device, no-op on coherent memory
+    void flush(const QVkAllocation& allocation,
+               VkDeviceSize offset = 0,
+               VkDeviceSize size = VK_WHOLE_SIZE);
+
+    QVkAllocatorStats stats();
+
+    // size of newly created blocks of memoryType
+    VkDeviceSize blockSize(uint32_t memoryType) const;
+
+private:
+    QVkAllocation allocateBest(const VkMemoryRequirements& requirements,
+                               const QVkMemoryRequest& request,
+                               QVkAllocation::Kind kind);
+    VkDeviceMemory allocateMemory(VkDeviceSize size, uint32_t memoryType, void** mapped);
+    void freeMemory(VkDeviceMemory memory, void* mapped, uint32_t memoryType, VkDeviceSize size);
+
+    QVkDevice& m_device;
+    VkPhysicalDeviceMemoryProperties m_memoryProperties;
+    VkDeviceSize m_nonCoherentAtomSize  {1};
+
+    QMutex m_lock;
+    QVector<QVkMemoryBlock*> m_blocks[VK_MAX_MEMORY_TYPES][2];
+    uint32_t m_dedicatedCount           {0};
+    VkDeviceSize m_dedicatedBytes       {0};
+    uint32_t m_allocationCount          {0};
+    VkDeviceSize m_usedBytes            {0};
+};
+
+/*
+ * One VkDeviceMemory split into power of two ranges by a buddy allocator.
+ * Order n ranges are minSize << n bytes large.
+ */
+class QVkMemoryBlock {
+public:
+    QVkMemoryBlock(VkDeviceMemory memory, void* mapped, VkDeviceSize size, VkDeviceSize minSize);
+
+    bool allocate(VkDeviceSize size, VkDeviceSize* offset, uint32_t* order);
+    void free(VkDeviceSize offset, uint32_t order);
+
+    bool isEmpty() const { return m_freeBytes == m_size; }
+    VkDeviceSize size() const { return m_size; }
+    VkDeviceSize freeBytes() const { return m_freeBytes; }
+    VkDeviceSize largestFreeRange() const;
+
+    VkDeviceMemory memory() const { return m_memory; }
+    void* mapped() const { return m_mapped; }
+
+private:
+    VkDeviceMemory m_memory;
+    void* m_mapped;
+    VkDeviceSize m_size;
+    VkDeviceSize m_minSize;
+    VkDeviceSize m_freeBytes;
+    // free range offsets per order
+    QVector<QSet<VkDeviceSize>> m_free;
+};
+
+#endif // QVKALLOCATOR_H
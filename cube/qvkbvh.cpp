@@ -0,0 +1,375 @@
+#include "qvkbvh.h"
+#include <algorithm>
+#include <cmath>
+#include <QVarLengthArray>
+
+// SAH bins per axis
+static const int BVH_BINS = 8;
+// cost of visiting a node relative to testing an object
+static const float BVH_TRAVERSAL_COST = 1.0f;
+
+void QVkAabb::grow(const QVector3D& point) {
+    for (int i = 0; i < 3; i++) {
+        min[i] = qMin(min[i], point[i]);
+        max[i] = qMax(max[i], point[i]);
+    }
+}
+
+void QVkAabb::grow(const QVkAabb& box) {
+    for (int i = 0; i < 3; i++) {
+        min[i] = qMin(min[i], box.min[i]);
+        max[i] = qMax(max[i], box.max[i]);
+    }
+}
+
+float QVkAabb::halfArea() const {
+    QVector3D e = max - min;
+    if (e.x() < 0.0f)
+        return 0.0f;
+    return e.x() * e.y() + e.y() * e.z() + e.z() * e.x();
+}
+
+// entry distance of ray into the box, FLT_MAX if it misses
+static float intersectBox(const float* min, const float* max, const QVector3D& origin,
+                       const QVector3D& inverseDirection) {
+    float enter = 0.0f;
+    float leave = FLT_MAX;
+    for (int i = 0; i < 3; i++) {
+        float t0 = (min[i] - origin[i]) * inverseDirection[i];
+        float t1 = (max[i] - origin[i]) * inverseDirection[i];
+        enter = qMax(enter, qMin(t0, t1));
+        leave = qMin(leave, qMax(t0, t1));
+    }
+    return enter <= leave ? enter : FLT_MAX;
+}
+
+float QVkAabb::intersect(const QVkRay& ray) const {
+    const float lo[3] = { min.x(), min.y(), min.z() };
+    const float hi[3] = { max.x(), max.y(), max.z() };
+    const QVector3D inverse(1.0f / ray.direction.x(), 1.0f / ray.direction.y(), 1.0f / ray.direction.z());
+    return intersectBox(lo, hi, ray.origin, inverse);
+}
+
+QVkRay QVkRay::fromWindow(const QMatrix4x4& viewProjection, const QPointF& pos, const QSize& size) {
+    // window y points down, clip space y up
+    float x = 2.0f * (float)pos.x() / qMax(1, size.width()) - 1.0f;
+    float y = 1.0f - 2.0f * (float)pos.y() / qMax(1, size.height());
+    QMatrix4x4 inverse = viewProjection.inverted();
+    QVector4D nearPoint = inverse * QVector4D(x, y, -1.0f, 1.0f);
+    QVector4D farPoint = inverse * QVector4D(x, y, 1.0f, 1.0f);
+
+    QVkRay ray;
+    ray.origin = nearPoint.toVector3D() / nearPoint.w();
+    ray.direction = (farPoint.toVector3D() / farPoint.w() - ray.origin).normalized();
+    return ray;
+}
+
+void QVkBvh::setBox(Node& node, const QVkAabb& box) {
+    for (int i = 0; i < 3; i++) {
+        node.min[i] = box.min[i];
+        node.max[i] = box.max[i];
+    }
+}
+
+QVkAabb QVkBvh::box(const Node& node) {
+    return QVkAabb(QVector3D(node.min[0], node.min[1], node.min[2]),
+                   QVector3D(node.max[0], node.max[1], node.max[2]));
+}
+
+void QVkBvh::build(const QVector<QVkAabb>& bounds) {
+    DEBUG_ENTRY;
+    const uint32_t n = bounds.size();
+    m_nodes.clear();
+    m_indices.resize(n);
+    m_boxes.resize(n);
+    if (n == 0)
+        return;
+
+    QVector<QVector3D> centers(n);
+    QVkAabb all;
+    for (uint32_t i = 0; i < n; i++) {
+        m_indices[i] = i;
+        centers[i] = bounds[i].center();
+        all.grow(bounds[i]);
+    }
+
+    // a binary tree with one object per leaf at most, so appending
+    // never reallocates
+    m_nodes.reserve(2 * n - 1);
+    Node root = {};
+    root.count = n;
+    setBox(root, all);
+    m_nodes.append(root);
+    subdivide(0, bounds, centers);
+
+    for (uint32_t i = 0; i < n; i++)
+        m_boxes[i] = bounds[m_indices[i]];
+}
+
+void QVkBvh::subdivide(uint32_t index, const QVector<QVkAabb>& bounds, const QVector<QVector3D>& centers) {
+    const Node node = m_nodes[index];
+    if (node.count <= 1)
+        return;
+
+    // the bins are spread over the centers, not the boxes
+    QVkAabb centerBounds;
+    for (uint32_t i = node.first; i < node.first + node.count; i++)
+        centerBounds.grow(centers[m_indices[i]]);
+
+    // splitting has to be cheaper than testing every object of a leaf
+    const float area = box(node).halfArea();
+    float bestCost = (node.count - BVH_TRAVERSAL_COST) * area;
+    int bestAxis = -1;
+    int bestBin = 0;
+    for (int axis = 0; axis < 3; axis++) {
+        const float lo = centerBounds.min[axis];
+        const float extent = centerBounds.max[axis] - lo;
+        if (extent <= 0.0f)
+            continue;
+        const float scale = BVH_BINS / extent;
+
+        QVkAabb binBoxes[BVH_BINS];
+        uint32_t binCounts[BVH_BINS] = {};
+        for (uint32_t i = node.first; i < node.first + node.count; i++) {
+            uint32_t object = m_indices[i];
+            int bin = qMin(BVH_BINS - 1, (int)((centers[object][axis] - lo) * scale));
+            binBoxes[bin].grow(bounds[object]);
+            binCounts[bin]++;
+        }
+
+        // sweep the split planes between the bins from both sides
+        float leftArea[BVH_BINS - 1], rightArea[BVH_BINS - 1];
+        uint32_t leftCount[BVH_BINS - 1], rightCount[BVH_BINS - 1];
+        QVkAabb left, right;
+        uint32_t leftSum = 0, rightSum = 0;
+        for (int i = 0; i < BVH_BINS - 1; i++) {
+            leftSum += binCounts[i];
+            leftCount[i] = leftSum;
+            left.grow(binBoxes[i]);
+            leftArea[i] = left.halfArea();
+            rightSum += binCounts[BVH_BINS - 1 - i];
+            rightCount[BVH_BINS - 2 - i] = rightSum;
+            right.grow(binBoxes[BVH_BINS - 1 - i]);
+            rightArea[BVH_BINS - 2 - i] = right.halfArea();
+        }
+        for (int i = 0; i < BVH_BINS - 1; i++) {
+            if (!leftCount[i] || !rightCount[i])
+                continue;
+            float cost = leftCount[i] * leftArea[i] + rightCount[i] * rightArea[i];
+            if (cost < bestCost) {
+                bestCost = cost;
+                bestAxis = axis;
+                bestBin = i;
+            }
+        }
+    }
+    if (bestAxis < 0)
+        return;
+
+    // objects in bins up to bestBin go left, binned exactly like above
+    const float lo = centerBounds.min[bestAxis];
+    const float scale = BVH_BINS / (centerBounds.max[bestAxis] - lo);
+    uint32_t* begin = m_indices.data() + node.first;
+    uint32_t* end = begin + node.count;
+    uint32_t* middle = std::partition(begin, end, [&](uint32_t object) {
+        return qMin(BVH_BINS - 1, (int)((centers[object][bestAxis] - lo) * scale)) <= bestBin;
+    });
+    const uint32_t leftObjects = middle - begin;
+    Q_ASSERT(leftObjects > 0 && leftObjects < node.count);
+
+    Node children[2] = {};
+    children[0].first = node.first;
+    children[0].count = leftObjects;
+    children[1].first = node.first + leftObjects;
+    children[1].count = node.count - leftObjects;
+    for (Node& child : children) {
+        QVkAabb childBox;
+        for (uint32_t i = child.first; i < child.first + child.count; i++)
+            childBox.grow(bounds[m_indices[i]]);
+        setBox(child, childBox);
+    }
+
+    const uint32_t first = m_nodes.size();
+    m_nodes.append(children[0]);
+    m_nodes.append(children[1]);
+    m_nodes[index].first = first;
+    m_nodes[index].count = 0;
+    subdivide(first, bounds, centers);
+    subdivide(first + 1, bounds, centers);
+}
+
+void QVkBvh::refit(const QVector<QVkAabb>& bounds) {
+    Q_ASSERT(bounds.size() == m_indices.size());
+    for (int i = 0; i < m_indices.size(); i++)
+        m_boxes[i] = bounds[m_indices[i]];
+
+    // children come after their parents
+    for (int i = m_nodes.size() - 1; i >= 0; i--) {
+        Node& node = m_nodes[i];
+        QVkAabb nodeBox;
+        if (node.isLeaf()) {
+            for (uint32_t j = node.first; j < node.first + node.count; j++)
+                nodeBox.grow(m_boxes[j]);
+        } else {
+            nodeBox = box(m_nodes[node.first]);
+            nodeBox.grow(box(m_nodes[node.first + 1]));
+        }
+        setBox(node, nodeBox);
+    }
+}
+
+void QVkBvh::appendSubtree(uint32_t index, QVector<uint32_t>* visible) const {
+    // the objects of a subtree are contiguous, from its leftmost to its
+    // rightmost leaf
+    uint32_t first = index;
+    while (!m_nodes[first].isLeaf())
+        first = m_nodes[first].first;
+    uint32_t last = index;
+    while (!m_nodes[last].isLeaf())
+        last = m_nodes[last].first + 1;
+    const uint32_t begin = m_nodes[first].first;
+    const uint32_t end = m_nodes[last].first + m_nodes[last].count;
+    for (uint32_t i = begin; i < end; i++)
+        visible->append(m_indices[i]);
+}
+
+// -1 if the box is behind plane, 1 if it is completely in front of it
+static int classify(const QVector4D& plane, const float* min, const float* max) {
+    float distance = plane.w();
+    float radius = 0.0f;
+    for (int i = 0; i < 3; i++) {
+        distance += plane[i] * (min[i] + max[i]) * 0.5f;
+        radius += std::fabs(plane[i]) * (max[i] - min[i]) * 0.5f;
+    }
+    if (distance + radius < 0.0f)
+        return -1;
+    return distance - radius >= 0.0f ? 1 : 0;
+}
+
+uint32_t QVkBvh::cullFrustum(const QVkFrustum& frustum, QVector<uint32_t>* visible) const {
+    visible->clear();
+    if (m_nodes.isEmpty())
+        return 0;
+
+    // planes the node may still cross, children skip the ones their
+    // parent is completely in front of
+    struct Entry {
+        uint32_t node;
+        uint32_t planes;
+    };
+    QVarLengthArray<Entry, 64> stack;
+    stack.append({0, 0x3f});
+    while (!stack.isEmpty()) {
+        Entry entry = stack.last();
+        stack.removeLast();
+        const Node& node = m_nodes[entry.node];
+
+        bool outside = false;
+        for (int p = 0; p < 6 && !outside; p++) {
+            if (!(entry.planes & (1u << p)))
+                continue;
+            int side = classify(frustum.planes[p], node.min, node.max);
+            outside = side < 0;
+            if (side > 0)
+                entry.planes &= ~(1u << p);
+        }
+        if (outside)
+            continue;
+        if (!entry.planes) {
+            appendSubtree(entry.node, visible);
+        } else if (!node.isLeaf()) {
+            stack.append({node.first, entry.planes});
+            stack.append({node.first + 1, entry.planes});
+        } else {
+            for (uint32_t i = node.first; i < node.first + node.count; i++) {
+                const QVkAabb& b = m_boxes[i];
+                const float min[3] = { b.min.x(), b.min.y(), b.min.z() };
+                const float max[3] = { b.max.x(), b.max.y(), b.max.z() };
+                bool inside = true;
+                for (int p = 0; p < 6 && inside; p++) {
+                    if (entry.planes & (1u << p))
+                        inside = classify(frustum.planes[p], min, max) >= 0;
+                }
+                if (inside)
+                    visible->append(m_indices[i]);
+            }
+        }
+    }
+    return visible->size();
+}
+
+int QVkBvh::raycast(const QVkRay& ray, float* t, const RayTest& test) const {
+    if (m_nodes.isEmpty())
+        return -1;
+    const QVector3D inverse(1.0f / ray.direction.x(), 1.0f / ray.direction.y(), 1.0f / ray.direction.z());
+
+    float closest = FLT_MAX;
+    int hit = -1;
+    struct Entry {
+        uint32_t node;
+        float t;
+    };
+    QVarLengthArray<Entry, 64> stack;
+    float rootT = intersectBox(m_nodes[0].min, m_nodes[0].max, ray.origin, inverse);
+    if (rootT != FLT_MAX)
+        stack.append({0, rootT});
+    while (!stack.isEmpty()) {
+        Entry entry = stack.last();
+        stack.removeLast();
+        // a closer hit was found since the node was pushed
+        if (entry.t >= closest)
+            continue;
+        const Node& node = m_nodes[entry.node];
+        if (node.isLeaf()) {
+            for (uint32_t i = node.first; i < node.first + node.count; i++) {
+                const QVkAabb& b = m_boxes[i];
+                const float min[3] = { b.min.x(), b.min.y(), b.min.z() };
+                const float max[3] = { b.max.x(), b.max.y(), b.max.z() };
+                float boxT = intersectBox(min, max, ray.origin, inverse);
+                if (boxT >= closest)
+                    continue;
+                float objectT = boxT;
+                if (test && !(test(m_indices[i], ray, &objectT) && objectT < closest))
+                    continue;
+                closest = objectT;
+                hit = m_indices[i];
+            }
+            continue;
+        }
+        // visit the nearer child first
+        const Node& left = m_nodes[node.first];
+        const Node& right = m_nodes[node.first + 1];
+        float leftT = intersectBox(left.min, left.max, ray.origin, inverse);
+        float rightT = intersectBox(right.min, right.max, ray.origin, inverse);
+        Entry nearer = {node.first, leftT};
+        Entry farther = {node.first + 1, rightT};
+        if (rightT < leftT)
+            qSwap(nearer, farther);
+        if (farther.t < closest)
+            stack.append(farther);
+        if (nearer.t < closest)
+            stack.append(nearer);
+    }
+    if (t && hit >= 0)
+        *t = closest;
+    return hit;
+}
+
+int QVkBvh::depth() const {
+    if (m_nodes.isEmpty())
+        return 0;
+    int deepest = 0;
+    QVarLengthArray<QPair<uint32_t, int>, 64> stack;
+    stack.append(qMakePair(0u, 1));
+    while (!stack.isEmpty()) {
+        QPair<uint32_t, int> entry = stack.last();
+        stack.removeLast();
+        deepest = qMax(deepest, entry.second);
+        const Node& node = m_nodes[entry.first];
+        if (!node.isLeaf()) {
+            stack.append(qMakePair(node.first, entry.second + 1));
+            stack.append(qMakePair(node.first + 1, entry.second + 1));
+        }
+    }
+    return deepest;
+}
@@ -0,0 +1,102 @@
+#ifndef QVKBVH_H
+#define QVKBVH_H
+
+#include <cfloat>
+#include <functional>
+#include <QMatrix4x4>
+#include <QPointF>
+#include <QSize>
+#include <QVector>
+#include <QVector3D>
+#include "qvkculling.h"
+
+struct QVkRay;
+
+// axis aligned bounding box, empty if min > max
+struct QVkAabb {
+    QVector3D min   {FLT_MAX, FLT_MAX, FLT_MAX};
+    QVector3D max   {-FLT_MAX, -FLT_MAX, -FLT_MAX};
+
+    QVkAabb() {}
+    QVkAabb(const QVector3D& lo, const QVector3D& hi) : min(lo), max(hi) {}
+
+    void grow(const QVector3D& point);
+    void grow(const QVkAabb& box);
+
+    QVector3D center() const { return (min + max) * 0.5f; }
+    // half the surface area, the SAH only compares them
+    float halfArea() const;
+
+    // distance along ray to where it enters the box, FLT_MAX if it misses
+    float intersect(const QVkRay& ray) const;
+};
+
+// origin + t * direction, t >= 0
+struct QVkRay {
+    QVector3D origin;
+    QVector3D direction;
+
+    // Ray through pos of a window of size, pos in window coordinates,
+    // viewProjection with OpenGL conventions like QVkFrustum::fromMatrix().
+    static QVkRay fromWindow(const QMatrix4x4& viewProjection, const QPointF& pos, const QSize& size);
+};
+
+/*
+ * Bounding volume hierarchy over the bounding boxes of scene objects.
+ *
+ * build() splits the objects with the surface area heuristic, evaluated
+ * on a few bins per axis. The nodes are stored depth first in one array
+ * of 32 byte nodes, the two children of a node next to each other, and the
+ * objects of every subtree are a contiguous range of objectIndices().
+ *
+ * refit() recomputes the boxes bottom up when objects move, without
+ * changing the tree. That is much faster than a new build, but the tree
+ * degrades when objects move far, build again then.
+ */
+class QVkBvh {
+public:
+    struct Node {
+        float min[3];
+        // first child for inner nodes, first object index for leaves
+        uint32_t first;
+        float max[3];
+        // objects in a leaf, 0 for inner nodes
+        uint32_t count;
+
+        bool isLeaf() const { return count != 0; }
+    };
+
+    // called for the objects whose box a ray hits, returns whether the
+    // object itself is hit and where
+    typedef std::function<bool(uint32_t object, const QVkRay& ray, float* t)> RayTest;
+
+    void build(const QVector<QVkAabb>& bounds);
+    // bounds has to hold the same objects build() was given
+    void refit(const QVector<QVkAabb>& bounds);
+
+    // Replaces visible with the objects whose box intersects the frustum.
+    // Subtrees completely inside are taken without testing their nodes.
+    uint32_t cullFrustum(const QVkFrustum& frustum, QVector<uint32_t>* visible) const;
+
+    // Closest object hit by ray, -1 if none. Without test, the boxes of
+    // the objects are what is hit.
+    int raycast(const QVkRay& ray, float* t = nullptr, const RayTest& test = RayTest()) const;
+
+    const QVector<Node>& nodes() const { return m_nodes; }
+    const QVector<uint32_t>& objectIndices() const { return m_indices; }
+    int depth() const;
+
+private:
+    void subdivide(uint32_t node, const QVector<QVkAabb>& bounds, const QVector<QVector3D>& centers);
+    static void setBox(Node& node, const QVkAabb& box);
+    static QVkAabb box(const Node& node);
+    void appendSubtree(uint32_t node, QVector<uint32_t>* visible) const;
+
+    QVector<Node> m_nodes;
+    // objects in the order of the leaves
+    QVector<uint32_t> m_indices;
+    // their boxes, in the same order
+    QVector<QVkAabb> m_boxes;
+};
+
+#endif // QVKBVH_H
@@ -71,6 +71,11 @@ QVkCommandBufferRecorder &QVkCommandBufferRecorder::draw(uint32_t vertices, uint
     return *this;
 }
 
+QVkCommandBufferRecorder &QVkCommandBufferRecorder::drawIndexed(uint32_t indices, uint32_t first_index, int32_t vertex_offset, uint32_t instances, uint32_t first_instance) {
+    vkCmdDrawIndexed(m_cb, indices, instances, first_index, vertex_offset, first_instance);
+    return *this;
+}
+
 QVkCommandBufferRecorder &QVkCommandBufferRecorder::beginRenderPass(VkRenderPass renderpass, VkFramebuffer framebuffer, QVkRect area, QColor clearColor) {
     DEBUG_ENTRY;
 
@@ -99,21 +104,95 @@ QVkCommandBufferRecorder &QVkCommandBufferRecorder::endRenderPass() {
     return *this;
 }
 
-QVkCommandBufferRecorder &QVkCommandBufferRecorder::bindPipeline(VkPipeline pipeline) {
+QVkCommandBufferRecorder &QVkCommandBufferRecorder::bindPipeline(VkPipeline pipeline, VkPipelineBindPoint bindPoint) {
     DEBUG_ENTRY;
-    vkCmdBindPipeline(m_cb, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+    vkCmdBindPipeline(m_cb, bindPoint, pipeline);
     return *this;
 }
 
-QVkCommandBufferRecorder &QVkCommandBufferRecorder::bindDescriptorSet(VkPipelineLayout layout, VkDescriptorSet *descSet, uint32_t dynamicOffsetCount, const uint32_t *pDynamicOffsets) {
+QVkCommandBufferRecorder &QVkCommandBufferRecorder::bindDescriptorSet(VkPipelineLayout layout, VkDescriptorSet *descSet, uint32_t dynamicOffsetCount, const uint32_t *pDynamicOffsets, VkPipelineBindPoint bindPoint) {
     DEBUG_ENTRY;
-    vkCmdBindDescriptorSets(m_cb, VK_PIPELINE_BIND_POINT_GRAPHICS,
+    vkCmdBindDescriptorSets(m_cb, bindPoint,
                             layout,
                             0, 1, descSet,
                             dynamicOffsetCount, pDynamicOffsets);
     return *this;
 }
 
+QVkCommandBufferRecorder &QVkCommandBufferRecorder::pushConstants(VkPipelineLayout layout, VkShaderStageFlags stages, uint32_t offset, uint32_t size, const void *data) {
+    DEBUG_ENTRY;
+    vkCmdPushConstants(m_cb, layout, stages, offset, size, data);
+    return *this;
+}
+
+QVkCommandBufferRecorder &QVkCommandBufferRecorder::dispatch(uint32_t groupsX, uint32_t groupsY, uint32_t groupsZ) {
+    DEBUG_ENTRY;
+    vkCmdDispatch(m_cb, groupsX, groupsY, groupsZ);
+    return *this;
+}
+
+QVkCommandBufferRecorder &QVkCommandBufferRecorder::drawIndirect(VkBuffer buffer, VkDeviceSize offset, uint32_t drawCount, uint32_t stride) {
+    vkCmdDrawIndirect(m_cb, buffer, offset, drawCount, stride);
+    return *this;
+}
+
+QVkCommandBufferRecorder &QVkCommandBufferRecorder::drawIndexedIndirect(VkBuffer buffer, VkDeviceSize offset, uint32_t drawCount, uint32_t stride) {
+    vkCmdDrawIndexedIndirect(m_cb, buffer, offset, drawCount, stride);
+    return *this;
+}
+
+QVkCommandBufferRecorder &QVkCommandBufferRecorder::drawIndirectCount(QVkDevice &dev, VkBuffer buffer, VkDeviceSize offset, VkBuffer countBuffer, VkDeviceSize countOffset, uint32_t maxDrawCount, uint32_t stride) {
+    Q_ASSERT(dev.hasDrawIndirectCount());
+#ifdef VK_KHR_draw_indirect_count
+    dev.fpCmdDrawIndirectCountKHR(m_cb, buffer, offset, countBuffer, countOffset, maxDrawCount, stride);
+#else
+    Q_UNUSED(dev); Q_UNUSED(buffer); Q_UNUSED(offset); Q_UNUSED(countBuffer);
+    Q_UNUSED(countOffset); Q_UNUSED(maxDrawCount); Q_UNUSED(stride);
+#endif
+    return *this;
+}
+
+QVkCommandBufferRecorder &QVkCommandBufferRecorder::drawIndexedIndirectCount(QVkDevice &dev, VkBuffer buffer, VkDeviceSize offset, VkBuffer countBuffer, VkDeviceSize countOffset, uint32_t maxDrawCount, uint32_t stride) {
+    Q_ASSERT(dev.hasDrawIndirectCount());
+#ifdef VK_KHR_draw_indirect_count
+    dev.fpCmdDrawIndexedIndirectCountKHR(m_cb, buffer, offset, countBuffer, countOffset, maxDrawCount, stride);
+#else
+    Q_UNUSED(dev); Q_UNUSED(buffer); Q_UNUSED(offset); Q_UNUSED(countBuffer);
+    Q_UNUSED(countOffset); Q_UNUSED(maxDrawCount); Q_UNUSED(stride);
+#endif
+    return *this;
+}
+
+QVkCommandBufferRecorder &QVkCommandBufferRecorder::fillBuffer(VkBuffer buffer, VkDeviceSize offset, VkDeviceSize size, uint32_t data) {
+    DEBUG_ENTRY;
+    vkCmdFillBuffer(m_cb, buffer, offset, size, data);
+    return *this;
+}
+
+QVkCommandBufferRecorder &QVkCommandBufferRecorder::updateBuffer(VkBuffer buffer, VkDeviceSize offset, VkDeviceSize size, const void *data) {
+    DEBUG_ENTRY;
+    Q_ASSERT(size <= 65536 && size % 4 == 0);
+    vkCmdUpdateBuffer(m_cb, buffer, offset, size, data);
+    return *this;
+}
+
+QVkCommandBufferRecorder &QVkCommandBufferRecorder::bufferBarrier(VkBuffer buffer, VkPipelineStageFlags srcStageMask, VkAccessFlags srcAccess, VkPipelineStageFlags dstStageMask, VkAccessFlags dstAccess, VkDeviceSize offset, VkDeviceSize size) {
+    DEBUG_ENTRY;
+    VkBufferMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    barrier.srcAccessMask = srcAccess;
+    barrier.dstAccessMask = dstAccess;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.buffer = buffer;
+    barrier.offset = offset;
+    barrier.size = size;
+    return pipelineBarrier(srcStageMask, dstStageMask, 0,
+                           0, nullptr,
+                           1, &barrier,
+                           0, nullptr);
+}
+
 QVkCommandBufferRecorder &QVkCommandBufferRecorder::bindDescriptorSets(VkPipelineLayout layout, uint32_t firstSet, QVector<VkDescriptorSet> sets, QVector<uint32_t> dynamicOffsets) {
     DEBUG_ENTRY;
     vkCmdBindDescriptorSets(m_cb, VK_PIPELINE_BIND_POINT_GRAPHICS,
@@ -124,6 +203,26 @@ QVkCommandBufferRecorder &QVkCommandBufferRecorder::bindDescriptorSets(VkPipelin
     return *this;
 }
 
+QVkCommandBufferRecorder &QVkCommandBufferRecorder::bindVertexBuffers(uint32_t firstBinding, QVector<VkBuffer> buffers, QVector<VkDeviceSize> offsets) {
+    DEBUG_ENTRY;
+    Q_ASSERT(buffers.size() == offsets.size());
+    vkCmdBindVertexBuffers(m_cb, firstBinding,
+                           buffers.size(), buffers.data(), offsets.data());
+    return *this;
+}
+
+QVkCommandBufferRecorder &QVkCommandBufferRecorder::bindVertexBuffer(VkBuffer buffer, VkDeviceSize offset, uint32_t binding) {
+    DEBUG_ENTRY;
+    vkCmdBindVertexBuffers(m_cb, binding, 1, &buffer, &offset);
+    return *this;
+}
+
+QVkCommandBufferRecorder &QVkCommandBufferRecorder::bindIndexBuffer(VkBuffer buffer, VkIndexType indexType, VkDeviceSize offset) {
+    DEBUG_ENTRY;
+    vkCmdBindIndexBuffer(m_cb, buffer, offset, indexType);
+    return *this;
+}
+
 QVkCommandBufferRecorder &QVkCommandBufferRecorder::pipelineBarrier(VkPipelineStageFlags srcStageMask, VkPipelineStageFlags dstStageMask, VkDependencyFlags dependencyFlags, uint32_t memoryBarrierCount, const VkMemoryBarrier *pMemoryBarriers, uint32_t bufferMemoryBarrierCount, const VkBufferMemoryBarrier *pBufferMemoryBarriers, uint32_t imageMemoryBarrierCount, const VkImageMemoryBarrier *pImageMemoryBarriers) {
     DEBUG_ENTRY;
     vkCmdPipelineBarrier(m_cb,
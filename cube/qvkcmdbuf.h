@@ -29,6 +29,13 @@ public:
             uint32_t instances = 1,
             uint32_t first_instance = 0);
 
+    QVkCommandBufferRecorder& drawIndexed(
+            uint32_t indices,
+            uint32_t first_index = 0,
+            int32_t vertex_offset = 0,
+            uint32_t instances = 1,
+            uint32_t first_instance = 0);
+
     QVkCommandBufferRecorder& beginRenderPass(
             VkRenderPass renderpass,
             VkFramebuffer framebuffer,
@@ -37,15 +44,88 @@ public:
 
     QVkCommandBufferRecorder& endRenderPass();
 
-    QVkCommandBufferRecorder& bindPipeline(VkPipeline pipeline);
+    QVkCommandBufferRecorder& bindPipeline(
+            VkPipeline pipeline,
+            VkPipelineBindPoint bindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS);
 
     QVkCommandBufferRecorder& bindDescriptorSet(
                VkPipelineLayout layout,
                VkDescriptorSet*  descSet,
                uint32_t         dynamicOffsetCount = 0,
-               const uint32_t*  pDynamicOffsets = nullptr
+               const uint32_t*  pDynamicOffsets = nullptr,
+               VkPipelineBindPoint bindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS
+            );
+
+    QVkCommandBufferRecorder& pushConstants(
+            VkPipelineLayout    layout,
+            VkShaderStageFlags  stages,
+            uint32_t            offset,
+            uint32_t            size,
+            const void*         data
             );
 
+    QVkCommandBufferRecorder& dispatch(
+            uint32_t groupsX,
+            uint32_t groupsY = 1,
+            uint32_t groupsZ = 1);
+
+    // buffer holds drawCount VkDrawIndirectCommands
+    QVkCommandBufferRecorder& drawIndirect(
+            VkBuffer        buffer,
+            VkDeviceSize    offset = 0,
+            uint32_t        drawCount = 1,
+            uint32_t        stride = sizeof(VkDrawIndirectCommand));
+
+    // buffer holds drawCount VkDrawIndexedIndirectCommands
+    QVkCommandBufferRecorder& drawIndexedIndirect(
+            VkBuffer        buffer,
+            VkDeviceSize    offset = 0,
+            uint32_t        drawCount = 1,
+            uint32_t        stride = sizeof(VkDrawIndexedIndirectCommand));
+
+    // The number of draws is read from countBuffer at countOffset, up to
+    // maxDrawCount. Needs dev.hasDrawIndirectCount().
+    QVkCommandBufferRecorder& drawIndirectCount(
+            QVkDevice&      dev,
+            VkBuffer        buffer,
+            VkDeviceSize    offset,
+            VkBuffer        countBuffer,
+            VkDeviceSize    countOffset,
+            uint32_t        maxDrawCount,
+            uint32_t        stride = sizeof(VkDrawIndirectCommand));
+
+    QVkCommandBufferRecorder& drawIndexedIndirectCount(
+            QVkDevice&      dev,
+            VkBuffer        buffer,
+            VkDeviceSize    offset,
+            VkBuffer        countBuffer,
+            VkDeviceSize    countOffset,
+            uint32_t        maxDrawCount,
+            uint32_t        stride = sizeof(VkDrawIndexedIndirectCommand));
+
+    // outside of render passes only
+    QVkCommandBufferRecorder& fillBuffer(
+            VkBuffer        buffer,
+            VkDeviceSize    offset,
+            VkDeviceSize    size,
+            uint32_t        data);
+
+    // outside of render passes only, size <= 65536
+    QVkCommandBufferRecorder& updateBuffer(
+            VkBuffer        buffer,
+            VkDeviceSize    offset,
+            VkDeviceSize    size,
+            const void*     data);
+
+    QVkCommandBufferRecorder& bufferBarrier(
+            VkBuffer                buffer,
+            VkPipelineStageFlags    srcStageMask,
+            VkAccessFlags           srcAccess,
+            VkPipelineStageFlags    dstStageMask,
+            VkAccessFlags           dstAccess,
+            VkDeviceSize            offset = 0,
+            VkDeviceSize            size = VK_WHOLE_SIZE);
+
     QVkCommandBufferRecorder& bindDescriptorSets(
                VkPipelineLayout layout,
                uint32_t         firstSet,
@@ -53,6 +133,24 @@ public:
                 QVector<uint32_t> dynamicOffsets
             );
 
+    QVkCommandBufferRecorder& bindVertexBuffers(
+            uint32_t                firstBinding,
+            QVector<VkBuffer>       buffers,
+            QVector<VkDeviceSize>   offsets
+            );
+
+    QVkCommandBufferRecorder& bindVertexBuffer(
+            VkBuffer        buffer,
+            VkDeviceSize    offset = 0,
+            uint32_t        binding = 0
+            );
+
+    QVkCommandBufferRecorder& bindIndexBuffer(
+            VkBuffer        buffer,
+            VkIndexType     indexType,
+            VkDeviceSize    offset = 0
+            );
+
     QVkCommandBufferRecorder& pipelineBarrier(
             VkPipelineStageFlags                        srcStageMask,
             VkPipelineStageFlags                        dstStageMask,
@@ -121,10 +219,60 @@ public:
 
     QVkCommandBufferRecorder& copyBuffer(QVkStagingBuffer& src, QVkDeviceBuffer& dst) {
     DEBUG_ENTRY;
+        Q_ASSERT(src.size() <= dst.size());
+        return copyBuffer(src.buffer(), dst.buffer(), src.size());
+    }
+
+    QVkCommandBufferRecorder& copyBuffer(VkBuffer src, VkBuffer dst, VkDeviceSize size,
+                                         VkDeviceSize srcOffset = 0, VkDeviceSize dstOffset = 0) {
         VkBufferCopy copyRegion = {};
-        Q_ASSERT(src.size() == dst.size());
-        copyRegion.size = src.size();
-        vkCmdCopyBuffer(m_cb, src.buffer(), dst.buffer(), 1, &copyRegion);
+        copyRegion.srcOffset = srcOffset;
+        copyRegion.dstOffset = dstOffset;
+        copyRegion.size = size;
+        vkCmdCopyBuffer(m_cb, src, dst, 1, &copyRegion);
+        return *this;
+    }
+
+    QVkCommandBufferRecorder& copyBuffer(VkBuffer src, VkBuffer dst, const QVector<VkBufferCopy>& regions) {
+        vkCmdCopyBuffer(m_cb, src, dst, regions.count(), regions.constData());
+        return *this;
+    }
+
+    // dst has to be in VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL
+    QVkCommandBufferRecorder& copyBufferToImage(VkBuffer src, VkImage dst,
+                                                const QVector<VkBufferImageCopy>& regions) {
+        vkCmdCopyBufferToImage(m_cb, src, dst, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                               regions.count(), regions.constData());
+        return *this;
+    }
+
+    // src has to be in VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, dst in
+    // VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL
+    QVkCommandBufferRecorder& blitImage(VkImage src, VkImage dst, const VkImageBlit& region,
+                                        VkFilter filter = VK_FILTER_LINEAR) {
+        vkCmdBlitImage(m_cb, src, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                       dst, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region, filter);
+        return *this;
+    }
+
+    // src has to be in VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, dst in
+    // VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL; unlike a blit, block
+    // compressed images can be copied
+    QVkCommandBufferRecorder& copyImage(VkImage src, VkImage dst, const QVector<VkImageCopy>& regions) {
+        vkCmdCopyImage(m_cb, src, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                       dst, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, regions.count(), regions.constData());
+        return *this;
+    }
+
+    // image has to be in VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL
+    QVkCommandBufferRecorder& clearColorImage(VkImage image, const QColor& color,
+                                              const VkImageSubresourceRange& range) {
+        VkClearColorValue value = {};
+        value.float32[0] = (float)color.redF();
+        value.float32[1] = (float)color.greenF();
+        value.float32[2] = (float)color.blueF();
+        value.float32[3] = (float)color.alphaF();
+        vkCmdClearColorImage(m_cb, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, &value, 1, &range);
         return *this;
     }
 
@@ -0,0 +1,409 @@
+#include "qvkculling.h"
+#include <cmath>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64)
+#define QVK_CULLING_SSE
+#include <immintrin.h>
+// the AVX kernel is compiled for AVX alone and picked at runtime
+#if defined(__GNUC__)
+#define QVK_CULLING_AVX
+#endif
+#endif
+
+// local_size_x of cull.comp
+static const uint32_t CULL_GROUP_SIZE = 64;
+
+QVkFrustum QVkFrustum::fromMatrix(const QMatrix4x4& viewProjection) {
+    // Gribb/Hartmann: -w <= x, y, z <= w in clip space
+    const QVector4D x = viewProjection.row(0);
+    const QVector4D y = viewProjection.row(1);
+    const QVector4D z = viewProjection.row(2);
+    const QVector4D w = viewProjection.row(3);
+
+    QVkFrustum f;
+    f.planes[0] = w + x;
+    f.planes[1] = w - x;
+    f.planes[2] = w + y;
+    f.planes[3] = w - y;
+    f.planes[4] = w + z;
+    f.planes[5] = w - z;
+    // unit normals, so the distances compare with radii
+    for (int i = 0; i < 6; i++)
+        f.planes[i] /= f.planes[i].toVector3D().length();
+    return f;
+}
+
+bool QVkFrustum::intersectsSphere(const QVector4D& sphere) const {
+    const QVector4D center(sphere.toVector3D(), 1.0f);
+    for (int i = 0; i < 6; i++) {
+        if (QVector4D::dotProduct(planes[i], center) < -sphere.w())
+            return false;
+    }
+    return true;
+}
+
+QVkCpuCuller::Kernel QVkCpuCuller::bestKernel() {
+#ifdef QVK_CULLING_AVX
+    if (__builtin_cpu_supports("avx"))
+        return Avx;
+#endif
+#ifdef QVK_CULLING_SSE
+    return Sse;
+#else
+    return Scalar;
+#endif
+}
+
+void QVkCpuCuller::reserve(uint32_t objects) {
+    m_x.reserve(objects);
+    m_y.reserve(objects);
+    m_z.reserve(objects);
+    m_radius.reserve(objects);
+    m_extentX.reserve(objects);
+    m_extentY.reserve(objects);
+    m_extentZ.reserve(objects);
+}
+
+void QVkCpuCuller::clear() {
+    m_x.clear();
+    m_y.clear();
+    m_z.clear();
+    m_radius.clear();
+    m_extentX.clear();
+    m_extentY.clear();
+    m_extentZ.clear();
+}
+
+uint32_t QVkCpuCuller::addSphere(const QVector4D& sphere) {
+    m_x.append(sphere.x());
+    m_y.append(sphere.y());
+    m_z.append(sphere.z());
+    m_radius.append(sphere.w());
+    m_extentX.append(0.0f);
+    m_extentY.append(0.0f);
+    m_extentZ.append(0.0f);
+    return size() - 1;
+}
+
+uint32_t QVkCpuCuller::addBox(const QVector3D& min, const QVector3D& max) {
+    const QVector3D center = (min + max) * 0.5f;
+    const QVector3D extent = (max - min) * 0.5f;
+    m_x.append(center.x());
+    m_y.append(center.y());
+    m_z.append(center.z());
+    m_radius.append(0.0f);
+    m_extentX.append(extent.x());
+    m_extentY.append(extent.y());
+    m_extentZ.append(extent.z());
+    return size() - 1;
+}
+
+uint32_t QVkCpuCuller::cull(const QVkFrustum& frustum, QVector<uint32_t>* visible, Kernel kernel) const {
+    // the kernels write the index of every object tested and advance past
+    // the visible ones only, so they need room for a whole batch more
+    visible->resize(size() + 8);
+    uint32_t* out = visible->data();
+    uint32_t count;
+    switch (kernel) {
+    case Avx:
+        count = cullAvx(frustum, out);
+        break;
+    case Sse:
+        count = cullSse(frustum, out);
+        break;
+    default:
+        count = cullScalar(frustum, 0, out);
+        break;
+    }
+    visible->resize(count);
+    return count;
+}
+
+uint32_t QVkCpuCuller::cullScalar(const QVkFrustum& frustum, uint32_t first, uint32_t* out) const {
+    const float* x = m_x.constData();
+    const float* y = m_y.constData();
+    const float* z = m_z.constData();
+    const float* r = m_radius.constData();
+    const float* ex = m_extentX.constData();
+    const float* ey = m_extentY.constData();
+    const float* ez = m_extentZ.constData();
+    uint32_t count = 0;
+    for (uint32_t i = first; i < size(); i++) {
+        bool inside = true;
+        for (int p = 0; p < 6 && inside; p++) {
+            const QVector4D& plane = frustum.planes[p];
+            // grouped like the SIMD kernels, so they agree on the borders
+            float distance = (plane.x() * x[i] + plane.y() * y[i]) + (plane.z() * z[i] + plane.w());
+            float radius = (r[i] + std::fabs(plane.x()) * ex[i])
+                         + (std::fabs(plane.y()) * ey[i] + std::fabs(plane.z()) * ez[i]);
+            inside = distance + radius >= 0.0f;
+        }
+        out[count] = i;
+        count += inside;
+    }
+    return count;
+}
+
+uint32_t QVkCpuCuller::cullSse(const QVkFrustum& frustum, uint32_t* out) const {
+#ifdef QVK_CULLING_SSE
+    __m128 nx[6], ny[6], nz[6], nw[6], ax[6], ay[6], az[6];
+    for (int p = 0; p < 6; p++) {
+        const QVector4D& plane = frustum.planes[p];
+        nx[p] = _mm_set1_ps(plane.x());
+        ny[p] = _mm_set1_ps(plane.y());
+        nz[p] = _mm_set1_ps(plane.z());
+        nw[p] = _mm_set1_ps(plane.w());
+        ax[p] = _mm_set1_ps(std::fabs(plane.x()));
+        ay[p] = _mm_set1_ps(std::fabs(plane.y()));
+        az[p] = _mm_set1_ps(std::fabs(plane.z()));
+    }
+    const __m128 zero = _mm_setzero_ps();
+
+    const uint32_t n = size();
+    uint32_t count = 0;
+    uint32_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        const __m128 x = _mm_loadu_ps(m_x.constData() + i);
+        const __m128 y = _mm_loadu_ps(m_y.constData() + i);
+        const __m128 z = _mm_loadu_ps(m_z.constData() + i);
+        const __m128 r = _mm_loadu_ps(m_radius.constData() + i);
+        const __m128 ex = _mm_loadu_ps(m_extentX.constData() + i);
+        const __m128 ey = _mm_loadu_ps(m_extentY.constData() + i);
+        const __m128 ez = _mm_loadu_ps(m_extentZ.constData() + i);
+        __m128 inside = _mm_cmpeq_ps(zero, zero);
+        for (int p = 0; p < 6; p++) {
+            __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx[p], x), _mm_mul_ps(ny[p], y)),
+                                         _mm_add_ps(_mm_mul_ps(nz[p], z), nw[p]));
+            __m128 radius = _mm_add_ps(_mm_add_ps(r, _mm_mul_ps(ax[p], ex)),
+                                       _mm_add_ps(_mm_mul_ps(ay[p], ey), _mm_mul_ps(az[p], ez)));
+            inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(distance, radius), zero));
+        }
+        // compact without branching on the mask
+        const int mask = _mm_movemask_ps(inside);
+        for (uint32_t k = 0; k < 4; k++) {
+            out[count] = i + k;
+            count += (mask >> k) & 1;
+        }
+    }
+    return count + cullScalar(frustum, i, out + count);
+#else
+    return cullScalar(frustum, 0, out);
+#endif
+}
+
+#ifdef QVK_CULLING_AVX
+__attribute__((target("avx")))
+#endif
+uint32_t QVkCpuCuller::cullAvx(const QVkFrustum& frustum, uint32_t* out) const {
+#ifdef QVK_CULLING_AVX
+    __m256 nx[6], ny[6], nz[6], nw[6], ax[6], ay[6], az[6];
+    for (int p = 0; p < 6; p++) {
+        const QVector4D& plane = frustum.planes[p];
+        nx[p] = _mm256_set1_ps(plane.x());
+        ny[p] = _mm256_set1_ps(plane.y());
+        nz[p] = _mm256_set1_ps(plane.z());
+        nw[p] = _mm256_set1_ps(plane.w());
+        ax[p] = _mm256_set1_ps(std::fabs(plane.x()));
+        ay[p] = _mm256_set1_ps(std::fabs(plane.y()));
+        az[p] = _mm256_set1_ps(std::fabs(plane.z()));
+    }
+    const __m256 zero = _mm256_setzero_ps();
+
+    const uint32_t n = size();
+    uint32_t count = 0;
+    uint32_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        const __m256 x = _mm256_loadu_ps(m_x.constData() + i);
+        const __m256 y = _mm256_loadu_ps(m_y.constData() + i);
+        const __m256 z = _mm256_loadu_ps(m_z.constData() + i);
+        const __m256 r = _mm256_loadu_ps(m_radius.constData() + i);
+        const __m256 ex = _mm256_loadu_ps(m_extentX.constData() + i);
+        const __m256 ey = _mm256_loadu_ps(m_extentY.constData() + i);
+        const __m256 ez = _mm256_loadu_ps(m_extentZ.constData() + i);
+        __m256 inside = _mm256_cmp_ps(zero, zero, _CMP_EQ_OQ);
+        for (int p = 0; p < 6; p++) {
+            __m256 distance = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(nx[p], x), _mm256_mul_ps(ny[p], y)),
+                                            _mm256_add_ps(_mm256_mul_ps(nz[p], z), nw[p]));
+            __m256 radius = _mm256_add_ps(_mm256_add_ps(r, _mm256_mul_ps(ax[p], ex)),
+                                          _mm256_add_ps(_mm256_mul_ps(ay[p], ey), _mm256_mul_ps(az[p], ez)));
+            inside = _mm256_and_ps(inside, _mm256_cmp_ps(_mm256_add_ps(distance, radius), zero, _CMP_GE_OQ));
+        }
+        const int mask = _mm256_movemask_ps(inside);
+        for (uint32_t k = 0; k < 8; k++) {
+            out[count] = i + k;
+            count += (mask >> k) & 1;
+        }
+    }
+    return count + cullScalar(frustum, i, out + count);
+#else
+    return cullSse(frustum, out);
+#endif
+}
+
+QVkGpuCuller::QVkGpuCuller(QSharedPointer<QVkDevice> dev, VkShaderModule shader, uint32_t objects,
+                           uint32_t instanceSize)
+    : QVkDeviceResource(dev)
+    , m_objects(objects)
+    , m_instanceSize(instanceSize)
+    , m_bounds(dev, sizeof(QVector4D) * objects, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT)
+    , m_instances(dev, (VkDeviceSize)instanceSize * objects, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT)
+    , m_visible(dev, (VkDeviceSize)instanceSize * objects,
+                VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT)
+    , m_indirect(dev, sizeof(VkDrawIndexedIndirectCommand),
+                 VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT)
+{
+    DEBUG_ENTRY;
+    VkResult U_ASSERT_ONLY err;
+    // cull.comp copies uvec4s
+    Q_ASSERT(instanceSize > 0 && instanceSize % 16 == 0);
+
+    // frustum, bounds, instances, visible instances, draw
+    VkDescriptorSetLayoutBinding bindings[5] = {};
+    for (uint32_t i = 0; i < 5; i++) {
+        bindings[i].binding = i;
+        bindings[i].descriptorType = i == 0 ? VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC
+                                            : VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        bindings[i].descriptorCount = 1;
+        bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    }
+    VkDescriptorSetLayoutCreateInfo layout_ci = {};
+    layout_ci.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layout_ci.bindingCount = 5;
+    layout_ci.pBindings = bindings;
+    err = vkCreateDescriptorSetLayout(device(), &layout_ci, nullptr, &m_setLayout);
+    Q_ASSERT(!err);
+
+    // number of objects, uvec4s per instance
+    VkPushConstantRange pushConstants = {};
+    pushConstants.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    pushConstants.size = 2 * sizeof(uint32_t);
+
+    VkPipelineLayoutCreateInfo pipelineLayout_ci = {};
+    pipelineLayout_ci.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayout_ci.setLayoutCount = 1;
+    pipelineLayout_ci.pSetLayouts = &m_setLayout;
+    pipelineLayout_ci.pushConstantRangeCount = 1;
+    pipelineLayout_ci.pPushConstantRanges = &pushConstants;
+    err = vkCreatePipelineLayout(device(), &pipelineLayout_ci, nullptr, &m_pipelineLayout);
+    Q_ASSERT(!err);
+
+    VkComputePipelineCreateInfo pipeline_ci = {};
+    pipeline_ci.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    pipeline_ci.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    pipeline_ci.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    pipeline_ci.stage.module = shader;
+    pipeline_ci.stage.pName = "main";
+    pipeline_ci.layout = m_pipelineLayout;
+    err = vkCreateComputePipelines(device(), nullptr, 1, &pipeline_ci, nullptr, &m_pipeline);
+    Q_ASSERT(!err);
+    vkDestroyShaderModule(device(), shader, nullptr);
+}
+
+QVkGpuCuller::~QVkGpuCuller() {
+    DEBUG_ENTRY;
+    vkDestroyDescriptorPool(device(), m_pool, nullptr);
+    vkDestroyPipeline(device(), m_pipeline, nullptr);
+    vkDestroyPipelineLayout(device(), m_pipelineLayout, nullptr);
+    vkDestroyDescriptorSetLayout(device(), m_setLayout, nullptr);
+}
+
+void QVkGpuCuller::upload(QVkUploadManager& uploads,
+                          const QVector<QVector4D>& spheres,
+                          const void* instances) {
+    DEBUG_ENTRY;
+    Q_ASSERT((uint32_t)spheres.size() == m_objects);
+    uploads.uploadBuffer(m_bounds.buffer(), 0, spheres.constData(), sizeof(QVector4D) * m_objects);
+    uploads.uploadBuffer(m_instances.buffer(), 0, instances, (VkDeviceSize)m_instanceSize * m_objects);
+}
+
+void QVkGpuCuller::setFrustumBuffer(const VkDescriptorBufferInfo& frustum) {
+    DEBUG_ENTRY;
+    VkResult U_ASSERT_ONLY err;
+
+    // the old set may still be in use by frames in flight
+    if (m_pool)
+        dev()->deletionQueue().retire(m_pool, vkDestroyDescriptorPool);
+
+    VkDescriptorPoolSize sizes[2] = {};
+    sizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+    sizes[0].descriptorCount = 1;
+    sizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    sizes[1].descriptorCount = 4;
+    VkDescriptorPoolCreateInfo pool_ci = {};
+    pool_ci.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    pool_ci.maxSets = 1;
+    pool_ci.poolSizeCount = 2;
+    pool_ci.pPoolSizes = sizes;
+    err = vkCreateDescriptorPool(device(), &pool_ci, nullptr, &m_pool);
+    Q_ASSERT(!err);
+
+    VkDescriptorSetAllocateInfo alloc_info = {};
+    alloc_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    alloc_info.descriptorPool = m_pool;
+    alloc_info.descriptorSetCount = 1;
+    alloc_info.pSetLayouts = &m_setLayout;
+    err = vkAllocateDescriptorSets(device(), &alloc_info, &m_set);
+    Q_ASSERT(!err);
+
+    VkDescriptorBufferInfo infos[5] = {};
+    infos[0] = frustum;
+    VkBuffer buffers[4] = { m_bounds.buffer(), m_instances.buffer(),
+                            m_visible.buffer(), m_indirect.buffer() };
+    for (int i = 0; i < 4; i++) {
+        infos[i + 1].buffer = buffers[i];
+        infos[i + 1].range = VK_WHOLE_SIZE;
+    }
+
+    VkWriteDescriptorSet writes[5] = {};
+    for (uint32_t i = 0; i < 5; i++) {
+        writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        writes[i].dstSet = m_set;
+        writes[i].dstBinding = i;
+        writes[i].descriptorCount = 1;
+        writes[i].descriptorType = i == 0 ? VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC
+                                          : VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        writes[i].pBufferInfo = &infos[i];
+    }
+    vkUpdateDescriptorSets(device(), 5, writes, 0, nullptr);
+}
+
+void QVkGpuCuller::setDraw(uint32_t indexCount, uint32_t firstIndex, int32_t vertexOffset) {
+    m_draw.indexCount = indexCount;
+    m_draw.firstIndex = firstIndex;
+    m_draw.vertexOffset = vertexOffset;
+}
+
+void QVkGpuCuller::record(QVkCommandBufferRecorder& recorder, uint32_t frustumOffset) {
+    DEBUG_ENTRY;
+    Q_ASSERT(m_set);
+    // the shader counts the instances from 0
+    VkDrawIndexedIndirectCommand draw = m_draw;
+    draw.instanceCount = 0;
+    draw.firstInstance = 0;
+    // Params of cull.comp
+    const uint32_t params[2] = { m_objects, m_instanceSize / 16 };
+
+    // The draw of the previous frame may still read the results, the
+    // barriers order this frame's writes after it.
+    recorder.bufferBarrier(m_indirect.buffer(),
+                           VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, VK_ACCESS_INDIRECT_COMMAND_READ_BIT,
+                           VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT)
+        .updateBuffer(m_indirect.buffer(), 0, sizeof(draw), &draw)
+        .bufferBarrier(m_indirect.buffer(),
+                       VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+                       VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                       VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT)
+        .bufferBarrier(m_visible.buffer(),
+                       VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT,
+                       VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT)
+        .bindPipeline(m_pipeline, VK_PIPELINE_BIND_POINT_COMPUTE)
+        .bindDescriptorSet(m_pipelineLayout, &m_set, 1, &frustumOffset, VK_PIPELINE_BIND_POINT_COMPUTE)
+        .pushConstants(m_pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(params), params)
+        .dispatch((m_objects + CULL_GROUP_SIZE - 1) / CULL_GROUP_SIZE)
+        .bufferBarrier(m_indirect.buffer(),
+                       VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+                       VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, VK_ACCESS_INDIRECT_COMMAND_READ_BIT)
+        .bufferBarrier(m_visible.buffer(),
+                       VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+                       VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT);
+}
@@ -0,0 +1,151 @@
+#ifndef QVKCULLING_H
+#define QVKCULLING_H
+
+#include <vulkan/vulkan.h>
+#include <QMatrix4x4>
+#include <QVector>
+#include <QVector4D>
+#include "qvkdevice.h"
+#include "qvulkanbuffer.h"
+#include "qvkvertexbuffer.h"
+#include "qvkupload.h"
+#include "qvkcmdbuf.h"
+
+/*
+ * The six planes of a view frustum, laid out like the Frustum block of
+ * cull.comp. Normals point inwards, a point p is inside a plane if
+ * dot(plane, vec4(p, 1)) >= 0.
+ */
+struct QVkFrustum {
+    // left, right, bottom, top, near, far
+    QVector4D planes[6];
+
+    // planes of the clip volume of viewProjection, OpenGL conventions
+    static QVkFrustum fromMatrix(const QMatrix4x4& viewProjection);
+
+    // sphere: xyz center, w radius
+    bool intersectsSphere(const QVector4D& sphere) const;
+};
+
+/*
+ * Frustum culling on the CPU. The bounds are kept as structure of arrays,
+ * so the kernels test 4 (SSE) or 8 (AVX) objects per plane at once.
+ *
+ * Spheres and boxes share one test: an object is outside of a plane if
+ * its center is further behind it than its effective radius, the sphere
+ * radius plus the box extents projected on the plane normal.
+ */
+class QVkCpuCuller {
+public:
+    enum Kernel {
+        Scalar,
+        Sse,
+        // only on x86 CPUs supporting it
+        Avx
+    };
+
+    // the fastest kernel the CPU runs
+    static Kernel bestKernel();
+
+    void reserve(uint32_t objects);
+    void clear();
+
+    // return the index of the object in the visible lists
+    uint32_t addSphere(const QVector4D& sphere);
+    uint32_t addBox(const QVector3D& min, const QVector3D& max);
+
+    uint32_t size() const {
+        return m_x.size();
+    }
+
+    // Replaces visible with the indices of the objects in the frustum, in
+    // increasing order, and returns their number.
+    uint32_t cull(const QVkFrustum& frustum, QVector<uint32_t>* visible,
+                  Kernel kernel = bestKernel()) const;
+
+private:
+    uint32_t cullScalar(const QVkFrustum& frustum, uint32_t first, uint32_t* out) const;
+    uint32_t cullSse(const QVkFrustum& frustum, uint32_t* out) const;
+    uint32_t cullAvx(const QVkFrustum& frustum, uint32_t* out) const;
+
+    // centers
+    QVector<float> m_x, m_y, m_z;
+    // sphere radii, 0 for boxes
+    QVector<float> m_radius;
+    // half the box sizes, 0 for spheres
+    QVector<float> m_extentX, m_extentY, m_extentZ;
+};
+
+/*
+ * Frustum culling on the GPU. A compute pass tests one bounding sphere per
+ * object against the frustum and copies the instance data of the visible
+ * objects, compacted, to visibleInstances(). It counts them in the
+ * instanceCount of the VkDrawIndexedIndirectCommand in indirectBuffer(),
+ * so drawing the survivors is a single drawIndexedIndirect() no matter
+ * how many objects there are. The CPU records the same commands every
+ * frame, the frustum comes from a dynamic uniform buffer.
+ *
+ * The instance data of an object is instanceSize bytes, a multiple of 16.
+ */
+class QVkGpuCuller : public QVkDeviceResource {
+public:
+    // shader is the module of cull.comp, the culler destroys it
+    QVkGpuCuller(QSharedPointer<QVkDevice> dev, VkShaderModule shader, uint32_t objects,
+                 uint32_t instanceSize = sizeof(QVkMatrix4));
+    ~QVkGpuCuller();
+    Q_DISABLE_COPY(QVkGpuCuller)
+
+    // spheres: xyz center, w radius of every object
+    template <typename T> void upload(QVkUploadManager& uploads,
+                                      const QVector<QVector4D>& spheres,
+                                      const QVector<T>& instances) {
+        Q_ASSERT(sizeof(T) == m_instanceSize);
+        Q_ASSERT((uint32_t)instances.size() == m_objects);
+        upload(uploads, spheres, instances.constData());
+    }
+    // instances: objects() times instanceSize bytes
+    void upload(QVkUploadManager& uploads,
+                const QVector<QVector4D>& spheres,
+                const void* instances);
+
+    // Where record() reads the QVkFrustum from, at a dynamic offset. Has to
+    // be set again when the buffer changes.
+    void setFrustumBuffer(const VkDescriptorBufferInfo& frustum);
+
+    // the indexed draw issued for each visible instance
+    void setDraw(uint32_t indexCount, uint32_t firstIndex = 0, int32_t vertexOffset = 0);
+
+    // Culls and leaves the results ready for drawIndexedIndirect() and
+    // vertex input. Has to be recorded outside of render passes.
+    void record(QVkCommandBufferRecorder& recorder, uint32_t frustumOffset);
+
+    VkBuffer indirectBuffer() {
+        return m_indirect.buffer();
+    }
+
+    // instance data of the visible objects, for an instance rate binding
+    VkBuffer visibleInstances() {
+        return m_visible.buffer();
+    }
+
+    uint32_t objects() const {
+        return m_objects;
+    }
+
+private:
+    uint32_t m_objects;
+    uint32_t m_instanceSize;
+    QVkDeviceBuffer m_bounds;
+    QVkDeviceBuffer m_instances;
+    QVkDeviceBuffer m_visible;
+    QVkDeviceBuffer m_indirect;
+    VkDrawIndexedIndirectCommand m_draw         {};
+
+    VkDescriptorSetLayout m_setLayout           {nullptr};
+    VkPipelineLayout m_pipelineLayout           {nullptr};
+    VkPipeline m_pipeline                       {nullptr};
+    VkDescriptorPool m_pool                     {nullptr};
+    VkDescriptorSet m_set                       {nullptr};
+};
+
+#endif // QVKCULLING_H
@@ -0,0 +1,75 @@
+#include "qvkdeletionqueue.h"
+#include "qvkdevice.h"
+
+QVkDeletionQueue::QVkDeletionQueue(QVkDevice& device)
+    : m_device(device)
+    , m_vkDevice(device)
+{
+    DEBUG_ENTRY;
+}
+
+QVkDeletionQueue::~QVkDeletionQueue() {
+    DEBUG_ENTRY;
+    flush();
+}
+
+void QVkDeletionQueue::retire(const Deleter& deleter) {
+    QMutexLocker locker(&m_lock);
+    Entry entry;
+    entry.frame = m_currentFrame;
+    entry.deleter = deleter;
+    m_entries << entry;
+}
+
+void QVkDeletionQueue::retire(const QVkAllocation& allocation) {
+    if (allocation.isNull())
+        return;
+    QVkMemoryAllocator* allocator = &m_device.allocator();
+    QVkAllocation a = allocation;
+    retire([=]() mutable { allocator->free(a); });
+}
+
+void QVkDeletionQueue::retire(QVkDeviceResource* resource) {
+    retire([=]() { delete resource; });
+}
+
+uint64_t QVkDeletionQueue::currentFrame() {
+    QMutexLocker locker(&m_lock);
+    return m_currentFrame;
+}
+
+uint64_t QVkDeletionQueue::frameSubmitted() {
+    QMutexLocker locker(&m_lock);
+    return m_currentFrame++;
+}
+
+void QVkDeletionQueue::collect(uint64_t serial) {
+    QVector<Deleter> expired;
+    {
+        QMutexLocker locker(&m_lock);
+        // entries are in retire order, so their frames never decrease
+        int count = 0;
+        while (count < m_entries.count() && m_entries[count].frame <= serial)
+            expired << m_entries[count++].deleter;
+        m_entries.remove(0, count);
+    }
+    // deleters may retire more objects
+    for (const Deleter& deleter: expired)
+        deleter();
+}
+
+void QVkDeletionQueue::flush() {
+    DEBUG_ENTRY;
+    // deleting a resource may retire its members
+    while (true) {
+        QVector<Entry> entries;
+        {
+            QMutexLocker locker(&m_lock);
+            if (m_entries.isEmpty())
+                break;
+            entries.swap(m_entries);
+        }
+        for (const Entry& entry: entries)
+            entry.deleter();
+    }
+}
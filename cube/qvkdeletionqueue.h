@@ -0,0 +1,74 @@
+#ifndef QVKDELETIONQUEUE_H
+#define QVKDELETIONQUEUE_H
+
+#include <functional>
+#include <vulkan/vulkan.h>
+#include <QMutex>
+#include <QVector>
+#include "qvkallocator.h"
+
+class QVkDevice;
+class QVkDeviceResource;
+
+/*
+ * Destroys Vulkan objects once the GPU is done with them, without waiting
+ * for the device to go idle.
+ *
+ * Frames get increasing serials. Whatever is retired while a frame is
+ * recorded may be used by it and all frames before, so it is tagged with
+ * the frame's serial and destroyed by collect() once that frame is known
+ * to have completed. The renderer calls frameSubmitted() after each
+ * submit and collect() after each fence wait. Views sharing the device
+ * share the serials; they submit to the same queue, so the fence of a
+ * frame also covers the frames other views submitted before it.
+ */
+class QVkDeletionQueue {
+public:
+    typedef std::function<void()> Deleter;
+
+    explicit QVkDeletionQueue(QVkDevice& device);
+    ~QVkDeletionQueue();
+    Q_DISABLE_COPY(QVkDeletionQueue)
+
+    void retire(const Deleter& deleter);
+
+    // e.g. retire(framebuffer, vkDestroyFramebuffer)
+    template <typename Handle>
+    void retire(Handle handle, void (VKAPI_PTR *destroy)(VkDevice, Handle, const VkAllocationCallbacks*)) {
+        if (handle == nullptr)
+            return;
+        VkDevice dev = m_vkDevice;
+        retire([=]() { destroy(dev, handle, nullptr); });
+    }
+
+    void retire(const QVkAllocation& allocation);
+    void retire(QVkDeviceResource* resource);
+
+    // serial retired objects are currently tagged with
+    uint64_t currentFrame();
+
+    // The current frame was submitted, returns its serial. Later retires
+    // belong to the next frame.
+    uint64_t frameSubmitted();
+
+    // all frames up to and including serial have completed
+    void collect(uint64_t serial);
+
+    // destroys everything, the device has to be idle
+    void flush();
+
+private:
+    struct Entry {
+        uint64_t frame;
+        Deleter deleter;
+    };
+
+    QVkDevice& m_device;
+    VkDevice m_vkDevice;
+
+    QMutex m_lock;
+    QVector<Entry> m_entries;
+    uint64_t m_currentFrame     {1};
+};
+
+#endif // QVKDELETIONQUEUE_H
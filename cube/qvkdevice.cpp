@@ -1,4 +1,5 @@
 #include <QDebug>
+#include <QtAlgorithms>
 #include "qvkdevice.h"
 
 static PFN_vkGetDeviceProcAddr g_gdpa = nullptr;
@@ -27,6 +28,7 @@ QVkDevice::QVkDevice(QVkInstance &instance,
     Q_ASSERT((VkPhysicalDevice) m_gpu) ;
     // Get Memory information and properties
     vkGetPhysicalDeviceMemoryProperties(m_gpu, &m_memory_properties);
+    m_properties = m_gpu.properties();
 
     // Look for validation layers
     if(/*m_validate*/ true) {
@@ -45,6 +47,8 @@ QVkDevice::QVkDevice(QVkInstance &instance,
 
     /* Look for device extensions */
     VkBool32 swapchainExtFound = 0;
+    bool descriptorIndexingFound = false;
+    bool maintenance3Found = false;
     m_extensionNames.clear();
 
     auto getDevExt = [this](uint32_t* c, VkExtensionProperties* d) {
@@ -62,6 +66,27 @@ QVkDevice::QVkDevice(QVkInstance &instance,
             swapchainExtFound = 1;
             requestedExtensions << VK_KHR_SWAPCHAIN_EXTENSION_NAME;
         }
+#ifdef VK_EXT_memory_budget
+        // the budget is queried through an instance level extension
+        if (!strcmp(ext.extensionName, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME)
+                && instance.fpGetPhysicalDeviceMemoryProperties2KHR) {
+            m_hasMemoryBudget = true;
+            fpGetPhysicalDeviceMemoryProperties2KHR = instance.fpGetPhysicalDeviceMemoryProperties2KHR;
+            requestedExtensions << VK_EXT_MEMORY_BUDGET_EXTENSION_NAME;
+        }
+#endif
+#ifdef VK_KHR_draw_indirect_count
+        if (!strcmp(ext.extensionName, VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME)) {
+            m_hasDrawIndirectCount = true;
+            requestedExtensions << VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME;
+        }
+#endif
+#ifdef VK_EXT_descriptor_indexing
+        if (!strcmp(ext.extensionName, VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME))
+            descriptorIndexingFound = true;
+        if (!strcmp(ext.extensionName, VK_KHR_MAINTENANCE3_EXTENSION_NAME))
+            maintenance3Found = true;
+#endif
     }
 
     if (!swapchainExtFound) {
@@ -91,33 +116,177 @@ QVkDevice::QVkDevice(QVkInstance &instance,
     device_ci.ppEnabledLayerNames =  requestedLayers.data();
     device_ci.enabledExtensionCount = requestedExtensions.count();
     device_ci.ppEnabledExtensionNames = requestedExtensions.data();
-    device_ci.pEnabledFeatures = nullptr; // If specific features are required, pass them in here
+    // GPU driven rendering writes more than one draw, or draws starting
+    // at an instance other than 0, into indirect buffers
+    VkPhysicalDeviceFeatures supported = {};
+    vkGetPhysicalDeviceFeatures(m_gpu, &supported);
+    m_features.multiDrawIndirect = supported.multiDrawIndirect;
+    m_features.drawIndirectFirstInstance = supported.drawIndirectFirstInstance;
+    device_ci.pEnabledFeatures = &m_features;
+
+#ifdef VK_EXT_descriptor_indexing
+    // Bindless textures: one large array of sampled images, indexed with
+    // values that differ between the invocations of a draw, updated while
+    // command buffers that bind it are pending, and with only the
+    // elements written that are used.
+    VkPhysicalDeviceDescriptorIndexingFeaturesEXT indexing = {};
+    indexing.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
+    if (descriptorIndexingFound && maintenance3Found && instance.fpGetPhysicalDeviceFeatures2KHR) {
+        VkPhysicalDeviceFeatures2KHR features2 = {};
+        features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2_KHR;
+        features2.pNext = &indexing;
+        instance.fpGetPhysicalDeviceFeatures2KHR(m_gpu, &features2);
+
+        VkPhysicalDeviceDescriptorIndexingPropertiesEXT limits = {};
+        limits.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_PROPERTIES_EXT;
+        VkPhysicalDeviceProperties2KHR properties2 = {};
+        properties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2_KHR;
+        properties2.pNext = &limits;
+        instance.fpGetPhysicalDeviceProperties2KHR(m_gpu, &properties2);
+
+        if (indexing.shaderSampledImageArrayNonUniformIndexing &&
+                indexing.runtimeDescriptorArray &&
+                indexing.descriptorBindingSampledImageUpdateAfterBind &&
+                indexing.descriptorBindingPartiallyBound &&
+                indexing.descriptorBindingVariableDescriptorCount) {
+            m_maxBindlessTextures = qMin(limits.maxPerStageDescriptorUpdateAfterBindSampledImages,
+                                         limits.maxDescriptorSetUpdateAfterBindSampledImages);
+            m_maxBindlessTextures = qMin(m_maxBindlessTextures,
+                                         (uint32_t)MAX_BINDLESS_TEXTURES);
+        }
+    }
+    if (m_maxBindlessTextures > 0) {
+        requestedExtensions << VK_KHR_MAINTENANCE3_EXTENSION_NAME
+                            << VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME;
+        device_ci.enabledExtensionCount = requestedExtensions.count();
+        device_ci.ppEnabledExtensionNames = requestedExtensions.data();
+        // only what the bindless textures need
+        VkPhysicalDeviceDescriptorIndexingFeaturesEXT enabled = {};
+        enabled.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
+        enabled.shaderSampledImageArrayNonUniformIndexing = VK_TRUE;
+        enabled.runtimeDescriptorArray = VK_TRUE;
+        enabled.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+        enabled.descriptorBindingPartiallyBound = VK_TRUE;
+        enabled.descriptorBindingVariableDescriptorCount = VK_TRUE;
+        indexing = enabled;
+        device_ci.pNext = &indexing;
+    }
+    qDebug()<<"bindless textures:"<<m_maxBindlessTextures;
+#else
+    Q_UNUSED(descriptorIndexingFound)
+    Q_UNUSED(maintenance3Found)
+#endif
 
     err = vkCreateDevice(physicalDevice, &device_ci, nullptr, &m_device);
     Q_ASSERT(!err);
     initFunctions(instance);
+
+    updateMemoryBudget();
+    for (uint32_t heap = 0; heap < m_memory_properties.memoryHeapCount; heap++) {
+        QVkHeapBudget b = heapBudget(heap);
+        qDebug()<<"memory heap"<<heap<<"size"<<b.size<<"budget"<<b.budget
+                <<"usage"<<b.usage<<(m_hasMemoryBudget ? "(VK_EXT_memory_budget)" : "");
+    }
+
+    m_allocator.reset(new QVkMemoryAllocator(*this, m_memory_properties));
+    m_deletionQueue.reset(new QVkDeletionQueue(*this));
+    m_textureCache.reset(new QVkTextureCache(*this));
 }
 
 QVkDevice::~QVkDevice() {
     DEBUG_ENTRY;
+    // retired objects may hold allocations
+    vkDeviceWaitIdle(m_device);
+    // retires its textures
+    m_textureCache.reset();
+    m_deletionQueue.reset();
+    m_allocator.reset();
     vkDestroyDevice(m_device, nullptr);
 }
 
-int32_t QVkDevice::memoryType(uint32_t typeBits, VkFlags requirements) {
+int32_t QVkDevice::memoryType(uint32_t typeBits, const QVkMemoryRequest& request,
+                              VkDeviceSize size) {
+    QMutexLocker locker(&m_budgetLock);
+    int32_t best = -1;
+    int bestScore = 0;
+
+    for (uint32_t i = 0; i < m_memory_properties.memoryTypeCount; i++) {
+        if (!(typeBits & (1u << i)))
+            continue;
+        VkMemoryPropertyFlags flags = m_memory_properties.memoryTypes[i].propertyFlags;
+        if ((flags & request.required) != request.required)
+            continue;
+        if (flags & request.forbidden)
+            continue;
+        // lazily allocated memory only works for transient attachments
+        if ((flags & VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT)
+                && !(request.required & VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT))
+            continue;
+
+        // A preferred flag outweighs any number of unrequested ones, an
+        // unrequested flag (host cached for uploads, host visible for
+        // device only data) usually means a slower or scarcer type.
+        int score = 64 * int(qPopulationCount(flags & request.preferred))
+                - int(qPopulationCount(flags & ~(request.required | request.preferred)));
 
-    // Search memtypes to find first index with those properties
-    for (uint32_t i = 0; i < 32; i++) {
-        if ((typeBits & 1) == 1) {
-            // Type is available, does it match user properties?
-            if ((m_memory_properties.memoryTypes[i].propertyFlags &
-                 requirements) == requirements) {
-                return i;
-            }
+        uint32_t heap = m_memory_properties.memoryTypes[i].heapIndex;
+        if (m_heapUsage[heap] + size > m_heapBudget[heap])
+            score -= 1024;
+
+        // Drivers list faster types first, keep the first of equal ones.
+        if (best < 0 || score > bestScore) {
+            best = i;
+            bestScore = score;
+        }
+    }
+    return best;
+}
+
+QVkHeapBudget QVkDevice::heapBudget(uint32_t heap) {
+    Q_ASSERT(heap < m_memory_properties.memoryHeapCount);
+    QMutexLocker locker(&m_budgetLock);
+    QVkHeapBudget b;
+    b.size = m_memory_properties.memoryHeaps[heap].size;
+    b.budget = m_heapBudget[heap];
+    b.usage = m_heapUsage[heap];
+    return b;
+}
+
+void QVkDevice::memoryAllocated(uint32_t memoryType, VkDeviceSize size) {
+    QMutexLocker locker(&m_budgetLock);
+    m_heapUsage[m_memory_properties.memoryTypes[memoryType].heapIndex] += size;
+    // the driver's numbers include what was just allocated
+    if (m_hasMemoryBudget)
+        updateMemoryBudget();
+}
+
+void QVkDevice::memoryFreed(uint32_t memoryType, VkDeviceSize size) {
+    QMutexLocker locker(&m_budgetLock);
+    m_heapUsage[m_memory_properties.memoryTypes[memoryType].heapIndex] -= size;
+    if (m_hasMemoryBudget)
+        updateMemoryBudget();
+}
+
+void QVkDevice::updateMemoryBudget() {
+#ifdef VK_EXT_memory_budget
+    if (m_hasMemoryBudget) {
+        VkPhysicalDeviceMemoryBudgetPropertiesEXT budget = {};
+        budget.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT;
+        VkPhysicalDeviceMemoryProperties2KHR props = {};
+        props.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2_KHR;
+        props.pNext = &budget;
+        fpGetPhysicalDeviceMemoryProperties2KHR(m_gpu, &props);
+        for (uint32_t heap = 0; heap < m_memory_properties.memoryHeapCount; heap++) {
+            m_heapBudget[heap] = budget.heapBudget[heap];
+            m_heapUsage[heap] = budget.heapUsage[heap];
         }
-        typeBits >>= 1;
+        return;
     }
-    // No memory types matched, return failure
-    return -1;
+#endif
+    // Without the extension all we know is our own usage. Leave some of
+    // each heap to the rest of the system.
+    for (uint32_t heap = 0; heap < m_memory_properties.memoryHeapCount; heap++)
+        m_heapBudget[heap] = m_memory_properties.memoryHeaps[heap].size / 10 * 8;
 }
 
 void QVkDevice::initFunctions(QVkInstance& instance) {
@@ -126,5 +295,11 @@ void QVkDevice::initFunctions(QVkInstance& instance) {
     GET_DEVICE_PROC_ADDR(instance, m_device, GetSwapchainImagesKHR);
     GET_DEVICE_PROC_ADDR(instance, m_device, AcquireNextImageKHR);
     GET_DEVICE_PROC_ADDR(instance, m_device, QueuePresentKHR);
+#ifdef VK_KHR_draw_indirect_count
+    if (m_hasDrawIndirectCount) {
+        GET_DEVICE_PROC_ADDR(instance, m_device, CmdDrawIndirectCountKHR);
+        GET_DEVICE_PROC_ADDR(instance, m_device, CmdDrawIndexedIndirectCountKHR);
+    }
+#endif
 }
 
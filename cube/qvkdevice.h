@@ -1,9 +1,29 @@
 #ifndef QVKDEVICE_H
 #define QVKDEVICE_H
 #include <vulkan/vulkan.h>
+#include <QScopedPointer>
+#include <QMutex>
 #include "qvkutil.h"
 #include "qvkinstance.h"
 #include "qvkphysicaldevice.h"
+#include "qvkallocator.h"
+#include "qvkdeletionqueue.h"
+#include "qvktexturecache.h"
+
+struct QVkHeapBudget {
+    VkDeviceSize size   {0};
+    // bytes this process should not allocate beyond
+    VkDeviceSize budget {0};
+    VkDeviceSize usage  {0};
+
+    bool fits(VkDeviceSize bytes) const {
+        return usage + bytes <= budget;
+    }
+};
+
+// bindless texture arrays are not made larger than this, whatever the
+// device allows
+#define MAX_BINDLESS_TEXTURES 4096
 
 class QVkDevice {
 public:
@@ -16,7 +36,68 @@ public:
     ~QVkDevice();
     Q_DISABLE_COPY(QVkDevice)
 
-    int32_t memoryType(uint32_t typeBits, VkFlags requirements);
+    // Best memory type in typeBits for request, -1 if none qualifies.
+    // Types with more of the preferred and fewer of the unrequested flags
+    // score higher. Types whose heap has no budget left for size bytes
+    // are only picked when there is nothing else.
+    int32_t memoryType(uint32_t typeBits, const QVkMemoryRequest& request,
+                       VkDeviceSize size = 0);
+
+    QVkHeapBudget heapBudget(uint32_t heap);
+
+    // whether heapBudget() comes from VK_EXT_memory_budget rather than
+    // our own bookkeeping
+    bool hasMemoryBudget() const {
+        return m_hasMemoryBudget;
+    }
+
+    // bookkeeping for heapBudget(), called by QVkMemoryAllocator for every
+    // VkDeviceMemory
+    void memoryAllocated(uint32_t memoryType, VkDeviceSize size);
+    void memoryFreed(uint32_t memoryType, VkDeviceSize size);
+
+    VkMemoryPropertyFlags memoryTypeFlags(uint32_t typeIndex) const {
+        Q_ASSERT(typeIndex < m_memory_properties.memoryTypeCount);
+        return m_memory_properties.memoryTypes[typeIndex].propertyFlags;
+    }
+
+    QVkMemoryAllocator& allocator() {
+        return *m_allocator;
+    }
+
+    // objects that frames in flight may still use, see QVkDeletionQueue
+    QVkDeletionQueue& deletionQueue() {
+        return *m_deletionQueue;
+    }
+
+    // textures shared by all views on the device
+    QVkTextureCache& textureCache() {
+        return *m_textureCache;
+    }
+
+    // VK_KHR_draw_indirect_count, see QVkCommandBufferRecorder::drawIndirectCount()
+    bool hasDrawIndirectCount() const {
+        return m_hasDrawIndirectCount;
+    }
+
+    // Size of the texture arrays VK_EXT_descriptor_indexing allows, 0 if
+    // it is not supported. See QVulkanView::textureMode().
+    uint32_t maxBindlessTextures() const {
+        return m_maxBindlessTextures;
+    }
+
+    // features enabled on the device
+    const VkPhysicalDeviceFeatures& features() const {
+        return m_features;
+    }
+
+    const VkPhysicalDeviceProperties& properties() const {
+        return m_properties;
+    }
+
+    const VkPhysicalDeviceLimits& limits() const {
+        return m_properties.limits;
+    }
 
     operator VkDevice&() {
         return m_device;
@@ -47,14 +128,34 @@ public:
     PFN_vkGetSwapchainImagesKHR fpGetSwapchainImagesKHR {nullptr};
     PFN_vkAcquireNextImageKHR fpAcquireNextImageKHR     {nullptr};
     PFN_vkQueuePresentKHR fpQueuePresentKHR             {nullptr};
+#ifdef VK_KHR_draw_indirect_count
+    PFN_vkCmdDrawIndirectCountKHR fpCmdDrawIndirectCountKHR               {nullptr};
+    PFN_vkCmdDrawIndexedIndirectCountKHR fpCmdDrawIndexedIndirectCountKHR {nullptr};
+#endif
 
 private:
     void initFunctions(QVkInstance &instance);
+    void updateMemoryBudget();
     VkDevice m_device       {nullptr};
     QVkPhysicalDevice m_gpu;
+    VkPhysicalDeviceProperties m_properties                 {};
     VkPhysicalDeviceMemoryProperties m_memory_properties    {};
+    VkPhysicalDeviceFeatures m_features                     {};
     QVulkanNames m_layerNames;
     QVulkanNames m_extensionNames;
+    QScopedPointer<QVkMemoryAllocator> m_allocator;
+    QScopedPointer<QVkDeletionQueue> m_deletionQueue;
+    QScopedPointer<QVkTextureCache> m_textureCache;
+
+    QMutex m_budgetLock;
+    bool m_hasMemoryBudget                                  {false};
+    bool m_hasDrawIndirectCount                             {false};
+    uint32_t m_maxBindlessTextures                          {0};
+    VkDeviceSize m_heapUsage[VK_MAX_MEMORY_HEAPS]           {};
+    VkDeviceSize m_heapBudget[VK_MAX_MEMORY_HEAPS]          {};
+#ifdef VK_EXT_memory_budget
+    PFN_vkGetPhysicalDeviceMemoryProperties2KHR fpGetPhysicalDeviceMemoryProperties2KHR {nullptr};
+#endif
 };
 
 class QVkDeviceResource {
@@ -62,6 +163,14 @@ public:
     QVkDeviceResource(QSharedPointer<QVkDevice> dev)
         : m_device(dev)
     { }
+    virtual ~QVkDeviceResource() { }
+
+    // Deletes a heap allocated resource once the frames in flight that
+    // may use it have completed.
+    void deleteLater() {
+        m_device->deletionQueue().retire(this);
+    }
+
     VkDevice device() { return *m_device; }
     QSharedPointer<QVkDevice> dev() { return m_device; }
 
@@ -31,4 +31,22 @@ private:
     VkImageLayout m_layout;
 };
 
+// barrier for levels firstLevel to firstLevel + levelCount - 1 of a
+// single layer color image
+inline VkImageMemoryBarrier levelBarrier(VkImage image, uint32_t firstLevel, uint32_t levelCount,
+                                         VkImageLayout oldLayout, VkImageLayout newLayout,
+                                         VkAccessFlags srcAccess, VkAccessFlags dstAccess) {
+    VkImageMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.srcAccessMask = srcAccess;
+    barrier.dstAccessMask = dstAccess;
+    barrier.oldLayout = oldLayout;
+    barrier.newLayout = newLayout;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = image;
+    barrier.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, firstLevel, levelCount, 0, 1};
+    return barrier;
+}
+
 #endif // QVKIMAGE_H
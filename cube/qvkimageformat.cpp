@@ -0,0 +1,262 @@
+#include <QVector>
+#include "qvkimageformat.h"
+#include "qvkutil.h"
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64)
+// the SSSE3 kernel is compiled for SSSE3 alone and picked at runtime
+#if defined(__GNUC__)
+#define QVK_EXPAND_SSSE3
+#include <immintrin.h>
+#endif
+#endif
+
+static const VkComponentSwizzle ID = VK_COMPONENT_SWIZZLE_IDENTITY;
+static const VkComponentSwizzle R = VK_COMPONENT_SWIZZLE_R;
+static const VkComponentSwizzle G = VK_COMPONENT_SWIZZLE_G;
+static const VkComponentSwizzle B = VK_COMPONENT_SWIZZLE_B;
+static const VkComponentSwizzle A = VK_COMPONENT_SWIZZLE_A;
+static const VkComponentSwizzle ZERO = VK_COMPONENT_SWIZZLE_ZERO;
+static const VkComponentSwizzle ONE = VK_COMPONENT_SWIZZLE_ONE;
+
+// Vulkan formats of the bytes of format, on little endian hosts. Packed
+// QImage formats are native endian words with the first channel in the
+// high bits, like the PACK16 and PACK32 Vulkan formats; the others are
+// bytes in the order of their name, like the Vulkan byte formats.
+static QVector<QVkImageFormat> candidates(QImage::Format format) {
+    QVector<QVkImageFormat> formats;
+    auto add = [&](VkFormat vkFormat, VkComponentSwizzle r, VkComponentSwizzle g, VkComponentSwizzle b,
+                   VkComponentSwizzle a) {
+        formats << QVkImageFormat{vkFormat, {r, g, b, a}, format};
+    };
+    // B8G8R8A8 can be sampled and blitted on every device, the last resort
+    auto convert = [&](QImage::Format storage) {
+        formats << QVkImageFormat{VK_FORMAT_B8G8R8A8_UNORM, {ID, ID, ID, ID}, storage};
+    };
+
+    switch (format) {
+    // 0xAARRGGBB, B, G, R, A in memory
+    case QImage::Format_RGB32:
+    case QImage::Format_ARGB32:
+    case QImage::Format_ARGB32_Premultiplied:
+        add(VK_FORMAT_B8G8R8A8_UNORM, ID, ID, ID, ID);
+        add(VK_FORMAT_R8G8B8A8_UNORM, B, G, R, A);
+        break;
+    case QImage::Format_RGBX8888:
+    case QImage::Format_RGBA8888:
+    case QImage::Format_RGBA8888_Premultiplied:
+        add(VK_FORMAT_R8G8B8A8_UNORM, ID, ID, ID, ID);
+        add(VK_FORMAT_B8G8R8A8_UNORM, B, G, R, A);
+        break;
+    case QImage::Format_RGB888:
+        add(VK_FORMAT_R8G8B8_UNORM, ID, ID, ID, ID);
+        add(VK_FORMAT_B8G8R8_UNORM, B, G, R, ONE);
+        // R, G, B, 0xff
+        formats << QVkImageFormat{VK_FORMAT_R8G8B8A8_UNORM, {ID, ID, ID, ID}, QImage::Format_RGBX8888};
+        formats << QVkImageFormat{VK_FORMAT_B8G8R8A8_UNORM, {B, G, R, A}, QImage::Format_RGBX8888};
+        break;
+#if QT_VERSION >= QT_VERSION_CHECK(5, 14, 0)
+    case QImage::Format_BGR888:
+        add(VK_FORMAT_B8G8R8_UNORM, ID, ID, ID, ID);
+        add(VK_FORMAT_R8G8B8_UNORM, B, G, R, ONE);
+        // B, G, R, 0xff
+        formats << QVkImageFormat{VK_FORMAT_B8G8R8A8_UNORM, {ID, ID, ID, ID}, QImage::Format_RGB32};
+        formats << QVkImageFormat{VK_FORMAT_R8G8B8A8_UNORM, {B, G, R, A}, QImage::Format_RGB32};
+        break;
+#endif
+    // R5 G6 B5 from the high bits
+    case QImage::Format_RGB16:
+        add(VK_FORMAT_R5G6B5_UNORM_PACK16, ID, ID, ID, ID);
+        add(VK_FORMAT_B5G6R5_UNORM_PACK16, B, G, R, ONE);
+        break;
+    // an unused bit, R5 G5 B5
+    case QImage::Format_RGB555:
+        add(VK_FORMAT_A1R5G5B5_UNORM_PACK16, ID, ID, ID, ONE);
+        break;
+    // an unused nibble, R4 G4 B4, or A4 R4 G4 B4
+    case QImage::Format_RGB444:
+        add(VK_FORMAT_B4G4R4A4_UNORM_PACK16, G, R, A, ONE);
+        add(VK_FORMAT_R4G4B4A4_UNORM_PACK16, G, B, A, ONE);
+        break;
+    case QImage::Format_ARGB4444_Premultiplied:
+        add(VK_FORMAT_B4G4R4A4_UNORM_PACK16, G, R, A, B);
+        add(VK_FORMAT_R4G4B4A4_UNORM_PACK16, G, B, A, R);
+        break;
+    // A2 B10 G10 R10 or A2 R10 G10 B10, unused alpha bits in the RGB
+    // formats
+    case QImage::Format_BGR30:
+        add(VK_FORMAT_A2B10G10R10_UNORM_PACK32, ID, ID, ID, ONE);
+        add(VK_FORMAT_A2R10G10B10_UNORM_PACK32, B, G, R, ONE);
+        break;
+    case QImage::Format_A2BGR30_Premultiplied:
+        add(VK_FORMAT_A2B10G10R10_UNORM_PACK32, ID, ID, ID, ID);
+        add(VK_FORMAT_A2R10G10B10_UNORM_PACK32, B, G, R, A);
+        break;
+    case QImage::Format_RGB30:
+        add(VK_FORMAT_A2R10G10B10_UNORM_PACK32, ID, ID, ID, ONE);
+        add(VK_FORMAT_A2B10G10R10_UNORM_PACK32, B, G, R, ONE);
+        break;
+    case QImage::Format_A2RGB30_Premultiplied:
+        add(VK_FORMAT_A2R10G10B10_UNORM_PACK32, ID, ID, ID, ID);
+        add(VK_FORMAT_A2B10G10R10_UNORM_PACK32, B, G, R, A);
+        break;
+    case QImage::Format_Alpha8:
+        add(VK_FORMAT_R8_UNORM, ZERO, ZERO, ZERO, R);
+        break;
+    case QImage::Format_Grayscale8:
+        add(VK_FORMAT_R8_UNORM, R, R, R, ONE);
+        break;
+#if QT_VERSION >= QT_VERSION_CHECK(5, 13, 0)
+    case QImage::Format_Grayscale16:
+        add(VK_FORMAT_R16_UNORM, R, R, R, ONE);
+        break;
+#endif
+#if QT_VERSION >= QT_VERSION_CHECK(5, 12, 0)
+    // 16 bit words R, G, B, A
+    case QImage::Format_RGBX64:
+        add(VK_FORMAT_R16G16B16A16_UNORM, ID, ID, ID, ONE);
+        break;
+    case QImage::Format_RGBA64:
+    case QImage::Format_RGBA64_Premultiplied:
+        add(VK_FORMAT_R16G16B16A16_UNORM, ID, ID, ID, ID);
+        break;
+#endif
+    default:
+        // Mono, MonoLSB, Indexed8 and the packed formats with 6 or 8 bit
+        // alpha next to 5 or 6 bit colors
+        break;
+    }
+
+    switch (format) {
+    case QImage::Format_ARGB32_Premultiplied:
+    case QImage::Format_RGBA8888_Premultiplied:
+    case QImage::Format_ARGB8565_Premultiplied:
+    case QImage::Format_ARGB6666_Premultiplied:
+    case QImage::Format_ARGB8555_Premultiplied:
+    case QImage::Format_ARGB4444_Premultiplied:
+    case QImage::Format_A2BGR30_Premultiplied:
+    case QImage::Format_A2RGB30_Premultiplied:
+#if QT_VERSION >= QT_VERSION_CHECK(5, 12, 0)
+    case QImage::Format_RGBA64_Premultiplied:
+#endif
+        convert(QImage::Format_ARGB32_Premultiplied);
+        break;
+    case QImage::Format_RGB32:
+    case QImage::Format_RGBX8888:
+    case QImage::Format_RGB888:
+    case QImage::Format_RGB16:
+    case QImage::Format_RGB666:
+    case QImage::Format_RGB555:
+    case QImage::Format_RGB444:
+    case QImage::Format_BGR30:
+    case QImage::Format_RGB30:
+    case QImage::Format_Grayscale8:
+#if QT_VERSION >= QT_VERSION_CHECK(5, 12, 0)
+    case QImage::Format_RGBX64:
+#endif
+#if QT_VERSION >= QT_VERSION_CHECK(5, 13, 0)
+    case QImage::Format_Grayscale16:
+#endif
+#if QT_VERSION >= QT_VERSION_CHECK(5, 14, 0)
+    case QImage::Format_BGR888:
+#endif
+        convert(QImage::Format_RGB32);
+        break;
+    default:
+        // the color tables of Indexed8 and Mono may have alpha
+        convert(QImage::Format_ARGB32);
+        break;
+    }
+    return formats;
+}
+
+QVkImageFormat QVkImageFormat::negotiate(VkPhysicalDevice gpu, QImage::Format format, bool blit) {
+    const VkFormatFeatureFlags blitFeatures = VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT |
+                                              VK_FORMAT_FEATURE_BLIT_SRC_BIT |
+                                              VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+    const QVector<QVkImageFormat> formats = candidates(format);
+    for (const QVkImageFormat& candidate : formats) {
+        if (blit && !isIdentity(candidate.swizzle))
+            continue;
+        VkFormatProperties props;
+        vkGetPhysicalDeviceFormatProperties(gpu, candidate.format, &props);
+        // optimal tiling, textures with mip levels are never linear
+        const VkFormatFeatureFlags features = blit ? blitFeatures
+                                                   : (VkFormatFeatureFlags)VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT;
+        if ((props.optimalTilingFeatures & features) == features)
+            return candidate;
+    }
+    // B8G8R8A8 has all the features, unless the driver is wrong;
+    // QVulkanView::prepare_texture_image() falls back to linear tiling
+    qWarning()<<"no sampled format for QImage format"<<(int)format;
+    return formats.last();
+}
+
+bool QVkImageFormat::isIdentity(const VkComponentMapping& mapping) {
+    return (mapping.r == ID || mapping.r == R) && (mapping.g == ID || mapping.g == G) &&
+           (mapping.b == ID || mapping.b == B) && (mapping.a == ID || mapping.a == A);
+}
+
+QImage QVkImageFormat::convert(const QImage& image) const {
+    if (image.format() == storage)
+        return image;
+
+    // the 3 byte formats get their fourth byte, with no other conversion
+    const bool expand = (image.format() == QImage::Format_RGB888 && storage == QImage::Format_RGBX8888)
+#if QT_VERSION >= QT_VERSION_CHECK(5, 14, 0)
+            || (image.format() == QImage::Format_BGR888 && storage == QImage::Format_RGB32)
+#endif
+            ;
+    if (!expand)
+        return image.convertToFormat(storage);
+
+    QImage expanded(image.size(), storage);
+    for (int y = 0; y < image.height(); y++)
+        expandRgb24(image.constScanLine(y), expanded.scanLine(y), (uint32_t)image.width());
+    return expanded;
+}
+
+static void expandScalar(const uchar* src, uchar* dst, uint32_t pixels) {
+    for (uint32_t i = 0; i < pixels; i++) {
+        dst[0] = src[0];
+        dst[1] = src[1];
+        dst[2] = src[2];
+        dst[3] = 0xff;
+        src += 3;
+        dst += 4;
+    }
+}
+
+#ifdef QVK_EXPAND_SSSE3
+__attribute__((target("ssse3")))
+static void expandSsse3(const uchar* src, uchar* dst, uint32_t pixels) {
+    // 4 texels of 3 bytes spread to 4 bytes each, the fourth or'ed in
+    const __m128i spread = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+    const __m128i alpha = _mm_set1_epi32((int)0xff000000u);
+    uint32_t i = 0;
+    // 16 texels from 3 loads, nothing is read beyond the row
+    for (; i + 16 <= pixels; i += 16) {
+        const __m128i* in = reinterpret_cast<const __m128i*>(src + i * 3);
+        __m128i* out = reinterpret_cast<__m128i*>(dst + i * 4);
+        const __m128i a = _mm_loadu_si128(in);
+        const __m128i b = _mm_loadu_si128(in + 1);
+        const __m128i c = _mm_loadu_si128(in + 2);
+        // texels 0-3 are bytes 0-11, 4-7 bytes 12-23, 8-11 bytes 24-35
+        // and 12-15 bytes 36-47
+        _mm_storeu_si128(out, _mm_or_si128(_mm_shuffle_epi8(a, spread), alpha));
+        _mm_storeu_si128(out + 1, _mm_or_si128(_mm_shuffle_epi8(_mm_alignr_epi8(b, a, 12), spread), alpha));
+        _mm_storeu_si128(out + 2, _mm_or_si128(_mm_shuffle_epi8(_mm_alignr_epi8(c, b, 8), spread), alpha));
+        _mm_storeu_si128(out + 3, _mm_or_si128(_mm_shuffle_epi8(_mm_srli_si128(c, 4), spread), alpha));
+    }
+    expandScalar(src + i * 3, dst + i * 4, pixels - i);
+}
+#endif
+
+void expandRgb24(const uchar* src, uchar* dst, uint32_t pixels) {
+#ifdef QVK_EXPAND_SSSE3
+    if (__builtin_cpu_supports("ssse3")) {
+        expandSsse3(src, dst, pixels);
+        return;
+    }
+#endif
+    expandScalar(src, dst, pixels);
+}
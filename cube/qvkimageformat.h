@@ -0,0 +1,52 @@
+#ifndef QVKIMAGEFORMAT_H
+#define QVKIMAGEFORMAT_H
+
+#include <vulkan/vulkan.h>
+#include <QImage>
+
+/*
+ * How the texels of a QImage end up in a VkImage.
+ *
+ * negotiate() goes through the Vulkan formats that hold the bytes of a
+ * QImage format as they are, those in the same channel order first, and
+ * picks the first the device samples with optimal tiling. Channels stored
+ * in a different order, or not at all, are put in place by the component
+ * swizzle of the image view: Format_RGB30 is sampled from
+ * VK_FORMAT_A2B10G10R10_UNORM_PACK32 with R and B swapped if the device
+ * lacks A2R10G10B10, Format_Grayscale8 from VK_FORMAT_R8_UNORM as R, R,
+ * R, 1 and Format_RGB444 from a 4444 format with its unused nibble
+ * replaced by 1.
+ *
+ * Only if no format fits are the texels converted on the CPU, to
+ * storage. 24 bit RGB888 and BGR888 images, whose formats are rarely
+ * sampled, are expanded by expandRgb24(); formats Vulkan has no layout
+ * for (Indexed8, Mono, RGB666, ...) are converted by QImage.
+ *
+ * Premultiplied formats are sampled premultiplied.
+ */
+struct QVkImageFormat {
+    // of the image and its view
+    VkFormat format;
+    VkComponentMapping swizzle;
+    // the QImage format the bytes are uploaded in, the format of the
+    // image itself if they need no conversion
+    QImage::Format storage;
+
+    // Picks the format for images of format. Textures copied by blits,
+    // e.g. into a QVkTextureAtlas, need blit: blits apply no swizzle, and
+    // the format has to be a blit source with linear filtering.
+    static QVkImageFormat negotiate(VkPhysicalDevice gpu, QImage::Format format, bool blit = false);
+
+    // image in storage, image itself if it is in storage already
+    QImage convert(const QImage& image) const;
+
+    // whether mapping leaves all components where they are
+    static bool isIdentity(const VkComponentMapping& mapping);
+};
+
+// Expands pixels 3 byte texels to 4 bytes, in the same order, with 0xff
+// as the fourth: RGB888 to RGBX8888, BGR888 to RGB32. Uses SSSE3 where
+// the CPU has it.
+void expandRgb24(const uchar* src, uchar* dst, uint32_t pixels);
+
+#endif // QVKIMAGEFORMAT_H
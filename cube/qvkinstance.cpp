@@ -66,6 +66,12 @@ QVkInstance::QVkInstance() {
                 m_extensionNames << VK_EXT_DEBUG_REPORT_EXTENSION_NAME;
             }
         }
+#ifdef VK_KHR_get_physical_device_properties2
+        // needed to query VK_EXT_memory_budget and VK_EXT_descriptor_indexing
+        if (!strcmp(ext.extensionName, VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME)) {
+            m_extensionNames << VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME;
+        }
+#endif
     }
 
     if (!surfaceExtFound) {
@@ -247,6 +253,17 @@ void QVkInstance::initFunctions()
     GET_INSTANCE_PROC_ADDR(m_instance, GetPhysicalDeviceSurfaceFormatsKHR);
     GET_INSTANCE_PROC_ADDR(m_instance, GetPhysicalDeviceSurfacePresentModesKHR);
 // GET_INSTANCE_PROC_ADDR(m_instance, GetSwapchainImagesKHR);
+#ifdef VK_KHR_get_physical_device_properties2
+    fpGetPhysicalDeviceMemoryProperties2KHR =
+            (PFN_vkGetPhysicalDeviceMemoryProperties2KHR)vkGetInstanceProcAddr(
+                m_instance, "vkGetPhysicalDeviceMemoryProperties2KHR");
+    fpGetPhysicalDeviceFeatures2KHR =
+            (PFN_vkGetPhysicalDeviceFeatures2KHR)vkGetInstanceProcAddr(
+                m_instance, "vkGetPhysicalDeviceFeatures2KHR");
+    fpGetPhysicalDeviceProperties2KHR =
+            (PFN_vkGetPhysicalDeviceProperties2KHR)vkGetInstanceProcAddr(
+                m_instance, "vkGetPhysicalDeviceProperties2KHR");
+#endif
 }
 
 QVkPhysicalDevice QVkInstance::device(uint32_t index) {
@@ -35,6 +35,12 @@ public:
     PFN_vkGetPhysicalDeviceSurfaceCapabilitiesKHR fpGetPhysicalDeviceSurfaceCapabilitiesKHR {nullptr};
     PFN_vkGetPhysicalDeviceSurfaceFormatsKHR fpGetPhysicalDeviceSurfaceFormatsKHR           {nullptr};
     PFN_vkGetPhysicalDeviceSurfacePresentModesKHR fpGetPhysicalDeviceSurfacePresentModesKHR {nullptr};
+#ifdef VK_KHR_get_physical_device_properties2
+    // optional, nullptr when VK_KHR_get_physical_device_properties2 is missing
+    PFN_vkGetPhysicalDeviceMemoryProperties2KHR fpGetPhysicalDeviceMemoryProperties2KHR {nullptr};
+    PFN_vkGetPhysicalDeviceFeatures2KHR fpGetPhysicalDeviceFeatures2KHR                 {nullptr};
+    PFN_vkGetPhysicalDeviceProperties2KHR fpGetPhysicalDeviceProperties2KHR             {nullptr};
+#endif
 
     operator VkInstance() {
         return m_instance;
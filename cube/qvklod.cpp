@@ -0,0 +1,403 @@
+#include "qvklod.h"
+#include <algorithm>
+#include <cmath>
+#include <QHash>
+#include <QtMath>
+#include "qvulkanview.h"
+
+namespace {
+
+enum VertexKind {
+    // inside the mesh, may collapse onto any neighbor
+    Manifold,
+    // on an open edge, may only collapse along it
+    Border,
+    // one of two vertices at the same position on an attribute seam
+    Seam,
+    // never moves
+    Locked
+};
+
+// no open edge, and more than one
+const uint32_t NONE = ~0u;
+const uint32_t MANY = ~1u;
+
+// symmetric 4x4 matrix of the sum of squared distances to planes
+struct Quadric {
+    double a00, a01, a02, a03;
+    double a11, a12, a13;
+    double a22, a23;
+    double a33;
+    // number of planes
+    double weight;
+
+    void addPlane(double x, double y, double z, double d) {
+        a00 += x * x; a01 += x * y; a02 += x * z; a03 += x * d;
+        a11 += y * y; a12 += y * z; a13 += y * d;
+        a22 += z * z; a23 += z * d;
+        a33 += d * d;
+        weight += 1.0;
+    }
+
+    void add(const Quadric& q) {
+        a00 += q.a00; a01 += q.a01; a02 += q.a02; a03 += q.a03;
+        a11 += q.a11; a12 += q.a12; a13 += q.a13;
+        a22 += q.a22; a23 += q.a23;
+        a33 += q.a33;
+        weight += q.weight;
+    }
+
+    // mean squared distance of p to the planes
+    double evaluate(const QVector3D& p) const {
+        const double x = p.x(), y = p.y(), z = p.z();
+        double e = a00 * x * x + a11 * y * y + a22 * z * z + a33
+                 + 2.0 * (a01 * x * y + a02 * x * z + a12 * y * z)
+                 + 2.0 * (a03 * x + a13 * y + a23 * z);
+        return weight > 0.0 ? qMax(0.0, e) / weight : 0.0;
+    }
+};
+
+// half edges leaving every vertex, with the triangle they belong to
+struct Adjacency {
+    QVector<uint32_t> offsets;
+    QVector<uint32_t> targets;
+    QVector<uint32_t> triangles;
+
+    void build(const QVector<uint32_t>& indices, uint32_t vertexCount) {
+        offsets.fill(0, vertexCount + 1);
+        for (int i = 0; i < indices.size(); i++)
+            offsets[indices[i] + 1]++;
+        for (uint32_t v = 0; v < vertexCount; v++)
+            offsets[v + 1] += offsets[v];
+        targets.resize(indices.size());
+        triangles.resize(indices.size());
+        QVector<uint32_t> fill = offsets;
+        for (int i = 0; i < indices.size(); i++) {
+            const int t = i / 3;
+            const uint32_t next = indices[t * 3 + (i + 1) % 3];
+            const uint32_t slot = fill[indices[i]]++;
+            targets[slot] = next;
+            triangles[slot] = t;
+        }
+    }
+
+    bool hasEdge(uint32_t a, uint32_t b) const {
+        for (uint32_t i = offsets[a]; i < offsets[a + 1]; i++) {
+            if (targets[i] == b)
+                return true;
+        }
+        return false;
+    }
+};
+
+struct Collapse {
+    uint32_t from;
+    uint32_t to;
+    double cost;
+
+    bool operator<(const Collapse& other) const {
+        return cost < other.cost;
+    }
+};
+
+QVector3D triangleNormal(const QVector3D& a, const QVector3D& b, const QVector3D& c) {
+    return QVector3D::crossProduct(b - a, c - a);
+}
+
+// whether moving from onto to turns a triangle around from over
+bool flipsTriangles(uint32_t from, uint32_t to, const QVector<uint32_t>& indices,
+                    const QVector<QVector3D>& positions, const Adjacency& adjacency) {
+    for (uint32_t i = adjacency.offsets[from]; i < adjacency.offsets[from + 1]; i++) {
+        const uint32_t* tri = indices.constData() + adjacency.triangles[i] * 3;
+        // the triangles on the collapsed edge go away
+        if (tri[0] == to || tri[1] == to || tri[2] == to)
+            continue;
+        QVector3D p[3], q[3];
+        for (int k = 0; k < 3; k++) {
+            p[k] = positions[tri[k]];
+            q[k] = tri[k] == from ? positions[to] : p[k];
+        }
+        if (QVector3D::dotProduct(triangleNormal(p[0], p[1], p[2]), triangleNormal(q[0], q[1], q[2])) <= 0.0f)
+            return true;
+    }
+    return false;
+}
+
+// Follows the open edge loop of v past vertices collapsed onto v.
+uint32_t remapLoop(uint32_t v, uint32_t next, const QVector<uint32_t>& loop,
+                   const QVector<uint32_t>& collapseRemap) {
+    if (next == NONE || next == MANY)
+        return next;
+    uint32_t steps = 0;
+    while (collapseRemap[next] == v && loop[next] != NONE && loop[next] != MANY
+           && steps++ < (uint32_t)loop.size())
+        next = loop[next];
+    return collapseRemap[next] == v ? NONE : collapseRemap[next];
+}
+
+} // namespace
+
+QVector<uint32_t> simplifyMesh(const QVector<uint32_t>& input, const QVector<QVector3D>& positions,
+                               uint32_t targetIndexCount, float* error) {
+    DEBUG_ENTRY;
+    const uint32_t vertexCount = positions.size();
+    QVector<uint32_t> indices = input;
+    indices.resize(indices.size() / 3 * 3);
+
+    // vertices at the same position: the first of them, and a ring
+    // through all of them
+    QVector<uint32_t> canonical(vertexCount);
+    QVector<uint32_t> wedge(vertexCount);
+    {
+        QHash<QByteArray, uint32_t> first;
+        first.reserve(vertexCount);
+        for (uint32_t v = 0; v < vertexCount; v++) {
+            QByteArray key(reinterpret_cast<const char*>(&positions[v]), sizeof(QVector3D));
+            auto it = first.constFind(key);
+            if (it == first.constEnd()) {
+                first.insert(key, v);
+                canonical[v] = v;
+                wedge[v] = v;
+            } else {
+                canonical[v] = it.value();
+                wedge[v] = wedge[it.value()];
+                wedge[it.value()] = v;
+            }
+        }
+    }
+
+    Adjacency adjacency;
+    adjacency.build(indices, vertexCount);
+
+    // the open edges leaving and entering every vertex
+    QVector<uint32_t> openOut(vertexCount, NONE);
+    QVector<uint32_t> openIn(vertexCount, NONE);
+    for (uint32_t v = 0; v < vertexCount; v++) {
+        for (uint32_t i = adjacency.offsets[v]; i < adjacency.offsets[v + 1]; i++) {
+            const uint32_t w = adjacency.targets[i];
+            if (adjacency.hasEdge(w, v))
+                continue;
+            openOut[v] = openOut[v] == NONE ? w : MANY;
+            openIn[w] = openIn[w] == NONE ? v : MANY;
+        }
+    }
+
+    auto single = [](uint32_t v) { return v != NONE && v != MANY; };
+    QVector<VertexKind> kind(vertexCount, Locked);
+    for (uint32_t v = 0; v < vertexCount; v++) {
+        if (wedge[v] == v) {
+            if (openOut[v] == NONE && openIn[v] == NONE)
+                kind[v] = Manifold;
+            else if (single(openOut[v]) && single(openIn[v]))
+                kind[v] = Border;
+        } else if (wedge[wedge[v]] == v) {
+            // both sides of the seam run along the same positions
+            const uint32_t w = wedge[v];
+            if (single(openOut[v]) && single(openIn[v]) && single(openOut[w]) && single(openIn[w])
+                && canonical[openOut[v]] == canonical[openIn[w]]
+                && canonical[openIn[v]] == canonical[openOut[w]])
+                kind[v] = Seam;
+        }
+    }
+
+    // planes of the triangles around each position, and planes through
+    // border edges perpendicular to their triangle to keep borders in place
+    QVector<Quadric> quadrics(vertexCount);
+    for (int t = 0; t < indices.size() / 3; t++) {
+        const uint32_t* tri = indices.constData() + t * 3;
+        QVector3D normal = triangleNormal(positions[tri[0]], positions[tri[1]], positions[tri[2]]);
+        if (normal.isNull())
+            continue;
+        normal.normalize();
+        const float d = -QVector3D::dotProduct(normal, positions[tri[0]]);
+        for (int k = 0; k < 3; k++)
+            quadrics[canonical[tri[k]]].addPlane(normal.x(), normal.y(), normal.z(), d);
+
+        for (int k = 0; k < 3; k++) {
+            const uint32_t a = tri[k];
+            const uint32_t b = tri[(k + 1) % 3];
+            if (kind[a] != Border || openOut[a] != b)
+                continue;
+            QVector3D edgeNormal = QVector3D::crossProduct(positions[b] - positions[a], normal).normalized();
+            const float edgeD = -QVector3D::dotProduct(edgeNormal, positions[a]);
+            quadrics[canonical[a]].addPlane(edgeNormal.x(), edgeNormal.y(), edgeNormal.z(), edgeD);
+            quadrics[canonical[b]].addPlane(edgeNormal.x(), edgeNormal.y(), edgeNormal.z(), edgeD);
+        }
+    }
+
+    // the vertex every input vertex ended up on
+    QVector<uint32_t> target(vertexCount);
+    for (uint32_t v = 0; v < vertexCount; v++)
+        target[v] = v;
+    QVector<uint32_t> collapseRemap(vertexCount);
+    QVector<bool> locked(vertexCount);
+    QVector<Collapse> collapses;
+    while ((uint32_t)indices.size() > targetIndexCount) {
+        // manifold vertices onto any neighbor, the others along their
+        // open edges
+        collapses.clear();
+        for (uint32_t v = 0; v < vertexCount; v++) {
+            // collapsed already
+            if (adjacency.offsets[v] == adjacency.offsets[v + 1])
+                continue;
+            if (kind[v] == Manifold) {
+                for (uint32_t i = adjacency.offsets[v]; i < adjacency.offsets[v + 1]; i++) {
+                    const uint32_t u = adjacency.targets[i];
+                    collapses.append({v, u, quadrics[canonical[v]].evaluate(positions[u])});
+                }
+            } else if (kind[v] != Locked) {
+                for (uint32_t u : { openOut[v], openIn[v] }) {
+                    if (single(u))
+                        collapses.append({v, u, quadrics[canonical[v]].evaluate(positions[u])});
+                }
+            }
+        }
+        if (collapses.isEmpty())
+            break;
+        std::sort(collapses.begin(), collapses.end());
+
+        for (uint32_t v = 0; v < vertexCount; v++)
+            collapseRemap[v] = v;
+        locked.fill(false);
+
+        // a collapse takes two triangles away, one on a border
+        const uint32_t toRemove = ((uint32_t)indices.size() - targetIndexCount) / 3;
+        uint32_t removed = 0;
+        for (const Collapse& c : collapses) {
+            if (removed >= toRemove)
+                break;
+            const uint32_t v = c.from;
+            const uint32_t u = c.to;
+            if (locked[canonical[v]] || locked[canonical[u]])
+                continue;
+
+            // the twin on the other side of a seam follows along
+            uint32_t twin = NONE, twinTarget = NONE;
+            if (kind[v] == Seam) {
+                twin = wedge[v];
+                twinTarget = u == openOut[v] ? openIn[twin] : openOut[twin];
+                if (!single(twinTarget) || canonical[twinTarget] != canonical[u])
+                    continue;
+            }
+            if (flipsTriangles(v, u, indices, positions, adjacency))
+                continue;
+            if (twin != NONE && flipsTriangles(twin, twinTarget, indices, positions, adjacency))
+                continue;
+
+            collapseRemap[v] = u;
+            if (twin != NONE)
+                collapseRemap[twin] = twinTarget;
+            quadrics[canonical[u]].add(quadrics[canonical[v]]);
+            locked[canonical[v]] = true;
+            locked[canonical[u]] = true;
+            removed += kind[v] == Border ? 1 : 2;
+        }
+        if (removed == 0)
+            break;
+        const int before = indices.size();
+
+        // drop the triangles that lost an edge
+        QVector<uint32_t> result;
+        result.reserve(indices.size());
+        for (int t = 0; t < indices.size() / 3; t++) {
+            const uint32_t a = collapseRemap[indices[t * 3]];
+            const uint32_t b = collapseRemap[indices[t * 3 + 1]];
+            const uint32_t c = collapseRemap[indices[t * 3 + 2]];
+            if (a != b && b != c && c != a)
+                result << a << b << c;
+        }
+        indices.swap(result);
+        // nothing collapses onto a vertex that moves in the same pass
+        for (uint32_t v = 0; v < vertexCount; v++)
+            target[v] = collapseRemap[target[v]];
+        if (indices.size() == before)
+            break;
+
+        // open edge loops skip the collapsed vertices
+        const QVector<uint32_t> oldOut = openOut;
+        const QVector<uint32_t> oldIn = openIn;
+        for (uint32_t v = 0; v < vertexCount; v++) {
+            openOut[v] = remapLoop(v, oldOut[v], oldOut, collapseRemap);
+            openIn[v] = remapLoop(v, oldIn[v], oldIn, collapseRemap);
+        }
+        adjacency.build(indices, vertexCount);
+    }
+
+    // Every point of an input triangle maps to the same barycentric point
+    // of the triangle its vertices ended up on, so it moved no farther than
+    // the farthest of those vertices.
+    if (error) {
+        float maxDistance = 0.0f;
+        for (uint32_t v : input)
+            maxDistance = qMax(maxDistance, (positions[target[v]] - positions[v]).length());
+        *error = maxDistance;
+    }
+    return indices;
+}
+
+// a MeshData vertex, welded bitwise
+struct MeshDataVertex {
+    QVector3D position;
+    QVector2D uv;
+};
+
+MeshData simplifyMeshData(const MeshData& mesh, float ratio, float* error) {
+    DEBUG_ENTRY;
+    QVector<MeshDataVertex> triangles(mesh.pos.size());
+    for (int i = 0; i < mesh.pos.size(); i++) {
+        triangles[i].position = mesh.pos[i];
+        triangles[i].uv = i < mesh.uv.size() ? mesh.uv[i] : QVector2D();
+    }
+    QVector<MeshDataVertex> vertices;
+    QVector<uint32_t> indices = weldVertices(triangles, &vertices);
+    QVector<QVector3D> positions(vertices.size());
+    for (int i = 0; i < vertices.size(); i++)
+        positions[i] = vertices[i].position;
+
+    QVector<uint32_t> simplified = simplifyMesh(indices, positions,
+                                                (uint32_t)(indices.size() * ratio) / 3 * 3, error);
+    MeshData result;
+    result.pos.reserve(simplified.size());
+    result.uv.reserve(simplified.size());
+    for (uint32_t i : simplified) {
+        result.pos << vertices[i].position;
+        result.uv << vertices[i].uv;
+    }
+    return result;
+}
+
+QVkLodSelector::QVkLodSelector(const QVector<QVkLod>& lods, float maxPixelError, float hysteresis)
+    : m_maxPixelError(maxPixelError)
+    , m_hysteresis(hysteresis)
+{
+    for (const QVkLod& lod : lods)
+        m_errors.append(lod.error);
+}
+
+float QVkLodSelector::pixelsPerUnit(float fovY, int viewportHeight) {
+    return viewportHeight / (2.0f * std::tan(qDegreesToRadians(fovY) / 2.0f));
+}
+
+float QVkLodSelector::screenError(int lod, float distance, float pixelsPerUnit) const {
+    return m_errors[lod] * pixelsPerUnit / qMax(distance, 1e-3f);
+}
+
+int QVkLodSelector::select(float distance, float pixelsPerUnit, int current) const {
+    if (m_errors.isEmpty())
+        return 0;
+    const int last = m_errors.size() - 1;
+    if (current < 0) {
+        int lod = 0;
+        while (lod < last && screenError(lod + 1, distance, pixelsPerUnit) <= m_maxPixelError)
+            lod++;
+        return lod;
+    }
+
+    int lod = qMin(current, last);
+    while (lod > 0 && screenError(lod, distance, pixelsPerUnit) > m_maxPixelError)
+        lod--;
+    const float coarser = m_maxPixelError * (1.0f - m_hysteresis);
+    while (lod < last && screenError(lod + 1, distance, pixelsPerUnit) <= coarser)
+        lod++;
+    return lod;
+}
@@ -0,0 +1,100 @@
+#ifndef QVKLOD_H
+#define QVKLOD_H
+
+#include <QVector>
+#include <QVector3D>
+#include "qvkmesh.h"
+
+struct MeshData;
+
+/*
+ * Level of detail: simplified versions of a mesh, chosen per object by the
+ * size of their error on screen.
+ *
+ * simplifyMesh() collapses edges in the order of their quadric error
+ * (Garland and Heckbert, "Surface Simplification Using Quadric Error
+ * Metrics"). A vertex is only ever collapsed onto one of its neighbors, so
+ * every LOD indexes a subset of the original vertices and all LODs share
+ * one vertex buffer. Vertices on mesh borders only move along the border,
+ * vertices on attribute seams move together with their twin on the other
+ * side, and corners of several seams or borders stay put.
+ */
+
+// Indices of a simplified version of the triangles in indices, with about
+// targetIndexCount indices if that is possible. error receives an upper
+// bound of the distance the surface moved, in the units of positions: the
+// farthest any vertex of indices moved onto the vertex it collapsed into.
+// The quadric error only orders the collapses.
+QVector<uint32_t> simplifyMesh(const QVector<uint32_t>& indices, const QVector<QVector3D>& positions,
+                               uint32_t targetIndexCount, float* error = nullptr);
+
+// MeshData with about ratio of its triangles. Vertices are welded by
+// position and texture coordinate first, so the result keeps its seams.
+MeshData simplifyMeshData(const MeshData& mesh, float ratio, float* error = nullptr);
+
+// a range of the index buffer of a mesh
+struct QVkLod {
+    uint32_t firstIndex;
+    uint32_t indexCount;
+    // distance the surface may be off from the full detail mesh
+    float error;
+};
+
+// Appends LODs to mesh.indices, each with about ratio of the triangles of
+// the one before, until maxLods or the simplifier gets stuck. LOD 0 is the
+// mesh itself. VT needs a QVector3D position.
+template <typename VT>
+QVector<QVkLod> buildLodChain(QVkMesh<VT>& mesh, int maxLods = 6, float ratio = 0.5f) {
+    QVector<QVector3D> positions(mesh.vertices.size());
+    for (int i = 0; i < mesh.vertices.size(); i++)
+        positions[i] = mesh.vertices[i].position;
+
+    QVector<QVkLod> lods;
+    lods.append({0, (uint32_t)mesh.indices.size(), 0.0f});
+    QVector<uint32_t> previous = mesh.indices;
+    float error = 0.0f;
+    while (lods.size() < maxLods) {
+        uint32_t target = (uint32_t)(previous.size() * ratio) / 3 * 3;
+        float stepError = 0.0f;
+        QVector<uint32_t> simplified = simplifyMesh(previous, positions, target, &stepError);
+        // less than half of the reduction asked for
+        if (simplified.isEmpty() || simplified.size() > previous.size() * (1.0f + ratio) / 2.0f)
+            break;
+        optimizeVertexCache(simplified, positions.size());
+        // errors of successive simplifications add up at most
+        error += stepError;
+        lods.append({(uint32_t)mesh.indices.size(), (uint32_t)simplified.size(), error});
+        mesh.indices += simplified;
+        previous.swap(simplified);
+    }
+    return lods;
+}
+
+/*
+ * Picks the coarsest LOD whose error projects to at most maxPixelError
+ * pixels. An object only switches to a coarser LOD once it would be below
+ * maxPixelError * (1 - hysteresis), so objects moving back and forth
+ * around a switching distance do not pop every frame.
+ */
+class QVkLodSelector {
+public:
+    explicit QVkLodSelector(const QVector<QVkLod>& lods = QVector<QVkLod>(),
+                            float maxPixelError = 1.0f, float hysteresis = 0.25f);
+
+    // pixels covered by one unit at distance 1, for a perspective
+    // projection with a vertical field of view of fovY degrees
+    static float pixelsPerUnit(float fovY, int viewportHeight);
+
+    // error of lod in pixels, for an object at distance
+    float screenError(int lod, float distance, float pixelsPerUnit) const;
+
+    // current is the LOD of the object in the last frame, -1 if none
+    int select(float distance, float pixelsPerUnit, int current = -1) const;
+
+private:
+    QVector<float> m_errors;
+    float m_maxPixelError;
+    float m_hysteresis;
+};
+
+#endif // QVKLOD_H
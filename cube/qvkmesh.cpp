@@ -0,0 +1,185 @@
+#include "qvkmesh.h"
+#include <cmath>
+
+// Size of the simulated cache the scores are tuned for. It is larger
+// than real post-transform caches, which only makes the result less
+// sensitive to their actual size.
+static const int CACHE_SIZE = 32;
+static const float CACHE_DECAY_POWER = 1.5f;
+static const float LAST_TRIANGLE_SCORE = 0.75f;
+static const float VALENCE_BOOST_SCALE = 2.0f;
+static const float VALENCE_BOOST_POWER = 0.5f;
+
+static float vertexScore(int cachePosition, uint32_t remainingTriangles) {
+    if (remainingTriangles == 0)
+        return -1.0f;
+
+    float score = 0.0f;
+    if (cachePosition >= 0) {
+        if (cachePosition < 3) {
+            // the vertices of the last triangle, reusing them right away
+            // would favor strips over fans
+            score = LAST_TRIANGLE_SCORE;
+        } else {
+            const float scale = 1.0f / (CACHE_SIZE - 3);
+            score = std::pow(1.0f - (cachePosition - 3) * scale, CACHE_DECAY_POWER);
+        }
+    }
+    // finish off vertices with few triangles left, so they don't have to
+    // be transformed once more later
+    score += VALENCE_BOOST_SCALE * std::pow((float)remainingTriangles, -VALENCE_BOOST_POWER);
+    return score;
+}
+
+VkIndexType indexTypeFor(uint32_t vertexCount) {
+    return vertexCount <= 0xffff ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32;
+}
+
+uint32_t indexSize(VkIndexType type) {
+    return type == VK_INDEX_TYPE_UINT16 ? 2 : 4;
+}
+
+void optimizeVertexCache(QVector<uint32_t>& indices, uint32_t vertexCount) {
+    const int triangleCount = indices.size() / 3;
+    if (triangleCount == 0)
+        return;
+
+    // triangles using each vertex, the first remaining[v] entries from
+    // offsets[v] on are the ones not emitted yet
+    QVector<uint32_t> remaining(vertexCount, 0);
+    for (int i = 0; i < triangleCount * 3; i++)
+        remaining[indices[i]]++;
+    QVector<uint32_t> offsets(vertexCount + 1, 0);
+    for (uint32_t v = 0; v < vertexCount; v++)
+        offsets[v + 1] = offsets[v] + remaining[v];
+    QVector<uint32_t> adjacency(triangleCount * 3);
+    QVector<uint32_t> fill = offsets;
+    for (int i = 0; i < triangleCount * 3; i++)
+        adjacency[fill[indices[i]]++] = i / 3;
+
+    QVector<int> cachePosition(vertexCount, -1);
+    QVector<float> score(vertexCount);
+    for (uint32_t v = 0; v < vertexCount; v++)
+        score[v] = vertexScore(-1, remaining[v]);
+    QVector<float> triangleScore(triangleCount);
+    for (int t = 0; t < triangleCount; t++)
+        triangleScore[t] = score[indices[t * 3]] + score[indices[t * 3 + 1]] + score[indices[t * 3 + 2]];
+
+    QVector<bool> emitted(triangleCount, false);
+    QVector<uint32_t> result;
+    result.reserve(triangleCount * 3);
+    QVector<uint32_t> cache;
+    QVector<uint32_t> newCache;
+    cache.reserve(CACHE_SIZE + 3);
+    newCache.reserve(CACHE_SIZE + 3);
+
+    auto updateScore = [&](uint32_t v) {
+        float s = vertexScore(cachePosition[v], remaining[v]);
+        float delta = s - score[v];
+        score[v] = s;
+        for (uint32_t i = offsets[v]; i < offsets[v] + remaining[v]; i++)
+            triangleScore[adjacency[i]] += delta;
+    };
+
+    int best = -1;
+    int cursor = 0;
+    for (int n = 0; n < triangleCount; n++) {
+        if (best < 0) {
+            // nothing in the cache has triangles left, start over with
+            // the next triangle in input order
+            while (emitted[cursor])
+                cursor++;
+            best = cursor;
+        }
+        emitted[best] = true;
+        const uint32_t* tri = indices.constData() + best * 3;
+        result << tri[0] << tri[1] << tri[2];
+
+        newCache.clear();
+        newCache << tri[0] << tri[1] << tri[2];
+        for (int i = 0; i < cache.size(); i++) {
+            uint32_t v = cache[i];
+            if (v != tri[0] && v != tri[1] && v != tri[2])
+                newCache << v;
+        }
+
+        for (int k = 0; k < 3; k++) {
+            uint32_t v = tri[k];
+            uint32_t last = offsets[v] + remaining[v] - 1;
+            for (uint32_t i = offsets[v]; i <= last; i++) {
+                if (adjacency[i] == (uint32_t)best) {
+                    qSwap(adjacency[i], adjacency[last]);
+                    break;
+                }
+            }
+            remaining[v]--;
+        }
+
+        // vertices pushed out of the cache
+        for (int i = CACHE_SIZE; i < newCache.size(); i++) {
+            uint32_t v = newCache[i];
+            cachePosition[v] = -1;
+            updateScore(v);
+        }
+        if (newCache.size() > CACHE_SIZE)
+            newCache.resize(CACHE_SIZE);
+        cache.swap(newCache);
+
+        for (int i = 0; i < cache.size(); i++) {
+            cachePosition[cache[i]] = i;
+            updateScore(cache[i]);
+        }
+
+        // only triangles of cached vertices changed their score enough
+        // to matter
+        best = -1;
+        float bestScore = -1.0f;
+        for (int i = 0; i < cache.size(); i++) {
+            uint32_t v = cache[i];
+            for (uint32_t j = offsets[v]; j < offsets[v] + remaining[v]; j++) {
+                uint32_t t = adjacency[j];
+                if (triangleScore[t] > bestScore) {
+                    bestScore = triangleScore[t];
+                    best = t;
+                }
+            }
+        }
+    }
+
+    // a trailing partial triangle is kept as it is
+    for (int i = triangleCount * 3; i < indices.size(); i++)
+        result << indices[i];
+    indices.swap(result);
+}
+
+float vertexCacheMissRatio(const QVector<uint32_t>& indices, uint32_t vertexCount,
+                           uint32_t cacheSize) {
+    const int triangleCount = indices.size() / 3;
+    if (triangleCount == 0)
+        return 0.0f;
+
+    // time each vertex entered the cache, it is still in there if that
+    // was less than cacheSize misses ago
+    QVector<uint32_t> insertedAt(vertexCount, 0);
+    uint32_t misses = 0;
+    for (int i = 0; i < triangleCount * 3; i++) {
+        uint32_t v = indices[i];
+        if (insertedAt[v] == 0 || misses - insertedAt[v] >= cacheSize) {
+            misses++;
+            insertedAt[v] = misses;
+        }
+    }
+    return (float)misses / triangleCount;
+}
+
+uint32_t vertexFetchRemap(const QVector<uint32_t>& indices, uint32_t vertexCount,
+                          QVector<uint32_t>* remap) {
+    remap->fill(~0u, vertexCount);
+    uint32_t next = 0;
+    for (int i = 0; i < indices.size(); i++) {
+        uint32_t& r = (*remap)[indices[i]];
+        if (r == ~0u)
+            r = next++;
+    }
+    return next;
+}
@@ -0,0 +1,104 @@
+#ifndef QVKMESH_H
+#define QVKMESH_H
+
+#include <vulkan/vulkan.h>
+#include <QByteArray>
+#include <QHash>
+#include <QVector>
+
+/*
+ * Preprocessing of indexed triangle meshes:
+ *
+ * weldVertices() merges bitwise identical vertices of a triangle list,
+ * optimizeVertexCache() reorders triangles so vertices are reused while
+ * they are still in the post-transform cache and optimizeVertexFetch()
+ * reorders vertices into the order they are first used, so vertex fetches
+ * walk the vertex buffer mostly linearly.
+ */
+
+// VK_INDEX_TYPE_UINT16 if all vertices can be addressed with 16 bits
+VkIndexType indexTypeFor(uint32_t vertexCount);
+
+// bytes per index
+uint32_t indexSize(VkIndexType type);
+
+// Reorders the triangles of indices for the post-transform vertex cache,
+// after Tom Forsyth's "Linear-Speed Vertex Cache Optimisation".
+void optimizeVertexCache(QVector<uint32_t>& indices, uint32_t vertexCount);
+
+// Average cache miss ratio (vertex shader invocations per triangle) of
+// indices with a FIFO cache of cacheSize vertices. 3 is the worst case,
+// 0.5 the limit for large regular meshes.
+float vertexCacheMissRatio(const QVector<uint32_t>& indices, uint32_t vertexCount,
+                           uint32_t cacheSize = 16);
+
+// New index of every vertex in order of first use by indices. Returns the
+// number of used vertices, unused ones are mapped to ~0u.
+uint32_t vertexFetchRemap(const QVector<uint32_t>& indices, uint32_t vertexCount,
+                          QVector<uint32_t>* remap);
+
+// Indices into *vertices, which receives each distinct vertex of the
+// triangle list once. VT must not contain padding, vertices are compared
+// bitwise.
+template <typename VT>
+QVector<uint32_t> weldVertices(const QVector<VT>& triangles, QVector<VT>* vertices) {
+    QHash<QByteArray, uint32_t> unique;
+    unique.reserve(triangles.size());
+    QVector<uint32_t> indices(triangles.size());
+    vertices->clear();
+    for (int i = 0; i < triangles.size(); i++) {
+        // refers to triangles, which outlives unique
+        QByteArray key = QByteArray::fromRawData(reinterpret_cast<const char*>(&triangles[i]), sizeof(VT));
+        auto it = unique.constFind(key);
+        uint32_t index;
+        if (it == unique.constEnd()) {
+            index = vertices->size();
+            unique.insert(key, index);
+            vertices->append(triangles[i]);
+        } else {
+            index = it.value();
+        }
+        indices[i] = index;
+    }
+    return indices;
+}
+
+// Reorders vertices into the order of first use, unused vertices are
+// dropped.
+template <typename VT>
+void optimizeVertexFetch(QVector<VT>& vertices, QVector<uint32_t>& indices) {
+    QVector<uint32_t> remap;
+    uint32_t used = vertexFetchRemap(indices, vertices.size(), &remap);
+    QVector<VT> reordered(used);
+    for (int i = 0; i < vertices.size(); i++) {
+        if (remap[i] != ~0u)
+            reordered[remap[i]] = vertices[i];
+    }
+    for (int i = 0; i < indices.size(); i++)
+        indices[i] = remap[indices[i]];
+    vertices.swap(reordered);
+}
+
+template <typename VT> struct QVkMesh {
+    QVector<VT> vertices;
+    QVector<uint32_t> indices;
+
+    // welded and optimized mesh of a non-indexed triangle list
+    static QVkMesh fromTriangles(const QVector<VT>& triangles) {
+        QVkMesh mesh;
+        mesh.indices = weldVertices(triangles, &mesh.vertices);
+        mesh.optimize();
+        return mesh;
+    }
+
+    void optimize() {
+        optimizeVertexCache(indices, vertices.size());
+        optimizeVertexFetch(vertices, indices);
+    }
+
+    VkIndexType indexType() const {
+        return indexTypeFor(vertices.size());
+    }
+};
+
+#endif // QVKMESH_H
@@ -0,0 +1,241 @@
+#include <QVector>
+#include "qvkmipmap.h"
+
+// stages sampling the generated levels may start in
+static const VkPipelineStageFlags SHADER_STAGES =
+        VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+
+QVkMipGenerator::QVkMipGenerator(QSharedPointer<QVkDevice> dev, VkPhysicalDevice gpu, VkShaderModule shader)
+    : QVkDeviceResource(dev)
+    , m_gpu(gpu)
+{
+    DEBUG_ENTRY;
+    VkResult U_ASSERT_ONLY err;
+
+    // level above, level below
+    VkDescriptorSetLayoutBinding bindings[2] = {};
+    for (uint32_t i = 0; i < 2; i++) {
+        bindings[i].binding = i;
+        bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+        bindings[i].descriptorCount = 1;
+        bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    }
+    VkDescriptorSetLayoutCreateInfo layout_ci = {};
+    layout_ci.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layout_ci.bindingCount = 2;
+    layout_ci.pBindings = bindings;
+    err = vkCreateDescriptorSetLayout(device(), &layout_ci, nullptr, &m_setLayout);
+    Q_ASSERT(!err);
+
+    VkPipelineLayoutCreateInfo pipelineLayout_ci = {};
+    pipelineLayout_ci.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayout_ci.setLayoutCount = 1;
+    pipelineLayout_ci.pSetLayouts = &m_setLayout;
+    err = vkCreatePipelineLayout(device(), &pipelineLayout_ci, nullptr, &m_pipelineLayout);
+    Q_ASSERT(!err);
+
+    VkComputePipelineCreateInfo pipeline_ci = {};
+    pipeline_ci.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    pipeline_ci.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    pipeline_ci.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    pipeline_ci.stage.module = shader;
+    pipeline_ci.stage.pName = "main";
+    pipeline_ci.layout = m_pipelineLayout;
+    err = vkCreateComputePipelines(device(), nullptr, 1, &pipeline_ci, nullptr, &m_pipeline);
+    Q_ASSERT(!err);
+    vkDestroyShaderModule(device(), shader, nullptr);
+}
+
+QVkMipGenerator::~QVkMipGenerator() {
+    DEBUG_ENTRY;
+    vkDestroyPipeline(device(), m_pipeline, nullptr);
+    vkDestroyPipelineLayout(device(), m_pipelineLayout, nullptr);
+    vkDestroyDescriptorSetLayout(device(), m_setLayout, nullptr);
+}
+
+uint32_t QVkMipGenerator::levelCount(uint32_t width, uint32_t height) {
+    uint32_t levels = 1;
+    for (uint32_t size = qMax(width, height); size > 1; size /= 2)
+        levels++;
+    return levels;
+}
+
+QVkMipGenerator::Method QVkMipGenerator::method(VkFormat format) const {
+    VkFormatProperties props;
+    vkGetPhysicalDeviceFormatProperties(m_gpu, format, &props);
+    const VkFormatFeatureFlags blit = VK_FORMAT_FEATURE_BLIT_SRC_BIT |
+                                      VK_FORMAT_FEATURE_BLIT_DST_BIT |
+                                      VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+    if ((props.optimalTilingFeatures & blit) == blit)
+        return Blit;
+    // the format mip.comp declares its images with
+    if (format == VK_FORMAT_R8G8B8A8_UNORM &&
+        (props.optimalTilingFeatures & VK_FORMAT_FEATURE_STORAGE_IMAGE_BIT))
+        return Compute;
+    return None;
+}
+
+uint32_t QVkMipGenerator::levels(VkFormat format, uint32_t width, uint32_t height) const {
+    return method(format) == None ? 1 : levelCount(width, height);
+}
+
+VkImageUsageFlags QVkMipGenerator::usage(VkFormat format) const {
+    switch (method(format)) {
+    case Blit:      return VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+    case Compute:   return VK_IMAGE_USAGE_STORAGE_BIT;
+    case None:      return 0;
+    }
+    return 0;
+}
+
+void QVkMipGenerator::record(QVkCommandBufferRecorder& recorder, VkImage image, VkFormat format,
+                             uint32_t width, uint32_t height, uint32_t levels,
+                             VkImageLayout finalLayout) {
+    DEBUG_ENTRY;
+    Method how = levels > 1 ? method(format) : None;
+    if (how == Blit) {
+        recordBlits(recorder, image, width, height, levels, finalLayout);
+    } else if (how == Compute) {
+        recordCompute(recorder, image, format, width, height, levels, finalLayout);
+    } else {
+        Q_ASSERT(levels == 1);
+        VkImageMemoryBarrier toFinal = levelBarrier(image, 0, 1,
+                VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, finalLayout,
+                VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT);
+        recorder.pipelineBarrier(VK_PIPELINE_STAGE_TRANSFER_BIT, SHADER_STAGES, 0, &toFinal);
+    }
+}
+
+void QVkMipGenerator::recordBlits(QVkCommandBufferRecorder& recorder, VkImage image,
+                                  uint32_t width, uint32_t height, uint32_t levels,
+                                  VkImageLayout finalLayout) {
+    // every level below 0 is written once, by the blit into it
+    VkImageMemoryBarrier toDst = levelBarrier(image, 1, levels - 1,
+            VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+            0, VK_ACCESS_TRANSFER_WRITE_BIT);
+    recorder.pipelineBarrier(VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, &toDst);
+
+    int32_t w = (int32_t)width, h = (int32_t)height;
+    for (uint32_t level = 1; level < levels; level++) {
+        VkImageBlit blit = {};
+        blit.srcSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, level - 1, 0, 1};
+        blit.srcOffsets[1] = {w, h, 1};
+        w = qMax(1, w / 2);
+        h = qMax(1, h / 2);
+        blit.dstSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, level, 0, 1};
+        blit.dstOffsets[1] = {w, h, 1};
+        recorder.blitImage(image, image, blit, VK_FILTER_LINEAR);
+
+        // the next blit reads this level
+        VkImageMemoryBarrier toSrc = levelBarrier(image, level, 1,
+                VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_TRANSFER_READ_BIT);
+        recorder.pipelineBarrier(VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, &toSrc);
+    }
+
+    VkImageMemoryBarrier toFinal = levelBarrier(image, 0, levels,
+            VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, finalLayout,
+            VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT);
+    recorder.pipelineBarrier(VK_PIPELINE_STAGE_TRANSFER_BIT, SHADER_STAGES, 0, &toFinal);
+}
+
+void QVkMipGenerator::recordCompute(QVkCommandBufferRecorder& recorder, VkImage image, VkFormat format,
+                                    uint32_t width, uint32_t height, uint32_t levels,
+                                    VkImageLayout finalLayout) {
+    VkResult U_ASSERT_ONLY err;
+
+    // storage images are read and written in the general layout
+    VkImageMemoryBarrier toGeneral[2] = {
+        levelBarrier(image, 0, 1,
+                     VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_GENERAL,
+                     VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT),
+        levelBarrier(image, 1, levels - 1,
+                     VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL,
+                     0, VK_ACCESS_SHADER_WRITE_BIT)
+    };
+    recorder.pipelineBarrier(VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                             VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+                             0, nullptr, 0, nullptr, 2, toGeneral);
+
+    // A view per level and a set per generated level. They are retired
+    // right away, the batch recording them is submitted before the frame
+    // they are tagged with.
+    QVector<VkImageView> views(levels);
+    for (uint32_t level = 0; level < levels; level++) {
+        VkImageViewCreateInfo view = {};
+        view.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+        view.image = image;
+        view.viewType = VK_IMAGE_VIEW_TYPE_2D;
+        view.format = format;
+        view.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, level, 1, 0, 1};
+        err = vkCreateImageView(device(), &view, nullptr, &views[level]);
+        Q_ASSERT(!err);
+    }
+
+    VkDescriptorPoolSize poolSize = {};
+    poolSize.type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+    poolSize.descriptorCount = 2 * (levels - 1);
+    VkDescriptorPoolCreateInfo pool_ci = {};
+    pool_ci.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    pool_ci.maxSets = levels - 1;
+    pool_ci.poolSizeCount = 1;
+    pool_ci.pPoolSizes = &poolSize;
+    VkDescriptorPool pool = nullptr;
+    err = vkCreateDescriptorPool(device(), &pool_ci, nullptr, &pool);
+    Q_ASSERT(!err);
+
+    QVector<VkDescriptorSetLayout> setLayouts(levels - 1, m_setLayout);
+    QVector<VkDescriptorSet> sets(levels - 1);
+    VkDescriptorSetAllocateInfo alloc_info = {};
+    alloc_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    alloc_info.descriptorPool = pool;
+    alloc_info.descriptorSetCount = levels - 1;
+    alloc_info.pSetLayouts = setLayouts.constData();
+    err = vkAllocateDescriptorSets(device(), &alloc_info, sets.data());
+    Q_ASSERT(!err);
+
+    QVector<VkDescriptorImageInfo> infos(levels);
+    for (uint32_t level = 0; level < levels; level++) {
+        infos[level].imageView = views[level];
+        infos[level].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+    }
+    QVector<VkWriteDescriptorSet> writes(2 * (levels - 1));
+    for (uint32_t i = 0; i < (uint32_t)writes.size(); i++) {
+        writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        writes[i].dstSet = sets[i / 2];
+        writes[i].dstBinding = i % 2;
+        writes[i].descriptorCount = 1;
+        writes[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+        // set n reads level n and writes level n + 1
+        writes[i].pImageInfo = &infos[i / 2 + i % 2];
+    }
+    vkUpdateDescriptorSets(device(), writes.size(), writes.constData(), 0, nullptr);
+
+    recorder.bindPipeline(m_pipeline, VK_PIPELINE_BIND_POINT_COMPUTE);
+    uint32_t w = width, h = height;
+    for (uint32_t level = 1; level < levels; level++) {
+        w = qMax(1u, w / 2);
+        h = qMax(1u, h / 2);
+        recorder.bindDescriptorSet(m_pipelineLayout, &sets[level - 1], 0, nullptr,
+                                   VK_PIPELINE_BIND_POINT_COMPUTE)
+            .dispatch((w + MIP_GROUP_SIZE - 1) / MIP_GROUP_SIZE,
+                      (h + MIP_GROUP_SIZE - 1) / MIP_GROUP_SIZE);
+
+        // the next dispatch reads this level
+        VkImageMemoryBarrier written = levelBarrier(image, level, 1,
+                VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_GENERAL,
+                VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT);
+        recorder.pipelineBarrier(VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                                 VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, &written);
+    }
+
+    VkImageMemoryBarrier toFinal = levelBarrier(image, 0, levels,
+            VK_IMAGE_LAYOUT_GENERAL, finalLayout,
+            VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT);
+    recorder.pipelineBarrier(VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, SHADER_STAGES, 0, &toFinal);
+
+    QVkDeletionQueue& retired = dev()->deletionQueue();
+    for (VkImageView view : views)
+        retired.retire(view, vkDestroyImageView);
+    retired.retire(pool, vkDestroyDescriptorPool);
+}
@@ -0,0 +1,66 @@
+#ifndef QVKMIPMAP_H
+#define QVKMIPMAP_H
+
+#include <vulkan/vulkan.h>
+#include "qvkdevice.h"
+#include "qvkcmdbuf.h"
+
+// local size of mip.comp in x and y
+#define MIP_GROUP_SIZE 8
+
+/*
+ * Generates the mip levels of images from their level 0 on the GPU.
+ *
+ * Formats that support linear filtered blits get a chain of
+ * vkCmdBlitImage, every level from the one above it. The others fall back
+ * to mip.comp, a 2x2 box filter from a storage image view of one level to
+ * the next, which needs VK_FORMAT_R8G8B8A8_UNORM with storage image
+ * support. Images of formats supporting neither get a single level, see
+ * levels().
+ */
+class QVkMipGenerator : public QVkDeviceResource {
+public:
+    enum Method {
+        None,
+        Blit,
+        Compute
+    };
+
+    // shader is the module of mip.comp, the generator destroys it
+    QVkMipGenerator(QSharedPointer<QVkDevice> dev, VkPhysicalDevice gpu, VkShaderModule shader);
+    ~QVkMipGenerator();
+    Q_DISABLE_COPY(QVkMipGenerator)
+
+    // levels of a full chain, down to 1x1
+    static uint32_t levelCount(uint32_t width, uint32_t height);
+
+    Method method(VkFormat format) const;
+
+    // levels to create optimal images of format with, 1 if record() can
+    // not generate them
+    uint32_t levels(VkFormat format, uint32_t width, uint32_t height) const;
+
+    // usage the images need besides what their upload and sampling need
+    VkImageUsageFlags usage(VkFormat format) const;
+
+    // Records the generation of levels 1 to levels - 1 of image. Level 0
+    // has to be in VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, with the writes
+    // to it available, the contents of the other levels are discarded.
+    // All levels end up in finalLayout, visible to shaders.
+    void record(QVkCommandBufferRecorder& recorder, VkImage image, VkFormat format,
+                uint32_t width, uint32_t height, uint32_t levels,
+                VkImageLayout finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+
+private:
+    void recordBlits(QVkCommandBufferRecorder& recorder, VkImage image,
+                     uint32_t width, uint32_t height, uint32_t levels, VkImageLayout finalLayout);
+    void recordCompute(QVkCommandBufferRecorder& recorder, VkImage image, VkFormat format,
+                       uint32_t width, uint32_t height, uint32_t levels, VkImageLayout finalLayout);
+
+    VkPhysicalDevice m_gpu;
+    VkDescriptorSetLayout m_setLayout           {nullptr};
+    VkPipelineLayout m_pipelineLayout           {nullptr};
+    VkPipeline m_pipeline                       {nullptr};
+};
+
+#endif // QVKMIPMAP_H
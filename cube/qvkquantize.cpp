@@ -0,0 +1,190 @@
+#include "qvkquantize.h"
+#include <cmath>
+#include <cstring>
+#include <cfloat>
+
+uint16_t floatToHalf(float f) {
+    uint32_t bits;
+    memcpy(&bits, &f, sizeof(bits));
+    const uint32_t sign = (bits >> 16) & 0x8000;
+    const uint32_t exponent = (bits >> 23) & 0xff;
+    uint32_t mantissa = bits & 0x7fffff;
+
+    if (exponent == 0xff) {
+        // infinity stays infinity, NaN stays NaN
+        return (uint16_t)(sign | 0x7c00 | (mantissa ? 0x200 : 0));
+    }
+
+    int e = (int)exponent - 127 + 15;
+    if (e >= 0x1f) {
+        // overflow
+        return (uint16_t)(sign | 0x7c00);
+    }
+    if (e <= 0) {
+        // denormal or zero
+        if (e < -10)
+            return (uint16_t)sign;
+        mantissa |= 0x800000;
+        const uint32_t shift = (uint32_t)(14 - e);
+        uint32_t half = mantissa >> shift;
+        const uint32_t rest = mantissa & ((1u << shift) - 1);
+        const uint32_t halfway = 1u << (shift - 1);
+        if (rest > halfway || (rest == halfway && (half & 1)))
+            half++;
+        return (uint16_t)(sign | half);
+    }
+
+    uint32_t half = ((uint32_t)e << 10) | (mantissa >> 13);
+    const uint32_t rest = mantissa & 0x1fff;
+    // a carry into the exponent rounds up correctly, up to infinity
+    if (rest > 0x1000 || (rest == 0x1000 && (half & 1)))
+        half++;
+    return (uint16_t)(sign | half);
+}
+
+float halfToFloat(uint16_t h) {
+    const uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+    const uint32_t exponent = (h >> 10) & 0x1f;
+    const uint32_t mantissa = h & 0x3ff;
+
+    uint32_t bits;
+    if (exponent == 0x1f) {
+        bits = sign | 0x7f800000 | (mantissa << 13);
+    } else if (exponent != 0) {
+        bits = sign | ((exponent - 15 + 127) << 23) | (mantissa << 13);
+    } else if (mantissa == 0) {
+        bits = sign;
+    } else {
+        // denormal, 2^-24 per mantissa step
+        float f = std::ldexp((float)mantissa, -24);
+        return sign ? -f : f;
+    }
+    float f;
+    memcpy(&f, &bits, sizeof(f));
+    return f;
+}
+
+int16_t floatToSnorm16(float f) {
+    f = qBound(-1.0f, f, 1.0f);
+    return (int16_t)std::lround(f * 32767.0f);
+}
+
+float snorm16ToFloat(int16_t v) {
+    return qMax(-1.0f, v / 32767.0f);
+}
+
+uint16_t floatToUnorm16(float f) {
+    f = qBound(0.0f, f, 1.0f);
+    return (uint16_t)std::lround(f * 65535.0f);
+}
+
+float unorm16ToFloat(uint16_t v) {
+    return v / 65535.0f;
+}
+
+QVkPositionQuantizer::QVkPositionQuantizer(const QVector<QVector3D>& positions) {
+    QVector3D min(FLT_MAX, FLT_MAX, FLT_MAX);
+    QVector3D max(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+    for (const QVector3D& p : positions) {
+        for (int i = 0; i < 3; i++) {
+            min[i] = qMin(min[i], p[i]);
+            max[i] = qMax(max[i], p[i]);
+        }
+    }
+    if (positions.isEmpty()) {
+        min = QVector3D();
+        max = QVector3D();
+    }
+    m_center = (min + max) * 0.5f;
+    m_extent = (max - min) * 0.5f;
+    // flat meshes would divide by zero
+    for (int i = 0; i < 3; i++)
+        m_extent[i] = qMax(m_extent[i], 1e-6f);
+}
+
+QVector3D QVkPositionQuantizer::normalize(const QVector3D& position) const {
+    return (position - m_center) / m_extent;
+}
+
+QVector3D QVkPositionQuantizer::denormalize(const QVector3D& normalized) const {
+    return normalized * m_extent + m_center;
+}
+
+QVkSnorm16x4 QVkPositionQuantizer::encodeSnorm(const QVector3D& position) const {
+    QVector3D n = normalize(position);
+    QVkSnorm16x4 v;
+    v.x = floatToSnorm16(n.x());
+    v.y = floatToSnorm16(n.y());
+    v.z = floatToSnorm16(n.z());
+    v.w = floatToSnorm16(1.0f);
+    return v;
+}
+
+QVkHalf4 QVkPositionQuantizer::encodeHalf(const QVector3D& position) const {
+    QVector3D n = normalize(position);
+    QVkHalf4 v;
+    v.x = floatToHalf(n.x());
+    v.y = floatToHalf(n.y());
+    v.z = floatToHalf(n.z());
+    v.w = floatToHalf(1.0f);
+    return v;
+}
+
+QVector3D QVkPositionQuantizer::decode(const QVkSnorm16x4& position) const {
+    return denormalize(QVector3D(snorm16ToFloat(position.x),
+                                 snorm16ToFloat(position.y),
+                                 snorm16ToFloat(position.z)));
+}
+
+QVector3D QVkPositionQuantizer::decode(const QVkHalf4& position) const {
+    return denormalize(QVector3D(halfToFloat(position.x),
+                                 halfToFloat(position.y),
+                                 halfToFloat(position.z)));
+}
+
+QMatrix4x4 QVkPositionQuantizer::dequantization() const {
+    QMatrix4x4 m;
+    m.translate(m_center);
+    m.scale(m_extent);
+    return m;
+}
+
+QVkUnorm16x2 encodeUv(const QVector2D& uv) {
+    QVkUnorm16x2 v;
+    v.u = floatToUnorm16(uv.x());
+    v.v = floatToUnorm16(uv.y());
+    return v;
+}
+
+QVector2D decodeUv(const QVkUnorm16x2& uv) {
+    return QVector2D(unorm16ToFloat(uv.u), unorm16ToFloat(uv.v));
+}
+
+void QVkQuantizationReport::addPosition(const QVector3D& original, const QVector3D& decoded, float boundsSize) {
+    float error = (decoded - original).length();
+    positions++;
+    maxPositionError = qMax(maxPositionError, error);
+    sumSquaredPositionError += (double)error * error;
+    if (boundsSize > 0.0f)
+        maxRelativePositionError = qMax(maxRelativePositionError, error / boundsSize);
+}
+
+void QVkQuantizationReport::addUv(const QVector2D& original, const QVector2D& decoded) {
+    uvs++;
+    maxUvError = qMax(maxUvError, (decoded - original).length());
+}
+
+float QVkQuantizationReport::rmsPositionError() const {
+    return positions ? (float)std::sqrt(sumSquaredPositionError / positions) : 0.0f;
+}
+
+QDebug operator<<(QDebug dbg, const QVkQuantizationReport& report) {
+    QDebugStateSaver saver(dbg);
+    dbg.nospace() << "QVkQuantizationReport(positions " << report.positions
+                  << ", max error " << report.maxPositionError
+                  << ", rms error " << report.rmsPositionError()
+                  << ", max relative error " << report.maxRelativePositionError
+                  << ", uvs " << report.uvs
+                  << ", max uv error " << report.maxUvError << ")";
+    return dbg;
+}
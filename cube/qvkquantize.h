@@ -0,0 +1,94 @@
+#ifndef QVKQUANTIZE_H
+#define QVKQUANTIZE_H
+
+#include <vulkan/vulkan.h>
+#include <QDebug>
+#include <QMatrix4x4>
+#include <QVector>
+#include <QVector2D>
+#include <QVector3D>
+#include "qvkvertexbuffer.h"
+
+/*
+ * Compact vertex attribute types. Their formats are registered with
+ * QVkVertexFormat, so vertex structs built from them get the matching
+ * attribute formats from QVK_DECLARE_VERTEX_LAYOUT. All of them are
+ * mandatory vertex buffer formats.
+ */
+
+// position in [-1, 1] relative to the bounds, see QVkPositionQuantizer
+struct QVkSnorm16x4 { int16_t x, y, z, w; };
+// half float position, see floatToHalf()
+struct QVkHalf4 { uint16_t x, y, z, w; };
+// texture coordinate in [0, 1]
+struct QVkUnorm16x2 { uint16_t u, v; };
+
+QVK_VERTEX_FORMAT(QVkSnorm16x4, VK_FORMAT_R16G16B16A16_SNORM)
+QVK_VERTEX_FORMAT(QVkHalf4, VK_FORMAT_R16G16B16A16_SFLOAT)
+QVK_VERTEX_FORMAT(QVkUnorm16x2, VK_FORMAT_R16G16_UNORM)
+
+// IEEE 754 binary16, rounded to nearest even
+uint16_t floatToHalf(float f);
+float halfToFloat(uint16_t h);
+
+// the conversions the vertex fetch applies for SNORM and UNORM formats
+int16_t floatToSnorm16(float f);
+float snorm16ToFloat(int16_t v);
+uint16_t floatToUnorm16(float f);
+float unorm16ToFloat(uint16_t v);
+
+/*
+ * Maps the bounding box of a set of positions to [-1, 1]. Encoded
+ * positions are turned back into model space by dequantization(), which
+ * is folded into the model matrix, so shaders need no changes.
+ */
+class QVkPositionQuantizer {
+public:
+    explicit QVkPositionQuantizer(const QVector<QVector3D>& positions);
+
+    QVkSnorm16x4 encodeSnorm(const QVector3D& position) const;
+    QVkHalf4 encodeHalf(const QVector3D& position) const;
+
+    QVector3D decode(const QVkSnorm16x4& position) const;
+    QVector3D decode(const QVkHalf4& position) const;
+
+    // model space position of an encoded one
+    QMatrix4x4 dequantization() const;
+
+    // length of the diagonal of the bounds
+    float size() const { return 2.0f * m_extent.length(); }
+
+private:
+    QVector3D normalize(const QVector3D& position) const;
+    QVector3D denormalize(const QVector3D& normalized) const;
+
+    QVector3D m_center;
+    // half the size of the bounds, at least a tiny bit
+    QVector3D m_extent;
+};
+
+// texture coordinates outside [0, 1] are clamped, the report shows it
+QVkUnorm16x2 encodeUv(const QVector2D& uv);
+QVector2D decodeUv(const QVkUnorm16x2& uv);
+
+/*
+ * Precision lost by quantization, fed with original and decoded values.
+ */
+struct QVkQuantizationReport {
+    uint32_t positions          {0};
+    float maxPositionError      {0.0f};
+    double sumSquaredPositionError {0.0};
+    // largest position error relative to the size of the bounds
+    float maxRelativePositionError {0.0f};
+    uint32_t uvs                {0};
+    float maxUvError            {0.0f};
+
+    void addPosition(const QVector3D& original, const QVector3D& decoded, float boundsSize);
+    void addUv(const QVector2D& original, const QVector2D& decoded);
+
+    float rmsPositionError() const;
+};
+
+QDebug operator<<(QDebug dbg, const QVkQuantizationReport& report);
+
+#endif // QVKQUANTIZE_H
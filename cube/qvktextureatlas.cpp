@@ -0,0 +1,185 @@
+#include <QVector>
+#include "qvktextureatlas.h"
+#include "qvkmipmap.h"
+
+// stages sampling the atlas and the textures copied into it
+static const VkPipelineStageFlags SHADER_STAGES =
+        VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+
+QVkTextureAtlas::QVkTextureAtlas(QSharedPointer<QVkDevice> dev, VkPhysicalDevice gpu, uint32_t count,
+                                 uint32_t maxCellSize)
+    : QVkDeviceResource(dev)
+    , m_gpu(gpu)
+{
+    DEBUG_ENTRY;
+    VkResult U_ASSERT_ONLY err;
+    Q_ASSERT(count > 0);
+
+    // a power of two of columns keeps the cells of every level whole
+    while (m_columns * m_columns < count)
+        m_columns *= 2;
+    m_rows = (count + m_columns - 1) / m_columns;
+    const uint32_t maxSize = dev->limits().maxImageDimension2D;
+    m_cellSize = 1;
+    while (m_cellSize * 2 <= maxCellSize && m_cellSize * 2 * m_columns <= maxSize)
+        m_cellSize *= 2;
+    if (m_cellSize < maxCellSize)
+        qWarning()<<count<<"textures only fit in cells of"<<m_cellSize<<"texels";
+
+    m_texture.format = VK_FORMAT_R8G8B8A8_UNORM;
+    m_texture.swizzle = {
+        VK_COMPONENT_SWIZZLE_IDENTITY, VK_COMPONENT_SWIZZLE_IDENTITY,
+        VK_COMPONENT_SWIZZLE_IDENTITY, VK_COMPONENT_SWIZZLE_IDENTITY,
+    };
+    m_texture.tex_width = m_columns * m_cellSize;
+    m_texture.tex_height = m_rows * m_cellSize;
+    // down to a texel per cell
+    m_texture.mipLevels = QVkMipGenerator::levelCount(m_cellSize, m_cellSize);
+    m_texture.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+    VkImageCreateInfo image_ci = {};
+    image_ci.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    image_ci.imageType = VK_IMAGE_TYPE_2D;
+    image_ci.format = m_texture.format;
+    image_ci.extent = {m_texture.tex_width, m_texture.tex_height, 1};
+    image_ci.mipLevels = m_texture.mipLevels;
+    image_ci.arrayLayers = 1;
+    image_ci.samples = VK_SAMPLE_COUNT_1_BIT;
+    image_ci.tiling = VK_IMAGE_TILING_OPTIMAL;
+    image_ci.usage = VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT |
+                     VK_IMAGE_USAGE_SAMPLED_BIT;
+    image_ci.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    err = vkCreateImage(device(), &image_ci, nullptr, &m_texture.image);
+    Q_ASSERT(!err);
+    m_texture.mem = dev->allocator().allocateForImage(m_texture.image, VK_IMAGE_TILING_OPTIMAL,
+                                                      QVkMemoryUsage::GpuOnly);
+
+    VkImageViewCreateInfo view = {};
+    view.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    view.image = m_texture.image;
+    view.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    view.format = m_texture.format;
+    view.components = m_texture.swizzle;
+    view.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, m_texture.mipLevels, 0, 1};
+    err = vkCreateImageView(device(), &view, nullptr, &m_texture.view);
+    Q_ASSERT(!err);
+
+    VkSamplerCreateInfo sampler = {};
+    sampler.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+    sampler.magFilter = VK_FILTER_NEAREST;
+    sampler.minFilter = VK_FILTER_LINEAR;
+    sampler.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+    sampler.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    sampler.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    sampler.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    sampler.maxAnisotropy = 1;
+    sampler.compareOp = VK_COMPARE_OP_NEVER;
+    sampler.maxLod = (float)m_texture.mipLevels;
+    sampler.borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_WHITE;
+    err = vkCreateSampler(device(), &sampler, nullptr, &m_texture.sampler);
+    Q_ASSERT(!err);
+
+    qDebug()<<"texture atlas of"<<m_columns<<"x"<<m_rows<<"cells of"<<m_cellSize<<"texels";
+}
+
+QVkTextureAtlas::~QVkTextureAtlas() {
+    DEBUG_ENTRY;
+    QVkTextureCache::retire(dev()->deletionQueue(), m_texture);
+}
+
+bool QVkTextureAtlas::canBlit(VkFormat format) const {
+    VkFormatProperties props;
+    vkGetPhysicalDeviceFormatProperties(m_gpu, format, &props);
+    const VkFormatFeatureFlags blit = VK_FORMAT_FEATURE_BLIT_SRC_BIT |
+                                      VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+    return (props.optimalTilingFeatures & blit) == blit;
+}
+
+void QVkTextureAtlas::recordClear(QVkCommandBufferRecorder& recorder) {
+    DEBUG_ENTRY;
+    const uint32_t levels = m_texture.mipLevels;
+    VkImageMemoryBarrier toDst = levelBarrier(m_texture.image, 0, levels,
+            VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+            0, VK_ACCESS_TRANSFER_WRITE_BIT);
+    recorder.pipelineBarrier(VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, &toDst);
+
+    recorder.clearColorImage(m_texture.image, Qt::gray, {VK_IMAGE_ASPECT_COLOR_BIT, 0, levels, 0, 1});
+
+    VkImageMemoryBarrier toShader = levelBarrier(m_texture.image, 0, levels,
+            VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, m_texture.imageLayout,
+            VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT);
+    recorder.pipelineBarrier(VK_PIPELINE_STAGE_TRANSFER_BIT, SHADER_STAGES, 0, &toShader);
+}
+
+void QVkTextureAtlas::record(QVkCommandBufferRecorder& recorder, uint32_t index,
+                             const texture_object& texture) {
+    DEBUG_ENTRY;
+    Q_ASSERT(index < m_columns * m_rows);
+    const VkImage atlas = m_texture.image;
+    const uint32_t levels = m_texture.mipLevels;
+    const int32_t x = (int32_t)(index % m_columns * m_cellSize);
+    const int32_t y = (int32_t)(index / m_columns * m_cellSize);
+    const int32_t cell = (int32_t)m_cellSize;
+
+    // the smallest level still covering the cell, a blit does not filter
+    // over more than 2x2 texels
+    uint32_t srcLevel = 0;
+    while (srcLevel + 1 < texture.mipLevels &&
+           qMax(texture.tex_width, texture.tex_height) >> (srcLevel + 1) >= m_cellSize)
+        srcLevel++;
+    const int32_t srcWidth = (int32_t)qMax(1u, texture.tex_width >> srcLevel);
+    const int32_t srcHeight = (int32_t)qMax(1u, texture.tex_height >> srcLevel);
+
+    // The other cells are sampled by frames in flight, all levels of the
+    // atlas keep their contents.
+    VkImageMemoryBarrier toTransfer[2] = {
+        levelBarrier(atlas, 0, levels,
+                     m_texture.imageLayout, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                     0, VK_ACCESS_TRANSFER_WRITE_BIT),
+        levelBarrier(texture.image, srcLevel, 1,
+                     texture.imageLayout, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                     0, VK_ACCESS_TRANSFER_READ_BIT)
+    };
+    recorder.pipelineBarrier(SHADER_STAGES, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+                             0, nullptr, 0, nullptr, 2, toTransfer);
+
+    VkImageBlit blit = {};
+    blit.srcSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, srcLevel, 0, 1};
+    blit.srcOffsets[1] = {srcWidth, srcHeight, 1};
+    blit.dstSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+    blit.dstOffsets[0] = {x, y, 0};
+    blit.dstOffsets[1] = {x + cell, y + cell, 1};
+    recorder.blitImage(texture.image, atlas, blit, VK_FILTER_LINEAR);
+
+    // the levels of the cell, each from the one above
+    for (uint32_t level = 1; level < levels; level++) {
+        VkImageMemoryBarrier toSrc = levelBarrier(atlas, level - 1, 1,
+                VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_TRANSFER_READ_BIT);
+        recorder.pipelineBarrier(VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, &toSrc);
+
+        VkImageBlit down = {};
+        down.srcSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, level - 1, 0, 1};
+        down.srcOffsets[0] = {x >> (level - 1), y >> (level - 1), 0};
+        down.srcOffsets[1] = {(x + cell) >> (level - 1), (y + cell) >> (level - 1), 1};
+        down.dstSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, level, 0, 1};
+        down.dstOffsets[0] = {x >> level, y >> level, 0};
+        down.dstOffsets[1] = {(x + cell) >> level, (y + cell) >> level, 1};
+        recorder.blitImage(atlas, atlas, down, VK_FILTER_LINEAR);
+    }
+
+    // all levels but the last were read by the blit below them
+    QVector<VkImageMemoryBarrier> toShader;
+    if (levels > 1)
+        toShader << levelBarrier(atlas, 0, levels - 1,
+                                 VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, m_texture.imageLayout,
+                                 VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT);
+    toShader << levelBarrier(atlas, levels - 1, 1,
+                             VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, m_texture.imageLayout,
+                             VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT)
+             << levelBarrier(texture.image, srcLevel, 1,
+                             VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, texture.imageLayout,
+                             0, VK_ACCESS_SHADER_READ_BIT);
+    recorder.pipelineBarrier(VK_PIPELINE_STAGE_TRANSFER_BIT, SHADER_STAGES, 0,
+                             0, nullptr, 0, nullptr, toShader.size(), toShader.constData());
+}
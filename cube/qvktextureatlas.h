@@ -0,0 +1,61 @@
+#ifndef QVKTEXTUREATLAS_H
+#define QVKTEXTUREATLAS_H
+
+#include <vulkan/vulkan.h>
+#include "qvkdevice.h"
+#include "qvkcmdbuf.h"
+#include "qvktexturecache.h"
+
+// texels per side of a cell, unless the device limits the atlas to less
+#define DEFAULT_ATLAS_CELL_SIZE 512
+
+/*
+ * Many textures in one image, for devices without
+ * VK_EXT_descriptor_indexing: a single descriptor samples all of them.
+ *
+ * The atlas is a grid of square cells of a power of two size, one per
+ * texture, with columns() * rows() cells in VK_FORMAT_R8G8B8A8_UNORM.
+ * Textures are scaled into their cell by linear blits from the level
+ * closest to the cell size, whatever their format. Every cell has a mip
+ * chain of its own, built from the cell alone, so levels never mix
+ * neighbouring textures. Only bilinear filtering reaches half a texel
+ * into the neighbours at the cell borders.
+ *
+ * Cells stay grey until their texture is recorded.
+ */
+class QVkTextureAtlas : public QVkDeviceResource {
+public:
+    QVkTextureAtlas(QSharedPointer<QVkDevice> dev, VkPhysicalDevice gpu, uint32_t count,
+                    uint32_t maxCellSize = DEFAULT_ATLAS_CELL_SIZE);
+    ~QVkTextureAtlas();
+    Q_DISABLE_COPY(QVkTextureAtlas)
+
+    uint32_t columns() const { return m_columns; }
+    uint32_t rows() const { return m_rows; }
+    uint32_t cellSize() const { return m_cellSize; }
+
+    // the image, view and sampler of the atlas
+    const texture_object& texture() const { return m_texture; }
+
+    // whether record() can copy textures of format
+    bool canBlit(VkFormat format) const;
+
+    // Records the clear of all cells, before anything else is recorded
+    // for the atlas.
+    void recordClear(QVkCommandBufferRecorder& recorder);
+
+    // Records the copy of texture into cell index and the levels of the
+    // cell. The texture has to be in VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+    // with VK_IMAGE_USAGE_TRANSFER_SRC_BIT, and its writes visible to
+    // shaders. It ends up in that layout again.
+    void record(QVkCommandBufferRecorder& recorder, uint32_t index, const texture_object& texture);
+
+private:
+    VkPhysicalDevice m_gpu;
+    uint32_t m_columns      {1};
+    uint32_t m_rows         {1};
+    uint32_t m_cellSize     {1};
+    texture_object m_texture {};
+};
+
+#endif // QVKTEXTUREATLAS_H
@@ -0,0 +1,137 @@
+#include <QCryptographicHash>
+#include <QFileInfo>
+#include <QMutexLocker>
+#include "qvktexturecache.h"
+#include "qvkdevice.h"
+
+QVkTextureCache::QVkTextureCache(QVkDevice& device, VkDeviceSize budget)
+    : m_device(device)
+    , m_budget(budget)
+{
+}
+
+QVkTextureCache::~QVkTextureCache() {
+    DEBUG_ENTRY;
+    for (const Entry& entry : m_entries) {
+        if (entry.refs > 0)
+            qWarning()<<"texture"<<entry.path<<"still has"<<entry.refs<<"references";
+        retire(m_device.deletionQueue(), entry.texture);
+    }
+}
+
+QByteArray QVkTextureCache::contentKey(const QByteArray& data) {
+    return QCryptographicHash::hash(data, QCryptographicHash::Sha1);
+}
+
+void QVkTextureCache::retire(QVkDeletionQueue& queue, const texture_object& texture) {
+    queue.retire(texture.view, vkDestroyImageView);
+    queue.retire(texture.image, vkDestroyImage);
+    queue.retire(texture.mem);
+    queue.retire(texture.sampler, vkDestroySampler);
+}
+
+bool QVkTextureCache::acquire(const QString& path, texture_object* texture) {
+    DEBUG_ENTRY;
+    QMutexLocker locker(&m_lock);
+    QFileInfo info(path);
+    auto key = m_paths.constFind(info.absoluteFilePath());
+    if (key == m_paths.constEnd())
+        return false;
+    auto entry = m_entries.find(*key);
+    Q_ASSERT(entry != m_entries.end());
+
+    // the contents are only trusted as long as the file looks the same
+    if (!info.exists() || info.size() != entry->fileSize || info.lastModified() != entry->fileModified) {
+        m_paths.remove(info.absoluteFilePath());
+        return false;
+    }
+    entry->refs++;
+    entry->used = ++m_useCounter;
+    *texture = entry->texture;
+    return true;
+}
+
+// called by the threads of QVkTextureLoader, without DEBUG_ENTRY
+bool QVkTextureCache::acquireKey(const QByteArray& key, texture_object* texture) {
+    QMutexLocker locker(&m_lock);
+    auto entry = m_entries.find(key);
+    if (entry == m_entries.end())
+        return false;
+    entry->refs++;
+    entry->used = ++m_useCounter;
+    *texture = entry->texture;
+    return true;
+}
+
+texture_object QVkTextureCache::insert(const QString& path, const QByteArray& key,
+                                       const texture_object& texture) {
+    DEBUG_ENTRY;
+    Q_ASSERT(!key.isEmpty());
+    QMutexLocker locker(&m_lock);
+    QFileInfo info(path);
+    m_paths[info.absoluteFilePath()] = key;
+
+    // loaded twice at the same time, the first one wins
+    auto existing = m_entries.find(key);
+    if (existing != m_entries.end()) {
+        retire(m_device.deletionQueue(), texture);
+        existing->refs++;
+        existing->used = ++m_useCounter;
+        return existing->texture;
+    }
+
+    Entry entry;
+    entry.texture = texture;
+    entry.texture.cacheKey = key;
+    entry.path = info.absoluteFilePath();
+    entry.fileSize = info.size();
+    entry.fileModified = info.lastModified();
+    entry.refs = 1;
+    entry.used = ++m_useCounter;
+    m_entries.insert(key, entry);
+    m_size += texture.mem.size;
+    evictLocked();
+    return entry.texture;
+}
+
+void QVkTextureCache::release(const QByteArray& key) {
+    DEBUG_ENTRY;
+    QMutexLocker locker(&m_lock);
+    auto entry = m_entries.find(key);
+    Q_ASSERT(entry != m_entries.end() && entry->refs > 0);
+    entry->refs--;
+    evictLocked();
+}
+
+void QVkTextureCache::setBudget(VkDeviceSize bytes) {
+    QMutexLocker locker(&m_lock);
+    m_budget = bytes;
+    evictLocked();
+}
+
+VkDeviceSize QVkTextureCache::size() {
+    QMutexLocker locker(&m_lock);
+    return m_size;
+}
+
+void QVkTextureCache::evictLocked() {
+    DEBUG_ENTRY;
+    while (m_size > m_budget) {
+        // least recently used texture nobody references, the cache holds
+        // few enough textures to search them all
+        auto victim = m_entries.end();
+        for (auto entry = m_entries.begin(); entry != m_entries.end(); ++entry) {
+            if (entry->refs == 0 && (victim == m_entries.end() || entry->used < victim->used))
+                victim = entry;
+        }
+        if (victim == m_entries.end())
+            return;
+
+        DBG("evicting texture %s", qPrintable(victim->path));
+        retire(m_device.deletionQueue(), victim->texture);
+        m_size -= victim->texture.mem.size;
+        if (m_paths.value(victim->path) == victim.key())
+            m_paths.remove(victim->path);
+        m_entries.erase(victim);
+    }
+}
@@ -0,0 +1,110 @@
+#ifndef QVKTEXTURECACHE_H
+#define QVKTEXTURECACHE_H
+
+#include <vulkan/vulkan.h>
+#include <QByteArray>
+#include <QDateTime>
+#include <QHash>
+#include <QMutex>
+#include <QString>
+#include "qvkallocator.h"
+
+class QVkDevice;
+class QVkDeletionQueue;
+
+// device memory of all cached textures, referenced or not
+#define DEFAULT_TEXTURE_CACHE_BUDGET (256 * 1024 * 1024)
+
+/*
+ * structure to track all objects related to a texture.
+ */
+struct texture_object {
+    VkSampler sampler;
+
+    VkImage image;
+    VkImageLayout imageLayout;
+
+    QVkAllocation mem;
+    VkImageView view;
+    uint32_t tex_width, tex_height;
+    uint32_t mipLevels;
+    // of image and its view
+    VkFormat format;
+    VkComponentMapping swizzle;
+    // QVkTextureCache key of the texture, empty for textures of its owner
+    QByteArray cacheKey;
+};
+
+/*
+ * Textures of a device, shared by everything that loads the same content.
+ *
+ * Textures are keyed by a hash of the file they were created from, so
+ * copies of a file under different names are one texture. A file that
+ * did not change since it was inserted is found by its path alone,
+ * without reading it again.
+ *
+ * acquire() and insert() hand out references, release() gives them back.
+ * Textures nobody references stay resident for the next one to load them.
+ * While the cache holds more device memory than its budget, the least
+ * recently used of them are retired to the deletion queue. Referenced
+ * textures are never evicted, so the budget may be exceeded by them.
+ *
+ * There is one cache per QVkDevice. The views of a process share their
+ * device, so a texture one view loaded is found by the others.
+ */
+class QVkTextureCache {
+public:
+    explicit QVkTextureCache(QVkDevice& device, VkDeviceSize budget = DEFAULT_TEXTURE_CACHE_BUDGET);
+    ~QVkTextureCache();
+    Q_DISABLE_COPY(QVkTextureCache)
+
+    // key of the file contents data
+    static QByteArray contentKey(const QByteArray& data);
+
+    // Looks up a texture by the path it was inserted with, which must not
+    // have changed since, or by its key. Takes a reference and returns
+    // true if the texture is there.
+    bool acquire(const QString& path, texture_object* texture);
+    bool acquireKey(const QByteArray& key, texture_object* texture);
+
+    // Adds texture, created from path with contents key, with one
+    // reference. If key is there already, texture is retired and the one
+    // in the cache is returned instead.
+    texture_object insert(const QString& path, const QByteArray& key, const texture_object& texture);
+
+    void release(const QByteArray& key);
+
+    // bytes of device memory the textures may take
+    void setBudget(VkDeviceSize bytes);
+    VkDeviceSize budget() const { return m_budget; }
+    VkDeviceSize size();
+
+    // destroys the objects of texture once the frames in flight are done
+    static void retire(QVkDeletionQueue& queue, const texture_object& texture);
+
+private:
+    struct Entry {
+        texture_object texture;
+        QString path;
+        // of path when it was inserted
+        qint64 fileSize;
+        QDateTime fileModified;
+        int refs;
+        // acquire() counter at the last use
+        quint64 used;
+    };
+
+    void evictLocked();
+
+    QVkDevice& m_device;
+    VkDeviceSize m_budget;
+
+    QMutex m_lock;
+    QHash<QByteArray, Entry> m_entries;
+    QHash<QString, QByteArray> m_paths;
+    // device memory of all entries
+    VkDeviceSize m_size         {0};
+    quint64 m_useCounter        {0};
+};
+
+#endif // QVKTEXTURECACHE_H
@@ -0,0 +1,676 @@
+#include <string.h>
+#include <limits>
+#include <QFile>
+#include <QFileInfo>
+#include <QtEndian>
+#include "qvktexturefile.h"
+
+static quint32 read32(const QByteArray& file, int offset) {
+    quint32 value;
+    memcpy(&value, file.constData() + offset, sizeof(value));
+    return qFromLittleEndian(value);
+}
+
+static quint64 read64(const QByteArray& file, int offset) {
+    quint64 value;
+    memcpy(&value, file.constData() + offset, sizeof(value));
+    return qFromLittleEndian(value);
+}
+
+static quint32 fourCC(const char* code) {
+    return (quint32)(uchar)code[0] | (quint32)(uchar)code[1] << 8 |
+           (quint32)(uchar)code[2] << 16 | (quint32)(uchar)code[3] << 24;
+}
+
+bool QVkTextureFile::blockSize(VkFormat format, uint32_t* width, uint32_t* height, uint32_t* bytes) {
+    *width = 4;
+    *height = 4;
+    switch (format) {
+    case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+    case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+    case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+    case VK_FORMAT_BC1_RGBA_SRGB_BLOCK:
+    case VK_FORMAT_BC4_UNORM_BLOCK:
+    case VK_FORMAT_BC4_SNORM_BLOCK:
+    case VK_FORMAT_ETC2_R8G8B8_UNORM_BLOCK:
+    case VK_FORMAT_ETC2_R8G8B8_SRGB_BLOCK:
+    case VK_FORMAT_ETC2_R8G8B8A1_UNORM_BLOCK:
+    case VK_FORMAT_ETC2_R8G8B8A1_SRGB_BLOCK:
+    case VK_FORMAT_EAC_R11_UNORM_BLOCK:
+    case VK_FORMAT_EAC_R11_SNORM_BLOCK:
+        *bytes = 8;
+        return true;
+    case VK_FORMAT_BC2_UNORM_BLOCK:
+    case VK_FORMAT_BC2_SRGB_BLOCK:
+    case VK_FORMAT_BC3_UNORM_BLOCK:
+    case VK_FORMAT_BC3_SRGB_BLOCK:
+    case VK_FORMAT_BC5_UNORM_BLOCK:
+    case VK_FORMAT_BC5_SNORM_BLOCK:
+    case VK_FORMAT_BC6H_UFLOAT_BLOCK:
+    case VK_FORMAT_BC6H_SFLOAT_BLOCK:
+    case VK_FORMAT_BC7_UNORM_BLOCK:
+    case VK_FORMAT_BC7_SRGB_BLOCK:
+    case VK_FORMAT_ETC2_R8G8B8A8_UNORM_BLOCK:
+    case VK_FORMAT_ETC2_R8G8B8A8_SRGB_BLOCK:
+    case VK_FORMAT_EAC_R11G11_UNORM_BLOCK:
+    case VK_FORMAT_EAC_R11G11_SNORM_BLOCK:
+        *bytes = 16;
+        return true;
+    default:
+        break;
+    }
+
+    // ASTC blocks are 16 bytes, of UNORM and SRGB pairs of every size
+    static const uint32_t astc[][2] = {
+        {4, 4}, {5, 4}, {5, 5}, {6, 5}, {6, 6}, {8, 5}, {8, 6},
+        {8, 8}, {10, 5}, {10, 6}, {10, 8}, {10, 10}, {12, 10}, {12, 12}
+    };
+    if (format >= VK_FORMAT_ASTC_4x4_UNORM_BLOCK && format <= VK_FORMAT_ASTC_12x12_SRGB_BLOCK) {
+        int size = (format - VK_FORMAT_ASTC_4x4_UNORM_BLOCK) / 2;
+        *width = astc[size][0];
+        *height = astc[size][1];
+        *bytes = 16;
+        return true;
+    }
+
+    // uncompressed formats are blocks of one texel
+    *width = 1;
+    *height = 1;
+    switch (format) {
+    case VK_FORMAT_R8_UNORM:
+        *bytes = 1;
+        return true;
+    case VK_FORMAT_R8G8_UNORM:
+    case VK_FORMAT_R16_UNORM:
+    case VK_FORMAT_R5G6B5_UNORM_PACK16:
+    case VK_FORMAT_B5G6R5_UNORM_PACK16:
+    case VK_FORMAT_A1R5G5B5_UNORM_PACK16:
+    case VK_FORMAT_R4G4B4A4_UNORM_PACK16:
+    case VK_FORMAT_B4G4R4A4_UNORM_PACK16:
+        *bytes = 2;
+        return true;
+    case VK_FORMAT_R8G8B8_UNORM:
+    case VK_FORMAT_B8G8R8_UNORM:
+        *bytes = 3;
+        return true;
+    case VK_FORMAT_R8G8B8A8_UNORM:
+    case VK_FORMAT_R8G8B8A8_SRGB:
+    case VK_FORMAT_B8G8R8A8_UNORM:
+    case VK_FORMAT_B8G8R8A8_SRGB:
+    case VK_FORMAT_A2B10G10R10_UNORM_PACK32:
+    case VK_FORMAT_A2R10G10B10_UNORM_PACK32:
+        *bytes = 4;
+        return true;
+    case VK_FORMAT_R16G16B16A16_UNORM:
+    case VK_FORMAT_R16G16B16A16_SFLOAT:
+        *bytes = 8;
+        return true;
+    default:
+        return false;
+    }
+}
+
+bool QVkTextureFile::isCompressed() const {
+    uint32_t width, height, bytes;
+    return blockSize(m_format, &width, &height, &bytes) && width > 1;
+}
+
+VkDeviceSize QVkTextureFile::stagingAlignment() const {
+    uint32_t width, height, bytes;
+    if (!blockSize(m_format, &width, &height, &bytes))
+        return 16;
+    // 3 byte texels need 48
+    return 16 % bytes == 0 || bytes % 16 == 0 ? qMax(16u, bytes) : 16 * bytes;
+}
+
+bool QVkTextureFile::isTextureFile(const QString& filename) {
+    QString suffix = QFileInfo(filename).suffix().toLower();
+    return suffix == "ktx2" || suffix == "dds";
+}
+
+QVkTextureFile QVkTextureFile::load(const QString& filename) {
+    QFile file(filename);
+    if (!file.open(QIODevice::ReadOnly)) {
+        QVkTextureFile texture;
+        texture.fail(file.errorString());
+        return texture;
+    }
+    return fromData(file.readAll());
+}
+
+QVkTextureFile QVkTextureFile::fromData(const QByteArray& file) {
+    static const char ktx2[] = "\xABKTX 20\xBB\r\n\x1A\n";
+    QVkTextureFile texture;
+    if (file.startsWith(QByteArray(ktx2, 12)))
+        texture.readKtx2(file);
+    else if (file.startsWith("DDS "))
+        texture.readDds(file);
+    else
+        texture.fail("neither KTX2 nor DDS");
+    return texture;
+}
+
+QVkTextureFile QVkTextureFile::fromImages(VkFormat format, const VkComponentMapping& swizzle,
+                                          const QVector<QImage>& levels) {
+    QVkTextureFile texture;
+    texture.m_format = format;
+    texture.m_swizzle = swizzle;
+    uint32_t blockWidth, blockHeight, blockBytes;
+    if (levels.isEmpty() || !blockSize(format, &blockWidth, &blockHeight, &blockBytes) ||
+        blockWidth != 1 || blockHeight != 1 || (uint32_t)levels[0].depth() != blockBytes * 8) {
+        texture.fail("images do not match the format");
+        return texture;
+    }
+
+    const uint32_t width = levels[0].width();
+    const uint32_t height = levels[0].height();
+    texture.m_levels.resize(levels.size());
+    for (int i = 0; i < levels.size(); i++) {
+        const QImage& image = levels[i];
+        Level& level = texture.m_levels[i];
+        level.width = qMax(1u, width >> i);
+        level.height = qMax(1u, height >> i);
+        if ((uint32_t)image.width() != level.width || (uint32_t)image.height() != level.height ||
+            image.depth() != levels[0].depth()) {
+            texture.fail(QString("level %1 has the wrong size").arg(i));
+            return texture;
+        }
+        // tightly packed rows, whatever the padding of the image is
+        const int rowSize = (int)(level.width * blockBytes);
+        level.offset = (uint32_t)texture.m_data.size();
+        level.size = (uint32_t)rowSize * level.height;
+        texture.m_data.reserve(texture.m_data.size() + (int)level.size);
+        for (int y = 0; y < image.height(); y++)
+            texture.m_data.append(reinterpret_cast<const char*>(image.constScanLine(y)), rowSize);
+    }
+    return texture;
+}
+
+bool QVkTextureFile::fail(const QString& error) {
+    m_error = error;
+    m_levels.clear();
+    m_data.clear();
+    return false;
+}
+
+bool QVkTextureFile::setLevels(const QByteArray& file, uint32_t width, uint32_t height, uint32_t count,
+                               uint32_t offset, const QVector<quint64>& offsets) {
+    uint32_t blockWidth, blockHeight, blockBytes;
+    if (!blockSize(m_format, &blockWidth, &blockHeight, &blockBytes))
+        return fail(QString("unsupported format %1").arg(m_format));
+    // larger than any device supports, and small enough that the sizes
+    // below cannot overflow
+    if (width == 0 || height == 0 || width > 65536 || height > 65536 || count == 0 || count > 32)
+        return fail("bad size");
+
+    // the levels are copied to data() in the order of their size
+    m_levels.resize(count);
+    quint64 position = offset;
+    quint64 total = 0;
+    const quint64 fileSize = file.size();
+    for (uint32_t i = 0; i < count; i++) {
+        Level& level = m_levels[i];
+        level.width = qMax(1u, width >> i);
+        level.height = qMax(1u, height >> i);
+        quint64 size = (quint64)((level.width + blockWidth - 1) / blockWidth) *
+                       ((level.height + blockHeight - 1) / blockHeight) * blockBytes;
+        if (!offsets.isEmpty())
+            position = offsets[i];
+        if (position > fileSize || size > fileSize - position)
+            return fail("truncated file");
+        // levels may share bytes of the file through offsets, data() may
+        // not grow past what a QByteArray holds
+        if (total + size > (quint64)std::numeric_limits<int>::max())
+            return fail("bad size");
+        level.offset = (uint32_t)total;
+        level.size = (uint32_t)size;
+        total += size;
+        position += size;
+    }
+
+    m_data.resize((int)total);
+    position = offset;
+    for (uint32_t i = 0; i < count; i++) {
+        if (!offsets.isEmpty())
+            position = offsets[i];
+        memcpy(m_data.data() + m_levels[i].offset, file.constData() + position, m_levels[i].size);
+        position += m_levels[i].size;
+    }
+    return true;
+}
+
+bool QVkTextureFile::readKtx2(const QByteArray& file) {
+    // identifier, header, index
+    if (file.size() < 80)
+        return fail("truncated file");
+    m_format = (VkFormat)read32(file, 12);
+    uint32_t width = read32(file, 20);
+    uint32_t height = read32(file, 24);
+    uint32_t depth = read32(file, 28);
+    uint32_t layers = read32(file, 32);
+    uint32_t faces = read32(file, 36);
+    // 0 asks the loader to generate the levels, the level index has one
+    uint32_t levelCount = qMax(1u, read32(file, 40));
+    uint32_t supercompression = read32(file, 44);
+
+    if (m_format == VK_FORMAT_UNDEFINED || supercompression != 0)
+        return fail("supercompressed KTX2 files are not supported");
+    if (depth > 1 || layers > 1 || faces != 1)
+        return fail("only 2D textures are supported");
+    if (levelCount > 32 || 80 + levelCount * 24 > (uint32_t)file.size())
+        return fail("truncated file");
+
+    // byteOffset, byteLength, uncompressedByteLength per level, largest
+    // level first
+    QVector<quint64> offsets(levelCount);
+    for (uint32_t i = 0; i < levelCount; i++)
+        offsets[i] = read64(file, 80 + i * 24);
+    return setLevels(file, width, height, levelCount, 0, offsets);
+}
+
+bool QVkTextureFile::readDds(const QByteArray& file) {
+    // magic, DDS_HEADER
+    if (file.size() < 128 || read32(file, 4) != 124)
+        return fail("truncated file");
+    const uint32_t DDSD_MIPMAPCOUNT = 0x20000;
+    const uint32_t DDPF_FOURCC = 0x4;
+    const uint32_t DDPF_RGB = 0x40;
+    const uint32_t DDSCAPS2_CUBEMAP = 0x200;
+    const uint32_t DDSCAPS2_VOLUME = 0x200000;
+
+    uint32_t flags = read32(file, 8);
+    uint32_t height = read32(file, 12);
+    uint32_t width = read32(file, 16);
+    uint32_t levelCount = flags & DDSD_MIPMAPCOUNT ? qMax(1u, read32(file, 28)) : 1;
+    uint32_t formatFlags = read32(file, 80);
+    uint32_t code = read32(file, 84);
+    uint32_t bits = read32(file, 88);
+    uint32_t redMask = read32(file, 92);
+    uint32_t caps2 = read32(file, 112);
+    if (caps2 & (DDSCAPS2_CUBEMAP | DDSCAPS2_VOLUME))
+        return fail("only 2D textures are supported");
+
+    uint32_t offset = 128;
+    if ((formatFlags & DDPF_FOURCC) && code == fourCC("DX10")) {
+        // DDS_HEADER_DXT10
+        if (file.size() < 148)
+            return fail("truncated file");
+        const uint32_t DDS_DIMENSION_TEXTURE2D = 3;
+        const uint32_t DDS_RESOURCE_MISC_TEXTURECUBE = 0x4;
+        if (read32(file, 132) != DDS_DIMENSION_TEXTURE2D
+            || (read32(file, 136) & DDS_RESOURCE_MISC_TEXTURECUBE) || read32(file, 140) > 1)
+            return fail("only 2D textures are supported");
+        switch (read32(file, 128)) {
+        case 28: m_format = VK_FORMAT_R8G8B8A8_UNORM; break;
+        case 29: m_format = VK_FORMAT_R8G8B8A8_SRGB; break;
+        case 71: m_format = VK_FORMAT_BC1_RGBA_UNORM_BLOCK; break;
+        case 72: m_format = VK_FORMAT_BC1_RGBA_SRGB_BLOCK; break;
+        case 74: m_format = VK_FORMAT_BC2_UNORM_BLOCK; break;
+        case 75: m_format = VK_FORMAT_BC2_SRGB_BLOCK; break;
+        case 77: m_format = VK_FORMAT_BC3_UNORM_BLOCK; break;
+        case 78: m_format = VK_FORMAT_BC3_SRGB_BLOCK; break;
+        case 80: m_format = VK_FORMAT_BC4_UNORM_BLOCK; break;
+        case 81: m_format = VK_FORMAT_BC4_SNORM_BLOCK; break;
+        case 83: m_format = VK_FORMAT_BC5_UNORM_BLOCK; break;
+        case 84: m_format = VK_FORMAT_BC5_SNORM_BLOCK; break;
+        case 87: m_format = VK_FORMAT_B8G8R8A8_UNORM; break;
+        case 91: m_format = VK_FORMAT_B8G8R8A8_SRGB; break;
+        case 95: m_format = VK_FORMAT_BC6H_UFLOAT_BLOCK; break;
+        case 96: m_format = VK_FORMAT_BC6H_SFLOAT_BLOCK; break;
+        case 98: m_format = VK_FORMAT_BC7_UNORM_BLOCK; break;
+        case 99: m_format = VK_FORMAT_BC7_SRGB_BLOCK; break;
+        default:
+            return fail(QString("unsupported DXGI format %1").arg(read32(file, 128)));
+        }
+        offset = 148;
+    } else if (formatFlags & DDPF_FOURCC) {
+        if (code == fourCC("DXT1"))
+            m_format = VK_FORMAT_BC1_RGBA_UNORM_BLOCK;
+        else if (code == fourCC("DXT2") || code == fourCC("DXT3"))
+            m_format = VK_FORMAT_BC2_UNORM_BLOCK;
+        else if (code == fourCC("DXT4") || code == fourCC("DXT5"))
+            m_format = VK_FORMAT_BC3_UNORM_BLOCK;
+        else if (code == fourCC("ATI1") || code == fourCC("BC4U"))
+            m_format = VK_FORMAT_BC4_UNORM_BLOCK;
+        else if (code == fourCC("ATI2") || code == fourCC("BC5U"))
+            m_format = VK_FORMAT_BC5_UNORM_BLOCK;
+        else
+            return fail("unsupported DDS four character code");
+    } else if ((formatFlags & DDPF_RGB) && bits == 32) {
+        m_format = redMask == 0xff ? VK_FORMAT_R8G8B8A8_UNORM : VK_FORMAT_B8G8R8A8_UNORM;
+    } else {
+        return fail("unsupported DDS pixel format");
+    }
+    return setLevels(file, width, height, levelCount, offset);
+}
+
+/*
+ * CPU decoders, each writes the 4x4 RGBA texels of one block, row by row.
+ */
+
+typedef void (*BlockDecoder)(const uchar* block, uchar* rgba);
+
+static void unpack565(uint32_t color, uchar* rgb) {
+    uint32_t r = (color >> 11) & 31, g = (color >> 5) & 63, b = color & 31;
+    rgb[0] = (uchar)(r << 3 | r >> 2);
+    rgb[1] = (uchar)(g << 2 | g >> 4);
+    rgb[2] = (uchar)(b << 3 | b >> 2);
+}
+
+// opaque: BC1 without alpha and the color part of BC2 and BC3, which
+// always interpolate 4 colors
+static void decodeBc1Colors(const uchar* block, uchar* rgba, bool opaque, bool fourColors) {
+    uint32_t c0 = block[0] | block[1] << 8;
+    uint32_t c1 = block[2] | block[3] << 8;
+    uchar palette[4][4];
+    unpack565(c0, palette[0]);
+    unpack565(c1, palette[1]);
+    palette[0][3] = palette[1][3] = 255;
+    for (int c = 0; c < 3; c++) {
+        if (fourColors || c0 > c1) {
+            palette[2][c] = (uchar)((2 * palette[0][c] + palette[1][c]) / 3);
+            palette[3][c] = (uchar)((palette[0][c] + 2 * palette[1][c]) / 3);
+        } else {
+            palette[2][c] = (uchar)((palette[0][c] + palette[1][c]) / 2);
+            palette[3][c] = 0;
+        }
+    }
+    palette[2][3] = 255;
+    palette[3][3] = fourColors || c0 > c1 || opaque ? 255 : 0;
+
+    uint32_t indices = block[4] | block[5] << 8 | block[6] << 16 | (uint32_t)block[7] << 24;
+    for (int i = 0; i < 16; i++)
+        memcpy(rgba + i * 4, palette[(indices >> (2 * i)) & 3], 4);
+}
+
+static void decodeBc1Rgb(const uchar* block, uchar* rgba) {
+    decodeBc1Colors(block, rgba, true, false);
+}
+
+static void decodeBc1Rgba(const uchar* block, uchar* rgba) {
+    decodeBc1Colors(block, rgba, false, false);
+}
+
+// BC3 alpha, BC4 and BC5 channels: two endpoints and 3 bit indices
+static void decodeBc4Channel(const uchar* block, uchar* rgba, int channel) {
+    uint32_t a0 = block[0], a1 = block[1];
+    uchar values[8] = { (uchar)a0, (uchar)a1 };
+    if (a0 > a1) {
+        for (uint32_t i = 1; i < 7; i++)
+            values[i + 1] = (uchar)(((7 - i) * a0 + i * a1) / 7);
+    } else {
+        for (uint32_t i = 1; i < 5; i++)
+            values[i + 1] = (uchar)(((5 - i) * a0 + i * a1) / 5);
+        values[6] = 0;
+        values[7] = 255;
+    }
+    quint64 indices = 0;
+    for (int i = 0; i < 6; i++)
+        indices |= (quint64)block[2 + i] << (8 * i);
+    for (int i = 0; i < 16; i++)
+        rgba[i * 4 + channel] = values[(indices >> (3 * i)) & 7];
+}
+
+static void decodeBc2(const uchar* block, uchar* rgba) {
+    decodeBc1Colors(block + 8, rgba, true, true);
+    for (int i = 0; i < 16; i++) {
+        uint32_t alpha = (block[i / 2] >> (4 * (i % 2))) & 15;
+        rgba[i * 4 + 3] = (uchar)(alpha * 17);
+    }
+}
+
+static void decodeBc3(const uchar* block, uchar* rgba) {
+    decodeBc1Colors(block + 8, rgba, true, true);
+    decodeBc4Channel(block, rgba, 3);
+}
+
+// what sampling the formats returns: missing channels 0, alpha 1
+static void decodeBc4(const uchar* block, uchar* rgba) {
+    for (int i = 0; i < 16; i++) {
+        rgba[i * 4 + 1] = rgba[i * 4 + 2] = 0;
+        rgba[i * 4 + 3] = 255;
+    }
+    decodeBc4Channel(block, rgba, 0);
+}
+
+static void decodeBc5(const uchar* block, uchar* rgba) {
+    decodeBc4(block, rgba);
+    decodeBc4Channel(block + 8, rgba, 1);
+}
+
+static uchar clamp255(int value) {
+    return (uchar)qBound(0, value, 255);
+}
+
+static int extend4(int value) { return value << 4 | value; }
+static int extend5(int value) { return value << 3 | value >> 2; }
+static int extend6(int value) { return value << 2 | value >> 4; }
+static int extend7(int value) { return value << 1 | value >> 6; }
+
+// 3 bit two's complement
+static int signed3(int value) {
+    return value >= 4 ? value - 8 : value;
+}
+
+// ETC2 RGB, with the ETC1 individual and differential modes and the T, H
+// and planar modes ETC2 encodes in their overflows. Texel indices run
+// down the columns, see the Khronos Data Format Specification.
+static void decodeEtc2Rgb(const uchar* b, uchar* rgba) {
+    static const int modifiers[8][2] = {
+        {2, 8}, {5, 17}, {9, 29}, {13, 42}, {18, 60}, {24, 80}, {33, 106}, {47, 183}
+    };
+    static const int distances[8] = {3, 6, 11, 16, 23, 32, 41, 64};
+
+    const uint32_t msbs = b[4] << 8 | b[5];
+    const uint32_t lsbs = b[6] << 8 | b[7];
+    auto index = [&](int x, int y) {
+        int k = x * 4 + y;
+        return (int)((msbs >> k) & 1) << 1 | (int)((lsbs >> k) & 1);
+    };
+    auto store = [&](int x, int y, int r, int g, int bl) {
+        uchar* texel = rgba + (y * 4 + x) * 4;
+        texel[0] = clamp255(r);
+        texel[1] = clamp255(g);
+        texel[2] = clamp255(bl);
+        texel[3] = 255;
+    };
+
+    int base[2][3];
+    const bool differential = b[3] & 2;
+    if (!differential) {
+        for (int c = 0; c < 3; c++) {
+            base[0][c] = extend4(b[c] >> 4);
+            base[1][c] = extend4(b[c] & 15);
+        }
+    } else {
+        int r = b[0] >> 3, dr = signed3(b[0] & 7);
+        int g = b[1] >> 3, dg = signed3(b[1] & 7);
+        int bl = b[2] >> 3, db = signed3(b[2] & 7);
+
+        if (r + dr < 0 || r + dr > 31) {
+            // T mode
+            int c[2][3] = {
+                { extend4((b[0] >> 3 & 3) << 2 | (b[0] & 3)), extend4(b[1] >> 4), extend4(b[1] & 15) },
+                { extend4(b[2] >> 4), extend4(b[2] & 15), extend4(b[3] >> 4) }
+            };
+            int d = distances[(b[3] >> 2 & 3) << 1 | (b[3] & 1)];
+            int paint[4][3];
+            for (int i = 0; i < 3; i++) {
+                paint[0][i] = c[0][i];
+                paint[1][i] = c[1][i] + d;
+                paint[2][i] = c[1][i];
+                paint[3][i] = c[1][i] - d;
+            }
+            for (int x = 0; x < 4; x++)
+                for (int y = 0; y < 4; y++) {
+                    const int* p = paint[index(x, y)];
+                    store(x, y, p[0], p[1], p[2]);
+                }
+            return;
+        }
+
+        if (g + dg < 0 || g + dg > 31) {
+            // H mode
+            int c4[2][3] = {
+                { b[0] >> 3 & 15, (b[0] & 7) << 1 | (b[1] >> 4 & 1), (b[1] & 8) | (b[1] & 3) << 1 | b[2] >> 7 },
+                { b[2] >> 3 & 15, (b[2] & 7) << 1 | b[3] >> 7, b[3] >> 3 & 15 }
+            };
+            int order = (c4[0][0] << 8 | c4[0][1] << 4 | c4[0][2]) >=
+                        (c4[1][0] << 8 | c4[1][1] << 4 | c4[1][2]) ? 1 : 0;
+            int d = distances[(b[3] & 4) | (b[3] & 1) << 1 | order];
+            int paint[4][3];
+            for (int i = 0; i < 3; i++) {
+                paint[0][i] = extend4(c4[0][i]) + d;
+                paint[1][i] = extend4(c4[0][i]) - d;
+                paint[2][i] = extend4(c4[1][i]) + d;
+                paint[3][i] = extend4(c4[1][i]) - d;
+            }
+            for (int x = 0; x < 4; x++)
+                for (int y = 0; y < 4; y++) {
+                    const int* p = paint[index(x, y)];
+                    store(x, y, p[0], p[1], p[2]);
+                }
+            return;
+        }
+
+        if (bl + db < 0 || bl + db > 31) {
+            // planar mode, a gradient from three colors
+            int o[3] = {
+                extend6(b[0] >> 1 & 63),
+                extend7((b[0] & 1) << 6 | (b[1] >> 1 & 63)),
+                extend6((b[1] & 1) << 5 | (b[2] >> 3 & 3) << 3 | (b[2] & 3) << 1 | b[3] >> 7)
+            };
+            int h[3] = {
+                extend6((b[3] >> 2 & 31) << 1 | (b[3] & 1)),
+                extend7(b[4] >> 1),
+                extend6((b[4] & 1) << 5 | b[5] >> 3)
+            };
+            int v[3] = {
+                extend6((b[5] & 7) << 3 | b[6] >> 5),
+                extend7((b[6] & 31) << 2 | b[7] >> 6),
+                extend6(b[7] & 63)
+            };
+            for (int x = 0; x < 4; x++)
+                for (int y = 0; y < 4; y++) {
+                    int c[3];
+                    for (int i = 0; i < 3; i++)
+                        c[i] = (x * (h[i] - o[i]) + y * (v[i] - o[i]) + 4 * o[i] + 2) >> 2;
+                    store(x, y, c[0], c[1], c[2]);
+                }
+            return;
+        }
+
+        base[0][0] = extend5(r);
+        base[0][1] = extend5(g);
+        base[0][2] = extend5(bl);
+        base[1][0] = extend5(r + dr);
+        base[1][1] = extend5(g + dg);
+        base[1][2] = extend5(bl + db);
+    }
+
+    // two 2x4 or 4x2 sub-blocks with a base color and a modifier table each
+    const bool flip = b[3] & 1;
+    const int table[2] = { b[3] >> 5, b[3] >> 2 & 7 };
+    for (int x = 0; x < 4; x++)
+        for (int y = 0; y < 4; y++) {
+            int sub = flip ? y / 2 : x / 2;
+            int i = index(x, y);
+            int modifier = modifiers[table[sub]][i & 1];
+            if (i & 2)
+                modifier = -modifier;
+            store(x, y, base[sub][0] + modifier, base[sub][1] + modifier, base[sub][2] + modifier);
+        }
+}
+
+// EAC alpha of ETC2 RGBA, followed by an ETC2 RGB block
+static void decodeEtc2Rgba(const uchar* block, uchar* rgba) {
+    static const int modifiers[16][8] = {
+        {-3, -6, -9, -15, 2, 5, 8, 14}, {-3, -7, -10, -13, 2, 6, 9, 12},
+        {-2, -5, -8, -13, 1, 4, 7, 12}, {-2, -4, -6, -13, 1, 3, 5, 12},
+        {-3, -6, -8, -12, 2, 5, 7, 11}, {-3, -7, -9, -11, 2, 6, 8, 10},
+        {-4, -7, -8, -11, 3, 6, 7, 10}, {-3, -5, -8, -11, 2, 4, 7, 10},
+        {-2, -6, -8, -10, 1, 5, 7, 9}, {-2, -5, -8, -10, 1, 4, 7, 9},
+        {-2, -4, -8, -10, 1, 3, 7, 9}, {-2, -5, -7, -10, 1, 4, 6, 9},
+        {-3, -4, -7, -10, 2, 3, 6, 9}, {-1, -2, -3, -10, 0, 1, 2, 9},
+        {-4, -6, -8, -9, 3, 5, 7, 8}, {-3, -5, -7, -9, 2, 4, 6, 8}
+    };
+    decodeEtc2Rgb(block + 8, rgba);
+
+    const int base = block[0];
+    const int multiplier = block[1] >> 4;
+    const int* table = modifiers[block[1] & 15];
+    quint64 indices = 0;
+    for (int i = 2; i < 8; i++)
+        indices = indices << 8 | block[i];
+    // first index in the highest bits, down the columns
+    for (int x = 0; x < 4; x++)
+        for (int y = 0; y < 4; y++) {
+            int k = x * 4 + y;
+            int i = (int)(indices >> (45 - 3 * k)) & 7;
+            rgba[(y * 4 + x) * 4 + 3] = clamp255(base + table[i] * multiplier);
+        }
+}
+
+bool QVkTextureFile::decompress() {
+    BlockDecoder decode;
+    switch (m_format) {
+    case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+    case VK_FORMAT_BC1_RGB_SRGB_BLOCK:          decode = decodeBc1Rgb; break;
+    case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+    case VK_FORMAT_BC1_RGBA_SRGB_BLOCK:         decode = decodeBc1Rgba; break;
+    case VK_FORMAT_BC2_UNORM_BLOCK:
+    case VK_FORMAT_BC2_SRGB_BLOCK:              decode = decodeBc2; break;
+    case VK_FORMAT_BC3_UNORM_BLOCK:
+    case VK_FORMAT_BC3_SRGB_BLOCK:              decode = decodeBc3; break;
+    case VK_FORMAT_BC4_UNORM_BLOCK:             decode = decodeBc4; break;
+    case VK_FORMAT_BC5_UNORM_BLOCK:             decode = decodeBc5; break;
+    case VK_FORMAT_ETC2_R8G8B8_UNORM_BLOCK:
+    case VK_FORMAT_ETC2_R8G8B8_SRGB_BLOCK:      decode = decodeEtc2Rgb; break;
+    case VK_FORMAT_ETC2_R8G8B8A8_UNORM_BLOCK:
+    case VK_FORMAT_ETC2_R8G8B8A8_SRGB_BLOCK:    decode = decodeEtc2Rgba; break;
+    default:
+        return fail(QString("no CPU decoder for format %1").arg(m_format));
+    }
+    const bool srgb = m_format == VK_FORMAT_BC1_RGB_SRGB_BLOCK || m_format == VK_FORMAT_BC1_RGBA_SRGB_BLOCK ||
+                      m_format == VK_FORMAT_BC2_SRGB_BLOCK || m_format == VK_FORMAT_BC3_SRGB_BLOCK ||
+                      m_format == VK_FORMAT_ETC2_R8G8B8_SRGB_BLOCK || m_format == VK_FORMAT_ETC2_R8G8B8A8_SRGB_BLOCK;
+
+    uint32_t blockWidth, blockHeight, blockBytes;
+    blockSize(m_format, &blockWidth, &blockHeight, &blockBytes);
+
+    // setLevels() bounds the size of the blocks, not of the texels they
+    // decode to
+    QVector<Level> levels = m_levels;
+    quint64 total = 0;
+    for (Level& level : levels) {
+        const quint64 size = (quint64)level.width * level.height * 4;
+        if (total + size > (quint64)std::numeric_limits<int>::max())
+            return fail("too large to decompress");
+        level.offset = (uint32_t)total;
+        level.size = (uint32_t)size;
+        total += size;
+    }
+
+    QByteArray data((int)total, Qt::Uninitialized);
+    uchar texels[16 * 4];
+    for (int l = 0; l < levels.size(); l++) {
+        const Level& level = levels[l];
+        const uchar* src = reinterpret_cast<const uchar*>(m_data.constData()) + m_levels[l].offset;
+        uchar* dst = reinterpret_cast<uchar*>(data.data()) + level.offset;
+        for (uint32_t by = 0; by < level.height; by += 4) {
+            for (uint32_t bx = 0; bx < level.width; bx += 4) {
+                decode(src, texels);
+                src += blockBytes;
+                // blocks on the right and bottom edges may stick out
+                uint32_t w = qMin(4u, level.width - bx), h = qMin(4u, level.height - by);
+                for (uint32_t y = 0; y < h; y++)
+                    memcpy(dst + ((by + y) * level.width + bx) * 4, texels + y * 16, w * 4);
+            }
+        }
+    }
+
+    m_levels = levels;
+    m_data = data;
+    m_format = srgb ? VK_FORMAT_R8G8B8A8_SRGB : VK_FORMAT_R8G8B8A8_UNORM;
+    return true;
+}
@@ -0,0 +1,85 @@
+#ifndef QVKTEXTUREFILE_H
+#define QVKTEXTUREFILE_H
+
+#include <vulkan/vulkan.h>
+#include <QByteArray>
+#include <QImage>
+#include <QString>
+#include <QVector>
+
+/*
+ * A 2D texture read from a KTX2 or DDS file, with the mip levels stored
+ * in the file. Block compressed data (BCn, ETC2, ASTC) is kept as it is;
+ * every level is tightly packed rows of texel blocks, which is what
+ * vkCmdCopyBufferToImage takes.
+ *
+ * Devices that cannot sample format() get decompress(). It decodes BC1 to
+ * BC5 and ETC2 RGB and RGBA on the CPU. Supercompressed KTX2 files, cube
+ * maps, arrays and volumes are not supported.
+ */
+class QVkTextureFile {
+public:
+    struct Level {
+        uint32_t width;
+        uint32_t height;
+        // range of data()
+        uint32_t offset;
+        uint32_t size;
+    };
+
+    // whether load() reads filename, by its extension
+    static bool isTextureFile(const QString& filename);
+
+    // isNull() with an errorString() if the file cannot be read
+    static QVkTextureFile load(const QString& filename);
+    static QVkTextureFile fromData(const QByteArray& file);
+    // Levels given as images, each half the size of the one before. The
+    // texels of format have to match the bytes of the images, swizzle
+    // puts their channels in place, see QVkImageFormat.
+    static QVkTextureFile fromImages(VkFormat format, const VkComponentMapping& swizzle,
+                                     const QVector<QImage>& levels);
+
+    bool isNull() const { return m_levels.isEmpty(); }
+    QString errorString() const { return m_error; }
+
+    VkFormat format() const { return m_format; }
+    // of the image view, identity for KTX2 and DDS files
+    const VkComponentMapping& swizzle() const { return m_swizzle; }
+    uint32_t width() const { return m_levels.isEmpty() ? 0 : m_levels[0].width; }
+    uint32_t height() const { return m_levels.isEmpty() ? 0 : m_levels[0].height; }
+    const QVector<Level>& levels() const { return m_levels; }
+    const QByteArray& data() const { return m_data; }
+
+    bool isCompressed() const;
+
+    // Replaces the blocks of every level with R8G8B8A8 texels, sRGB if
+    // the format was. Returns false with an errorString() if there is no
+    // decoder for format() or the texels would not fit data().
+    bool decompress();
+
+    // texel blocks of format, false for formats the loader does not know
+    static bool blockSize(VkFormat format, uint32_t* width, uint32_t* height, uint32_t* bytes);
+    // of the levels in staging memory, a multiple of the block size, see
+    // QVkUploadManager::stageImage()
+    VkDeviceSize stagingAlignment() const;
+
+private:
+    bool readKtx2(const QByteArray& file);
+    bool readDds(const QByteArray& file);
+    // levels of format starting at offset in file, one after the other
+    // unless offsets are given
+    bool setLevels(const QByteArray& file, uint32_t width, uint32_t height, uint32_t count,
+                   uint32_t offset, const QVector<quint64>& offsets = QVector<quint64>());
+    bool fail(const QString& error);
+
+    VkFormat m_format           {VK_FORMAT_UNDEFINED};
+    VkComponentMapping m_swizzle {
+        VK_COMPONENT_SWIZZLE_IDENTITY, VK_COMPONENT_SWIZZLE_IDENTITY,
+        VK_COMPONENT_SWIZZLE_IDENTITY, VK_COMPONENT_SWIZZLE_IDENTITY,
+    };
+    QVector<Level> m_levels;
+    QByteArray m_data;
+    QString m_error;
+};
+
+#endif // QVKTEXTUREFILE_H
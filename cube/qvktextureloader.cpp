@@ -0,0 +1,145 @@
+#include <QBuffer>
+#include <QDebug>
+#include <QFile>
+#include <QFileInfo>
+#include <QImageReader>
+#include <QMutexLocker>
+#include <QRunnable>
+#include "qvktextureloader.h"
+#include "qvkimageformat.h"
+#include "qvkutil.h"
+
+class QVkTextureLoadTask : public QRunnable {
+public:
+    QVkTextureLoadTask(QVkTextureLoader* loader, int id, const QString& filename)
+        : m_loader(loader)
+        , m_id(id)
+        , m_filename(filename)
+    {}
+
+    void run() override {
+        m_loader->finished({m_id, m_filename, m_loader->read(m_filename)});
+    }
+
+private:
+    QVkTextureLoader* m_loader;
+    int m_id;
+    QString m_filename;
+};
+
+QVkTextureLoader::QVkTextureLoader(VkPhysicalDevice gpu, QVkTextureCache* cache, QObject* parent)
+    : QObject(parent)
+    , m_gpu(gpu)
+    , m_cache(cache)
+{
+    DEBUG_ENTRY;
+}
+
+QVkTextureLoader::~QVkTextureLoader() {
+    DEBUG_ENTRY;
+    m_pool.clear();
+    m_pool.waitForDone();
+    for (const Result& result : m_results) {
+        if (!result.texture.cached.cacheKey.isEmpty())
+            m_cache->release(result.texture.cached.cacheKey);
+    }
+}
+
+void QVkTextureLoader::load(int id, const QString& filename) {
+    DEBUG_ENTRY;
+    m_pool.start(new QVkTextureLoadTask(this, id, filename));
+}
+
+// Runs on the pool, like decode() and the cache lookup, so neither
+// traces with DEBUG_ENTRY: ScopeDebug is not thread safe.
+QVkDecodedTexture QVkTextureLoader::read(const QString& filename) {
+    QFile file(filename);
+    if (!file.open(QIODevice::ReadOnly)) {
+        QVkDecodedTexture texture;
+        texture.error = file.errorString();
+        return texture;
+    }
+    // the file is read once, hashed and decoded from memory
+    const QByteArray data = file.readAll();
+    const QByteArray key = QVkTextureCache::contentKey(data);
+    QVkDecodedTexture texture;
+    if (!m_cache->acquireKey(key, &texture.cached))
+        texture = decode(filename, data, m_gpu, m_mipChainSize, m_blitSource);
+    texture.key = key;
+    return texture;
+}
+
+QVkDecodedTexture QVkTextureLoader::decode(const QString& filename, const QByteArray& data,
+                                           VkPhysicalDevice gpu, uint32_t mipChainSize, bool blitSource) {
+    QVkDecodedTexture texture;
+    if (QVkTextureFile::isTextureFile(filename)) {
+        texture.file = QVkTextureFile::fromData(data);
+        if (texture.file.isNull()) {
+            texture.error = texture.file.errorString();
+            return texture;
+        }
+        // block compressed formats are optional, BC on desktops and ETC2
+        // and ASTC on mobile GPUs
+        VkFormatProperties props;
+        vkGetPhysicalDeviceFormatProperties(gpu, texture.file.format(), &props);
+        if (!(props.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT)) {
+            qWarning()<<filename<<"format"<<(int)texture.file.format()<<"cannot be sampled, decoding it on the CPU";
+            if (!texture.file.decompress())
+                texture.error = texture.file.errorString();
+        }
+        return texture;
+    }
+
+    // in the format the reader decodes to, if the device samples it, see
+    // QVulkanView::prepare_texture_image()
+    QBuffer buffer;
+    buffer.setData(data);
+    QImageReader reader(&buffer, QFileInfo(filename).suffix().toLatin1());
+    if (!reader.read(&texture.image)) {
+        texture.error = reader.errorString();
+        return texture;
+    }
+    const QVkImageFormat format = QVkImageFormat::negotiate(gpu, texture.image.format(), blitSource);
+    texture.image = format.convert(texture.image);
+
+    const QSize size = texture.image.size();
+    if (mipChainSize == 0 || (uint32_t)qMax(size.width(), size.height()) <= mipChainSize)
+        return texture;
+    // Each level from the one before, as QVkMipGenerator does on the GPU.
+    // Smooth scaling filters premultiplied, which keeps transparent texels
+    // from bleeding their color.
+    QVector<QImage> levels;
+    levels << texture.image;
+    while (levels.last().width() > 1 || levels.last().height() > 1) {
+        const QImage& previous = levels.last();
+        QImage level = previous.scaled(qMax(1, previous.width() / 2), qMax(1, previous.height() / 2),
+                                       Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+        if (level.format() != format.storage)
+            level = level.convertToFormat(format.storage);
+        levels << level;
+    }
+    texture.file = QVkTextureFile::fromImages(format.format, format.swizzle, levels);
+    texture.image = QImage();
+    if (texture.file.isNull())
+        texture.error = texture.file.errorString();
+    return texture;
+}
+
+void QVkTextureLoader::finished(const Result& result) {
+    QMutexLocker locker(&m_lock);
+    m_results << result;
+    // one delivery for all the results that pile up until it runs
+    if (m_results.size() == 1)
+        QMetaObject::invokeMethod(this, "deliver", Qt::QueuedConnection);
+}
+
+void QVkTextureLoader::deliver() {
+    DEBUG_ENTRY;
+    QVector<Result> results;
+    {
+        QMutexLocker locker(&m_lock);
+        results.swap(m_results);
+    }
+    for (const Result& result : results)
+        emit loaded(result.id, result.filename, result.texture);
+}
@@ -0,0 +1,95 @@
+#ifndef QVKTEXTURELOADER_H
+#define QVKTEXTURELOADER_H
+
+#include <vulkan/vulkan.h>
+#include <QImage>
+#include <QMutex>
+#include <QObject>
+#include <QThreadPool>
+#include <QVector>
+#include "qvktexturefile.h"
+#include "qvktexturecache.h"
+
+// a texture read and decoded by QVkTextureLoader, ready to be uploaded
+struct QVkDecodedTexture {
+    // QVkTextureCache::contentKey() of the file
+    QByteArray key;
+    // the texture of key if the cache had it, with a reference taken;
+    // nothing was decoded then
+    texture_object cached;
+    // KTX2 and DDS files, in a format the device samples
+    QVkTextureFile file;
+    // any other image, in the storage format QVkImageFormat negotiated
+    // for it. Images with mip chains, see
+    // QVkTextureLoader::setMipChainSize(), come as file instead.
+    QImage image;
+    // empty if one of them is set
+    QString error;
+};
+
+/*
+ * Reads and decodes textures on a thread pool, so the window shows its
+ * first frame while the disk and the decoders are busy.
+ *
+ * loaded() is emitted on the thread of the loader, from its event loop.
+ * Creating the image and staging its upload is left to the receiver, the
+ * workers never touch the device. Files whose contents are in the cache
+ * already are not decoded at all.
+ */
+class QVkTextureLoader : public QObject {
+    Q_OBJECT
+public:
+    // gpu decides which block compressed formats are decoded on the CPU
+    QVkTextureLoader(VkPhysicalDevice gpu, QVkTextureCache* cache, QObject* parent = nullptr);
+    // waits for the running loads, loads not started yet and results not
+    // delivered yet are dropped
+    ~QVkTextureLoader();
+
+    // id is passed on to loaded()
+    void load(int id, const QString& filename);
+
+    // Images larger than size in either dimension are delivered with all
+    // their mip levels, scaled down on the worker, so their upload can
+    // start with the smallest ones. 0, the default, never builds them.
+    // Set before the first load().
+    void setMipChainSize(uint32_t size) { m_mipChainSize = size; }
+    // Images are blitted, e.g. into an atlas, and get formats that need
+    // no swizzle, see QVkImageFormat::negotiate(). Set before the first
+    // load().
+    void setBlitSource(bool blit) { m_blitSource = blit; }
+
+    // blocks until the pool is idle, the results are still delivered from
+    // the event loop
+    void waitForDone() { m_pool.waitForDone(); }
+
+    // decodes data, the contents of filename, on the calling thread
+    static QVkDecodedTexture decode(const QString& filename, const QByteArray& data, VkPhysicalDevice gpu,
+                                    uint32_t mipChainSize = 0, bool blitSource = false);
+
+signals:
+    void loaded(int id, const QString& filename, const QVkDecodedTexture& texture);
+
+private slots:
+    void deliver();
+
+private:
+    struct Result {
+        int id;
+        QString filename;
+        QVkDecodedTexture texture;
+    };
+    friend class QVkTextureLoadTask;
+    QVkDecodedTexture read(const QString& filename);
+    void finished(const Result& result);
+
+    VkPhysicalDevice m_gpu;
+    QVkTextureCache* m_cache;
+    uint32_t m_mipChainSize     {0};
+    bool m_blitSource           {false};
+    QThreadPool m_pool;
+    // results waiting for deliver()
+    QMutex m_lock;
+    QVector<Result> m_results;
+};
+
+#endif // QVKTEXTURELOADER_H
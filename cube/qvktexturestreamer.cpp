@@ -0,0 +1,264 @@
+#include "qvktexturestreamer.h"
+#include "qvkcmdbuf.h"
+#include "qvkimage.h"
+
+// stages sampling the textures
+static const VkPipelineStageFlags SHADER_STAGES =
+        VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+
+// the finest level of file no larger than STREAMING_TAIL_SIZE, or the
+// last one
+static uint32_t tailLevel(const QVkTextureFile& file) {
+    const QVector<QVkTextureFile::Level>& levels = file.levels();
+    uint32_t level = 0;
+    while (level + 1 < (uint32_t)levels.size() &&
+           qMax(levels[level].width, levels[level].height) > STREAMING_TAIL_SIZE)
+        level++;
+    return level;
+}
+
+QVkTextureStreamer::QVkTextureStreamer(QSharedPointer<QVkDevice> dev, QVkUploadManager* uploads,
+                                       VkDeviceSize budget, VkDeviceSize bytesPerFrame)
+    : QVkDeviceResource(dev)
+    , m_uploads(uploads)
+    , m_budget(budget)
+    , m_bytesPerFrame(bytesPerFrame)
+{
+    DEBUG_ENTRY;
+}
+
+QVkTextureStreamer::~QVkTextureStreamer() {
+    DEBUG_ENTRY;
+    // the textures belong to the callers of add()
+}
+
+bool QVkTextureStreamer::isStreamable(const QVkTextureFile& file) {
+    return !file.isNull() && tailLevel(file) > 0;
+}
+
+VkDeviceSize QVkTextureStreamer::residentSize(const Stream& stream, uint32_t first) {
+    VkDeviceSize size = 0;
+    for (int level = (int)first; level < stream.file.levels().size(); level++)
+        size += stream.file.levels()[level].size;
+    return size;
+}
+
+texture_object QVkTextureStreamer::add(int id, const QVkTextureFile& file) {
+    DEBUG_ENTRY;
+    Q_ASSERT(isStreamable(file) && !m_streams.contains(id));
+    Stream& stream = m_streams[id];
+    stream.file = file;
+    stream.texture = {};
+    stream.tail = tailLevel(file);
+    // nothing resident yet
+    stream.first = file.levels().size();
+    stream.wanted = stream.tail;
+    stream.used = 0;
+    resize(stream, stream.tail);
+    return stream.texture;
+}
+
+const texture_object& QVkTextureStreamer::texture(int id) const {
+    auto stream = m_streams.constFind(id);
+    Q_ASSERT(stream != m_streams.constEnd());
+    return stream->texture;
+}
+
+void QVkTextureStreamer::request(int id, float size) {
+    auto stream = m_streams.find(id);
+    if (stream == m_streams.end())
+        return;
+    // the coarsest level with at least a texel per pixel
+    const QVector<QVkTextureFile::Level>& levels = stream->file.levels();
+    uint32_t level = stream->tail;
+    while (level > 0 && (float)qMax(levels[level].width, levels[level].height) < size)
+        level--;
+    stream->wanted = qMin(stream->wanted, level);
+    if (level < stream->tail)
+        stream->used = m_updates;
+}
+
+bool QVkTextureStreamer::evict(VkDeviceSize size, QVector<int>* changed) {
+    DEBUG_ENTRY;
+    while (m_size + size > m_budget) {
+        // the texture requested least recently of those with levels
+        // beyond their request
+        auto victim = m_streams.end();
+        for (auto stream = m_streams.begin(); stream != m_streams.end(); ++stream) {
+            if (stream->first < stream->wanted && (victim == m_streams.end() || stream->used < victim->used))
+                victim = stream;
+        }
+        if (victim == m_streams.end())
+            return false;
+
+        DBG("dropping levels %u to %u of texture %d", victim->first, victim->wanted - 1, victim.key());
+        Q_ASSERT(!changed->contains(victim.key()));
+        resize(*victim, victim->wanted);
+        *changed << victim.key();
+    }
+    return true;
+}
+
+QVector<int> QVkTextureStreamer::update() {
+    DEBUG_ENTRY;
+    QVector<int> changed;
+    // a lower budget or textures added since the last frame
+    evict(0, &changed);
+
+    // Textures missing the most levels first, each with as many levels as
+    // fit. The first level of a frame is staged even if it is larger than
+    // the bytes per frame, levels that size would never go otherwise.
+    QVector<int> done = changed;
+    VkDeviceSize staged = 0;
+    while (staged < m_bytesPerFrame) {
+        auto next = m_streams.end();
+        for (auto stream = m_streams.begin(); stream != m_streams.end(); ++stream) {
+            if (stream->first > stream->wanted && !done.contains(stream.key()) &&
+                (next == m_streams.end() || stream->first - stream->wanted > next->first - next->wanted))
+                next = stream;
+        }
+        if (next == m_streams.end())
+            break;
+        done << next.key();
+
+        uint32_t first = next->first;
+        VkDeviceSize bytes = 0;
+        while (first > next->wanted) {
+            const VkDeviceSize level = next->file.levels()[first - 1].size;
+            if (staged + bytes > 0 && staged + bytes + level > m_bytesPerFrame)
+                break;
+            if (!evict(bytes + level, &changed))
+                break;
+            bytes += level;
+            first--;
+        }
+        if (first == next->first)
+            continue;
+
+        DBG("streaming levels %u to %u of texture %d", first, next->first - 1, next.key());
+        resize(*next, first);
+        changed << next.key();
+        staged += bytes;
+    }
+
+    // requests are per frame
+    for (Stream& stream : m_streams)
+        stream.wanted = stream.tail;
+    m_updates++;
+    return changed;
+}
+
+void QVkTextureStreamer::resize(Stream& stream, uint32_t first) {
+    DEBUG_ENTRY;
+    VkResult U_ASSERT_ONLY err;
+    const QVector<QVkTextureFile::Level>& levels = stream.file.levels();
+    const uint32_t count = levels.size();
+    Q_ASSERT(first <= stream.tail && first != stream.first);
+    const VkImage old = stream.texture.image;
+    const uint32_t oldFirst = stream.first;
+
+    texture_object& texture = stream.texture;
+    texture = {};
+    texture.format = stream.file.format();
+    texture.swizzle = stream.file.swizzle();
+    texture.tex_width = levels[first].width;
+    texture.tex_height = levels[first].height;
+    texture.mipLevels = count - first;
+    texture.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+    // the source of the next resize and of copies into an atlas
+    VkImageCreateInfo image_ci = {};
+    image_ci.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    image_ci.imageType = VK_IMAGE_TYPE_2D;
+    image_ci.format = texture.format;
+    image_ci.extent = {texture.tex_width, texture.tex_height, 1};
+    image_ci.mipLevels = texture.mipLevels;
+    image_ci.arrayLayers = 1;
+    image_ci.samples = VK_SAMPLE_COUNT_1_BIT;
+    image_ci.tiling = VK_IMAGE_TILING_OPTIMAL;
+    image_ci.usage = VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT |
+                     VK_IMAGE_USAGE_SAMPLED_BIT;
+    image_ci.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    err = vkCreateImage(device(), &image_ci, nullptr, &texture.image);
+    Q_ASSERT(!err);
+    texture.mem = dev()->allocator().allocateForImage(texture.image, VK_IMAGE_TILING_OPTIMAL,
+                                                      QVkMemoryUsage::GpuOnly);
+
+    // the levels the old image does not have come from the file
+    for (uint32_t level = first; level < qMin(oldFirst, count); level++) {
+        const QVkTextureFile::Level& l = levels[level];
+        VkBufferImageCopy region = {};
+        region.imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, level - first, 0, 1};
+        region.imageOffset = {0, 0, 0};
+        region.imageExtent = {l.width, l.height, 1};
+        m_uploads->uploadImage(texture.image, region, stream.file.data().constData() + l.offset, l.size,
+                               texture.imageLayout, VK_IMAGE_LAYOUT_UNDEFINED, stream.file.stagingAlignment());
+    }
+
+    // The others are copied from the old image after the uploads of the
+    // batch, which may include the old image itself. Frames recorded
+    // before sample it until the batch runs, after it nothing does.
+    if (oldFirst < count) {
+        const uint32_t shared = count - qMax(first, oldFirst);
+        const uint32_t srcLevel = qMax(first, oldFirst) - oldFirst;
+        const uint32_t dstLevel = qMax(first, oldFirst) - first;
+        QVector<VkImageCopy> regions;
+        for (uint32_t i = 0; i < shared; i++) {
+            const QVkTextureFile::Level& l = levels[qMax(first, oldFirst) + i];
+            VkImageCopy region = {};
+            region.srcSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, srcLevel + i, 0, 1};
+            region.dstSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, dstLevel + i, 0, 1};
+            region.extent = {l.width, l.height, 1};
+            regions << region;
+        }
+        const VkImage image = texture.image;
+        const VkImageLayout layout = texture.imageLayout;
+        m_uploads->recordAfterCopies([=](QVkCommandBufferRecorder& recorder) {
+            VkImageMemoryBarrier toTransfer[2] = {
+                levelBarrier(old, srcLevel, shared, layout, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                             0, VK_ACCESS_TRANSFER_READ_BIT),
+                levelBarrier(image, dstLevel, shared, VK_IMAGE_LAYOUT_UNDEFINED,
+                             VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 0, VK_ACCESS_TRANSFER_WRITE_BIT)
+            };
+            recorder.pipelineBarrier(SHADER_STAGES | VK_PIPELINE_STAGE_TRANSFER_BIT,
+                                     VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+                                     0, nullptr, 0, nullptr, 2, toTransfer);
+            recorder.copyImage(old, image, regions);
+            // the old image is retired as it is
+            VkImageMemoryBarrier toShader = levelBarrier(image, dstLevel, shared,
+                    VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, layout,
+                    VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT);
+            recorder.pipelineBarrier(VK_PIPELINE_STAGE_TRANSFER_BIT, SHADER_STAGES, 0, &toShader);
+        });
+    }
+    m_size += residentSize(stream, first);
+    m_size -= residentSize(stream, oldFirst);
+    stream.first = first;
+
+    // the view covers the resident levels only, the coarser image is
+    // sampled as if it were the whole texture
+    VkImageViewCreateInfo view = {};
+    view.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    view.image = texture.image;
+    view.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    view.format = texture.format;
+    view.components = texture.swizzle;
+    view.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, texture.mipLevels, 0, 1};
+    err = vkCreateImageView(device(), &view, nullptr, &texture.view);
+    Q_ASSERT(!err);
+
+    VkSamplerCreateInfo sampler = {};
+    sampler.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+    sampler.magFilter = VK_FILTER_NEAREST;
+    sampler.minFilter = VK_FILTER_LINEAR;
+    sampler.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+    sampler.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    sampler.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    sampler.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    sampler.maxAnisotropy = 1;
+    sampler.compareOp = VK_COMPARE_OP_NEVER;
+    sampler.maxLod = (float)texture.mipLevels;
+    sampler.borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_WHITE;
+    err = vkCreateSampler(device(), &sampler, nullptr, &texture.sampler);
+    Q_ASSERT(!err);
+}
@@ -0,0 +1,108 @@
+#ifndef QVKTEXTURESTREAMER_H
+#define QVKTEXTURESTREAMER_H
+
+#include <vulkan/vulkan.h>
+#include <QHash>
+#include <QVector>
+#include "qvkdevice.h"
+#include "qvkupload.h"
+#include "qvktexturefile.h"
+#include "qvktexturecache.h"
+
+// the levels up to this size are uploaded with the texture and stay
+#define STREAMING_TAIL_SIZE 64
+// device memory of the streamed levels of all textures
+#define DEFAULT_TEXTURE_STREAMING_BUDGET (128 * 1024 * 1024)
+// bytes of levels staged per frame, one staging chunk
+#define DEFAULT_STREAMING_BYTES_PER_FRAME DEFAULT_STAGING_CHUNK_SIZE
+
+/*
+ * Streams the mip levels of large textures in, finest last, as far as
+ * their size on screen calls for, and drops them again when device
+ * memory gets short.
+ *
+ * A texture starts out with its tail, the levels up to
+ * STREAMING_TAIL_SIZE, so it can be drawn right away. The image of a
+ * texture only ever holds its resident levels: level 0 of the image is
+ * the finest resident level of the file, so the view covers exactly the
+ * levels there are and nothing samples a level that was not uploaded.
+ * Adding or dropping levels creates a new image, copies the levels both
+ * have on the GPU and stages only the new ones. The old image has to be
+ * retired by the owner of the texture, see update().
+ *
+ * Every frame, request() collects the largest size each texture is drawn
+ * at. update() then picks the textures missing the most levels and
+ * stages up to bytesPerFrame() of them, so big textures appearing do not
+ * stall a frame with their upload. Levels beyond what is requested stay
+ * until the budget is exceeded; then those of the textures requested
+ * least recently go first. Requested levels are never dropped, so the
+ * budget may hold less than is needed, but it is not exceeded by
+ * streaming more in.
+ *
+ * The textures are not shared through QVkTextureCache, their images
+ * change as they stream.
+ */
+class QVkTextureStreamer : public QVkDeviceResource {
+public:
+    QVkTextureStreamer(QSharedPointer<QVkDevice> dev, QVkUploadManager* uploads,
+                       VkDeviceSize budget = DEFAULT_TEXTURE_STREAMING_BUDGET,
+                       VkDeviceSize bytesPerFrame = DEFAULT_STREAMING_BYTES_PER_FRAME);
+    ~QVkTextureStreamer();
+    Q_DISABLE_COPY(QVkTextureStreamer)
+
+    // whether file has levels beyond the tail to stream
+    static bool isStreamable(const QVkTextureFile& file);
+
+    // Takes file over as texture id and stages its tail. Returns the
+    // texture, with its view and sampler, owned by the caller.
+    texture_object add(int id, const QVkTextureFile& file);
+    bool contains(int id) const { return m_streams.contains(id); }
+
+    // texture id is drawn size pixels across this frame
+    void request(int id, float size);
+
+    // Stages the level changes of this frame and returns the textures
+    // that changed, to be swapped in with texture() before the next
+    // submit of the upload manager. Their old images are still copied
+    // from by that submit; retire them with the frame recorded then.
+    QVector<int> update();
+    const texture_object& texture(int id) const;
+
+    void setBudget(VkDeviceSize bytes) { m_budget = bytes; }
+    VkDeviceSize budget() const { return m_budget; }
+    void setBytesPerFrame(VkDeviceSize bytes) { m_bytesPerFrame = bytes; }
+    VkDeviceSize bytesPerFrame() const { return m_bytesPerFrame; }
+    // bytes of all resident levels
+    VkDeviceSize size() const { return m_size; }
+
+private:
+    struct Stream {
+        QVkTextureFile file;
+        // current image, its level 0 is level first of file
+        texture_object texture;
+        uint32_t first;
+        // levels tail onwards are always resident
+        uint32_t tail;
+        // finest level requested this frame, tail if none
+        uint32_t wanted;
+        // update() counter at the last request beyond the tail
+        quint64 used;
+    };
+
+    // bytes of levels first to the last of stream
+    static VkDeviceSize residentSize(const Stream& stream, uint32_t first);
+    // replaces the image of stream with one holding levels first onwards
+    void resize(Stream& stream, uint32_t first);
+    // drops levels nothing requested until size more bytes fit into the
+    // budget, false if they do not
+    bool evict(VkDeviceSize size, QVector<int>* changed);
+
+    QVkUploadManager* m_uploads;
+    VkDeviceSize m_budget;
+    VkDeviceSize m_bytesPerFrame;
+    QHash<int, Stream> m_streams;
+    VkDeviceSize m_size         {0};
+    quint64 m_updates           {0};
+};
+
+#endif // QVKTEXTURESTREAMER_H
@@ -0,0 +1,314 @@
+#include <string.h>
+#include "qvkupload.h"
+#include "qvkcmdbuf.h"
+
+// idle chunks kept around for the next uploads, the rest is freed
+static const int MAX_IDLE_CHUNKS = 2;
+
+static VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+QVkUploadManager::QVkUploadManager(QSharedPointer<QVkDevice> dev,
+                                   VkQueue queue,
+                                   uint32_t queueFamilyIndex,
+                                   VkDeviceSize chunkSize)
+    : QVkDeviceResource(dev)
+    , m_queue(queue)
+    , m_chunkSize(chunkSize)
+{
+    DEBUG_ENTRY;
+    VkCommandPoolCreateInfo cmd_pool_info = {};
+    cmd_pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    cmd_pool_info.pNext = nullptr;
+    cmd_pool_info.queueFamilyIndex = queueFamilyIndex;
+    // command buffers are rerecorded for every batch
+    cmd_pool_info.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT |
+                          VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+    VkResult U_ASSERT_ONLY err = vkCreateCommandPool(device(), &cmd_pool_info, nullptr, &m_pool);
+    Q_ASSERT(!err);
+}
+
+QVkUploadManager::~QVkUploadManager() {
+    DEBUG_ENTRY;
+    if (!m_bufferCopies.isEmpty() || !m_imageCopies.isEmpty() || !m_commands.isEmpty())
+        qWarning("destroying upload manager with uploads that were never submitted");
+    wait(m_nextBatch - 1);
+
+    for (const Batch& batch: m_idle) {
+        vkFreeCommandBuffers(device(), m_pool, 1, &batch.cmd);
+        vkDestroyFence(device(), batch.fence, nullptr);
+    }
+    vkDestroyCommandPool(device(), m_pool, nullptr);
+
+    for (Chunk* chunk: m_chunks) {
+        delete chunk->buffer;
+        delete chunk;
+    }
+}
+
+char* QVkUploadManager::allocateStaging(VkDeviceSize size, VkDeviceSize alignment,
+                                        Chunk** chunk, VkDeviceSize* offset) {
+    if (m_current) {
+        VkDeviceSize start = alignUp(m_current->used, alignment);
+        if (start + size <= m_current->size) {
+            m_current->used = start + size;
+            m_current->lastBatch = m_nextBatch;
+            *chunk = m_current;
+            *offset = start;
+            return m_current->mapped + start;
+        }
+    }
+
+    // The current chunk is full, continue with an idle one or a new one.
+    // Chunks of completed batches have been rewound by collectLocked().
+    m_current = nullptr;
+    for (Chunk* candidate: m_chunks) {
+        if (candidate->used == 0 && candidate->size >= size) {
+            m_current = candidate;
+            break;
+        }
+    }
+    if (!m_current) {
+        m_current = new Chunk;
+        m_current->size = qMax(m_chunkSize, size);
+        m_current->buffer = new QVkStagingBuffer(dev(), m_current->size);
+        m_current->mapped = static_cast<char*>(m_current->buffer->memory().map());
+        m_chunks << m_current;
+    }
+
+    m_current->used = size;
+    m_current->lastBatch = m_nextBatch;
+    *chunk = m_current;
+    *offset = 0;
+    return m_current->mapped;
+}
+
+void* QVkUploadManager::stageBuffer(VkBuffer dst, VkDeviceSize dstOffset, VkDeviceSize size) {
+    QMutexLocker locker(&m_lock);
+    Chunk* chunk = nullptr;
+    VkBufferCopy region = {};
+    char* mapped = allocateStaging(size, 16, &chunk, &region.srcOffset);
+    region.dstOffset = dstOffset;
+    region.size = size;
+    m_bufferCopies[BufferCopyKey(chunk, dst)] << region;
+    m_writers++;
+    return mapped;
+}
+
+void QVkUploadManager::uploadBuffer(VkBuffer dst, VkDeviceSize dstOffset, const void* data, VkDeviceSize size) {
+    memcpy(stageBuffer(dst, dstOffset, size), data, size);
+    commit();
+}
+
+void* QVkUploadManager::stageImage(VkImage dst, const VkBufferImageCopy& region, VkDeviceSize size,
+                                   VkImageLayout finalLayout, VkImageLayout oldLayout,
+                                   VkDeviceSize alignment) {
+    QMutexLocker locker(&m_lock);
+    Chunk* chunk = nullptr;
+    VkBufferImageCopy copy = region;
+    char* mapped = allocateStaging(size, alignment, &chunk, &copy.bufferOffset);
+    m_imageCopies[ImageCopyKey(chunk, dst)] << copy;
+
+    // Several regions may target the same subresource, it is transitioned
+    // only once before and once after all copies of the batch.
+    const VkImageSubresourceLayers& sub = region.imageSubresource;
+    QPair<VkImage, quint64> key(dst, (quint64)sub.mipLevel << 32 | sub.baseArrayLayer);
+    if (!m_transitioned.contains(key)) {
+        m_transitioned.insert(key);
+
+        VkImageMemoryBarrier barrier = {};
+        barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.image = dst;
+        barrier.subresourceRange = {sub.aspectMask, sub.mipLevel, 1, sub.baseArrayLayer, sub.layerCount};
+
+        barrier.srcAccessMask = 0;
+        barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.oldLayout = oldLayout;
+        barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        m_toTransfer << barrier;
+
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_TRANSFER_READ_BIT;
+        barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        barrier.newLayout = finalLayout;
+        m_toFinal << barrier;
+    }
+    m_writers++;
+    return mapped;
+}
+
+void QVkUploadManager::uploadImage(VkImage dst, const VkBufferImageCopy& region, const void* data,
+                                   VkDeviceSize size, VkImageLayout finalLayout, VkImageLayout oldLayout,
+                                   VkDeviceSize alignment) {
+    memcpy(stageImage(dst, region, size, finalLayout, oldLayout, alignment), data, size);
+    commit();
+}
+
+void QVkUploadManager::commit() {
+    QMutexLocker locker(&m_lock);
+    Q_ASSERT(m_writers > 0);
+    if (--m_writers == 0)
+        m_committed.wakeAll();
+}
+
+void QVkUploadManager::recordAfterCopies(const Commands& commands) {
+    QMutexLocker locker(&m_lock);
+    m_commands << commands;
+}
+
+uint64_t QVkUploadManager::submit() {
+    DEBUG_ENTRY;
+    QMutexLocker locker(&m_lock);
+    while (m_writers > 0)
+        m_committed.wait(&m_lock);
+    collectLocked();
+
+    if (m_bufferCopies.isEmpty() && m_imageCopies.isEmpty() && m_commands.isEmpty())
+        return m_nextBatch - 1;
+
+    VkResult U_ASSERT_ONLY err;
+    for (Chunk* chunk: m_chunks) {
+        if (chunk->lastBatch == m_nextBatch && chunk->used > chunk->flushed) {
+            chunk->buffer->memory().flush(chunk->flushed, chunk->used - chunk->flushed);
+            chunk->flushed = chunk->used;
+        }
+    }
+
+    Batch batch;
+    if (!m_idle.isEmpty()) {
+        batch = m_idle.takeLast();
+    } else {
+        VkCommandBufferAllocateInfo cmd_ai = {};
+        cmd_ai.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        cmd_ai.pNext = nullptr;
+        cmd_ai.commandPool = m_pool;
+        cmd_ai.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        cmd_ai.commandBufferCount = 1;
+        err = vkAllocateCommandBuffers(device(), &cmd_ai, &batch.cmd);
+        Q_ASSERT(!err);
+
+        VkFenceCreateInfo fence_ci = {};
+        fence_ci.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+        err = vkCreateFence(device(), &fence_ci, nullptr, &batch.fence);
+        Q_ASSERT(!err);
+    }
+    batch.id = m_nextBatch++;
+
+    {
+        QVkCommandBufferRecorder rec(batch.cmd, VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+
+        if (!m_toTransfer.isEmpty()) {
+            rec.pipelineBarrier(VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+                                0, nullptr, 0, nullptr,
+                                m_toTransfer.count(), m_toTransfer.constData());
+        }
+
+        for (auto it = m_bufferCopies.constBegin(); it != m_bufferCopies.constEnd(); ++it)
+            rec.copyBuffer(it.key().first->buffer->buffer(), it.key().second, it.value());
+
+        for (auto it = m_imageCopies.constBegin(); it != m_imageCopies.constEnd(); ++it)
+            rec.copyBufferToImage(it.key().first->buffer->buffer(), it.key().second, it.value());
+
+        // make the copies visible to whatever is submitted after the batch
+        VkMemoryBarrier memoryBarrier = {};
+        memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        memoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        memoryBarrier.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT |
+                                      VK_ACCESS_INDEX_READ_BIT |
+                                      VK_ACCESS_INDIRECT_COMMAND_READ_BIT |
+                                      VK_ACCESS_UNIFORM_READ_BIT |
+                                      VK_ACCESS_SHADER_READ_BIT |
+                                      VK_ACCESS_TRANSFER_READ_BIT;
+        rec.pipelineBarrier(VK_PIPELINE_STAGE_TRANSFER_BIT,
+                            VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT |
+                            VK_PIPELINE_STAGE_VERTEX_INPUT_BIT |
+                            VK_PIPELINE_STAGE_VERTEX_SHADER_BIT |
+                            VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT |
+                            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT |
+                            VK_PIPELINE_STAGE_TRANSFER_BIT,
+                            0,
+                            1, &memoryBarrier, 0, nullptr,
+                            m_toFinal.count(), m_toFinal.constData());
+
+        for (const Commands& commands: m_commands)
+            commands(rec);
+    }
+
+    VkSubmitInfo submit_info = {};
+    submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submit_info.pNext = nullptr;
+    submit_info.commandBufferCount = 1;
+    submit_info.pCommandBuffers = &batch.cmd;
+    err = vkQueueSubmit(m_queue, 1, &submit_info, batch.fence);
+    Q_ASSERT(!err);
+    m_pending << batch;
+
+    m_bufferCopies.clear();
+    m_imageCopies.clear();
+    m_toTransfer.clear();
+    m_toFinal.clear();
+    m_transitioned.clear();
+    m_commands.clear();
+    return batch.id;
+}
+
+bool QVkUploadManager::isComplete(uint64_t batch) {
+    QMutexLocker locker(&m_lock);
+    collectLocked();
+    return batch <= m_completed;
+}
+
+void QVkUploadManager::wait(uint64_t batch) {
+    QMutexLocker locker(&m_lock);
+    Q_ASSERT(batch < m_nextBatch);
+    collectLocked();
+    while (m_completed < batch) {
+        VkResult U_ASSERT_ONLY err = vkWaitForFences(device(), 1, &m_pending.first().fence, VK_TRUE, UINT64_MAX);
+        Q_ASSERT(!err);
+        collectLocked();
+    }
+}
+
+void QVkUploadManager::collect() {
+    QMutexLocker locker(&m_lock);
+    collectLocked();
+}
+
+void QVkUploadManager::collectLocked() {
+    // batches complete in submission order
+    while (!m_pending.isEmpty() && vkGetFenceStatus(device(), m_pending.first().fence) == VK_SUCCESS) {
+        Batch batch = m_pending.takeFirst();
+        VkResult U_ASSERT_ONLY err = vkResetFences(device(), 1, &batch.fence);
+        Q_ASSERT(!err);
+        m_completed = batch.id;
+        m_idle << batch;
+    }
+
+    int idleChunks = 0;
+    for (int i = 0; i < m_chunks.count(); i++) {
+        Chunk* chunk = m_chunks[i];
+        if (chunk->lastBatch > m_completed)
+            continue;
+        chunk->used = 0;
+        chunk->flushed = 0;
+        if (chunk == m_current)
+            continue;
+        // oversized chunks were made for a single upload
+        if (chunk->size > m_chunkSize || ++idleChunks > MAX_IDLE_CHUNKS) {
+            delete chunk->buffer;
+            delete chunk;
+            m_chunks.removeAt(i--);
+        }
+    }
+}
+
+VkDeviceSize QVkUploadManager::stagingSize() {
+    QMutexLocker locker(&m_lock);
+    VkDeviceSize size = 0;
+    for (const Chunk* chunk: m_chunks)
+        size += chunk->size;
+    return size;
+}
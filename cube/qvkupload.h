@@ -0,0 +1,141 @@
+#ifndef QVKUPLOAD_H
+#define QVKUPLOAD_H
+
+#include <functional>
+#include <vulkan/vulkan.h>
+#include <QHash>
+#include <QPair>
+#include <QSet>
+#include <QMutex>
+#include <QVector>
+#include <QWaitCondition>
+#include "qvkdevice.h"
+#include "qvulkanbuffer.h"
+
+class QVkCommandBufferRecorder;
+
+#define DEFAULT_STAGING_CHUNK_SIZE (4 * 1024 * 1024)
+
+/*
+ * Uploads data to device local buffers and images through host visible
+ * staging memory.
+ *
+ * stage*() hands out staging memory for one copy and remembers the copy.
+ * submit() records everything staged since the last submit into a single
+ * command buffer, one vkCmdCopyBuffer/vkCmdCopyBufferToImage per
+ * destination with all its regions and one barrier before and after, and
+ * submits it with a fence. Staging memory is bump allocated from a few
+ * large chunks, which are reused once the fence of the last batch that
+ * used them has signaled.
+ *
+ * Staging may happen from any thread. Memory returned by stage*() has to
+ * be handed back with commit() once it is written; submit() waits for all
+ * outstanding stage*() calls to commit, so it never copies half written
+ * staging memory. submit() has to be called from the thread that submits
+ * to the queue, and never while that thread holds uncommitted staging
+ * memory.
+ */
+class QVkUploadManager : public QVkDeviceResource {
+public:
+    QVkUploadManager(QSharedPointer<QVkDevice> dev,
+                     VkQueue queue,
+                     uint32_t queueFamilyIndex,
+                     VkDeviceSize chunkSize = DEFAULT_STAGING_CHUNK_SIZE);
+    ~QVkUploadManager();
+    Q_DISABLE_COPY(QVkUploadManager)
+
+    // Staging memory for size bytes to end up at dstOffset in dst. The
+    // returned pointer may be written to until commit().
+    void* stageBuffer(VkBuffer dst, VkDeviceSize dstOffset, VkDeviceSize size);
+
+    void uploadBuffer(VkBuffer dst, VkDeviceSize dstOffset, const void* data, VkDeviceSize size);
+
+    // Staging memory for one region of dst, region.bufferOffset is filled
+    // in. The subresources of the region are transitioned from oldLayout
+    // (UNDEFINED discards their contents) to finalLayout. alignment has to
+    // be a multiple of 4 and of the texel block size of the format.
+    void* stageImage(VkImage dst, const VkBufferImageCopy& region, VkDeviceSize size,
+                     VkImageLayout finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                     VkImageLayout oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+                     VkDeviceSize alignment = 16);
+
+    void uploadImage(VkImage dst, const VkBufferImageCopy& region, const void* data, VkDeviceSize size,
+                     VkImageLayout finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                     VkImageLayout oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+                     VkDeviceSize alignment = 16);
+
+    // Hands back the memory of one stage*() call after it was written.
+    void commit();
+
+    // Recorded into the next batch after its copies and their barriers,
+    // e.g. to generate the mip levels of an image uploaded in the batch.
+    typedef std::function<void(QVkCommandBufferRecorder&)> Commands;
+    void recordAfterCopies(const Commands& commands);
+
+    // Submits everything staged so far. Returns the id of the batch to
+    // pass to wait() or isComplete(); the last submitted batch if nothing
+    // was staged.
+    uint64_t submit();
+
+    bool isComplete(uint64_t batch);
+
+    void wait(uint64_t batch);
+
+    // recycles command buffers and staging memory of completed batches,
+    // also done by submit()
+    void collect();
+
+    // bytes of staging memory currently held
+    VkDeviceSize stagingSize();
+
+private:
+    struct Chunk {
+        QVkStagingBuffer* buffer    {nullptr};
+        char* mapped                {nullptr};
+        VkDeviceSize size           {0};
+        VkDeviceSize used           {0};
+        VkDeviceSize flushed        {0};
+        // newest batch copying from this chunk
+        uint64_t lastBatch          {0};
+    };
+
+    struct Batch {
+        uint64_t id                 {0};
+        VkCommandBuffer cmd         {nullptr};
+        VkFence fence               {nullptr};
+    };
+
+    typedef QPair<Chunk*, VkBuffer> BufferCopyKey;
+    typedef QPair<Chunk*, VkImage> ImageCopyKey;
+
+    char* allocateStaging(VkDeviceSize size, VkDeviceSize alignment,
+                          Chunk** chunk, VkDeviceSize* offset);
+    void collectLocked();
+
+    VkQueue m_queue;
+    VkCommandPool m_pool            {nullptr};
+    VkDeviceSize m_chunkSize;
+
+    QMutex m_lock;
+    // stage*() calls not committed yet, submit() waits for them
+    int m_writers                   {0};
+    QWaitCondition m_committed;
+    QVector<Chunk*> m_chunks;
+    Chunk* m_current                {nullptr};
+
+    // copies staged for the next batch
+    QHash<BufferCopyKey, QVector<VkBufferCopy>> m_bufferCopies;
+    QHash<ImageCopyKey, QVector<VkBufferImageCopy>> m_imageCopies;
+    QVector<VkImageMemoryBarrier> m_toTransfer;
+    QVector<VkImageMemoryBarrier> m_toFinal;
+    // image and (mip level << 32 | array layer) already transitioned
+    QSet<QPair<VkImage, quint64>> m_transitioned;
+    QVector<Commands> m_commands;
+
+    QVector<Batch> m_pending;
+    QVector<Batch> m_idle;
+    uint64_t m_nextBatch            {1};
+    uint64_t m_completed            {0};
+};
+
+#endif // QVKUPLOAD_H
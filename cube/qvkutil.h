@@ -7,9 +7,15 @@
 #include <vulkan/vulkan.h>
 
 #define ERR_EXIT(err_msg, err_class) qFatal(err_msg)
+
+#if defined(NDEBUG) && defined(__GNUC__)
+#define U_ASSERT_ONLY __attribute__((unused))
+#else
+#define U_ASSERT_ONLY
+#endif
+
 typedef QVector<const char*> QVulkanNames;
 
-VkFormat QtFormat2vkFormat(QImage::Format f);
 QStringList getLayerNames(QVector<VkLayerProperties> layers);
 bool containsAllLayers(const QVector<VkLayerProperties> haystack, const QVulkanNames needles);
 
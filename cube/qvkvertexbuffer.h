@@ -0,0 +1,243 @@
+#ifndef QVKVERTEXBUFFER_H
+#define QVKVERTEXBUFFER_H
+
+#include <cstddef>
+#include <cstring>
+#include <vulkan/vulkan.h>
+#include <QVector>
+#include <QVector2D>
+#include <QVector3D>
+#include <QVector4D>
+#include <QMatrix4x4>
+#include "qvulkanbuffer.h"
+#include "qvkupload.h"
+#include "qvkmesh.h"
+
+/*
+ * VkFormat of a vertex attribute of C++ type T. Specialize for further
+ * attribute types. Types larger than one location, like matrices, take
+ * consecutive locations of format each.
+ */
+template <typename T> struct QVkVertexFormat;
+
+#define QVK_VERTEX_FORMAT(T, FORMAT) \
+    template <> struct QVkVertexFormat<T> { \
+        static const VkFormat format = FORMAT; \
+        static const uint32_t locations = 1; \
+    };
+
+QVK_VERTEX_FORMAT(float, VK_FORMAT_R32_SFLOAT)
+QVK_VERTEX_FORMAT(QVector2D, VK_FORMAT_R32G32_SFLOAT)
+QVK_VERTEX_FORMAT(QVector3D, VK_FORMAT_R32G32B32_SFLOAT)
+QVK_VERTEX_FORMAT(QVector4D, VK_FORMAT_R32G32B32A32_SFLOAT)
+QVK_VERTEX_FORMAT(uint32_t, VK_FORMAT_R32_UINT)
+QVK_VERTEX_FORMAT(int32_t, VK_FORMAT_R32_SINT)
+
+// column major 4x4 matrix attribute, e.g. a per-instance transform.
+// QMatrix4x4 itself carries extra flags.
+struct QVkMatrix4 {
+    QVkMatrix4() {}
+    QVkMatrix4(const QMatrix4x4& m) {
+        memcpy(columns, m.constData(), sizeof(columns));
+    }
+
+    QVector4D columns[4];
+};
+
+template <> struct QVkVertexFormat<QVkMatrix4> {
+    static const VkFormat format = VK_FORMAT_R32G32B32A32_SFLOAT;
+    static const uint32_t locations = 4;
+};
+
+// one member of a vertex struct, see QVK_VERTEX_ATTRIBUTE
+template <typename T, size_t Offset> struct QVkVertexAttribute {
+    static const VkFormat format = QVkVertexFormat<T>::format;
+    static const uint32_t offset = Offset;
+    static const uint32_t locations = QVkVertexFormat<T>::locations;
+    static const uint32_t locationSize = sizeof(T) / locations;
+};
+
+/*
+ * Binding and attribute descriptions of vertex struct VT, derived from
+ * its attributes at compile time. Attributes get consecutive shader
+ * locations in the order they are listed.
+ */
+template <typename VT, typename... Attributes> struct QVkVertexAttributes {
+    static const uint32_t count = sizeof...(Attributes);
+
+    static VkVertexInputBindingDescription binding(uint32_t binding = 0,
+                                                   VkVertexInputRate rate = VK_VERTEX_INPUT_RATE_VERTEX) {
+        VkVertexInputBindingDescription desc = {};
+        desc.binding = binding;
+        desc.stride = sizeof(VT);
+        desc.inputRate = rate;
+        return desc;
+    }
+
+    static QVector<VkVertexInputAttributeDescription> attributes(uint32_t binding = 0,
+                                                                 uint32_t firstLocation = 0) {
+        const VkFormat formats[] = { Attributes::format... };
+        const uint32_t offsets[] = { Attributes::offset... };
+        const uint32_t locations[] = { Attributes::locations... };
+        const uint32_t locationSizes[] = { Attributes::locationSize... };
+        QVector<VkVertexInputAttributeDescription> descs;
+        uint32_t location = firstLocation;
+        for (uint32_t i = 0; i < count; i++) {
+            for (uint32_t l = 0; l < locations[i]; l++) {
+                VkVertexInputAttributeDescription desc = {};
+                desc.location = location++;
+                desc.binding = binding;
+                desc.format = formats[i];
+                desc.offset = offsets[i] + l * locationSizes[i];
+                descs << desc;
+            }
+        }
+        return descs;
+    }
+};
+
+/*
+ * Vertex layout of VT, declare it with QVK_DECLARE_VERTEX_LAYOUT:
+ *
+ *   struct Vertex { QVector3D position; QVector2D uv; };
+ *   QVK_DECLARE_VERTEX_LAYOUT(Vertex,
+ *       QVK_VERTEX_ATTRIBUTE(Vertex, position),
+ *       QVK_VERTEX_ATTRIBUTE(Vertex, uv))
+ */
+template <typename VT> struct QVkVertexLayout;
+
+#define QVK_VERTEX_ATTRIBUTE(VT, member) \
+    QVkVertexAttribute<decltype(VT::member), offsetof(VT, member)>
+
+#define QVK_DECLARE_VERTEX_LAYOUT(VT, ...) \
+    template <> struct QVkVertexLayout<VT> \
+        : QVkVertexAttributes<VT, __VA_ARGS__> {};
+
+/*
+ * Device local buffer of verts vertices of type VT, filled through the
+ * upload manager.
+ */
+template <typename VT> class QVkVertexBuffer
+    : public QVkDeviceBuffer {
+public:
+    typedef QVkVertexLayout<VT> Layout;
+
+    QVkVertexBuffer(QSharedPointer<QVkDevice> device, uint32_t verts)
+        : QVkDeviceBuffer(device, sizeof(VT) * verts, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT)
+        , m_count(verts) {
+        DEBUG_ENTRY;
+    }
+
+    ~QVkVertexBuffer() {
+        DEBUG_ENTRY;
+    }
+
+    // Copies count vertices to vertex first with the next uploads.submit().
+    void upload(QVkUploadManager& uploads, const VT* vertices, uint32_t count, uint32_t first = 0) {
+        Q_ASSERT(first + count <= m_count);
+        uploads.uploadBuffer(buffer(), first * sizeof(VT), vertices, count * sizeof(VT));
+    }
+
+    void upload(QVkUploadManager& uploads, const QVector<VT>& vertices, uint32_t first = 0) {
+        upload(uploads, vertices.constData(), vertices.count(), first);
+    }
+
+    uint32_t count() const {
+        return m_count;
+    }
+
+    static VkVertexInputBindingDescription bindingDescription(uint32_t binding = 0) {
+        return Layout::binding(binding);
+    }
+
+    static QVector<VkVertexInputAttributeDescription> attributeDescriptions(uint32_t binding = 0,
+                                                                            uint32_t firstLocation = 0) {
+        return Layout::attributes(binding, firstLocation);
+    }
+
+private:
+    uint32_t m_count;
+};
+
+/*
+ * Per-instance data of type IT, stepped once per instance instead of once
+ * per vertex. It goes into its own binding next to the vertex buffer,
+ * its attributes follow the vertex attributes:
+ *
+ *   setVertexInput({ vertices.bindingDescription(0), instances.bindingDescription(1) },
+ *                  vertices.attributeDescriptions(0)
+ *                  + instances.attributeDescriptions(1, vertexAttributeLocations));
+ *
+ * Instance data that changes every frame may be allocated from the frame
+ * ring instead, with the same descriptions.
+ */
+template <typename IT> class QVkInstanceBuffer
+    : public QVkVertexBuffer<IT> {
+public:
+    typedef QVkVertexLayout<IT> Layout;
+
+    QVkInstanceBuffer(QSharedPointer<QVkDevice> device, uint32_t instances)
+        : QVkVertexBuffer<IT>(device, instances) {
+        DEBUG_ENTRY;
+    }
+
+    static VkVertexInputBindingDescription bindingDescription(uint32_t binding = 1) {
+        return Layout::binding(binding, VK_VERTEX_INPUT_RATE_INSTANCE);
+    }
+
+    static QVector<VkVertexInputAttributeDescription> attributeDescriptions(uint32_t binding = 1,
+                                                                            uint32_t firstLocation = 0) {
+        return Layout::attributes(binding, firstLocation);
+    }
+};
+
+/*
+ * Device local buffer of 16 or 32 bit indices. upload() narrows the
+ * indices to the index type while staging them.
+ */
+class QVkIndexBuffer
+    : public QVkDeviceBuffer {
+public:
+    QVkIndexBuffer(QSharedPointer<QVkDevice> device, uint32_t indices, VkIndexType type)
+        : QVkDeviceBuffer(device, (VkDeviceSize)indexSize(type) * indices, VK_BUFFER_USAGE_INDEX_BUFFER_BIT)
+        , m_count(indices)
+        , m_type(type) {
+        DEBUG_ENTRY;
+    }
+
+    ~QVkIndexBuffer() {
+        DEBUG_ENTRY;
+    }
+
+    // Copies indices to index first with the next uploads.submit().
+    void upload(QVkUploadManager& uploads, const QVector<uint32_t>& indices, uint32_t first = 0) {
+        const uint32_t count = indices.size();
+        const uint32_t size = indexSize(m_type);
+        Q_ASSERT(first + count <= m_count);
+        void* staging = uploads.stageBuffer(buffer(), (VkDeviceSize)first * size, (VkDeviceSize)count * size);
+        if (m_type == VK_INDEX_TYPE_UINT16) {
+            uint16_t* dst = static_cast<uint16_t*>(staging);
+            for (uint32_t i = 0; i < count; i++) {
+                Q_ASSERT(indices[i] <= 0xffff);
+                dst[i] = (uint16_t)indices[i];
+            }
+        } else {
+            memcpy(staging, indices.constData(), (size_t)count * size);
+        }
+        uploads.commit();
+    }
+
+    uint32_t count() const {
+        return m_count;
+    }
+
+    VkIndexType indexType() const {
+        return m_type;
+    }
+
+private:
+    uint32_t m_count;
+    VkIndexType m_type;
+};
+
+#endif // QVKVERTEXBUFFER_H
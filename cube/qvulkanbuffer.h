@@ -2,6 +2,13 @@
 #define QVULKANBUFFER_H
 #include <vulkan/vulkan.h>
 #include <qvkdevice.h>
+/*
+ * A device memory allocation, sub-allocated from the device's
+ * QVkMemoryAllocator. Host visible memory stays mapped for the lifetime of
+ * the allocation, map() only hands out pointers into that mapping. Writes
+ * to memory types without VK_MEMORY_PROPERTY_HOST_COHERENT_BIT have to be
+ * made visible with flush().
+ */
 class QVkDeviceMemory: public QVkDeviceResource
 {
 public:
@@ -11,47 +18,68 @@ public:
         DEBUG_ENTRY;
     }
 
-    void alloc(VkDeviceSize size, uint32_t typeIndex) {
+    void alloc(const VkMemoryRequirements& requirements, uint32_t typeIndex,
+               QVkAllocation::Kind kind = QVkAllocation::Linear) {
         DEBUG_ENTRY;
-        m_size = size;
-        VkMemoryAllocateInfo allocinfo = {};
-        allocinfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-        allocinfo.allocationSize = m_size;
-        allocinfo.memoryTypeIndex = typeIndex;
+        Q_ASSERT(m_allocation.isNull());
+        m_allocation = dev()->allocator().allocate(requirements, typeIndex, kind);
+        Q_ASSERT(!m_allocation.isNull());
+    }
 
-        VkResult err = vkAllocateMemory(device(), &allocinfo, nullptr, &m_memory);
-        Q_ASSERT(!err);
+    void allocForBuffer(VkBuffer buffer, const QVkMemoryRequest& request) {
+        DEBUG_ENTRY;
+        Q_ASSERT(m_allocation.isNull());
+        m_allocation = dev()->allocator().allocateForBuffer(buffer, request);
+    }
+
+    void allocForImage(VkImage image, VkImageTiling tiling, const QVkMemoryRequest& request) {
+        DEBUG_ENTRY;
+        Q_ASSERT(m_allocation.isNull());
+        m_allocation = dev()->allocator().allocateForImage(image, tiling, request);
     }
 
     ~QVkDeviceMemory() {
         DEBUG_ENTRY;
-        if(m_size)
-            vkFreeMemory(device(), m_memory, nullptr);
-        m_size = 0;
+        dev()->allocator().free(m_allocation);
     }
 
-    void* map() { return map(0, m_size); }
+    void* map() { return map(0, size()); }
 
     void* map(VkDeviceSize offset, VkDeviceSize size) {
-        Q_ASSERT(offset + size <= m_size);
-        void* ptr;
-        VkMemoryMapFlags flags {0};
-        vkMapMemory(device(), m_memory, offset, size, flags, &ptr);
-        return ptr;
+        Q_ASSERT(offset + size <= m_allocation.size);
+        Q_ASSERT(m_allocation.mapped);
+        return static_cast<char*>(m_allocation.mapped) + offset;
     }
 
-    void unmap() {
-    DEBUG_ENTRY;
-        vkUnmapMemory(device(), m_memory);
+    // Make host writes to [offset, offset + size) visible to the device.
+    // A no-op for coherent memory.
+    void flush(VkDeviceSize offset = 0, VkDeviceSize size = VK_WHOLE_SIZE) {
+        dev()->allocator().flush(m_allocation, offset, size);
+    }
+
+    bool isCoherent() {
+        return dev()->memoryTypeFlags(m_allocation.memoryType) & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
     }
 
     VkDeviceSize size() {
-        return m_size;
+        return m_allocation.size;
+    }
+
+    // offset of the allocation in the VkDeviceMemory
+    VkDeviceSize offset() {
+        return m_allocation.offset;
+    }
+
+    const QVkAllocation& allocation() const {
+        return m_allocation;
+    }
+
+    operator VkDeviceMemory() {
+        return m_allocation.memory;
     }
 
 protected:
-    VkDeviceSize m_size { 0 };
-    VkDeviceMemory m_memory { nullptr };
+    QVkAllocation m_allocation;
 };
 
 
@@ -59,7 +87,8 @@ class QVkBuffer
 : public QVkDeviceResource {
     public:
     QVkBuffer(QSharedPointer<QVkDevice> dev, VkDeviceSize size, VkBufferUsageFlags usage)
-        : QVkDeviceResource(dev) {
+        : QVkDeviceResource(dev)
+        , m_memory(dev) {
     DEBUG_ENTRY;
 
         VkResult err;
@@ -67,7 +96,6 @@ class QVkBuffer
         buf_ci.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
         buf_ci.size = size;
         buf_ci.usage = usage;
-        // Create a host-visible buffer to copy the vertex data to (staging buffer)
         err = vkCreateBuffer(device(), &buf_ci, nullptr, &m_buffer);
         Q_ASSERT(!err);
         vkGetBufferMemoryRequirements(device(), m_buffer, &m_memReqs);
@@ -86,9 +114,19 @@ class QVkBuffer
         return m_buffer;
     }
 
+    QVkDeviceMemory& memory() {
+        return m_memory;
+    }
+
 protected:
+    void allocate(const QVkMemoryRequest& request) {
+        DEBUG_ENTRY;
+        m_memory.allocForBuffer(m_buffer, request);
+    }
+
     VkBuffer m_buffer;
     VkMemoryRequirements m_memReqs;
+    QVkDeviceMemory m_memory;
 };
 
 class QVkStagingBuffer: public QVkBuffer {
@@ -96,32 +134,14 @@ public:
     QVkStagingBuffer(QSharedPointer<QVkDevice> dev, size_t size)
         : QVkBuffer(dev, size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT) {
     DEBUG_ENTRY;
-
-        VkResult err;
-        VkMemoryAllocateInfo memAlloc = {};
-        memAlloc.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-        memAlloc.allocationSize = m_memReqs.size;
-        // Request a host visible memory type that can be used to copy our data do
-        // Also request it to be coherent, so that writes are visible to the GPU right after unmapping the buffer
-//        memAlloc.memoryTypeIndex = getMemoryTypeIndex(m_memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-        err = vkAllocateMemory(device(), &memAlloc, nullptr, &m_memory);
-        Q_ASSERT(!err);
-        // Map and copy
-        void* data;
-        err = vkMapMemory(device(), m_memory, 0, memAlloc.allocationSize, 0, &data);
-        Q_ASSERT(!err);
-//        memcpy(data, vertexBuffer.data(), vertexBufferSize);
-        vkUnmapMemory(device(), m_memory);
-        err = vkBindBufferMemory(device(), m_buffer, m_memory, 0);
-        Q_ASSERT(!err);
+        // Host visible to copy our data to, preferably coherent so writes
+        // need no explicit flush before the copy is submitted.
+        allocate(QVkMemoryUsage::Upload);
     }
     ~QVkStagingBuffer() {
     DEBUG_ENTRY;
 
     }
-
-private:
-    VkDeviceMemory m_memory;
 };
 
 class QVkDeviceBuffer
@@ -130,6 +150,7 @@ public:
     QVkDeviceBuffer(QSharedPointer<QVkDevice> device, VkDeviceSize size, VkBufferUsageFlags usage)
         : QVkBuffer(device, size, VK_BUFFER_USAGE_TRANSFER_DST_BIT | usage) {
     DEBUG_ENTRY;
+        allocate(QVkMemoryUsage::GpuOnly);
     }
 
     ~QVkDeviceBuffer() {
@@ -138,134 +159,175 @@ public:
     }
 };
 
-template <typename VT> class QVkVertexBuffer
-    : public QVkDeviceBuffer {
-public:
-    QVkVertexBuffer(QSharedPointer<QVkDevice> device, uint32_t verts)
-        : QVkDeviceBuffer(device, sizeof(VT) * verts, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT) {
-        DEBUG_ENTRY;
+
+/*
+ * A range handed out by QVkFrameRingBuffer, valid until the ring gets back
+ * to the same region. offset is relative to buffer, so it can be passed
+ * as dynamic offset or to vkCmdBindVertexBuffers directly.
+ */
+struct QVkFrameAllocation {
+    VkBuffer buffer         {nullptr};
+    VkDeviceSize offset     {0};
+    VkDeviceSize size       {0};
+    void* mapped            {nullptr};
+
+    bool isNull() const { return mapped == nullptr; }
+
+    template <typename T> T* data() const {
+        return static_cast<T*>(mapped);
     }
 
-    ~QVkVertexBuffer() {
-        DEBUG_ENTRY;
+    uint32_t dynamicOffset() const {
+        return (uint32_t)offset;
     }
 };
 
-
-template <typename UniformStruct>
-class QVkUniformBuffer :public QVkDeviceResource {
+/*
+ * One host visible buffer for data that only lives for a single frame:
+ * uniforms, dynamic vertices, indirect arguments. The buffer is split into
+ * one region per swapchain image and allocations are bumped linearly out
+ * of the region of the current frame. beginFrame() may only rewind a
+ * region once the GPU is done with the frame that used it last, which
+ * QVulkanView::draw() guarantees by calling it after the image fence wait.
+ *
+ * Allocations start at regionOffset() and depend only on the sizes
+ * requested before them, so command buffers prerecorded per swapchain
+ * image see the same offsets every frame as long as the image allocates
+ * the same things in the same order.
+ */
+class QVkFrameRingBuffer : public QVkDeviceResource {
 public:
-    QVkUniformBuffer(QSharedPointer<QVkDevice> dev)
+    QVkFrameRingBuffer(QSharedPointer<QVkDevice> dev, VkDeviceSize regionSize, uint32_t regionCount)
         : QVkDeviceResource(dev)
+        , m_memory(dev)
+        , m_regions(regionCount)
     {
         DEBUG_ENTRY;
-        VkResult err;
+        Q_ASSERT(regionCount > 0);
+        const VkPhysicalDeviceLimits& limits = dev->limits();
+        m_alignment = qMax<VkDeviceSize>(16, qMax(limits.minUniformBufferOffsetAlignment,
+                                                  limits.minStorageBufferOffsetAlignment));
+        // regions are flushed separately, keep them nonCoherentAtomSize apart
+        VkDeviceSize regionAlignment = qMax(m_alignment, limits.nonCoherentAtomSize);
+        m_regionSize = alignUp(regionSize, regionAlignment);
+
+        VkResult U_ASSERT_ONLY err;
         VkBufferCreateInfo buf_ci = {};
         buf_ci.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-        buf_ci.usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT;
-        buf_ci.size = sizeof(UniformStruct);
+        buf_ci.usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT
+                | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
+                | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT
+                | VK_BUFFER_USAGE_INDEX_BUFFER_BIT
+                | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT;
+        buf_ci.size = m_regionSize * m_regions;
         err = vkCreateBuffer(device(), &buf_ci, nullptr, &m_buffer);
         Q_ASSERT(!err);
 
-        VkMemoryRequirements mem_reqs = {};
-        vkGetBufferMemoryRequirements(device(), m_buffer, &mem_reqs);
-
-        VkMemoryAllocateInfo mem_ai;
-        mem_ai.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-        mem_ai.pNext = nullptr;
-        mem_ai.allocationSize = mem_reqs.size;
-        mem_ai.memoryTypeIndex = 0;
-
-        int index = dev->memoryType(
-           mem_reqs.memoryTypeBits,
-           VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
-        Q_ASSERT(index >= 0);
-        mem_ai.memoryTypeIndex = index;
-
-        err = vkAllocateMemory(device(), &mem_ai, nullptr, &m_memory);
-        m_allocationSize = mem_ai.allocationSize;
-        Q_ASSERT(!err);
+        m_memory.allocForBuffer(m_buffer, QVkMemoryUsage::Dynamic);
+        m_mapped = static_cast<char*>(m_memory.map());
+    }
 
+    ~QVkFrameRingBuffer() {
+        DEBUG_ENTRY;
+        vkDestroyBuffer(device(), m_buffer, nullptr);
+    }
 
-        err = vkBindBufferMemory(device(), m_buffer, m_memory, /*offset*/ 0);
-        Q_ASSERT(!err);
+    // rewind region, the GPU must no longer read from it
+    void beginFrame(uint32_t region) {
+        checkRegion(region);
+        m_region = region;
+        m_used = 0;
+    }
 
-        m_descriptorInfo.buffer = m_buffer;
-        m_descriptorInfo.offset = 0;
-        m_descriptorInfo.range = sizeof(UniformStruct);
+    // Alignment 0 is suitable for uniform and storage buffer offsets. The
+    // callers write through the allocation unchecked, so running out of
+    // the region is fatal.
+    QVkFrameAllocation allocate(VkDeviceSize size, VkDeviceSize alignment = 0) {
+        QVkFrameAllocation a;
+        VkDeviceSize offset = alignUp(m_used, alignment ? alignment : m_alignment);
+        if (offset > m_regionSize || size > m_regionSize - offset)
+            qFatal("frame ring buffer region of %llu bytes exhausted",
+                   (unsigned long long)m_regionSize);
+        m_used = offset + size;
+
+        a.buffer = m_buffer;
+        a.offset = regionOffset(m_region) + offset;
+        a.size = size;
+        a.mapped = m_mapped + a.offset;
+        return a;
+    }
 
+    template <typename T> T* allocate(QVkFrameAllocation* allocation = nullptr) {
+        QVkFrameAllocation a = allocate(sizeof(T));
+        if (allocation)
+            *allocation = a;
+        return a.data<T>();
     }
-    ~QVkUniformBuffer() {
-        DEBUG_ENTRY;
-        vkDestroyBuffer(device(), m_buffer, nullptr);
-        vkFreeMemory(device(), m_memory, nullptr);
+
+    // make this frame's writes visible to the device
+    void flush() {
+        if (m_used)
+            m_memory.flush(regionOffset(m_region), m_used);
     }
 
-    UniformStruct* map() {
-        DEBUG_ENTRY;
-        VkResult err;
-        UniformStruct* mappedAddr;
-        err = vkMapMemory(device(), m_memory,
-                          /*offset*/ 0,
-                          m_allocationSize,
-                          /*flags*/0,
-                          (void **)&mappedAddr);
-        Q_ASSERT(!err);
-        return mappedAddr;
+    VkDeviceSize regionOffset(uint32_t region) const {
+        checkRegion(region);
+        return region * m_regionSize;
     }
 
-    void unmap() {
-        DEBUG_ENTRY;
-        vkUnmapMemory(device(), m_memory);
+    uint32_t regions() const {
+        return m_regions;
     }
 
-    void update() {
-        DEBUG_ENTRY;
-        UniformStruct* deviceData = map();
-        memcpy(deviceData, m_hostData, sizeof(UniformStruct) );
-        unmap();
+    VkDeviceSize regionSize() const {
+        return m_regionSize;
     }
 
-    UniformStruct* data() {
-        return &m_hostData;
+    // bytes allocate() takes for size, for computing the offsets of later
+    // allocations at record time
+    VkDeviceSize aligned(VkDeviceSize size) const {
+        return alignUp(size, m_alignment);
     }
 
-    VkDescriptorBufferInfo* descriptorInfo() {
-        DEBUG_ENTRY;
-        return &m_descriptorInfo;
+    // bytes allocated in the current region so far
+    VkDeviceSize used() const {
+        return m_used;
     }
 
-protected:
-    VkBuffer m_buffer { };
-    VkDeviceMemory m_memory { };
+    VkBuffer buffer() {
+        return m_buffer;
+    }
 
-    VkDeviceSize m_allocationSize { 0 };
+    // descriptor for a dynamic uniform or storage buffer binding of range
+    // bytes, the allocation is selected by its dynamicOffset()
+    VkDescriptorBufferInfo descriptorInfo(VkDeviceSize range) {
+        VkDescriptorBufferInfo info = {};
+        info.buffer = m_buffer;
+        info.offset = 0;
+        info.range = range;
+        return info;
+    }
 
-    UniformStruct m_hostData { };
+private:
+    static VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment) {
+        return (value + alignment - 1) / alignment * alignment;
+    }
 
-    VkDescriptorBufferInfo m_descriptorInfo { };
+    // more swapchain images than regions would let frames share a region
+    void checkRegion(uint32_t region) const {
+        if (region >= m_regions)
+            qFatal("frame ring buffer region %u out of %u", region, m_regions);
+    }
 
-/*    class Accessor { //FIXME something about move semantics
-    public:
-        Accessor(QVkUniformBuffer& ubuf)
-            : m_ubuf(ubuf) {
-            m_mappedAddr = m_ubuf.map();
-        }
-
-        ~Accessor() {
-            m_ubuf.unmap();
-        }
-
-        operator UniformStruct*() {
-            return m_mappedAddr;
-        }
-
-    private:
-        Accessor(Accessor&) = delete;
-        Accessor& operator=(Accessor&) = delete; // fixme make copyable
-        QVkUniformBuffer& m_ubuf;
-        UniformStruct* m_mappedAddr;
-    };*/
+    VkBuffer m_buffer { };
+    QVkDeviceMemory m_memory;
+    char* m_mapped { nullptr };
+
+    VkDeviceSize m_alignment { 16 };
+    VkDeviceSize m_regionSize { 0 };
+    uint32_t m_regions { 1 };
+    uint32_t m_region { 0 };
+    VkDeviceSize m_used { 0 };
 };
 
 
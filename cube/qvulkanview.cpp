@@ -40,9 +40,12 @@
 #include <qpa/qplatformnativeinterface.h>
 
 #include "qvkcmdbuf.h"
+#include "qvkimageformat.h"
 
 
-static const char *tex_files[] = {"lunarg.ppm"};
+static QStringList tex_files = {"lunarg.ppm"};
+static bool tex_atlas_forced = false;
+static VkDeviceSize tex_streaming_budget = DEFAULT_TEXTURE_STREAMING_BUDGET;
 uint32_t ScopeDebug::stack = 0;
 
 
@@ -69,19 +72,72 @@ BreakCallback(VkFlags msgFlags, VkDebugReportObjectTypeEXT objType,
 }
 
 
+// The views of a process share one instance and device, and with it the
+// QVkTextureCache, which lets them share textures. They go away with the
+// last view.
+static QSharedPointer<QVkInstance> sharedInstance() {
+    static QWeakPointer<QVkInstance> shared;
+    QSharedPointer<QVkInstance> inst = shared.toStrongRef();
+    if (!inst) {
+        inst.reset(new QVkInstance());
+        shared = inst;
+    }
+    return inst;
+}
+
+static QSharedPointer<QVkDevice> sharedDevice(QVkInstance& inst, QVkPhysicalDevice gpu, uint32_t queueIndex,
+                                              const QVulkanNames& layers, const QVulkanNames& extensions) {
+    static QWeakPointer<QVkDevice> shared;
+    QSharedPointer<QVkDevice> dev = shared.toStrongRef();
+    if (!dev) {
+        dev.reset(new QVkDevice(inst, gpu, queueIndex, layers, extensions));
+        shared = dev;
+    }
+    return dev;
+}
+
+
 QVulkanView::QVulkanView() :
-    m_inst(),
-    m_gpu(m_inst.device(0))
+    m_inst(sharedInstance()),
+    m_gpu(m_inst->device(0))
     , m_graphics_queue_node_index(0)
-    , m_device( new QVkDevice(m_inst, m_gpu, m_graphics_queue_node_index, m_deviceValidationLayers, m_extensionNames))
+    , m_device(sharedDevice(*m_inst, m_gpu, m_graphics_queue_node_index, m_deviceValidationLayers, m_extensionNames))
     , m_queue(m_device, m_graphics_queue_node_index)
 {
     DEBUG_ENTRY;
 
     QVkQueue::fpQueuePresentKHR = m_device->fpQueuePresentKHR; // ugh!
+    m_uploads.reset(new QVkUploadManager(m_device, m_queue, m_graphics_queue_node_index));
+    m_mips.reset(new QVkMipGenerator(m_device, m_gpu, createShaderModule("mip-comp.spv")));
+    m_textureLoader.reset(new QVkTextureLoader(m_gpu, &m_device->textureCache()));
+    connect(m_textureLoader.data(), &QVkTextureLoader::loaded, this, &QVulkanView::texture_loaded);
+    if (tex_streaming_budget > 0) {
+        m_streamer.reset(new QVkTextureStreamer(m_device, m_uploads.data(), tex_streaming_budget));
+        // images larger than the tail arrive with their levels
+        m_textureLoader->setMipChainSize(STREAMING_TAIL_SIZE);
+    }
+
+    m_textures.resize(tex_files.size());
+    if (m_textures.size() > 1) {
+        const uint32_t maxBindless = tex_atlas_forced ? 0 : m_device->maxBindlessTextures();
+        m_textureMode = (uint32_t)m_textures.size() <= maxBindless ? BindlessTextures : AtlasTextures;
+    }
+    if (m_textureMode == AtlasTextures) {
+        m_atlas.reset(new QVkTextureAtlas(m_device, m_gpu, m_textures.size()));
+        // blits apply no swizzle
+        m_textureLoader->setBlitSource(true);
+        QVkTextureAtlas* atlas = m_atlas.data();
+        uploads().recordAfterCopies([=](QVkCommandBufferRecorder& recorder) {
+            atlas->recordClear(recorder);
+        });
+    }
+    if (m_textureMode == BindlessTextures)
+        prepare_bindless_textures();
+    qDebug()<<m_textures.size()<<"textures,"
+            <<(m_textureMode == BindlessTextures ? "bindless" : m_textureMode == AtlasTextures ? "atlas" : "single");
     init_vk_swapchain();
     prepare();
-
+    prepare_frames(DEFAULT_FRAMES_IN_FLIGHT);
 }
 
 QVulkanView::~QVulkanView()
@@ -89,6 +145,16 @@ QVulkanView::~QVulkanView()
     DEBUG_ENTRY;
 
     m_prepared = false;
+    m_textureLoader.reset();
+
+    vkDeviceWaitIdle(*m_device);
+    m_device->deletionQueue().flush();
+    destroy_frames();
+    m_frameRing.reset();
+    m_streamer.reset();
+    m_uploads.reset();
+    m_mips.reset();
+    m_atlas.reset();
 
     for (int i = 0; i < m_framebuffers.count(); i++) {
         vkDestroyFramebuffer(*m_device, m_framebuffers[i], nullptr);
@@ -100,18 +166,25 @@ QVulkanView::~QVulkanView()
     vkDestroyRenderPass(*m_device, m_render_pass, nullptr);
     vkDestroyPipelineLayout(*m_device, m_pipeline_layout, nullptr);
     vkDestroyDescriptorSetLayout(*m_device, m_desc_layout, nullptr);
-
-    for (int i = 0; i < DEMO_TEXTURE_COUNT; i++) {
+    vkDestroyDescriptorPool(*m_device, m_bindless_pool, nullptr);
+    vkDestroyDescriptorSetLayout(*m_device, m_bindless_layout, nullptr);
+
+    // cached textures stay on the device for the next view to use them
+    for (int i = 0; i < m_textures.size(); i++) {
+        if (!m_textures[i].cacheKey.isEmpty()) {
+            m_device->textureCache().release(m_textures[i].cacheKey);
+            continue;
+        }
         vkDestroyImageView(*m_device, m_textures[i].view, nullptr);
         vkDestroyImage(*m_device, m_textures[i].image, nullptr);
-        vkFreeMemory(*m_device, m_textures[i].mem, nullptr);
+        m_device->allocator().free(m_textures[i].mem);
         vkDestroySampler(*m_device, m_textures[i].sampler, nullptr);
     }
     m_device->destroySwapchain(m_swapchain, nullptr);
 
     vkDestroyImageView(*m_device, m_depth.view, nullptr);
     vkDestroyImage(*m_device, m_depth.image, nullptr);
-    vkFreeMemory(*m_device, m_depth.mem, nullptr);
+    m_device->allocator().free(m_depth.mem);
 
     for (int i = 0; i < m_buffers.count(); i++) {
         vkDestroyImageView(*m_device, m_buffers[i].view, nullptr);
@@ -122,143 +195,34 @@ QVulkanView::~QVulkanView()
 
     vkDestroyCommandPool(*m_device, m_cmd_pool, nullptr);
 
-    vkDestroySurfaceKHR(m_inst, m_surface, nullptr);
-}
-
-void QVulkanView::flush_init_cmd() {
-    DEBUG_ENTRY;
-
-    VkResult U_ASSERT_ONLY err;
-
-    if (m_cmd == nullptr)
-        return;
-
-    err = vkEndCommandBuffer(m_cmd);
-    Q_ASSERT(!err);
-
-    const VkCommandBuffer cmd_bufs[] = {m_cmd};
-    VkFence nullFence = nullptr;
-    VkSubmitInfo submit_info = {};
-    submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-    submit_info.pNext = nullptr;
-    submit_info.waitSemaphoreCount = 0;
-    submit_info.pWaitSemaphores = nullptr;
-    submit_info.pWaitDstStageMask = nullptr;
-    submit_info.commandBufferCount = 1;
-    submit_info.pCommandBuffers = cmd_bufs;
-    submit_info.signalSemaphoreCount = 0;
-    submit_info.pSignalSemaphores = nullptr;
-
-    err = vkQueueSubmit(m_queue, 1, &submit_info, nullFence);
-    Q_ASSERT(!err);
-
-    err = vkQueueWaitIdle(m_queue);
-    Q_ASSERT(!err);
-
-    vkFreeCommandBuffers(*m_device, m_cmd_pool, 1, cmd_bufs);
-    m_cmd = nullptr;
-}
-
-void QVulkanView::set_image_layout(VkImage image,
-                                  VkImageAspectFlags aspectMask,
-                                  VkImageLayout old_image_layout,
-                                  VkImageLayout new_image_layout,
-                                  VkAccessFlagBits srcAccessMask) {
-    DEBUG_ENTRY;
-    DBG("image %p from %x to %x\n", (void*) image, old_image_layout, new_image_layout);
-    VkResult U_ASSERT_ONLY err;
-
-    if (m_cmd == nullptr) {
-        VkCommandBufferAllocateInfo cmd_ai = {};
-        cmd_ai.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-        cmd_ai.pNext = nullptr;
-        cmd_ai.commandPool = m_cmd_pool;
-        cmd_ai.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-        cmd_ai.commandBufferCount = 1;
-
-        err = vkAllocateCommandBuffers(*m_device, &cmd_ai, &m_cmd);
-        Q_ASSERT(!err);
-
-        VkCommandBufferInheritanceInfo cmd_buf_hinfo = {};
-            cmd_buf_hinfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
-            cmd_buf_hinfo.pNext = nullptr;
-            cmd_buf_hinfo.renderPass = nullptr;
-            cmd_buf_hinfo.subpass = 0;
-            cmd_buf_hinfo.framebuffer = nullptr;
-            cmd_buf_hinfo.occlusionQueryEnable = VK_FALSE;
-            cmd_buf_hinfo.queryFlags = 0;
-            cmd_buf_hinfo.pipelineStatistics = 0;
-        VkCommandBufferBeginInfo cmd_buf_info = {};
-            cmd_buf_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-            cmd_buf_info.pNext = nullptr;
-            cmd_buf_info.flags = 0;
-            cmd_buf_info.pInheritanceInfo = &cmd_buf_hinfo;
-        err = vkBeginCommandBuffer(m_cmd, &cmd_buf_info);
-        Q_ASSERT(!err);
-    }
-
-    VkImageMemoryBarrier image_memory_barrier = {};
-        image_memory_barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-        image_memory_barrier.pNext = nullptr;
-        image_memory_barrier.srcAccessMask = srcAccessMask;
-        image_memory_barrier.dstAccessMask = 0;
-        image_memory_barrier.oldLayout = old_image_layout;
-        image_memory_barrier.newLayout = new_image_layout;
-        image_memory_barrier.image = image;
-        image_memory_barrier.subresourceRange = {aspectMask, 0, 1, 0, 1};
-
-    if (new_image_layout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL) {
-        /* Make sure anything that was copying from this image has completed */
-        image_memory_barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
-    }
-
-    if (new_image_layout == VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL) {
-        image_memory_barrier.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-    }
-
-    if (new_image_layout == VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL) {
-        image_memory_barrier.dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
-    }
-
-    if (new_image_layout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL) {
-        /* Make sure any Copy or CPU writes to image are flushed */
-        image_memory_barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_INPUT_ATTACHMENT_READ_BIT;
-    }
-
-    VkPipelineStageFlags src_stages = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
-    VkPipelineStageFlags dest_stages = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
-
-    vkCmdPipelineBarrier(m_cmd, src_stages, dest_stages, 0, 0, nullptr, 0,
-                         nullptr, 1, &image_memory_barrier);
+    vkDestroySurfaceKHR(*m_inst, m_surface, nullptr);
 }
 
 void QVulkanView::draw() {
     DEBUG_ENTRY;
     VkResult U_ASSERT_ONLY err;
-    VkSemaphore presentCompleteSemaphore = nullptr;
-    VkSemaphoreCreateInfo presentCompleteSemaphoreCreateInfo = {};
-    presentCompleteSemaphoreCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
-    presentCompleteSemaphoreCreateInfo.pNext = nullptr;
-    presentCompleteSemaphoreCreateInfo.flags = 0;
+    FrameSync& frame = m_frames[m_curFrame];
 
-    VkFence nullFence = nullptr;
-
-    err = vkCreateSemaphore(*m_device, &presentCompleteSemaphoreCreateInfo,
-                            nullptr, &presentCompleteSemaphore);
+    // The GPU has to be done with the last frame that used this slot
+    // before its semaphores and fence can be reused. The other frames in
+    // flight keep the GPU busy meanwhile.
+    err = vkWaitForFences(*m_device, 1, &frame.fence, VK_TRUE, UINT64_MAX);
     Q_ASSERT(!err);
+    // Frames complete in submission order, so everything retired up to
+    // this one can go.
+    m_device->deletionQueue().collect(frame.serial);
 
     // Get the index of the next available swapchain image:
     err = m_device->acquireNextImage(m_swapchain, UINT64_MAX,
-                                      presentCompleteSemaphore,
-                                      nullptr, // TODO: Show use of fence
+                                      frame.imageAcquired,
+                                      nullptr,
                                       &m_current_buffer);
     if (err == VK_ERROR_OUT_OF_DATE_KHR) {
         qWarning("swapchain out of date!");
         // swapchain is out of date (e.g. the window was resized) and
-        // must be recreated:
+        // must be recreated. The fence is still signaled, so the slot
+        // can be used again on the next draw.
         resize_vk();
-        draw(); // FIXME recursive - bleh
-        vkDestroySemaphore(*m_device, presentCompleteSemaphore, nullptr);
         return;
     } else if (err == VK_SUBOPTIMAL_KHR) {
         qWarning("swapchain SUBOPTIMAL");
@@ -268,36 +232,47 @@ void QVulkanView::draw() {
         Q_ASSERT(!err);
     }
 
-    // Assume the command buffer has been run on current_buffer before so
-    // we need to set the image layout back to COLOR_ATTACHMENT_OPTIMAL
-    QVkCommandBuffer cmd(m_device, m_cmd_pool);
-    cmd.record()
-        .transformImage(m_buffers[m_current_buffer].image,
-                VK_IMAGE_LAYOUT_PRESENT_SRC_KHR, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
-    m_queue.submit(cmd);
-    m_queue.waitIdle();
+    // The prerecorded command buffers of this image may still be executing
+    // on behalf of an older frame slot.
+    VkFence& imageFence = m_image_fences[m_current_buffer];
+    if (imageFence != nullptr && imageFence != frame.fence) {
+        err = vkWaitForFences(*m_device, 1, &imageFence, VK_TRUE, UINT64_MAX);
+        Q_ASSERT(!err);
+    }
+    imageFence = frame.fence;
 
-    // Wait for the present complete semaphore to be signaled to ensure
-    // that the image won't be rendered to until the presentation
-    // engine has fully released ownership to the application, and it is
-    // okay to render to the image.
+    m_frameRing->beginFrame(m_current_buffer);
+    prepareFrame();
+    m_frameRing->flush();
+    stream_textures();
+    update_texture_descriptors();
 
-    // FIXME/TODO: DEAL WITH VK_IMAGE_LAYOUT_PRESENT_SRC_KHR
+    err = vkResetFences(*m_device, 1, &frame.fence);
+    Q_ASSERT(!err);
+
+    // Uploads staged so far, e.g. by prepareFrame(), go first on the same
+    // queue. Their barriers make them visible to the frame.
+    m_uploads->submit();
 
-    VkPipelineStageFlags pipe_stage_flags = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+    // Color attachment writes must not start before the presentation
+    // engine has released the image. The layout transitions in and out of
+    // VK_IMAGE_LAYOUT_PRESENT_SRC_KHR are done by the render pass, see
+    // prepare_render_pass().
+    VkPipelineStageFlags pipe_stage_flags = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
     VkSubmitInfo submit_info = {};
     submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
     submit_info.pNext = nullptr;
     submit_info.waitSemaphoreCount = 1;
-    submit_info.pWaitSemaphores = &presentCompleteSemaphore;
+    submit_info.pWaitSemaphores = &frame.imageAcquired;
     submit_info.pWaitDstStageMask = &pipe_stage_flags;
     submit_info.commandBufferCount = 1;
     submit_info.pCommandBuffers = &m_buffers[m_current_buffer].cmd;
-    submit_info.signalSemaphoreCount = 0;
-    submit_info.pSignalSemaphores = nullptr;
+    submit_info.signalSemaphoreCount = 1;
+    submit_info.pSignalSemaphores = &frame.renderFinished;
 
-    err = vkQueueSubmit(m_queue, 1, &submit_info, nullFence);
+    err = vkQueueSubmit(m_queue, 1, &submit_info, frame.fence);
     Q_ASSERT(!err);
+    frame.serial = m_device->deletionQueue().frameSubmitted();
 
     VkPresentInfoKHR present = {};
     present.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
@@ -305,7 +280,8 @@ void QVulkanView::draw() {
     present.swapchainCount = 1;
     present.pSwapchains = &m_swapchain;
     present.pImageIndices = &m_current_buffer;
-    present.waitSemaphoreCount = 0;
+    present.waitSemaphoreCount = 1;
+    present.pWaitSemaphores = &frame.renderFinished;
     present.pResults = nullptr;
 
     // TBD/TODO: SHOULD THE "present" PARAMETER BE "const" IN THE HEADER?
@@ -321,10 +297,60 @@ void QVulkanView::draw() {
         Q_ASSERT(!err);
     }
 
-    err = vkQueueWaitIdle(m_queue);
-    Q_ASSERT(err == VK_SUCCESS);
+    m_curFrame = (m_curFrame + 1) % m_frames.count();
+}
 
-    vkDestroySemaphore(*m_device, presentCompleteSemaphore, nullptr);
+void QVulkanView::prepare_frames(int count) {
+    DEBUG_ENTRY;
+    DBG("%d frames in flight", count);
+    Q_ASSERT(count > 0);
+    VkResult U_ASSERT_ONLY err;
+
+    VkSemaphoreCreateInfo semaphore_ci = {};
+    semaphore_ci.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    semaphore_ci.pNext = nullptr;
+    semaphore_ci.flags = 0;
+
+    // Created signaled, so the first wait on every slot returns at once.
+    VkFenceCreateInfo fence_ci = {};
+    fence_ci.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+    fence_ci.pNext = nullptr;
+    fence_ci.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+
+    m_frames.resize(count);
+    for (auto& frame: m_frames) {
+        err = vkCreateFence(*m_device, &fence_ci, nullptr, &frame.fence);
+        Q_ASSERT(!err);
+        err = vkCreateSemaphore(*m_device, &semaphore_ci, nullptr, &frame.imageAcquired);
+        Q_ASSERT(!err);
+        err = vkCreateSemaphore(*m_device, &semaphore_ci, nullptr, &frame.renderFinished);
+        Q_ASSERT(!err);
+        frame.serial = 0;
+    }
+    m_curFrame = 0;
+}
+
+void QVulkanView::destroy_frames() {
+    DEBUG_ENTRY;
+    for (auto& frame: m_frames) {
+        vkDestroyFence(*m_device, frame.fence, nullptr);
+        vkDestroySemaphore(*m_device, frame.imageAcquired, nullptr);
+        vkDestroySemaphore(*m_device, frame.renderFinished, nullptr);
+    }
+    m_frames.clear();
+    m_image_fences.fill(nullptr);
+}
+
+void QVulkanView::setFramesInFlight(int count) {
+    DEBUG_ENTRY;
+    Q_ASSERT(count > 0);
+    if (count == m_frames.count())
+        return;
+
+    // The sync objects of all slots may still be referenced by the GPU.
+    vkDeviceWaitIdle(*m_device);
+    destroy_frames();
+    prepare_frames(count);
 }
 
 void QVulkanView::prepare_buffers() {
@@ -336,12 +362,12 @@ void QVulkanView::prepare_buffers() {
 
     // Check the surface capabilities and formats
     VkSurfaceCapabilitiesKHR surfCapabilities = {};
-    err = m_inst.getPhysicalDeviceSurfaceCapabilities(
+    err = m_inst->getPhysicalDeviceSurfaceCapabilities(
         m_gpu, m_surface, &surfCapabilities);
     Q_ASSERT(!err);
 
     auto getPresModes = [this](uint32_t* c, VkPresentModeKHR* d) {
-            return m_inst.getPhysicalDeviceSurfacePresentModes(m_gpu, m_surface, c, d);
+            return m_inst->getPhysicalDeviceSurfacePresentModes(m_gpu, m_surface, c, d);
     };
     auto presentModes = getVk<VkPresentModeKHR>(getPresModes);
 
@@ -416,11 +442,14 @@ void QVulkanView::prepare_buffers() {
     Q_ASSERT(!err);
 
     // If we just re-created an existing swapchain, we should destroy the old
-    // swapchain at this point.
+    // swapchain once the frames in flight are done with its images.
     // Note: destroying the swapchain also cleans up all its associated
     // presentable images once the platform is done with them.
     if (oldSwapchain != nullptr) {
-        m_device->destroySwapchain(oldSwapchain, nullptr);
+        QSharedPointer<QVkDevice> dev = m_device;
+        m_device->deletionQueue().retire([dev, oldSwapchain]() {
+            dev->destroySwapchain(oldSwapchain, nullptr);
+        });
     }
 
     auto getSwapChainImages = [this](uint32_t* c, VkImage* d) {
@@ -433,10 +462,6 @@ void QVulkanView::prepare_buffers() {
 
     m_buffers.resize(swapchainImages.count());
 
-    QVkCommandBuffer cmd(m_device, m_cmd_pool);
-    {
-    auto cbr=cmd.record();
-
     for (int i = 0; i < m_buffers.count(); i++) {
         VkImageViewCreateInfo color_image_view = {};
         color_image_view.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
@@ -457,22 +482,11 @@ void QVulkanView::prepare_buffers() {
         color_image_view.flags = 0;
 
         m_buffers[i].image = swapchainImages[i];
-
-        // Render loop will expect image to have been used before and in
-        // VK_IMAGE_LAYOUT_PRESENT_SRC_KHR
-        // layout and will change to COLOR_ATTACHMENT_OPTIMAL, so init the image
-        // to that state
-        cbr.transformImage(m_buffers[i].image,
-                VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
-
         color_image_view.image = m_buffers[i].image;
 
         err = vkCreateImageView(*m_device, &color_image_view, nullptr, &m_buffers[i].view);
         Q_ASSERT(!err);
     }
-    }
-    m_queue.submit(cmd);
-    m_queue.waitIdle();
 }
 
 void QVulkanView::prepare_depth() {
@@ -507,7 +521,6 @@ void QVulkanView::prepare_depth() {
         view.flags = 0;
         view.viewType = VK_IMAGE_VIEW_TYPE_2D;
 
-    VkMemoryRequirements mem_reqs;
     VkResult U_ASSERT_ONLY err;
 
     m_depth.format = depth_format;
@@ -517,32 +530,12 @@ void QVulkanView::prepare_depth() {
     qDebug()<<"depth image is"<<m_depth.image;
     Q_ASSERT(!err);
 
-    vkGetImageMemoryRequirements(*m_device, m_depth.image, &mem_reqs);
-    Q_ASSERT(!err);
-
-    m_depth.mem_alloc.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    m_depth.mem_alloc.pNext = nullptr;
-    m_depth.mem_alloc.allocationSize = mem_reqs.size;
-    m_depth.mem_alloc.memoryTypeIndex = 0;
-
-    int index = device()->memoryType(mem_reqs.memoryTypeBits, 0 /* No requirements */);
-    Q_ASSERT(index >= 0);
-    m_depth.mem_alloc.memoryTypeIndex = index;
-
-    /* allocate memory */
-    err = vkAllocateMemory(*m_device, &m_depth.mem_alloc, nullptr,
-                           &m_depth.mem);
-    Q_ASSERT(!err);
-
-    /* bind memory */
-    err =
-        vkBindImageMemory(*m_device, m_depth.image, m_depth.mem, 0);
-    Q_ASSERT(!err);
+    /* allocate and bind memory */
+    m_depth.mem = device()->allocator().allocateForImage(m_depth.image, image.tiling,
+                                                         QVkMemoryUsage::GpuOnly);
 
-    set_image_layout(m_depth.image, VK_IMAGE_ASPECT_DEPTH_BIT,
-                          VK_IMAGE_LAYOUT_UNDEFINED,
-                          VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
-                          (VkAccessFlagBits)0);
+    // no layout transition, the render pass takes the image from
+    // VK_IMAGE_LAYOUT_UNDEFINED and clears it
 
     /* create image view */
     view.image = m_depth.image;
@@ -551,220 +544,522 @@ void QVulkanView::prepare_depth() {
 }
 
 
-void QVulkanView::prepare_texture_image(const char *filename,
-                                       struct texture_object *tex_obj,
-                                       VkImageTiling tiling,
-                                       VkImageUsageFlags usage,
-                                       VkFlags required_props) {
+void QVulkanView::setTextureFiles(const QStringList& filenames) {
+    if (!filenames.isEmpty())
+        tex_files = filenames;
+}
+
+void QVulkanView::setTextureAtlasForced(bool force) {
+    tex_atlas_forced = force;
+}
+
+void QVulkanView::setTextureStreamingBudget(VkDeviceSize bytes) {
+    tex_streaming_budget = bytes;
+}
+
+void QVulkanView::prepare_texture_image(const QImage& source, struct texture_object *tex_obj) {
     DEBUG_ENTRY;
 
     VkResult U_ASSERT_ONLY err;
 
-    QImage img(filename);
-    const VkFormat tex_format = QtFormat2vkFormat(img.format());
+    // Images from the loader are in their storage format already. Blits
+    // into an atlas would not apply a swizzle.
+    const QVkImageFormat imageFormat = QVkImageFormat::negotiate(m_gpu, source.format(),
+                                                                 m_textureMode == AtlasTextures);
+    const QImage image = imageFormat.convert(source);
+    const VkFormat tex_format = imageFormat.format;
+    tex_obj->format = tex_format;
+    tex_obj->swizzle = imageFormat.swizzle;
 
-    if (img.isNull()) {
-        qFatal("Failed to load textures %s\n", filename);
-    }
+    tex_obj->tex_width = image.width();
+    tex_obj->tex_height = image.height();
 
-    tex_obj->tex_width = img.width();
-    tex_obj->tex_height = img.height();
+    // Linear images are sampled where the CPU writes them, optimal ones
+    // are copied to from a staging buffer.
+    VkFormatProperties props;
+    vkGetPhysicalDeviceFormatProperties(m_gpu, tex_format, &props);
+    VkImageTiling tiling;
+    if (props.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT) {
+        tiling = VK_IMAGE_TILING_OPTIMAL;
+    } else if (props.linearTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT) {
+        /* Device can texture using linear textures */
+        tiling = VK_IMAGE_TILING_LINEAR;
+    } else {
+        qFatal("No support for format %d as texture image format", (int)tex_format);
+    }
+    const bool linear = tiling == VK_IMAGE_TILING_LINEAR;
+    // optimal images get a full mip chain, generated on the GPU from the
+    // uploaded level 0
+    tex_obj->mipLevels = linear ? 1 : m_mips->levels(tex_format, tex_obj->tex_width, tex_obj->tex_height);
 
     VkImageCreateInfo image_create_info = {};
     image_create_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
     image_create_info.pNext = nullptr;
     image_create_info.imageType = VK_IMAGE_TYPE_2D;
     image_create_info.format = tex_format;
-    image_create_info.extent.width = img.width();
-    image_create_info.extent.height = img.height();
+    image_create_info.extent.width = image.width();
+    image_create_info.extent.height = image.height();
     image_create_info.extent.depth = 1;
-    image_create_info.mipLevels = 1;
+    image_create_info.mipLevels = tex_obj->mipLevels;
     image_create_info.arrayLayers = 1;
     image_create_info.samples = VK_SAMPLE_COUNT_1_BIT;
     image_create_info.tiling = tiling;
-    image_create_info.usage = usage;
+    // the source of the copy into an atlas, see QVkTextureAtlas
+    image_create_info.usage = linear ? VK_IMAGE_USAGE_SAMPLED_BIT
+                                     : VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT |
+                                       VK_IMAGE_USAGE_SAMPLED_BIT;
+    if (tex_obj->mipLevels > 1)
+        image_create_info.usage |= m_mips->usage(tex_format);
     image_create_info.flags = 0;
-    image_create_info.initialLayout = VK_IMAGE_LAYOUT_PREINITIALIZED;
-
-    VkMemoryRequirements mem_reqs;
+    image_create_info.initialLayout = linear ? VK_IMAGE_LAYOUT_PREINITIALIZED
+                                             : VK_IMAGE_LAYOUT_UNDEFINED;
 
     err = vkCreateImage(*m_device, &image_create_info, nullptr, &tex_obj->image);
     Q_ASSERT(!err);
 
-    vkGetImageMemoryRequirements(*m_device, tex_obj->image, &mem_reqs);
-
-    tex_obj->mem_alloc.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    tex_obj->mem_alloc.pNext = nullptr;
-    tex_obj->mem_alloc.allocationSize = mem_reqs.size;
-    tex_obj->mem_alloc.memoryTypeIndex = 0;
-
-    int index =  device()->memoryType(mem_reqs.memoryTypeBits, required_props);
-
-    Q_ASSERT(index >= 0);
-    tex_obj->mem_alloc.memoryTypeIndex = index;
-    /* allocate memory */
-    err = vkAllocateMemory(*m_device, &tex_obj->mem_alloc, nullptr,
-                           &(tex_obj->mem));
-    Q_ASSERT(!err);
-
-    /* bind memory */
-    err = vkBindImageMemory(*m_device, tex_obj->image, tex_obj->mem, 0);
-    Q_ASSERT(!err);
+    const int texelBytes = image.depth() / 8;
+    const int rowSize = image.width() * texelBytes;
+    tex_obj->imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    if (linear) {
+        /* allocate and bind memory */
+        tex_obj->mem = device()->allocator().allocateForImage(tex_obj->image, tiling,
+                                                              VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
 
-    if (required_props & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
         VkImageSubresource subres = {};
         subres.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
         subres.mipLevel = 0;
         subres.arrayLayer = 0;
 
         VkSubresourceLayout layout;
-        void *data;
 
         vkGetImageSubresourceLayout(*m_device, tex_obj->image, &subres,
                                     &layout);
 
-        err = vkMapMemory(*m_device, tex_obj->mem, 0,
-                          tex_obj->mem_alloc.allocationSize, 0, &data);
-        Q_ASSERT(!err);
+        // host visible memory is mapped by the allocator, the rows are
+        // rowPitch apart, which may be more than a row of texels
+        uchar* mapped = static_cast<uchar*>(tex_obj->mem.mapped) + layout.offset;
+        for (int y = 0; y < image.height(); y++)
+            memcpy(mapped + y * layout.rowPitch, image.constScanLine(y), rowSize);
+        device()->allocator().flush(tex_obj->mem);
+
+        // The layout transition goes out with the uploads ahead of the
+        // next frame, the queue submit makes the host writes available.
+        const VkImage vkImage = tex_obj->image;
+        const VkImageLayout finalLayout = tex_obj->imageLayout;
+        uploads().recordAfterCopies([=](QVkCommandBufferRecorder& recorder) {
+            VkImageMemoryBarrier toFinal = levelBarrier(vkImage, 0, 1, VK_IMAGE_LAYOUT_PREINITIALIZED,
+                                                        finalLayout, VK_ACCESS_HOST_WRITE_BIT,
+                                                        VK_ACCESS_SHADER_READ_BIT);
+            recorder.pipelineBarrier(VK_PIPELINE_STAGE_HOST_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                                     0, &toFinal);
+        });
+    } else {
+        tex_obj->mem = device()->allocator().allocateForImage(tex_obj->image, tiling,
+                                                              QVkMemoryUsage::GpuOnly);
+
+        // tightly packed rows in the staging buffer, 3 byte texels at
+        // offsets of 48. The copy and the transitions are submitted with
+        // the other uploads ahead of the next frame, nothing waits for
+        // them here.
+        VkBufferImageCopy region = {};
+        region.bufferRowLength = 0;
+        region.bufferImageHeight = 0;
+        region.imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+        region.imageOffset = {0, 0, 0};
+        region.imageExtent = {tex_obj->tex_width, tex_obj->tex_height, 1};
+        const uint32_t levels = tex_obj->mipLevels;
+        uchar* staging = static_cast<uchar*>(
+                uploads().stageImage(tex_obj->image, region, (VkDeviceSize)rowSize * image.height(),
+                                     levels > 1 ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL
+                                                : tex_obj->imageLayout,
+                                     VK_IMAGE_LAYOUT_UNDEFINED, texelBytes == 3 ? 48 : 16));
+        // The loader decodes on another thread, before the image and its
+        // staging memory exist, so unlike a decode into staging memory this
+        // costs a copy on the GUI thread. QImage rows are padded to 4
+        // bytes.
+        if (image.bytesPerLine() == rowSize) {
+            memcpy(staging, image.constBits(), (size_t)rowSize * image.height());
+        } else {
+            for (int y = 0; y < image.height(); y++)
+                memcpy(staging + (size_t)y * rowSize, image.constScanLine(y), rowSize);
+        }
+        uploads().commit();
+
+        if (levels > 1) {
+            // the other levels are filled in the same batch, right after
+            // the copy into level 0
+            QVkMipGenerator* mips = m_mips.data();
+            const VkImage vkImage = tex_obj->image;
+            const uint32_t width = tex_obj->tex_width, height = tex_obj->tex_height;
+            const VkImageLayout finalLayout = tex_obj->imageLayout;
+            uploads().recordAfterCopies([=](QVkCommandBufferRecorder& recorder) {
+                mips->record(recorder, vkImage, tex_format, width, height, levels, finalLayout);
+            });
+        }
+    }
+}
 
-        memcpy(data, img.bits(), img.byteCount() ); // FIXME - in place decoding wanted
+void QVulkanView::prepare_texture_file(const QVkTextureFile& file, texture_object *tex_obj) {
+    DEBUG_ENTRY;
 
-        vkUnmapMemory(*m_device, tex_obj->mem);
-    }
+    VkResult U_ASSERT_ONLY err;
 
+    tex_obj->format = file.format();
+    tex_obj->swizzle = file.swizzle();
+    tex_obj->tex_width = file.width();
+    tex_obj->tex_height = file.height();
     tex_obj->imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-    set_image_layout(tex_obj->image, VK_IMAGE_ASPECT_COLOR_BIT,
-                          VK_IMAGE_LAYOUT_PREINITIALIZED, tex_obj->imageLayout,
-                          VK_ACCESS_HOST_WRITE_BIT);
-    /* setting the image layout does not reference the actual memory so no need
-     * to add a mem ref */
+    // files without levels of their own get them generated if the format
+    // allows, which compressed formats never do
+    const uint32_t fileLevels = file.levels().size();
+    tex_obj->mipLevels = fileLevels > 1 ? fileLevels
+                                        : m_mips->levels(tex_obj->format, tex_obj->tex_width, tex_obj->tex_height);
+
+    VkImageCreateInfo image_create_info = {};
+    image_create_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    image_create_info.imageType = VK_IMAGE_TYPE_2D;
+    image_create_info.format = tex_obj->format;
+    image_create_info.extent = {tex_obj->tex_width, tex_obj->tex_height, 1};
+    image_create_info.mipLevels = tex_obj->mipLevels;
+    image_create_info.arrayLayers = 1;
+    image_create_info.samples = VK_SAMPLE_COUNT_1_BIT;
+    image_create_info.tiling = VK_IMAGE_TILING_OPTIMAL;
+    image_create_info.usage = VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT |
+                              VK_IMAGE_USAGE_SAMPLED_BIT;
+    if (tex_obj->mipLevels > fileLevels)
+        image_create_info.usage |= m_mips->usage(tex_obj->format);
+    image_create_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+    err = vkCreateImage(*m_device, &image_create_info, nullptr, &tex_obj->image);
+    Q_ASSERT(!err);
+    tex_obj->mem = device()->allocator().allocateForImage(tex_obj->image, VK_IMAGE_TILING_OPTIMAL,
+                                                          QVkMemoryUsage::GpuOnly);
+
+    // the levels are rows of texel blocks, copied to the image as they
+    // are
+    const bool generate = tex_obj->mipLevels > fileLevels;
+    for (uint32_t level = 0; level < fileLevels; level++) {
+        const QVkTextureFile::Level& l = file.levels()[level];
+        VkBufferImageCopy region = {};
+        region.imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, level, 0, 1};
+        region.imageOffset = {0, 0, 0};
+        region.imageExtent = {l.width, l.height, 1};
+        uploads().uploadImage(tex_obj->image, region, file.data().constData() + l.offset, l.size,
+                              generate ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : tex_obj->imageLayout,
+                              VK_IMAGE_LAYOUT_UNDEFINED, file.stagingAlignment());
+    }
+
+    if (generate) {
+        QVkMipGenerator* mips = m_mips.data();
+        const VkImage image = tex_obj->image;
+        const VkFormat format = tex_obj->format;
+        const uint32_t width = tex_obj->tex_width, height = tex_obj->tex_height;
+        const uint32_t levels = tex_obj->mipLevels;
+        const VkImageLayout finalLayout = tex_obj->imageLayout;
+        uploads().recordAfterCopies([=](QVkCommandBufferRecorder& recorder) {
+            mips->record(recorder, image, format, width, height, levels, finalLayout);
+        });
+    }
 }
 
-void QVulkanView::destroy_texture_image(struct texture_object *tex_objs) {
+void QVulkanView::prepare_texture_view(texture_object *tex_obj) {
     DEBUG_ENTRY;
+    VkResult U_ASSERT_ONLY err;
+
+    VkSamplerCreateInfo sampler = {};
+        sampler.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+        sampler.pNext = nullptr;
+        sampler.magFilter = VK_FILTER_NEAREST;
+        // trilinear minification over all the levels
+        sampler.minFilter = VK_FILTER_LINEAR;
+        sampler.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+        sampler.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+        sampler.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+        sampler.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+        sampler.mipLodBias = 0.0f;
+        sampler.anisotropyEnable = VK_FALSE;
+        sampler.maxAnisotropy = 1;
+        sampler.compareOp = VK_COMPARE_OP_NEVER;
+        sampler.minLod = 0.0f;
+        sampler.maxLod = (float)tex_obj->mipLevels;
+        sampler.borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_WHITE;
+        sampler.unnormalizedCoordinates = VK_FALSE;
 
-    /* clean up staging resources */
-    vkFreeMemory(*m_device, tex_objs->mem, nullptr);
-    vkDestroyImage(*m_device, tex_objs->image, nullptr);
+    VkImageViewCreateInfo view = {};
+    view.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    view.pNext = nullptr;
+    view.image = nullptr;
+    view.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    view.format = tex_obj->format;
+    view.components = tex_obj->swizzle;
+    view.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, tex_obj->mipLevels, 0, 1};
+    view.flags = 0;
+
+    /* create sampler */
+    err = vkCreateSampler(*m_device, &sampler, nullptr,
+                          &tex_obj->sampler);
+    Q_ASSERT(!err);
+
+    /* create image view */
+    view.image = tex_obj->image;
+    err = vkCreateImageView(*m_device, &view, nullptr,
+                            &tex_obj->view);
+    Q_ASSERT(!err);
 }
 
 void QVulkanView::prepare_textures() {
     DEBUG_ENTRY;
 
-    const VkFormat tex_format = VK_FORMAT_R8G8B8A8_UNORM; // FIXME get from qimage format?
-    VkFormatProperties props;
-    uint32_t i;
-
-    vkGetPhysicalDeviceFormatProperties(m_gpu, tex_format, &props);
+    // Textures do not depend on the swapchain, after a resize they are
+    // all there or on their way. Textures still in the cache are taken
+    // from there. The others start out as a single grey texel, so the
+    // first frame does not wait for the disk, and are replaced as the
+    // loader delivers them, see texture_loaded().
+    QImage placeholder(1, 1, QImage::Format_RGB32);
+    placeholder.fill(Qt::gray);
+    for (int i = 0; i < m_textures.size(); i++) {
+        if (m_textures[i].image != nullptr)
+            continue;
+        if (m_device->textureCache().acquire(tex_files[i], &m_textures[i])) {
+            prepare_atlas_cell(i);
+            continue;
+        }
+        prepare_texture_image(placeholder, &m_textures[i]);
+        prepare_texture_view(&m_textures[i]);
+        m_textureLoader->load(i, tex_files[i]);
+    }
+}
 
-    for (i = 0; i < DEMO_TEXTURE_COUNT; i++) {
-        VkResult U_ASSERT_ONLY err;
-
-        if ((props.linearTilingFeatures &
-             VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT) &&
-            !m_use_staging_buffer) {
-            /* Device can texture using linear textures */
-            prepare_texture_image(tex_files[i], &m_textures[i],
-                                       VK_IMAGE_TILING_LINEAR,
-                                       VK_IMAGE_USAGE_SAMPLED_BIT,
-                                       VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
-        } else if (props.optimalTilingFeatures &
-                   VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT) {
-            /* Must use staging buffer to copy linear texture to optimized */
-            struct texture_object staging_texture = {};
-            prepare_texture_image(tex_files[i], &staging_texture,
-                                       VK_IMAGE_TILING_LINEAR,
-                                       VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
-                                       VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
-
-            prepare_texture_image(
-                tex_files[i], &m_textures[i], VK_IMAGE_TILING_OPTIMAL,
-                (VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT),
-                VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-
-            set_image_layout(staging_texture.image,
-                                  VK_IMAGE_ASPECT_COLOR_BIT,
-                                  staging_texture.imageLayout,
-                                  VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
-                                  (VkAccessFlagBits)0);
-
-            set_image_layout(m_textures[i].image,
-                                  VK_IMAGE_ASPECT_COLOR_BIT,
-                                  m_textures[i].imageLayout,
-                                  VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-                                  (VkAccessFlagBits)0);
-
-            VkImageCopy copy_region = {};
-
-                copy_region.srcSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
-                copy_region.srcOffset = {0, 0, 0};
-                copy_region.dstSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
-                copy_region.dstOffset = {0, 0, 0};
-                copy_region.extent = {staging_texture.tex_width, staging_texture.tex_height, 1};
-
-            vkCmdCopyImage(
-                m_cmd, staging_texture.image,
-                VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, m_textures[i].image,
-                VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copy_region);
-
-            set_image_layout(m_textures[i].image,
-                                  VK_IMAGE_ASPECT_COLOR_BIT,
-                                  VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-                                  m_textures[i].imageLayout,
-                                  (VkAccessFlagBits)0);
-
-            flush_init_cmd();
-
-            destroy_texture_image(&staging_texture);
+void QVulkanView::texture_loaded(int index, const QString& filename, const QVkDecodedTexture& texture) {
+    DEBUG_ENTRY;
+    QVkTextureCache& cache = m_device->textureCache();
+    texture_object loaded = {};
+    if (!texture.cached.cacheKey.isEmpty()) {
+        // the same contents were uploaded before, under any name
+        loaded = texture.cached;
+    } else {
+        // the cubes keep their placeholder
+        if (!texture.error.isEmpty()) {
+            qWarning("Failed to load texture %s: %s", qPrintable(filename), qPrintable(texture.error));
+            return;
+        }
+        // staged for the next frame, which is submitted after the upload
+        if (m_streamer && QVkTextureStreamer::isStreamable(texture.file)) {
+            // the smallest levels, the others as the frames ask for them
+            loaded = m_streamer->add(index, texture.file);
         } else {
-            /* Can't support VK_FORMAT_R8G8B8A8_UNORM !? */
-            Q_ASSERT(!"No support for R8G8B8A8_UNORM as texture image format");
+            if (texture.file.isNull())
+                prepare_texture_image(texture.image, &loaded);
+            else
+                prepare_texture_file(texture.file, &loaded);
+            prepare_texture_view(&loaded);
+            loaded = cache.insert(filename, texture.key, loaded);
         }
+    }
 
-        VkSamplerCreateInfo sampler = {};
-            sampler.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
-            sampler.pNext = nullptr;
-            sampler.magFilter = VK_FILTER_NEAREST;
-            sampler.minFilter = VK_FILTER_NEAREST;
-            sampler.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
-            sampler.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
-            sampler.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
-            sampler.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
-            sampler.mipLodBias = 0.0f;
-            sampler.anisotropyEnable = VK_FALSE;
-            sampler.maxAnisotropy = 1;
-            sampler.compareOp = VK_COMPARE_OP_NEVER;
-            sampler.minLod = 0.0f;
-            sampler.maxLod = 0.0f;
-            sampler.borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_WHITE;
-            sampler.unnormalizedCoordinates = VK_FALSE;
-
-        VkImageViewCreateInfo view = {};
-        view.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
-        view.pNext = nullptr;
-        view.image = nullptr;
-        view.viewType = VK_IMAGE_VIEW_TYPE_2D;
-        view.format = tex_format;
-        // attention: BGRA since that is what QImageReader gives us
-        // does it depoend on the endian-ness of the platform?
-        view.components =  {
-            VK_COMPONENT_SWIZZLE_B, VK_COMPONENT_SWIZZLE_G,
-            VK_COMPONENT_SWIZZLE_R, VK_COMPONENT_SWIZZLE_A,
-        };
-        view.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
-        view.flags = 0;
+    // the placeholder goes once no frame in flight samples it anymore
+    texture_object& tex_obj = m_textures[index];
+    Q_ASSERT(tex_obj.cacheKey.isEmpty());
+    QVkTextureCache::retire(m_device->deletionQueue(), tex_obj);
+    tex_obj = loaded;
+    textures_changed({ index });
+}
 
-        /* create sampler */
-        err = vkCreateSampler(*m_device, &sampler, nullptr,
-                              &m_textures[i].sampler);
-        Q_ASSERT(!err);
+void QVulkanView::textures_changed(const QVector<int>& indices) {
+    DEBUG_ENTRY;
+    // the descriptor of the atlas stays as it is
+    if (m_textureMode == AtlasTextures) {
+        for (int index : indices)
+            prepare_atlas_cell(index);
+        return;
+    }
 
-        /* create image view */
-        view.image = m_textures[i].image;
-        err = vkCreateImageView(*m_device, &view, nullptr,
-                                &m_textures[i].view);
-        Q_ASSERT(!err);
+    // The descriptor sets of a swapchain image are bound by its
+    // prerecorded command buffer, which may be in flight. Every image
+    // picks the change up the next time it is drawn, see
+    // update_texture_descriptors().
+    for (QVector<int>& changed : m_changed_textures)
+        changed += indices;
+}
+
+void QVulkanView::update_texture_descriptors() {
+    DEBUG_ENTRY;
+    QVector<int>& changed = m_changed_textures[m_current_buffer];
+    if (changed.isEmpty())
+        return;
+
+    // Bindless sets are updated after bind, the command buffer stays
+    // valid. Writing any other set invalidates the command buffers it was
+    // recorded into, the one of this image is no longer pending.
+    if (m_textureMode == BindlessTextures) {
+        update_bindless_textures(m_current_buffer, changed);
+    } else {
+        updateTextureDescriptors(m_current_buffer);
+        buildDrawCommand(m_buffers[m_current_buffer].cmd);
     }
+    changed.clear();
+}
+
+void QVulkanView::prepare_atlas_cell(int index) {
+    DEBUG_ENTRY;
+    if (!m_atlas)
+        return;
+    const texture_object& texture = m_textures[index];
+    if (!m_atlas->canBlit(texture.format)) {
+        qWarning()<<"texture"<<tex_files[index]<<"format"<<(int)texture.format<<"cannot be copied to the atlas";
+        return;
+    }
+    // textures from the cache may have been swizzled for another view
+    if (!QVkImageFormat::isIdentity(texture.swizzle)) {
+        qWarning()<<"texture"<<tex_files[index]<<"is swizzled, blits into the atlas would not apply it";
+        return;
+    }
+    // after the upload of the texture, if it is in the same batch
+    QVkTextureAtlas* atlas = m_atlas.data();
+    uploads().recordAfterCopies([=](QVkCommandBufferRecorder& recorder) {
+        atlas->record(recorder, (uint32_t)index, texture);
+    });
+}
+
+void QVulkanView::requestTextureSize(int index, float pixels) {
+    if (m_streamer && !m_atlas)
+        m_streamer->request(index, pixels);
+}
+
+void QVulkanView::stream_textures() {
+    DEBUG_ENTRY;
+    if (!m_streamer)
+        return;
+    // textures in an atlas are drawn at the size of their cell
+    if (m_atlas) {
+        for (int i = 0; i < m_textures.size(); i++)
+            m_streamer->request(i, (float)m_atlas->cellSize());
+    }
+    const QVector<int> changed = m_streamer->update();
+    if (changed.isEmpty())
+        return;
+
+    // The old images are copied from by the uploads submitted next, they
+    // go with the frame recorded now, which runs after them and after
+    // every frame submitted before. The descriptor sets of the other
+    // swapchain images still name them, but each image writes its sets
+    // before it is submitted again, see update_texture_descriptors(), so
+    // the swap needs no wait for the frames in flight.
+    for (int index : changed) {
+        QVkTextureCache::retire(m_device->deletionQueue(), m_textures[index]);
+        m_textures[index] = m_streamer->texture(index);
+    }
+    textures_changed(changed);
+}
+
+VkDescriptorImageInfo QVulkanView::textureDescriptor() const {
+    Q_ASSERT(m_textureMode != BindlessTextures);
+    const texture_object& texture = m_atlas ? m_atlas->texture() : m_textures[0];
+    return VkDescriptorImageInfo{texture.sampler, texture.view, texture.imageLayout};
+}
+
+void QVulkanView::prepare_bindless_textures() {
+    DEBUG_ENTRY;
+#ifdef VK_EXT_descriptor_indexing
+    VkResult U_ASSERT_ONLY err;
+
+    // An array as large as the device allows, the sets are allocated with
+    // textureCount() elements. They are written after the command buffers
+    // binding the set were recorded, which stay valid, and only the
+    // elements the instances index have to be valid.
+    VkDescriptorSetLayoutBinding binding = {};
+    binding.binding = 0;
+    binding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    binding.descriptorCount = m_device->maxBindlessTextures();
+    binding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+    VkDescriptorBindingFlagsEXT binding_flags = VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT_EXT |
+                                                VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT_EXT |
+                                                VK_DESCRIPTOR_BINDING_VARIABLE_DESCRIPTOR_COUNT_BIT_EXT;
+    VkDescriptorSetLayoutBindingFlagsCreateInfoEXT flags_ci = {};
+    flags_ci.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO_EXT;
+    flags_ci.bindingCount = 1;
+    flags_ci.pBindingFlags = &binding_flags;
+
+    VkDescriptorSetLayoutCreateInfo layout_ci = {};
+    layout_ci.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layout_ci.pNext = &flags_ci;
+    layout_ci.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT_EXT;
+    layout_ci.bindingCount = 1;
+    layout_ci.pBindings = &binding;
+    err = vkCreateDescriptorSetLayout(*m_device, &layout_ci, nullptr, &m_bindless_layout);
+    Q_ASSERT(!err);
+#else
+    qFatal("built without VK_EXT_descriptor_indexing");
+#endif
+}
+
+void QVulkanView::prepare_bindless_sets() {
+    DEBUG_ENTRY;
+#ifdef VK_EXT_descriptor_indexing
+    VkResult U_ASSERT_ONLY err;
+
+    // A set per swapchain image: draw() writes the textures that changed
+    // into the set of the image it renders to, which no frame in flight
+    // uses, so nothing waits and no element is written while pending.
+    const uint32_t sets = m_buffers.count();
+    const uint32_t count = m_textures.size();
+    VkDescriptorPoolSize pool_size = {};
+    pool_size.type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    pool_size.descriptorCount = count * sets;
+    VkDescriptorPoolCreateInfo pool_ci = {};
+    pool_ci.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    pool_ci.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT_EXT;
+    pool_ci.maxSets = sets;
+    pool_ci.poolSizeCount = 1;
+    pool_ci.pPoolSizes = &pool_size;
+    err = vkCreateDescriptorPool(*m_device, &pool_ci, nullptr, &m_bindless_pool);
+    Q_ASSERT(!err);
+
+    const QVector<uint32_t> counts(sets, count);
+    const QVector<VkDescriptorSetLayout> layouts(sets, m_bindless_layout);
+    VkDescriptorSetVariableDescriptorCountAllocateInfoEXT count_info = {};
+    count_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_VARIABLE_DESCRIPTOR_COUNT_ALLOCATE_INFO_EXT;
+    count_info.descriptorSetCount = sets;
+    count_info.pDescriptorCounts = counts.constData();
+    VkDescriptorSetAllocateInfo alloc_info = {};
+    alloc_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    alloc_info.pNext = &count_info;
+    alloc_info.descriptorPool = m_bindless_pool;
+    alloc_info.descriptorSetCount = sets;
+    alloc_info.pSetLayouts = layouts.constData();
+    m_bindless_sets.resize(sets);
+    err = vkAllocateDescriptorSets(*m_device, &alloc_info, m_bindless_sets.data());
+    Q_ASSERT(!err);
+
+    QVector<int> all(m_textures.size());
+    for (int i = 0; i < all.size(); i++)
+        all[i] = i;
+    for (uint32_t image = 0; image < sets; image++)
+        update_bindless_textures(image, all);
+#else
+    qFatal("built without VK_EXT_descriptor_indexing");
+#endif
+}
+
+void QVulkanView::update_bindless_textures(uint32_t image, const QVector<int>& indices) {
+    DEBUG_ENTRY;
+    // only the elements of the textures given, the others stay as they are
+    QVector<VkDescriptorImageInfo> descriptors(indices.size());
+    QVector<VkWriteDescriptorSet> writes(indices.size());
+    for (int i = 0; i < indices.size(); i++) {
+        const texture_object& texture = m_textures[indices[i]];
+        descriptors[i] = VkDescriptorImageInfo{texture.sampler, texture.view, texture.imageLayout};
+
+        VkWriteDescriptorSet& write = writes[i];
+        write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        write.dstSet = m_bindless_sets[image];
+        write.dstBinding = 0;
+        write.dstArrayElement = indices[i];
+        write.descriptorCount = 1;
+        write.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        write.pImageInfo = &descriptors[i];
+    }
+    vkUpdateDescriptorSets(*m_device, writes.size(), writes.constData(), 0, nullptr);
 }
 
 void QVulkanView::prepare_descriptor_layout() {
@@ -772,13 +1067,13 @@ void QVulkanView::prepare_descriptor_layout() {
 
     VkDescriptorSetLayoutBinding layout_bindings[2] = {};
     layout_bindings[0].binding = 0;
-    layout_bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    layout_bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
     layout_bindings[0].descriptorCount = 1;
     layout_bindings[0].stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
     layout_bindings[0].pImmutableSamplers = nullptr;
     layout_bindings[1].binding = 1;
     layout_bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-    layout_bindings[1].descriptorCount = DEMO_TEXTURE_COUNT;
+    layout_bindings[1].descriptorCount = 1;
     layout_bindings[1].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
     layout_bindings[1].pImmutableSamplers = nullptr;
 
@@ -788,6 +1083,10 @@ void QVulkanView::prepare_descriptor_layout() {
     descriptor_layout.bindingCount = 2;
     descriptor_layout.pBindings = layout_bindings;
 
+    // the textures are in a set of their own
+    if (m_textureMode == BindlessTextures)
+        descriptor_layout.bindingCount = 1;
+
     VkResult U_ASSERT_ONLY err;
 
     err = vkCreateDescriptorSetLayout(*m_device, &descriptor_layout, nullptr,
@@ -797,8 +1096,9 @@ void QVulkanView::prepare_descriptor_layout() {
     VkPipelineLayoutCreateInfo pPipelineLayoutCreateInfo = {};
         pPipelineLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
         pPipelineLayoutCreateInfo.pNext = nullptr;
-        pPipelineLayoutCreateInfo.setLayoutCount = 1;
-        pPipelineLayoutCreateInfo.pSetLayouts = &m_desc_layout;
+        const VkDescriptorSetLayout set_layouts[2] = { m_desc_layout, m_bindless_layout };
+        pPipelineLayoutCreateInfo.setLayoutCount = m_bindless_layout ? 2 : 1;
+        pPipelineLayoutCreateInfo.pSetLayouts = set_layouts;
 
     err = vkCreatePipelineLayout(*m_device, &pPipelineLayoutCreateInfo, nullptr,
                                  &m_pipeline_layout);
@@ -815,8 +1115,11 @@ void QVulkanView::prepare_render_pass() {
     attachments[0].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
     attachments[0].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
     attachments[0].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-    attachments[0].initialLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-    attachments[0].finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    // The attachment is cleared, so its previous contents (and layout) do
+    // not matter. Leaving the render pass in PRESENT_SRC saves the explicit
+    // barriers before and after the draw commands.
+    attachments[0].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    attachments[0].finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
 
     attachments[1].format = m_depth.format;
     attachments[1].samples = VK_SAMPLE_COUNT_1_BIT;
@@ -824,7 +1127,7 @@ void QVulkanView::prepare_render_pass() {
     attachments[1].storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
     attachments[1].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
     attachments[1].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-    attachments[1].initialLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+    attachments[1].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
     attachments[1].finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
 
     VkAttachmentReference color_reference = {};
@@ -854,8 +1157,26 @@ void QVulkanView::prepare_render_pass() {
     rp_info.pAttachments = attachments;
     rp_info.subpassCount = 1;
     rp_info.pSubpasses = &subpass;
-    rp_info.dependencyCount = 0;
-    rp_info.pDependencies = nullptr;
+    // The image layout transition at the start of the render pass has to
+    // wait for the image-acquired semaphore, which the submit waits on in
+    // the color attachment output stage. The depth buffer is shared by all
+    // frames in flight, so its clear also has to wait for the depth writes
+    // of the previous frame.
+    VkSubpassDependency dependency = {};
+    dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
+    dependency.dstSubpass = 0;
+    dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT |
+                              VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+    dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT |
+                              VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+    dependency.srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+    dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |
+                               VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT |
+                               VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+    dependency.dependencyFlags = 0;
+
+    rp_info.dependencyCount = 1;
+    rp_info.pDependencies = &dependency;
     VkResult U_ASSERT_ONLY err;
 
     err = vkCreateRenderPass(*m_device, &rp_info, nullptr, &m_render_pass);
@@ -888,6 +1209,23 @@ VkShaderModule QVulkanView::createShaderModule(QString filename) {
     return module;
 }
 
+void QVulkanView::setVertexInput(const QVector<VkVertexInputBindingDescription>& bindings,
+                                 const QVector<VkVertexInputAttributeDescription>& attributes) {
+    DEBUG_ENTRY;
+    m_vertexBindings = bindings;
+    m_vertexAttributes = attributes;
+
+    if (!m_pipeline)
+        return;
+    // frames in flight may still use the old pipeline
+    QVkDeletionQueue& retired = m_device->deletionQueue();
+    retired.retire(m_pipeline, vkDestroyPipeline);
+    retired.retire(m_pipelineCache, vkDestroyPipelineCache);
+    m_pipeline = nullptr;
+    m_pipelineCache = nullptr;
+    prepare_pipeline();
+}
+
 void QVulkanView::prepare_pipeline() {
     DEBUG_ENTRY;
 
@@ -898,6 +1236,10 @@ void QVulkanView::prepare_pipeline() {
 
     VkPipelineVertexInputStateCreateInfo vi = {};
     vi.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+    vi.vertexBindingDescriptionCount = m_vertexBindings.size();
+    vi.pVertexBindingDescriptions = m_vertexBindings.constData();
+    vi.vertexAttributeDescriptionCount = m_vertexAttributes.size();
+    vi.pVertexAttributeDescriptions = m_vertexAttributes.constData();
 
     VkPipelineInputAssemblyStateCreateInfo ia = {};
     ia.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
@@ -949,14 +1291,37 @@ void QVulkanView::prepare_pipeline() {
     const int numStages = 2;      // Two stages: vs and fs
     VkPipelineShaderStageCreateInfo shaderStages[numStages] = {};
 
+    // the grid of the atlas, 1 x 1 for the other texture modes
+    const uint32_t atlasGrid[2] = {
+        m_atlas ? m_atlas->columns() : 1,
+        m_atlas ? m_atlas->rows() : 1
+    };
+    VkSpecializationMapEntry gridEntries[2] = {};
+    for (uint32_t i = 0; i < 2; i++) {
+        gridEntries[i].constantID = i;
+        gridEntries[i].offset = i * sizeof(uint32_t);
+        gridEntries[i].size = sizeof(uint32_t);
+    }
+    VkSpecializationInfo gridInfo = {};
+    gridInfo.mapEntryCount = 2;
+    gridInfo.pMapEntries = gridEntries;
+    gridInfo.dataSize = sizeof(atlasGrid);
+    gridInfo.pData = atlasGrid;
+
     shaderStages[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
     shaderStages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
-    shaderStages[0].module = createShaderModule("cube-vert.spv");
+    if (m_textureMode == SingleTexture) {
+        shaderStages[0].module = createShaderModule("cube-vert.spv");
+    } else {
+        shaderStages[0].module = createShaderModule("cube-textures-vert.spv");
+        shaderStages[0].pSpecializationInfo = &gridInfo;
+    }
     shaderStages[0].pName = "main";
 
     shaderStages[1].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
     shaderStages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
-    shaderStages[1].module = createShaderModule("cube-frag.spv");
+    shaderStages[1].module = createShaderModule(m_textureMode == BindlessTextures ? "cube-bindless-frag.spv"
+                                                                                   : "cube-frag.spv");
     shaderStages[1].pName = "main";
 
     VkPipelineCacheCreateInfo pipelineCache_ci = {};
@@ -993,16 +1358,18 @@ void QVulkanView::prepare_pipeline() {
 void QVulkanView::prepare_descriptor_pool() {
     DEBUG_ENTRY;
 
+    // a set per swapchain image
+    const uint32_t sets = m_buffers.count();
     VkDescriptorPoolSize type_counts[2] = {{},{}};
-    type_counts[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-    type_counts[0].descriptorCount = 1;
+    type_counts[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+    type_counts[0].descriptorCount = sets;
     type_counts[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-    type_counts[1].descriptorCount = DEMO_TEXTURE_COUNT;
+    type_counts[1].descriptorCount = sets;
 
     VkDescriptorPoolCreateInfo descriptor_pool = {};
     descriptor_pool.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
     descriptor_pool.pNext = nullptr;
-    descriptor_pool.maxSets = 1;
+    descriptor_pool.maxSets = sets;
     descriptor_pool.poolSizeCount = 2;
     descriptor_pool.pPoolSizes = type_counts;
 
@@ -1049,7 +1416,9 @@ void QVulkanView::prepare() {
     cmd_pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
     cmd_pool_info.pNext = nullptr;
     cmd_pool_info.queueFamilyIndex = m_graphics_queue_node_index;
-    cmd_pool_info.flags = 0;
+    // the command buffer of a swapchain image is recorded again when its
+    // textures change
+    cmd_pool_info.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
 
     err = vkCreateCommandPool(*m_device, &cmd_pool_info, nullptr,
                               &m_cmd_pool);
@@ -1075,16 +1444,23 @@ void QVulkanView::prepare() {
         err = vkAllocateCommandBuffers(*m_device, &cmd_ai, &m_buffers[i].cmd);
         Q_ASSERT(!err);
     }
+    m_image_fences.fill(nullptr, m_buffers.count());
+    // the descriptor sets are written afresh, see prepareDescriptorSet()
+    m_changed_textures.fill(QVector<int>(), m_buffers.count());
+
+    // One ring region per swapchain image, like the command buffers. The
+    // image fences are gone, so frames still in flight may read from any
+    // region of the old ring: it goes to the deletion queue and a new one
+    // takes its place, even with the same number of images.
+    if (m_frameRing)
+        m_frameRing.take()->deleteLater();
+    m_frameRing.reset(new QVkFrameRingBuffer(m_device, DEFAULT_FRAME_RING_SIZE, m_buffers.count()));
 
     prepare_framebuffers();
 
     prepare_descriptor_pool();
-    /*
-     * Prepare functions above may generate pipeline commands
-     * that need to be flushed before beginning the render loop.
-     */
-    flush_init_cmd();
-
+    if (m_textureMode == BindlessTextures)
+        prepare_bindless_sets();
     m_current_buffer = 0;
     m_prepared = true;
 }
@@ -1102,35 +1478,34 @@ void QVulkanView::resize_vk() {
     // First, perform part of the demo_cleanup() function:
     m_prepared = false;
 
+    // Frames in flight may still use all of this, it is destroyed once
+    // they have completed instead of waiting for the device to go idle.
+    QVkDeletionQueue& retired = m_device->deletionQueue();
+
     for (int i = 0; i < m_framebuffers.count(); i++) {
-        vkDestroyFramebuffer(*m_device, m_framebuffers[i], nullptr);
+        retired.retire(m_framebuffers[i], vkDestroyFramebuffer);
     }
-    vkDestroyDescriptorPool(*m_device, m_desc_pool, nullptr);
+    retired.retire(m_desc_pool, vkDestroyDescriptorPool);
+    retired.retire(m_bindless_pool, vkDestroyDescriptorPool);
 
-    vkDestroyPipeline(*m_device, m_pipeline, nullptr);
-    vkDestroyPipelineCache(*m_device, m_pipelineCache, nullptr);
-    vkDestroyRenderPass(*m_device, m_render_pass, nullptr);
-    vkDestroyPipelineLayout(*m_device, m_pipeline_layout, nullptr);
-    vkDestroyDescriptorSetLayout(*m_device, m_desc_layout, nullptr);
+    retired.retire(m_pipeline, vkDestroyPipeline);
+    retired.retire(m_pipelineCache, vkDestroyPipelineCache);
+    retired.retire(m_render_pass, vkDestroyRenderPass);
+    retired.retire(m_pipeline_layout, vkDestroyPipelineLayout);
+    retired.retire(m_desc_layout, vkDestroyDescriptorSetLayout);
 
-    for (int i = 0; i < DEMO_TEXTURE_COUNT; i++) {
-        vkDestroyImageView(*m_device, m_textures[i].view, nullptr);
-        vkDestroyImage(*m_device, m_textures[i].image, nullptr);
-        vkFreeMemory(*m_device, m_textures[i].mem, nullptr);
-        vkDestroySampler(*m_device, m_textures[i].sampler, nullptr);
-    }
-
-    vkDestroyImageView(*m_device, m_depth.view, nullptr);
-    vkDestroyImage(*m_device, m_depth.image, nullptr);
-    vkFreeMemory(*m_device, m_depth.mem, nullptr);
+    retired.retire(m_depth.view, vkDestroyImageView);
+    retired.retire(m_depth.image, vkDestroyImage);
+    retired.retire(m_depth.mem);
+    m_depth.mem = QVkAllocation();
 
     for (int i = 0; i < m_buffers.count(); i++) {
-        vkDestroyImageView(*m_device, m_buffers[i].view, nullptr);
+        retired.retire(m_buffers[i].view, vkDestroyImageView);
         m_buffers[i].view = nullptr;
-        vkFreeCommandBuffers(*m_device, m_cmd_pool, 1, &m_buffers[i].cmd);
+        // freed along with the pool
         m_buffers[i].cmd = nullptr;
     }
-    vkDestroyCommandPool(*m_device, m_cmd_pool, nullptr);
+    retired.retire(m_cmd_pool, vkDestroyCommandPool);
     m_buffers.clear();
 
     // Second, re-perform the demo_prepare() function, which will re-create the
@@ -1194,7 +1569,7 @@ void QVulkanView::init_vk_swapchain() {
     createInfo.connection = connection;
     createInfo.window = xcb_window;
 
-    err = vkCreateXcbSurfaceKHR(m_inst, &createInfo, nullptr, &m_surface);
+    err = vkCreateXcbSurfaceKHR(*m_inst, &createInfo, nullptr, &m_surface);
 
 #endif // _WIN32
     Q_ASSERT(!err);
@@ -1204,7 +1579,7 @@ void QVulkanView::init_vk_swapchain() {
     QVector<VkBool32> supportsPresent;
     supportsPresent.resize(queueProperties.count());
     for (int i = 0; i < supportsPresent.count(); i++) {
-        m_inst.getPhysicalDeviceSurfaceSupport(m_gpu, i, m_surface, &supportsPresent[i]);
+        m_inst->getPhysicalDeviceSurfaceSupport(m_gpu, i, m_surface, &supportsPresent[i]);
     }
 
     // Search for a graphics and a present queue in the array of queue
@@ -1260,7 +1635,7 @@ void QVulkanView::init_vk_swapchain() {
 
     // Get the list of VkFormat's that are supported:
     auto getSurfForm = [this](uint32_t *c, VkSurfaceFormatKHR* d) {
-        return m_inst.getPhysicalDeviceSurfaceFormats(m_gpu, m_surface, c, d);
+        return m_inst->getPhysicalDeviceSurfaceFormats(m_gpu, m_surface, c, d);
     };
     auto surfFormats = getVk<VkSurfaceFormatKHR>(getSurfForm);
     Q_ASSERT(!surfFormats.isEmpty());
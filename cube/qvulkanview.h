@@ -8,12 +8,21 @@
 #include <QVector2D>
 #include <QVector3D>
 #include <QVector4D>
+#include <QScopedPointer>
+#include <QStringList>
 
 #include <vulkan/vulkan.h>
 #include "qvkcmdbuf.h"
 #include "qvkinstance.h"
+#include "qvkupload.h"
+#include "qvkmipmap.h"
+#include "qvktextureloader.h"
+#include "qvktextureatlas.h"
+#include "qvktexturestreamer.h"
 
-#define DEMO_TEXTURE_COUNT 1
+#define DEFAULT_FRAMES_IN_FLIGHT 2
+// bytes of transient data per frame, see frameRing()
+#define DEFAULT_FRAME_RING_SIZE (1024 * 1024)
 
 struct SwapchainBuffers {
     VkImage image;
@@ -22,18 +31,15 @@ struct SwapchainBuffers {
 };
 
 /*
- * structure to track all objects related to a texture.
+ * synchronization objects of one frame in flight. They are recycled
+ * round-robin once the fence of the frame has signaled.
  */
-struct texture_object {
-    VkSampler sampler;
-
-    VkImage image;
-    VkImageLayout imageLayout;
-
-    VkMemoryAllocateInfo mem_alloc;
-    VkDeviceMemory mem;
-    VkImageView view;
-    uint32_t tex_width, tex_height;
+struct FrameSync {
+    VkFence fence;
+    VkSemaphore imageAcquired;
+    VkSemaphore renderFinished;
+    // QVkDeletionQueue serial of the last frame submitted with fence
+    uint64_t serial;
 };
 
 struct MeshData {
@@ -41,16 +47,19 @@ struct MeshData {
     QVector<QVector2D> uv;
 };
 
-struct vktexcube_vs_uniform {
-    // Must start with MVP
-    float mvp[4][4];
-    QVector4D position[12 * 3];
-    QVector4D attr[12 * 3];
-};
-
-
 class QVulkanView : public QWindow {
 public:
+    // how the textures are bound, see textureMode()
+    enum TextureMode {
+        // a single texture, sampled by cube.frag
+        SingleTexture,
+        // an array of all textures, indexed per instance, with
+        // VK_EXT_descriptor_indexing
+        BindlessTextures,
+        // one QVkTextureAtlas with a cell per texture, the fallback
+        AtlasTextures
+    };
+
     QVulkanView();
     ~QVulkanView();
     void init_vk_swapchain();
@@ -60,20 +69,94 @@ public:
     void prepare_pipeline();
     void prepare();
     void draw();
-    void prepare_texture_image(const char *filename, texture_object *tex_obj, VkImageTiling tiling, VkImageUsageFlags usage, VkFlags required_props);
+    // Images the textures are loaded from, set before the first view is
+    // created. KTX2 and DDS files keep their format and mip levels, other
+    // images are decoded by QImageReader.
+    static void setTextureFiles(const QStringList& filenames);
+    // use an atlas for more than one texture even if the device supports
+    // bindless textures, set before the first view is created
+    static void setTextureAtlasForced(bool force);
+    // device memory the mip levels of large textures are streamed into,
+    // 0 uploads textures whole; set before the first view is created
+    static void setTextureStreamingBudget(VkDeviceSize bytes);
+
+    // Picked when the view is created: more than one texture is bound as
+    // an array if the device allows arrays of that many, as an atlas
+    // otherwise. Instances select their texture with a per-instance index
+    // attribute, see cube-textures.vert.
+    TextureMode textureMode() const { return m_textureMode; }
+    int textureCount() const { return m_textures.size(); }
+    // set 1 of the pipeline layout with BindlessTextures for swapchain
+    // image image, the textures at binding 0
+    VkDescriptorSet bindlessTextureSet(uint32_t image) const { return m_bindless_sets[image]; }
+    // streams the levels of large textures, nullptr if they are uploaded
+    // whole
+    QVkTextureStreamer* textureStreamer() { return m_streamer.data(); }
+    // Texture index is drawn pixels across in the frame prepareFrame()
+    // prepares, the streamer fetches the levels for that. Textures in an
+    // atlas are streamed up to the size of their cell instead.
+    void requestTextureSize(int index, float pixels);
+    // copies image into the linear image or the staging memory of an
+    // optimal one
+    void prepare_texture_image(const QImage& image, texture_object *tex_obj);
+    // uploads the levels of a KTX2 or DDS file as they are
+    void prepare_texture_file(const QVkTextureFile& file, texture_object *tex_obj);
+    // sampler and view of the image of tex_obj
+    void prepare_texture_view(texture_object *tex_obj);
+    // placeholders for the textures, which are loaded in the background
     void prepare_textures();
+    // replaces the placeholder of texture index, connected to
+    // QVkTextureLoader::loaded()
+    void texture_loaded(int index, const QString& filename, const QVkDecodedTexture& texture);
+    // copies texture index into its cell of the atlas, if there is one
+    void prepare_atlas_cell(int index);
+    // textures replaced in m_textures reach the atlas or the descriptors
+    void textures_changed(const QVector<int>& indices);
+    // Writes the textures changed since m_current_buffer was last drawn to
+    // its descriptor sets, and records its command buffer again unless
+    // they are bindless. Called by draw() once the GPU is done with the
+    // last frame on that image.
+    void update_texture_descriptors();
+    // swaps in the textures whose levels the streamer changed, called by
+    // draw() ahead of the uploads of the frame
+    void stream_textures();
+    // layout of the bindless textures
+    void prepare_bindless_textures();
+    // pool and a set per swapchain image, with all textures written
+    void prepare_bindless_sets();
+    // writes the textures indices of m_textures to the bindless set of
+    // swapchain image image
+    void update_bindless_textures(uint32_t image, const QVector<int>& indices);
     void prepare_depth();
-    void destroy_texture_image(texture_object *tex_objs);
     void prepare_descriptor_layout();
     void prepare_render_pass();
-    void flush_init_cmd();
-    void set_image_layout(VkImage image, VkImageAspectFlags aspectMask, VkImageLayout old_image_layout, VkImageLayout new_image_layout, VkAccessFlagBits srcAccessMask);
     void prepare_buffers();
     void prepare_descriptor_pool();
     void prepare_framebuffers();
+    void prepare_frames(int count);
+    void destroy_frames();
 
     VkShaderModule createShaderModule(QString filename);
 
+    // vertex input state of the pipeline, rebuilds the pipeline if it
+    // already exists. The draw commands have to be rebuilt afterwards.
+    void setVertexInput(const QVector<VkVertexInputBindingDescription>& bindings,
+                        const QVector<VkVertexInputAttributeDescription>& attributes);
+
+    // number of frames the CPU may record ahead of the GPU
+    void setFramesInFlight(int count);
+    int framesInFlight() const { return m_frames.count(); }
+
+    // per-frame scratch memory, rewound for m_current_buffer right before
+    // prepareFrame() and flushed before the frame is submitted
+    QVkFrameRingBuffer& frameRing() { return *m_frameRing; }
+
+    // staged uploads are submitted ahead of every frame
+    QVkUploadManager& uploads() { return *m_uploads; }
+
+    VkQueue queue() { return m_queue; }
+    uint32_t queueFamilyIndex() const { return m_graphics_queue_node_index; }
+
     bool validationError() { return m_validationError; }
     inline QSharedPointer<QVkDevice> device() { return m_device; }
 public slots:
@@ -91,18 +174,32 @@ protected:
     }*/
 
     virtual void prepareDescriptorSet() {}
+    // called by draw() once the GPU is done with the previous frame that
+    // rendered to m_current_buffer, so its per-image data may be updated
+    virtual void prepareFrame() {}
     virtual void buildDrawCommand(VkCommandBuffer cmd_buf) {
         Q_UNUSED(cmd_buf);
     }
+    // Writes the texture binding of the descriptor set of swapchain image
+    // image, whose command buffer is not in flight. Called when the set is
+    // allocated, and when textures in m_textures changed before the
+    // command buffer of image is recorded again. Not with
+    // BindlessTextures, whose set the view updates itself.
+    virtual void updateTextureDescriptors(uint32_t image) {
+        Q_UNUSED(image);
+    }
+    // what binding 1 of the descriptor set holds, the texture or the
+    // atlas; there is no binding 1 with BindlessTextures
+    VkDescriptorImageInfo textureDescriptor() const;
 
     QVector<const char*> m_extensionNames           {};
     QVector<const char*> m_deviceValidationLayers   {};
 
     VkSurfaceKHR m_surface      { nullptr };
     bool m_prepared             { false };
-    bool m_use_staging_buffer   { false };
 
-    QVkInstance m_inst;
+    // shared by all views, so is the texture cache of the device
+    QSharedPointer<QVkInstance> m_inst;
     QVkPhysicalDevice m_gpu;
     uint32_t m_graphics_queue_node_index                    {0};
     QSharedPointer<QVkDevice> m_device;
@@ -123,24 +220,47 @@ protected:
     struct {
         VkFormat format;
         VkImage image;
-        VkMemoryAllocateInfo mem_alloc;
-        VkDeviceMemory mem;
+        QVkAllocation mem;
         VkImageView view;
     } m_depth {};
 
-    struct texture_object m_textures[DEMO_TEXTURE_COUNT] {};
+    // one per setTextureFiles() file
+    QVector<texture_object> m_textures      {};
+    TextureMode m_textureMode               {SingleTexture};
+    // the textures with AtlasTextures
+    QScopedPointer<QVkTextureAtlas> m_atlas;
+    // The textures with BindlessTextures. They are a set of their own,
+    // layouts updated after bind may not have dynamic uniform buffers.
+    VkDescriptorSetLayout m_bindless_layout {nullptr};
+    VkDescriptorPool m_bindless_pool        {nullptr};
+    // one per swapchain image, like m_desc_sets
+    QVector<VkDescriptorSet> m_bindless_sets {};
+    QScopedPointer<QVkTextureStreamer> m_streamer;
 
-     // Buffer for initialization commands
-    VkCommandBuffer m_cmd               {nullptr};
     VkPipelineLayout m_pipeline_layout  {nullptr};
     VkDescriptorSetLayout m_desc_layout {nullptr};
     VkPipelineCache m_pipelineCache     {nullptr};
     VkRenderPass m_render_pass          {nullptr};
     VkPipeline m_pipeline               {nullptr};
+    QVector<VkVertexInputBindingDescription> m_vertexBindings       {};
+    QVector<VkVertexInputAttributeDescription> m_vertexAttributes   {};
     uint32_t m_current_buffer           {0};
 
     VkDescriptorPool m_desc_pool  {nullptr};
-    VkDescriptorSet m_desc_set  {nullptr};
+    // one per swapchain image, like the command buffers binding them, so
+    // a frame can rewrite its set while the others are in flight
+    QVector<VkDescriptorSet> m_desc_sets    {};
+    // textures replaced since each swapchain image was last drawn
+    QVector<QVector<int>> m_changed_textures {};
+
+    QVector<FrameSync> m_frames         {};
+    // fence of the frame that last rendered to each swapchain image
+    QVector<VkFence> m_image_fences     {};
+    QScopedPointer<QVkFrameRingBuffer> m_frameRing;
+    QScopedPointer<QVkUploadManager> m_uploads;
+    // fills the mip levels of the textures after their upload
+    QScopedPointer<QVkMipGenerator> m_mips;
+    QScopedPointer<QVkTextureLoader> m_textureLoader;
 
     int32_t m_curFrame  {0};
     int32_t m_frameCount  {INT32_MAX};
@@ -153,11 +273,6 @@ protected:
 
 #define ARRAY_SIZE(a) (sizeof(a) / sizeof(a[0]))
 
-#if defined(NDEBUG) && defined(__GNUC__)
-#define U_ASSERT_ONLY __attribute__((unused))
-#else
-#define U_ASSERT_ONLY
-#endif
 
 
 